@@ -0,0 +1,556 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbwal.h"
+#include "dblock.h"
+#include "dbbitmap.h"
+#include "dbmvcc.h"
+#include "dbcompact.h"
+#include "dbbatch.h"
+#include "dbiostat.h"
+
+//written by the deletes of a batch
+static const student_t batch_empty = EMPTY_STUDENT_RECORD;
+
+//one read or write of a submission
+typedef struct batch_io {
+    void *buf;
+    off_t off;
+    bool link;              // the next request waits for this one
+} batch_io_t;
+
+/*
+ *  uring_open
+ *      entries:  submission queue size
+ *
+ *  Sets up an io_uring and maps its rings.
+ *
+ *  returns:  the ring, or NULL if the kernel does not offer io_uring
+ */
+db_uring_t *uring_open(unsigned entries)
+{
+    struct io_uring_params p;
+    db_uring_t *u = calloc(1, sizeof(*u));
+
+    if (u == NULL)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0) {
+        free(u);
+        return NULL;
+    }
+    u->entries = p.sq_entries;
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_len > u->sq_len)
+            u->sq_len = u->cq_len;
+        u->cq_len = 0;
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_ring = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = (u->cq_len == 0) ? u->sq_ring :
+                 mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        uring_close(u);
+        return NULL;
+    }
+
+    char *sq = u->sq_ring;
+    char *cq = u->cq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return u;
+}
+
+//unmap the rings and close the ring fd
+void uring_close(db_uring_t *u)
+{
+    if (u == NULL)
+        return;
+    if (u->sqes != NULL && u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqes_len);
+    if (u->cq_len != 0 && u->cq_ring != NULL && u->cq_ring != MAP_FAILED)
+        munmap(u->cq_ring, u->cq_len);
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_len);
+    close(u->fd);
+    free(u);
+}
+
+/*
+ *  uring_prep
+ *      u:          ring
+ *      opcode:     IORING_OP_READ or IORING_OP_WRITE
+ *      fd:         file the request is for
+ *      buf, len:   data
+ *      off:        file offset
+ *      link:       the next request prepared starts only after this one
+ *                  completed, and is cancelled if it failed
+ *      user_data:  returned with the completion
+ *
+ *  Queues one request, uring_wait_all() submits it.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the submission queue is full
+ */
+int uring_prep(db_uring_t *u, int opcode, int fd, void *buf, unsigned len,
+               off_t off, bool link, uint64_t user_data)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= u->entries)
+        return ERR_DB_FILE;
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)off;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = user_data;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+    return NO_ERROR;
+}
+
+/*
+ *  uring_wait_all
+ *      u:     ring
+ *      res:   result of every request, indexed by its user_data
+ *      nres:  size of res
+ *
+ *  Submits the queued requests and waits until everything in flight has
+ *  completed.  Completions come in any order, each result lands in the
+ *  slot named by its user_data.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int uring_wait_all(db_uring_t *u, int *res, int nres)
+{
+    u->inflight += u->queued;
+    while (u->inflight > 0) {
+        int rc = (int)syscall(__NR_io_uring_enter, u->fd, u->queued, u->inflight,
+                              IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return ERR_DB_FILE;
+        }
+        u->queued -= ((unsigned)rc < u->queued) ? (unsigned)rc : u->queued;
+
+        unsigned head = *u->cq_head;
+        unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            if (cqe->user_data < (uint64_t)nres)
+                res[cqe->user_data] = cqe->res;
+            u->inflight--;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  batch_io
+ *
+ *  Runs one submission of reads or writes of STUDENT_RECORD_SIZE bytes,
+ *  res[i] gets the result of io[i] like a pread() or pwrite() would
+ *  return it (-errno on failure).  Without a ring the requests are done
+ *  one by one in order, a request linked to one that failed is cancelled
+ *  as the kernel would.
+ */
+static int batch_io(db_uring_t *u, int opcode, int fd, batch_io_t *io, int n, int *res)
+{
+    if (u != NULL) {
+        for (int i = 0; i < n; i++) {
+            if (uring_prep(u, opcode, fd, io[i].buf, STUDENT_RECORD_SIZE,
+                           io[i].off, io[i].link, (uint64_t)i) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+        return uring_wait_all(u, res, n);
+    }
+
+    bool failed = false;
+    for (int i = 0; i < n; i++) {
+        ssize_t r;
+
+        if (failed) {
+            r = -ECANCELED;
+        } else {
+            r = (opcode == IORING_OP_READ) ?
+                io_pread(fd, io[i].buf, STUDENT_RECORD_SIZE, io[i].off) :
+                io_pwrite(fd, io[i].buf, STUDENT_RECORD_SIZE, io[i].off);
+            if (r < 0)
+                r = -errno;
+        }
+        res[i] = (int)r;
+        failed = io[i].link && r != STUDENT_RECORD_SIZE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  batch_chunk
+ *
+ *  Runs up to BATCH_CHUNK operations: checks their slots, decides each one
+ *  in file order, logs the writes as one group and submits them together.
+ *  Called with every stripe and the meta lock held.
+ */
+static void batch_chunk(int fd, db_ctx_t *ctx, db_uring_t *u, batch_op_t *ops, int n)
+{
+    int ids[BATCH_CHUNK];           // distinct ids of the chunk
+    int slot_of[BATCH_CHUNK];       // index into ids of every operation
+    bool present[BATCH_CHUNK];
+    bool bad[BATCH_CHUNK];
+    bool deleted[BATCH_CHUNK];
+    student_t slots[BATCH_CHUNK];
+    batch_io_t io[BATCH_CHUNK];
+    int wop[BATCH_CHUNK];           // operation of every write
+    int res[BATCH_CHUNK];
+    int nids = 0;
+    int nw = 0;
+
+    for (int i = 0; i < n; i++) {
+        int k = 0;
+        while (k < nids && ids[k] != ops[i].s.id)
+            k++;
+        if (k == nids) {
+            ids[nids] = ops[i].s.id;
+            present[nids] = bad[nids] = deleted[nids] = false;
+            nids++;
+        }
+        slot_of[i] = k;
+    }
+
+    // check: one read per distinct id, the bitmap answers without I/O
+    if (ctx->bitmap != NULL) {
+        for (int k = 0; k < nids; k++)
+            present[k] = bitmap_test(ctx->bitmap, ids[k]);
+    } else {
+        for (int k = 0; k < nids; k++) {
+            io[k].buf = &slots[k];
+            io[k].off = (off_t)ids[k] * STUDENT_RECORD_SIZE;
+            io[k].link = false;
+        }
+        if (batch_io(u, IORING_OP_READ, fd, io, nids, res) != NO_ERROR) {
+            for (int i = 0; i < n; i++)
+                ops[i].status = ERR_DB_FILE;
+            return;
+        }
+        for (int k = 0; k < nids; k++) {
+            // past the end of the file is an empty slot
+            if (res[k] == STUDENT_RECORD_SIZE)
+                present[k] = memcmp(&slots[k], &batch_empty, STUDENT_RECORD_SIZE) != 0;
+            else
+                bad[k] = (res[k] != 0);
+        }
+    }
+
+    // decide, in file order so later operations see the earlier ones
+    for (int i = 0; i < n; i++) {
+        int k = slot_of[i];
+
+        if (bad[k]) {
+            ops[i].status = ERR_DB_FILE;
+        } else if (ops[i].op == BATCH_ADD) {
+            ops[i].status = present[k] ? ERR_DB_OP : NO_ERROR;
+            present[k] = true;
+        } else {
+            ops[i].status = present[k] ? NO_ERROR : SRCH_NOT_FOUND;
+            present[k] = false;
+        }
+    }
+
+    // log the writes as one group, then keep the pages of open snapshots
+    int rc = NO_ERROR;
+    if (ctx->wal != NULL) {
+        wal_group_begin(ctx->wal);
+        for (int i = 0; i < n && rc == NO_ERROR; i++) {
+            if (ops[i].status == NO_ERROR)
+                rc = wal_log(ctx->wal, ops[i].s.id, ops[i].op == BATCH_ADD ? &ops[i].s : NULL);
+        }
+        if (wal_group_end(ctx->wal) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    for (int i = 0; i < n && rc == NO_ERROR; i++) {
+        if (ops[i].status == NO_ERROR)
+            rc = mvcc_preserve(ctx, ops[i].s.id / MVCC_PAGE_RECORDS);
+    }
+
+    // write: the writes of one id are adjacent and linked, so they run in
+    // file order, different ids complete in any order
+    for (int k = 0; k < nids && rc == NO_ERROR; k++) {
+        int first = nw;
+        for (int i = 0; i < n; i++) {
+            if (slot_of[i] != k || ops[i].status != NO_ERROR)
+                continue;
+            io[nw].buf = (ops[i].op == BATCH_ADD) ? &ops[i].s : (void *)&batch_empty;
+            io[nw].off = (off_t)ids[k] * STUDENT_RECORD_SIZE;
+            io[nw].link = false;
+            if (nw > first)
+                io[nw - 1].link = true;
+            wop[nw++] = i;
+        }
+    }
+    if (rc == NO_ERROR && nw > 0) {
+        if (ctx->lock != NULL)
+            lock_write_begin_all(ctx->lock);
+        rc = batch_io(u, IORING_OP_WRITE, fd, io, nw, res);
+        if (ctx->lock != NULL)
+            lock_write_end_all(ctx->lock);
+    }
+    for (int w = 0; w < nw; w++) {
+        if (rc != NO_ERROR || res[w] != STUDENT_RECORD_SIZE)
+            ops[wop[w]].status = ERR_DB_FILE;
+    }
+    if (rc != NO_ERROR) {
+        for (int i = 0; i < n; i++) {
+            if (ops[i].status == NO_ERROR)
+                ops[i].status = ERR_DB_FILE;
+        }
+        return;
+    }
+
+    // sidecars follow in file order; pages are freed only once the last
+    // operation on them is in the bitmap, a later add may have reused them
+    for (int i = 0; i < n; i++) {
+        if (ops[i].status != NO_ERROR)
+            continue;
+        if (ops[i].op == BATCH_ADD) {
+            rc = db_ctx_added(ctx, &ops[i].s, 1);
+        } else {
+            rc = db_ctx_deleted(ctx, ops[i].s.id);
+            deleted[slot_of[i]] = true;
+        }
+        if (rc != NO_ERROR)
+            ops[i].status = ERR_DB_FILE;
+    }
+    for (int k = 0; k < nids; k++) {
+        if (deleted[k])
+            compact_page(ctx, ids[k]);
+    }
+    if (db_ctx_flush(ctx) != NO_ERROR) {
+        for (int i = 0; i < n; i++) {
+            if (ops[i].status == NO_ERROR)
+                ops[i].status = ERR_DB_FILE;
+        }
+    }
+}
+
+/*
+ *  batch_run
+ *      fd:   linux file descriptor of the database
+ *      ops:  operations in file order, status is filled in
+ *      n:    number of operations
+ *
+ *  Runs the operations BATCH_CHUNK at a time, see dbbatch.h.  Every
+ *  stripe is held for the length of a chunk, so other processes see a
+ *  chunk as a whole.  Without a database context (an fd that did not come
+ *  from open_db()) the operations fall back to insert_student() and
+ *  remove_student().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE, the result of each operation is in
+ *            its status
+ *
+ *  console:  Does not produce any console I/O
+ */
+int batch_run(int fd, batch_op_t *ops, int n)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+
+    if (ctx == NULL) {
+        for (int i = 0; i < n; i++)
+            ops[i].status = (ops[i].op == BATCH_ADD) ?
+                            insert_student(fd, &ops[i].s) : remove_student(fd, ops[i].s.id);
+        return NO_ERROR;
+    }
+
+    db_uring_t *u = uring_open(BATCH_CHUNK);
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < n && rc == NO_ERROR; i += BATCH_CHUNK) {
+        int m = (n - i < BATCH_CHUNK) ? n - i : BATCH_CHUNK;
+
+        if (db_ctx_lock_all(ctx) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        if (db_ctx_lock_meta(ctx) != NO_ERROR) {
+            db_ctx_unlock_all(ctx);
+            rc = ERR_DB_FILE;
+            break;
+        }
+        batch_chunk(fd, ctx, u, ops + i, m);
+        db_ctx_unlock_meta(ctx, true);
+        db_ctx_unlock_all(ctx);
+        rc = db_ctx_checkpoint(ctx, false);
+    }
+    uring_close(u);
+    return rc;
+}
+
+//parse one batch file line into op, 1 if it holds an operation, 0 if it
+//is blank or a comment, -1 if it is malformed or out of range
+static int batch_parse(char *line, batch_op_t *op)
+{
+    char kind[4];
+    char fname[BATCH_MAX_LINE];
+    char lname[BATCH_MAX_LINE];
+    char extra[2];
+    int id, gpa;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (sscanf(line, "%3s", kind) != 1 || kind[0] == '#')
+        return 0;
+
+    memset(op, 0, sizeof(*op));
+    if (strcmp(kind, "a") == 0) {
+        if (sscanf(line, "%3s %d %255s %255s %d %1s", kind, &id, fname, lname, &gpa, extra) != 5)
+            return -1;
+        if (validate_range(id, gpa) != NO_ERROR)
+            return -1;
+        op->op = BATCH_ADD;
+        op->s.gpa = gpa;
+        strncpy(op->s.fname, fname, sizeof(op->s.fname) - 1);
+        strncpy(op->s.lname, lname, sizeof(op->s.lname) - 1);
+    } else if (strcmp(kind, "d") == 0) {
+        if (sscanf(line, "%3s %d %1s", kind, &id, extra) != 2)
+            return -1;
+        if (validate_range(id, MIN_STD_GPA) != NO_ERROR)
+            return -1;
+        op->op = BATCH_DEL;
+    } else {
+        return -1;
+    }
+    op->s.id = id;
+    return 1;
+}
+
+/*
+ *  batch_file
+ *      fd:    linux file descriptor of the database
+ *      path:  batch file, see dbbatch.h
+ *
+ *  Reads and checks the whole batch file, runs it with batch_run() and
+ *  reports every operation in file order the way -a and -d would.
+ *
+ *  returns:  NO_ERROR       every operation succeeded
+ *            ERR_DB_OP      the file was bad, or some operations failed
+ *                           (duplicate add, delete of a missing student)
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_STD_ADDED, M_ERR_DB_ADD_DUP, M_STD_DEL_MSG,
+ *            M_STD_NOT_FND_MSG or M_ERR_DB_WRITE for every operation
+ *            M_BATCH_DONE      at the end
+ *            M_ERR_BATCH_OPEN  the batch file cant be read
+ *            M_ERR_BATCH_LINE  a line is malformed or out of range
+ */
+int batch_file(int fd, const char *path)
+{
+    FILE *in = fopen(path, "r");
+    char line[BATCH_MAX_LINE * 2 + 32];
+    batch_op_t *ops = NULL;
+    int n = 0, cap = 0, lineno = 0;
+    int rc = NO_ERROR;
+
+    if (in == NULL) {
+        printf(M_ERR_BATCH_OPEN, path);
+        return ERR_DB_OP;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        batch_op_t op;
+
+        lineno++;
+        int r = batch_parse(line, &op);
+        if (r == 0)
+            continue;
+        if (r < 0) {
+            printf(M_ERR_BATCH_LINE, lineno);
+            rc = ERR_DB_OP;
+            break;
+        }
+        if (n == cap) {
+            int ncap = cap ? cap * 2 : BATCH_CHUNK;
+            batch_op_t *grown = realloc(ops, (size_t)ncap * sizeof(*ops));
+            if (grown == NULL) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            ops = grown;
+            cap = ncap;
+        }
+        op.line = lineno;
+        ops[n++] = op;
+    }
+    fclose(in);
+    if (rc != NO_ERROR) {
+        if (rc == ERR_DB_FILE)
+            printf(M_ERR_DB_WRITE);
+        free(ops);
+        return rc;
+    }
+
+    rc = batch_run(fd, ops, n);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        free(ops);
+        return rc;
+    }
+
+    int done = 0;
+    for (int i = 0; i < n; i++) {
+        int id = ops[i].s.id;
+
+        switch (ops[i].status) {
+        case NO_ERROR:
+            printf(ops[i].op == BATCH_ADD ? M_STD_ADDED : M_STD_DEL_MSG, id);
+            done++;
+            break;
+        case ERR_DB_OP:
+            printf(M_ERR_DB_ADD_DUP, id);
+            rc = (rc == NO_ERROR) ? ERR_DB_OP : rc;
+            break;
+        case SRCH_NOT_FOUND:
+            printf(M_STD_NOT_FND_MSG, id);
+            rc = (rc == NO_ERROR) ? ERR_DB_OP : rc;
+            break;
+        default:
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+            break;
+        }
+    }
+    printf(M_BATCH_DONE, n, done, n - done);
+    free(ops);
+    return rc;
+}
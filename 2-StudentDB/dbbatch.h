@@ -0,0 +1,78 @@
+#ifndef __DBBATCH_H__
+    #define __DBBATCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#include "db.h"
+
+//Batched adds and deletes for sdbsc -b.  A batch file has one operation
+//per line:
+//
+//    a id first_name last_name gpa
+//    d id
+//
+//blank lines and lines starting with '#' are skipped.  The whole file is
+//checked with the rules of -a and -d before anything is written, then the
+//operations run BATCH_CHUNK at a time with every stripe held:
+//
+//  check     the slot of every id in the chunk is read in one submission
+//            (or taken from the occupancy bitmap when there is one)
+//  decide    the operations are played in file order against those slots,
+//            so an id added and deleted in the same batch ends up as the
+//            file says
+//  log       the writes that passed are logged as one group, one fdatasync
+//  write     all writes go out in one submission and complete in any
+//            order; writes to the same id are linked (IOSQE_IO_LINK) so
+//            the kernel runs them in file order
+//
+//and every operation gets its own result, printed in file order.  The I/O
+//goes through an io_uring set up with raw system calls; where the kernel
+//does not offer one (ENOSYS, or forbidden by a seccomp policy) the same
+//submissions are done with pread() and pwrite().
+#define BATCH_CHUNK         256     // operations per submission, ring size
+#define BATCH_MAX_LINE      256     // longest accepted batch file line
+
+#define BATCH_ADD           'a'
+#define BATCH_DEL           'd'
+
+typedef struct batch_op {
+    char op;                // BATCH_ADD or BATCH_DEL
+    int line;               // line of the batch file, for messages
+    student_t s;            // student to add, s.id for a delete
+    int status;             // NO_ERROR, ERR_DB_OP, SRCH_NOT_FOUND, ERR_DB_FILE
+} batch_op_t;
+
+//minimal io_uring, the parts of liburing that a batch needs
+typedef struct db_uring {
+    int fd;
+    unsigned entries;
+    void *sq_ring;
+    size_t sq_len;
+    void *cq_ring;          // same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned queued;        // prepared, not yet submitted
+    unsigned inflight;      // submitted, not yet reaped
+} db_uring_t;
+
+//prototypes
+db_uring_t *uring_open(unsigned entries);
+void uring_close(db_uring_t *u);
+int uring_prep(db_uring_t *u, int opcode, int fd, void *buf, unsigned len,
+               off_t off, bool link, uint64_t user_data);
+int uring_wait_all(db_uring_t *u, int *res, int nres);
+int batch_run(int fd, batch_op_t *ops, int n);
+int batch_file(int fd, const char *path);
+
+#endif
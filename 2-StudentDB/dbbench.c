@@ -0,0 +1,528 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbcursor.h"
+#include "dbimport.h"
+#include "dbcompact.h"
+#include "dbhash.h"
+#include "dbbloom.h"
+#include "dbbench.h"
+
+static const char *kind_names[BENCH_KINDS] = {
+    "read", "insert", "delete", "scan", "count", "compress", "load"
+};
+static const char *flat_fns[BENCH_KINDS] = {
+    "get_student", "add_student", "del_student", "db_cursor",
+    "count_db_records", "compact_db", "import_students"
+};
+static const char *hashed_fns[BENCH_KINDS] = {
+    "hash_get", "hash_put", "hash_del", "hash_get", NULL, NULL, "hash_put"
+};
+
+//state of the run over one store
+struct bench_run {
+    const bench_cfg_t *cfg;
+    int64_t n;                  // students loaded
+    int64_t next_id;            // next id never used
+    int64_t idmax;
+    bench_zipf_t zipf;
+    uint64_t rng;
+    uint8_t *live;              // 1 for every id that holds a student
+    int32_t *freed;             // ids deleted during the run, reused first
+    int nfreed;
+    int fd;                     // the flat store, or
+    hash_db_t *h;               // the hashed store
+    bench_lat_t lat[BENCH_KINDS];
+};
+
+//xorshift64*
+static uint64_t rng_next(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+static double rng_unit(uint64_t *s)
+{
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//murmur3 finalizer, scrambles zipfian ranks
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void zipf_init(bench_zipf_t *z, uint64_t n, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (uint64_t i = 1; i <= n; i++)
+        z->zetan += 1.0 / pow((double)i, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_next(bench_zipf_t *z, uint64_t *rng)
+{
+    double u = rng_unit(rng);
+    double uz = u * z->zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+    uint64_t r = (uint64_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return (r < z->n) ? r : z->n - 1;
+}
+
+//a loaded id drawn from the configured distribution
+static int pick_id(struct bench_run *r)
+{
+    if (r->cfg->zipf)
+        return 1 + mix64(zipf_next(&r->zipf, &r->rng)) % r->n;
+    return 1 + rng_next(&r->rng) % r->n;
+}
+
+static int lat_add(bench_lat_t *l, uint64_t ns)
+{
+    if (l->n == l->cap) {
+        uint32_t ncap = l->cap ? l->cap * 2 : 1024;
+        uint64_t *p = realloc(l->ns, (size_t)ncap * sizeof(uint64_t));
+        if (p == NULL)
+            return ERR_DB_FILE;
+        l->ns = p;
+        l->cap = ncap;
+    }
+    l->ns[l->n++] = ns;
+    l->total_ns += ns;
+    return NO_ERROR;
+}
+
+static int ns_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void json_str(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ *  emit_result
+ *      first:  true until the first result is written, for the commas
+ *
+ *  Writes one result line.  A load is reported as one batch for the flat
+ *  store, so it has no latencies of its own.
+ */
+static void emit_result(FILE *out, bool *first, struct bench_run *r, int kind)
+{
+    bench_lat_t *l = &r->lat[kind];
+    const char *fn = (r->h != NULL) ? hashed_fns[kind] : flat_fns[kind];
+    uint64_t count = (kind == BENCH_LOAD) ? (uint64_t)r->n : l->n;
+
+    if (l->n == 0 || fn == NULL)
+        return;
+    qsort(l->ns, l->n, sizeof(uint64_t), ns_cmp);
+
+    fprintf(out, "%s\n    {\"store\": \"%s\", \"records\": %lld, \"op\": \"%s\", \"fn\": \"%s\", "
+            "\"count\": %llu, \"misses\": %u, \"ops_per_sec\": %.1f",
+            *first ? "" : ",", (r->h != NULL) ? "hashed" : "flat", (long long)r->n,
+            kind_names[kind], fn, (unsigned long long)count, l->misses,
+            count * 1e9 / (l->total_ns ? l->total_ns : 1));
+    if (kind != BENCH_LOAD || r->h != NULL)
+        fprintf(out, ", \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f",
+                l->ns[(l->n - 1) * 50 / 100] / 1e3, l->ns[(l->n - 1) * 99 / 100] / 1e3,
+                l->ns[l->n - 1] / 1e3);
+    fputc('}', out);
+    *first = false;
+}
+
+static void fill_student(student_t *s, int id)
+{
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    snprintf(s->fname, sizeof(s->fname), "bench");
+    snprintf(s->lname, sizeof(s->lname), "student%d", id);
+    s->gpa = MIN_STD_GPA + id % (MAX_STD_GPA - MIN_STD_GPA + 1);
+}
+
+/*
+ *  run_op
+ *      kind:  BENCH_READ .. BENCH_SCAN
+ *      id:    student the operation is about
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND for a miss, or ERR_DB_FILE
+ */
+static int run_op(struct bench_run *r, int kind, int id)
+{
+    student_t s;
+    student_t batch[BENCH_SCAN_IDS];
+    db_cursor_t *cur;
+    int rc;
+
+    switch (kind) {
+    case BENCH_READ:
+        return (r->h != NULL) ? hash_get(r->h, id, &s) : get_student(r->fd, id, &s);
+
+    case BENCH_INSERT:
+        fill_student(&s, id);
+        if (r->h != NULL)
+            rc = hash_put(r->h, &s);
+        else
+            rc = add_student(r->fd, id, s.fname, s.lname, s.gpa);
+        return (rc == ERR_DB_OP) ? SRCH_NOT_FOUND : rc;
+
+    case BENCH_DELETE:
+        rc = (r->h != NULL) ? hash_del(r->h, id) : del_student(r->fd, id);
+        return (rc == ERR_DB_OP) ? SRCH_NOT_FOUND : rc;
+
+    default:
+        if (r->h == NULL) {
+            cur = db_cursor_open(r->fd, id, id + BENCH_SCAN_IDS - 1);
+            if (cur == NULL)
+                return ERR_DB_FILE;
+            rc = db_cursor_next_batch(cur, batch, BENCH_SCAN_IDS);
+            db_cursor_close(cur);
+            return (rc < 0) ? ERR_DB_FILE : NO_ERROR;
+        }
+        // no order in a hash, a range is one lookup per id
+        for (int i = id; i < id + BENCH_SCAN_IDS; i++) {
+            rc = hash_get(r->h, i, &s);
+            if (rc == ERR_DB_FILE)
+                return rc;
+        }
+        return NO_ERROR;
+    }
+}
+
+static int load_store(struct bench_run *r)
+{
+    student_t s;
+    int rc = NO_ERROR;
+
+    if (r->h != NULL) {
+        for (int64_t id = 1; id <= r->n && rc == NO_ERROR; id++) {
+            fill_student(&s, id);
+            uint64_t t0 = now_ns();
+            rc = hash_put(r->h, &s);
+            if (rc == NO_ERROR)
+                rc = lat_add(&r->lat[BENCH_LOAD], now_ns() - t0);
+        }
+    } else {
+        student_t *recs = malloc(r->n * sizeof(student_t));
+        if (recs == NULL)
+            return ERR_DB_FILE;
+        for (int64_t id = 1; id <= r->n; id++)
+            fill_student(&recs[id - 1], id);
+        uint64_t t0 = now_ns();
+        rc = import_students(r->fd, recs, r->n);
+        rc = (rc == r->n) ? lat_add(&r->lat[BENCH_LOAD], now_ns() - t0) : ERR_DB_FILE;
+        free(recs);
+    }
+    memset(r->live + 1, 1, r->n);
+    return rc;
+}
+
+static int run_mix(struct bench_run *r)
+{
+    const int *mix = r->cfg->mix;
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < r->cfg->ops && rc != ERR_DB_FILE; i++) {
+        int roll = rng_next(&r->rng) % 100;
+        int kind = (roll < mix[0]) ? BENCH_READ :
+                   (roll < mix[0] + mix[1]) ? BENCH_INSERT :
+                   (roll < mix[0] + mix[1] + mix[2]) ? BENCH_DELETE : BENCH_SCAN;
+        int id;
+
+        if (kind != BENCH_INSERT)
+            id = pick_id(r);
+        else if (r->nfreed > 0)
+            id = r->freed[--r->nfreed];
+        else if (r->next_id <= r->idmax)
+            id = r->next_id++;
+        else
+            kind = BENCH_READ, id = pick_id(r);
+
+        uint64_t t0 = now_ns();
+        rc = run_op(r, kind, id);
+        uint64_t ns = now_ns() - t0;
+        if (rc == ERR_DB_FILE)
+            break;
+        if (rc == SRCH_NOT_FOUND)
+            r->lat[kind].misses++;
+        if (kind == BENCH_INSERT && rc == NO_ERROR)
+            r->live[id] = 1;
+        if (kind == BENCH_DELETE && rc == NO_ERROR) {
+            r->live[id] = 0;
+            r->freed[r->nfreed++] = id;
+        }
+        rc = lat_add(&r->lat[kind], ns);
+    }
+    return rc;
+}
+
+//count and compress, which only the flat store has
+static int run_maintenance(struct bench_run *r)
+{
+    compact_state_t cs;
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < BENCH_COUNT_RUNS && rc == NO_ERROR; i++) {
+        uint64_t t0 = now_ns();
+        if (count_db_records(r->fd) < 0)
+            return ERR_DB_FILE;
+        rc = lat_add(&r->lat[BENCH_COUNT], now_ns() - t0);
+    }
+    // compress_db() without the fallback that rewrites DB_FILE
+    uint64_t t0 = now_ns();
+    if (rc == NO_ERROR && compact_db(r->fd, &cs) == NO_ERROR)
+        rc = lat_add(&r->lat[BENCH_COMPRESS], now_ns() - t0);
+    return rc;
+}
+
+/*
+ *  bench_store
+ *      n:       students to load
+ *      hashed:  run on the hashed store instead of the flat one
+ *
+ *  Loads, runs and reports one store at one size.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int bench_store(const bench_cfg_t *cfg, int64_t n, bool hashed, FILE *out, bool *first)
+{
+    struct bench_run r;
+    int rc = ERR_DB_FILE;
+
+    memset(&r, 0, sizeof(r));
+    r.cfg = cfg;
+    r.n = n;
+    r.next_id = n + 1;
+    r.idmax = hashed ? n + cfg->ops : MAX_STD_ID;
+    r.rng = cfg->seed ? cfg->seed : 1;
+    r.fd = -1;
+    if (cfg->zipf)
+        zipf_init(&r.zipf, n, BENCH_ZIPF_THETA);
+    r.live = calloc(r.idmax + BENCH_SCAN_IDS + 1, 1);
+    r.freed = malloc(((size_t)cfg->ops + 1) * sizeof(int32_t));
+    if (r.live == NULL || r.freed == NULL)
+        goto done;
+
+    if (hashed) {
+        unlink(BENCH_HDB_FILE);
+        unlink(BENCH_HDB_FILE BLOOM_SUFFIX);
+        r.h = hash_open(BENCH_HDB_FILE, true);
+        if (r.h == NULL)
+            goto done;
+    } else {
+        r.fd = open_db(BENCH_DB_FILE, true);
+        if (r.fd < 0)
+            goto done;
+    }
+
+    rc = load_store(&r);
+    if (rc == NO_ERROR)
+        rc = run_mix(&r);
+    if (rc == NO_ERROR && !hashed)
+        rc = run_maintenance(&r);
+    if (rc == NO_ERROR) {
+        emit_result(out, first, &r, BENCH_LOAD);
+        for (int k = BENCH_READ; k <= BENCH_COMPRESS; k++)
+            emit_result(out, first, &r, k);
+    }
+
+done:
+    if (r.h != NULL)
+        hash_close(r.h);
+    if (r.fd >= 0)
+        close_db(r.fd);
+    for (int k = 0; k < BENCH_KINDS; k++)
+        free(r.lat[k].ns);
+    free(r.live);
+    free(r.freed);
+    return rc;
+}
+
+//comma separated list of database sizes
+static int parse_sizes(bench_cfg_t *cfg, const char *arg)
+{
+    char *end;
+
+    cfg->nsizes = 0;
+    do {
+        if (cfg->nsizes == BENCH_MAX_SIZES)
+            return ERR_DB_OP;
+        long long n = strtoll(arg, &end, 10);
+        if (end == arg || n < 1 || n > HASH_MAX_ID / 2 || (*end != ',' && *end != '\0'))
+            return ERR_DB_OP;
+        cfg->records[cfg->nsizes++] = n;
+        arg = end + 1;
+    } while (*end == ',');
+    return NO_ERROR;
+}
+
+static int parse_mix(bench_cfg_t *cfg, const char *arg)
+{
+    int sum = 0;
+
+    if (sscanf(arg, "%d,%d,%d,%d", &cfg->mix[0], &cfg->mix[1], &cfg->mix[2], &cfg->mix[3]) != 4)
+        return ERR_DB_OP;
+    for (int i = 0; i < 4; i++) {
+        if (cfg->mix[i] < 0)
+            return ERR_DB_OP;
+        sum += cfg->mix[i];
+    }
+    return (sum == 100) ? NO_ERROR : ERR_DB_OP;
+}
+
+static int parse_args(bench_cfg_t *cfg, int argc, char *argv[])
+{
+    memset(cfg, 0, sizeof(*cfg));
+    parse_sizes(cfg, BENCH_RECORDS);
+    cfg->ops = BENCH_OPS;
+    cfg->zipf = true;
+    parse_mix(cfg, "50,20,20,10");
+    cfg->seed = 1;
+    cfg->tag = "";
+
+    for (int i = 0; i < argc; i += 2) {
+        const char *opt = argv[i], *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        char *end;
+
+        if (val == NULL)
+            return ERR_DB_OP;
+        if (strcmp(opt, "--records") == 0) {
+            if (parse_sizes(cfg, val) != NO_ERROR)
+                return ERR_DB_OP;
+        } else if (strcmp(opt, "--ops") == 0) {
+            long n = strtol(val, &end, 10);
+            if (*end != '\0' || n < 1 || n > HASH_MAX_ID / 2)
+                return ERR_DB_OP;
+            cfg->ops = n;
+        } else if (strcmp(opt, "--dist") == 0) {
+            if (strcmp(val, "zipf") != 0 && strcmp(val, "uniform") != 0)
+                return ERR_DB_OP;
+            cfg->zipf = (strcmp(val, "zipf") == 0);
+        } else if (strcmp(opt, "--mix") == 0) {
+            if (parse_mix(cfg, val) != NO_ERROR)
+                return ERR_DB_OP;
+        } else if (strcmp(opt, "--seed") == 0) {
+            cfg->seed = strtoull(val, &end, 10);
+            if (*end != '\0')
+                return ERR_DB_OP;
+        } else if (strcmp(opt, "--tag") == 0) {
+            cfg->tag = val;
+        } else if (strcmp(opt, "--out") == 0) {
+            cfg->out = val;
+        } else {
+            return ERR_DB_OP;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  bench_main
+ *      argc, argv:  the arguments after --bench
+ *
+ *  Runs the workload of dbbench.h for every size and writes the results
+ *  to --out, or stdout.
+ *
+ *  returns:  EXIT_OK, EXIT_FAIL_ARGS or EXIT_FAIL_DB
+ *
+ *  console:  M_BENCH_DONE     when the results went to a file
+ *            M_ERR_BENCH_OUT  the result file cannot be created
+ *            M_ERR_BENCH      a store could not be loaded or run
+ */
+int bench_main(char *exename, int argc, char *argv[])
+{
+    bench_cfg_t cfg;
+    bool first = true;
+    int rc = NO_ERROR;
+
+    if (parse_args(&cfg, argc, argv) != NO_ERROR) {
+        usage(exename);
+        return EXIT_FAIL_ARGS;
+    }
+
+    // the measured functions report on stdout, only the results are kept
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    FILE *out = (cfg.out != NULL) ? fopen(cfg.out, "w") : fdopen(dup(saved), "w");
+    if (saved < 0 || devnull < 0 || out == NULL) {
+        printf(M_ERR_BENCH_OUT, cfg.out ? cfg.out : "stdout");
+        return EXIT_FAIL_DB;
+    }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    fprintf(out, "{\"bench\": \"sdbsc\", \"tag\": ");
+    json_str(out, cfg.tag);
+    fprintf(out, ", \"ops\": %d, \"dist\": \"%s\", \"theta\": %.2f, "
+            "\"mix\": {\"read\": %d, \"insert\": %d, \"delete\": %d, \"scan\": %d}, "
+            "\"seed\": %llu,\n  \"results\": [",
+            cfg.ops, cfg.zipf ? "zipf" : "uniform", BENCH_ZIPF_THETA,
+            cfg.mix[0], cfg.mix[1], cfg.mix[2], cfg.mix[3], (unsigned long long)cfg.seed);
+
+    for (int i = 0; i < cfg.nsizes && rc == NO_ERROR; i++) {
+        // the flat file has a slot per id, larger sets only fit the hash
+        if (cfg.records[i] <= MAX_STD_ID)
+            rc = bench_store(&cfg, cfg.records[i], false, out, &first);
+        if (rc == NO_ERROR)
+            rc = bench_store(&cfg, cfg.records[i], true, out, &first);
+    }
+    fprintf(out, "\n  ]}\n");
+    fclose(out);
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_BENCH);
+        return EXIT_FAIL_DB;
+    }
+    if (cfg.out != NULL)
+        printf(M_BENCH_DONE, cfg.out);
+    return EXIT_OK;
+}
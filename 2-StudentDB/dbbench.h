@@ -0,0 +1,80 @@
+#ifndef __DBBENCH_H__
+    #define __DBBENCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+//Workload generator for sdbsc --bench (make bench), after YCSB.  For every
+//database size in --records:
+//
+//  load      a fresh BENCH_DB_FILE is filled with students 1..N in one
+//            import_students(), sizes above MAX_STD_ID only run on the
+//            hashed store (BENCH_HDB_FILE, see dbhash.h)
+//  run       --ops operations drawn from the --mix of reads, inserts,
+//            deletes and scans.  Reads, deletes and scans pick their id
+//            from the loaded ids, uniformly or zipfian (theta
+//            BENCH_ZIPF_THETA, ranks scrambled so the hot ids are spread
+//            over the file).  An insert puts back the id deleted last, or
+//            takes the next unused id.  A scan reads BENCH_SCAN_IDS ids
+//            from the one picked through a cursor (dbcursor.h).
+//  count     count_db_records() BENCH_COUNT_RUNS times
+//  compress  one compact_db() of the database left by the run
+//
+//Every operation is timed on its own, and each kind is reported with its
+//rate and its p50, p99 and max latency as a JSON document, one result per
+//line, so runs of different builds (--tag) can be compared by a script.
+//The console output of the measured functions goes to /dev/null.
+#define BENCH_DB_FILE       "bench.db"
+#define BENCH_HDB_FILE      "bench.hdb"
+#define BENCH_RECORDS       "10000,100000,1000000,10000000"
+#define BENCH_OPS           20000
+#define BENCH_MAX_SIZES     8
+#define BENCH_ZIPF_THETA    0.99
+#define BENCH_SCAN_IDS      100
+#define BENCH_COUNT_RUNS    100
+
+#define BENCH_READ          0
+#define BENCH_INSERT        1
+#define BENCH_DELETE        2
+#define BENCH_SCAN          3
+#define BENCH_COUNT         4
+#define BENCH_COMPRESS      5
+#define BENCH_LOAD          6
+#define BENCH_KINDS         7
+
+typedef struct bench_cfg {
+    int64_t records[BENCH_MAX_SIZES];
+    int nsizes;
+    int ops;
+    bool zipf;
+    int mix[4];             // percent of reads, inserts, deletes, scans
+    uint64_t seed;
+    const char *tag;        // label of the build, may be empty
+    const char *out;        // result file, NULL for stdout
+} bench_cfg_t;
+
+//latencies of one kind of operation
+typedef struct bench_lat {
+    uint64_t *ns;
+    uint32_t n;
+    uint32_t cap;
+    uint32_t misses;        // reads and deletes of an id that was not there
+    uint64_t total_ns;
+} bench_lat_t;
+
+//zipfian ranks over [0, n), Gray et al., "Quickly generating billion-record
+//synthetic databases"
+typedef struct bench_zipf {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} bench_zipf_t;
+
+//prototypes
+int bench_main(char *exename, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbiostat.h"
+
+//when print_db() or another scan walks the live ids, ids separated by at
+//most this many empty slots are read with a single pread() because reading
+//a few KB of deleted records is cheaper than issuing another syscall
+#define SCAN_GAP_RECORDS    64
+
+_Static_assert(sizeof(bitmap_hdr_t) == BITMAP_HDR_SIZE, "bitmap header size");
+
+static uint64_t round_up_bits(uint64_t nbits)
+{
+    return (nbits + BITMAP_GROW_BITS - 1) / BITMAP_GROW_BITS * BITMAP_GROW_BITS;
+}
+
+static int bitmap_write_hdr(db_bitmap_t *bm)
+{
+    return pwrite_all(bm->fd, &bm->hdr, sizeof(bm->hdr), 0);
+}
+
+//grow the in memory bitmap so that bit 'id' exists, new words are zero
+static int bitmap_grow(db_bitmap_t *bm, uint64_t id)
+{
+    uint64_t nbits = round_up_bits(id + 1);
+    uint64_t old_words = bm->hdr.nbits / 64;
+    uint64_t new_words = nbits / 64;
+
+    if (nbits <= bm->hdr.nbits)
+        return NO_ERROR;
+
+    uint64_t *words = realloc(bm->words, new_words * sizeof(uint64_t));
+    if (words == NULL)
+        return ERR_DB_FILE;
+    memset(words + old_words, 0, (new_words - old_words) * sizeof(uint64_t));
+    bm->words = words;
+    bm->hdr.nbits = nbits;
+    return NO_ERROR;
+}
+
+static int bitmap_load(db_bitmap_t *bm, const db_stamp_t *stamp)
+{
+    struct stat st;
+
+    if (io_pread(bm->fd, &bm->hdr, sizeof(bm->hdr), 0) != sizeof(bm->hdr))
+        return ERR_DB_FILE;
+    if (bm->hdr.magic != BITMAP_MAGIC || bm->hdr.version != BITMAP_VERSION)
+        return ERR_DB_FILE;
+    if (!db_stamp_equal(&bm->hdr.stamp, stamp))
+        return ERR_DB_FILE;
+    if (bm->hdr.nbits == 0 || bm->hdr.nbits % 64 != 0)
+        return ERR_DB_FILE;
+
+    size_t len = bm->hdr.nbits / 8;
+    if (fstat(bm->fd, &st) == -1 || (size_t)st.st_size < BITMAP_HDR_SIZE + len)
+        return ERR_DB_FILE;
+
+    bm->words = malloc(len);
+    if (bm->words == NULL)
+        return ERR_DB_FILE;
+    if (io_pread(bm->fd, bm->words, len, BITMAP_HDR_SIZE) != (ssize_t)len) {
+        free(bm->words);
+        bm->words = NULL;
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+static int rebuild_cb(const student_t *s, void *arg)
+{
+    db_bitmap_t *bm = arg;
+
+    if (s->id <= 0)
+        return 0;       // garbage record, it is not addressable by id
+    if ((uint64_t)s->id >= bm->hdr.nbits && bitmap_grow(bm, s->id) != NO_ERROR)
+        return 1;
+    bm->words[s->id / 64] |= 1ULL << (s->id % 64);
+    return 0;
+}
+
+//recreate the sidecar from the database file.  A fresh database is known
+//to be empty so it does not need to be scanned.
+static int bitmap_rebuild(db_bitmap_t *bm, int dbfd, const db_stamp_t *stamp,
+                          bool fresh)
+{
+    free(bm->words);
+    memset(&bm->hdr, 0, sizeof(bm->hdr));
+    bm->hdr.magic = BITMAP_MAGIC;
+    bm->hdr.version = BITMAP_VERSION;
+    bm->hdr.stamp = *stamp;
+
+    uint64_t nbits = stamp->size / STUDENT_RECORD_SIZE;
+    if (nbits < MAX_STD_ID + 1)
+        nbits = MAX_STD_ID + 1;
+    bm->hdr.nbits = round_up_bits(nbits);
+    bm->words = calloc(bm->hdr.nbits / 64, sizeof(uint64_t));
+    if (bm->words == NULL)
+        return ERR_DB_FILE;
+
+    if (!fresh && scan_db(dbfd, rebuild_cb, bm) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (ftruncate(bm->fd, 0) == -1)
+        return ERR_DB_FILE;
+    if (pwrite_all(bm->fd, bm->words, bm->hdr.nbits / 8, BITMAP_HDR_SIZE) != NO_ERROR)
+        return ERR_DB_FILE;
+    return bitmap_write_hdr(bm);
+}
+
+/*
+ *  bitmap_open
+ *      dbpath:  path of the database file
+ *      dbfd:    open file descriptor of the database
+ *      fresh:   true if the database was just created or truncated
+ *
+ *  Opens the occupancy bitmap sidecar of a database.  If the sidecar does
+ *  not exist, is damaged or describes a different database file it is
+ *  rebuilt with a scan of the database.
+ *
+ *  returns:  the bitmap, or NULL if it is not available
+ */
+db_bitmap_t *bitmap_open(const char *dbpath, int dbfd, bool fresh)
+{
+    char path[PATH_MAX];
+    db_stamp_t stamp;
+
+    if (sidecar_path(dbpath, BITMAP_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return NULL;
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return NULL;
+
+    db_bitmap_t *bm = calloc(1, sizeof(*bm));
+    if (bm == NULL)
+        return NULL;
+
+    bm->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (bm->fd < 0) {
+        free(bm);
+        return NULL;
+    }
+
+    if (!fresh && bitmap_load(bm, &stamp) == NO_ERROR)
+        return bm;
+
+    if (bitmap_rebuild(bm, dbfd, &stamp, fresh) != NO_ERROR) {
+        bitmap_close(bm);
+        return NULL;
+    }
+    return bm;
+}
+
+void bitmap_close(db_bitmap_t *bm)
+{
+    if (bm == NULL)
+        return;
+    close(bm->fd);
+    free(bm->words);
+    free(bm);
+}
+
+/*
+ *  bitmap_test
+ *      id:  student id
+ *
+ *  returns:  true if the slot for id holds a valid student
+ */
+bool bitmap_test(const db_bitmap_t *bm, int id)
+{
+    if (id < 0 || (uint64_t)id >= bm->hdr.nbits)
+        return false;
+    return (bm->words[id / 64] >> (id % 64)) & 1;
+}
+
+/*
+ *  bitmap_set
+ *      id:  student id
+ *      on:  true if the slot is now occupied, false if it was deleted
+ *
+ *  Updates the bit for id in memory and writes the word holding it back to
+ *  the sidecar.  The bitmap grows when id is beyond its current capacity.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE on a sidecar I/O error
+ */
+int bitmap_set(db_bitmap_t *bm, int id, bool on)
+{
+    if (id < 0)
+        return ERR_DB_FILE;
+
+    uint64_t old_nbits = bm->hdr.nbits;
+    if ((uint64_t)id >= old_nbits && bitmap_grow(bm, id) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    uint64_t w = id / 64;
+    if (on)
+        bm->words[w] |= 1ULL << (id % 64);
+    else
+        bm->words[w] &= ~(1ULL << (id % 64));
+
+    if (bm->hdr.nbits != old_nbits) {
+        // new words (including w) go out in one write, then the new size
+        uint64_t first = old_nbits / 64;
+        if (pwrite_all(bm->fd, bm->words + first,
+                      (bm->hdr.nbits - old_nbits) / 8,
+                      BITMAP_HDR_SIZE + first * sizeof(uint64_t)) != NO_ERROR)
+            return ERR_DB_FILE;
+        return bitmap_write_hdr(bm);
+    }
+
+    return pwrite_all(bm->fd, &bm->words[w], sizeof(uint64_t),
+                     BITMAP_HDR_SIZE + w * sizeof(uint64_t));
+}
+
+/*
+ *  bitmap_set_bulk
+ *      recs:  students that were just written to the database
+ *      n:     number of students in recs
+ *
+ *  Sets the bits of many students at once and writes the whole bitmap back
+ *  with a single write, used by bulk import instead of n bitmap_set() calls.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE on a sidecar I/O error
+ */
+int bitmap_set_bulk(db_bitmap_t *bm, const student_t *recs, int n)
+{
+    uint64_t old_nbits = bm->hdr.nbits;
+
+    for (int i = 0; i < n; i++) {
+        int id = recs[i].id;
+        if (id < 0)
+            return ERR_DB_FILE;
+        if ((uint64_t)id >= bm->hdr.nbits && bitmap_grow(bm, id) != NO_ERROR)
+            return ERR_DB_FILE;
+        bm->words[id / 64] |= 1ULL << (id % 64);
+    }
+
+    if (pwrite_all(bm->fd, bm->words, bm->hdr.nbits / 8, BITMAP_HDR_SIZE) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (bm->hdr.nbits != old_nbits)
+        return bitmap_write_hdr(bm);
+    return NO_ERROR;
+}
+
+/*
+ *  bitmap_stamp
+ *      dbfd:  database file descriptor
+ *
+ *  Records the current identity of the database file in the sidecar
+ *  header.  Call after every operation that may change the database size.
+ *  The header is only rewritten if the stamp actually changed.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int bitmap_stamp(db_bitmap_t *bm, int dbfd)
+{
+    db_stamp_t stamp;
+
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_stamp_equal(&stamp, &bm->hdr.stamp))
+        return NO_ERROR;
+    bm->hdr.stamp = stamp;
+    return bitmap_write_hdr(bm);
+}
+
+__attribute__((target("popcnt")))
+static int popcount_words_hw(const uint64_t *w, uint64_t n)
+{
+    int count = 0;
+
+    for (uint64_t i = 0; i < n; i++)
+        count += __builtin_popcountll(w[i]);
+    return count;
+}
+
+static int popcount_words(const uint64_t *w, uint64_t n)
+{
+    int count = 0;
+
+    for (uint64_t i = 0; i < n; i++)
+        count += __builtin_popcountll(w[i]);
+    return count;
+}
+
+/*
+ *  bitmap_count
+ *
+ *  returns:  the number of valid students, that is the number of set bits
+ */
+int bitmap_count(const db_bitmap_t *bm)
+{
+    if (__builtin_cpu_supports("popcnt"))
+        return popcount_words_hw(bm->words, bm->hdr.nbits / 64);
+    return popcount_words(bm->words, bm->hdr.nbits / 64);
+}
+
+/*
+ *  bitmap_next
+ *      from:  first id to consider
+ *
+ *  returns:  the smallest id >= from whose bit is set, or -1 if none
+ */
+int64_t bitmap_next(const db_bitmap_t *bm, int64_t from)
+{
+    if (from < 0)
+        from = 0;
+    if ((uint64_t)from >= bm->hdr.nbits)
+        return -1;
+
+    uint64_t w = from / 64;
+    uint64_t nwords = bm->hdr.nbits / 64;
+    uint64_t bits = bm->words[w] & (~0ULL << (from % 64));
+
+    while (bits == 0) {
+        if (++w >= nwords)
+            return -1;
+        bits = bm->words[w];
+    }
+    return (int64_t)(w * 64 + __builtin_ctzll(bits));
+}
+
+/*
+ *  bitmap_reload
+ *
+ *  Reads the bitmap back from its sidecar, picking up bits set or cleared
+ *  by other processes (see dblock.h).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int bitmap_reload(db_bitmap_t *bm)
+{
+    bitmap_hdr_t hdr;
+
+    if (io_pread(bm->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != BITMAP_MAGIC || hdr.version != BITMAP_VERSION ||
+        hdr.nbits == 0 || hdr.nbits % 64 != 0)
+        return ERR_DB_FILE;
+
+    if (hdr.nbits != bm->hdr.nbits) {
+        uint64_t *words = realloc(bm->words, hdr.nbits / 8);
+        if (words == NULL)
+            return ERR_DB_FILE;
+        bm->words = words;
+    }
+    bm->hdr = hdr;
+
+    size_t len = hdr.nbits / 8;
+    ssize_t n = io_pread(bm->fd, bm->words, len, BITMAP_HDR_SIZE);
+    if (n < 0)
+        return ERR_DB_FILE;
+    memset((char *)bm->words + n, 0, len - n);
+    return NO_ERROR;
+}
+
+/*
+ *  bitmap_last
+ *
+ *  returns:  the largest id whose bit is set, or -1 if the bitmap is empty
+ */
+int64_t bitmap_last(const db_bitmap_t *bm)
+{
+    for (uint64_t w = bm->hdr.nbits / 64; w-- > 0;) {
+        if (bm->words[w] != 0)
+            return (int64_t)(w * 64 + 63 - __builtin_clzll(bm->words[w]));
+    }
+    return -1;
+}
+
+/*
+ *  bitmap_page_empty
+ *      page:  index of a 4K page of the database, it holds the 64 records
+ *             with ids page*64 .. page*64+63
+ *
+ *  One bitmap word covers exactly the records of one page, so a page is
+ *  free when its word is zero.  Pages past the end of the bitmap hold no
+ *  valid students.
+ *
+ *  returns:  true if no valid student lives in the page
+ */
+bool bitmap_page_empty(const db_bitmap_t *bm, uint64_t page)
+{
+    if (page >= bm->hdr.nbits / 64)
+        return true;
+    return bm->words[page] == 0;
+}
+
+/*
+ *  scan_live_range
+ *      fd:      linux file descriptor
+ *      lo, hi:  ids [lo, hi) to scan
+ *      cb:      called with each valid record, in id order
+ *      arg:     passed through to cb
+ *
+ *  Same contract as scan_range() from dbscan.c, but when the database has
+ *  an occupancy bitmap only the slots of live ids are read.  Nearby live
+ *  ids are coalesced into one pread() of up to SCAN_BLOCK_SIZE bytes.
+ *  The bitmap is only read, so several threads may scan parts of the
+ *  database at once after the caller brought the context up to date with
+ *  db_ctx_refresh().
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or the value returned by cb
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_live_range(int fd, int64_t lo, int64_t hi, scan_cb_t cb, void *arg)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    if (ctx == NULL || ctx->bitmap == NULL)
+        return scan_range(fd, lo, hi, cb, arg);
+
+    db_bitmap_t *bm = ctx->bitmap;
+    const int64_t max_recs = SCAN_BLOCK_SIZE / STUDENT_RECORD_SIZE;
+    student_t *buf = NULL;
+    int rc = NO_ERROR;
+
+    int64_t id = bitmap_next(bm, lo);
+    while (id >= 0 && id < hi && rc == NO_ERROR) {
+        int64_t first = id;
+        int64_t last = id + 1;
+
+        // grow the read window [first, last) over nearby live ids
+        for (;;) {
+            id = bitmap_next(bm, last);
+            if (id < 0 || id >= hi || id - last > SCAN_GAP_RECORDS ||
+                id + 1 - first > max_recs)
+                break;
+            last = id + 1;
+        }
+
+        if (buf == NULL) {
+            buf = aligned_alloc(64, SCAN_BLOCK_SIZE);
+            if (buf == NULL)
+                return ERR_DB_FILE;
+        }
+
+        ssize_t n = io_pread(fd, buf, (last - first) * STUDENT_RECORD_SIZE,
+                          first * STUDENT_RECORD_SIZE);
+        if (n < 0) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        int64_t nrecs = n / STUDENT_RECORD_SIZE;
+        for (int64_t k = first; k >= 0 && k < first + nrecs; k = bitmap_next(bm, k + 1)) {
+            if (record_is_empty(&buf[k - first]))
+                continue;
+            rc = cb(&buf[k - first], arg);
+            if (rc != 0)
+                break;
+        }
+    }
+
+    free(buf);
+    return rc;
+}
+
+/*
+ *  scan_live
+ *      fd:     linux file descriptor
+ *      cb:     called with each valid record, in id order
+ *      arg:    passed through to cb
+ *
+ *  scan_live_range() over the whole database, with the occupancy bitmap
+ *  reloaded first if another process changed it.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or the value returned by cb
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_live(int fd, scan_cb_t cb, void *arg)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    if (ctx == NULL || ctx->bitmap == NULL || db_ctx_refresh(ctx) != NO_ERROR)
+        return scan_db(fd, cb, arg);
+    return scan_live_range(fd, 0, INT64_MAX, cb, arg);
+}
@@ -0,0 +1,51 @@
+#ifndef __DBBITMAP_H__
+    #define __DBBITMAP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "dbctx.h"
+#include "dbscan.h"
+
+//The occupancy bitmap keeps one bit per student id, set when the slot for
+//that id holds a valid student.  It is stored in a sidecar file next to the
+//database (student.db.bitmap) so the database file keeps its plain layout
+//of 64 byte records indexed by id.  The bitmap starts out sized for
+//MAX_STD_ID and grows on demand for larger ids.
+#define BITMAP_SUFFIX       ".bitmap"
+#define BITMAP_MAGIC        0x504d4253      // "SBMP"
+#define BITMAP_VERSION      2
+#define BITMAP_HDR_SIZE     64
+#define BITMAP_GROW_BITS    4096
+
+typedef struct bitmap_hdr {
+    uint32_t magic;
+    uint32_t version;
+    db_stamp_t stamp;       // database file the bitmap describes
+    uint64_t nbits;         // capacity in bits, a multiple of 64
+    char pad[BITMAP_HDR_SIZE - 48];
+} bitmap_hdr_t;
+
+typedef struct db_bitmap {
+    int fd;                 // sidecar file descriptor
+    bitmap_hdr_t hdr;
+    uint64_t *words;        // hdr.nbits / 64 words
+} db_bitmap_t;
+
+//prototypes
+db_bitmap_t *bitmap_open(const char *dbpath, int dbfd, bool fresh);
+void bitmap_close(db_bitmap_t *bm);
+bool bitmap_test(const db_bitmap_t *bm, int id);
+int bitmap_set(db_bitmap_t *bm, int id, bool on);
+int bitmap_set_bulk(db_bitmap_t *bm, const student_t *recs, int n);
+int bitmap_stamp(db_bitmap_t *bm, int dbfd);
+int bitmap_count(const db_bitmap_t *bm);
+int64_t bitmap_next(const db_bitmap_t *bm, int64_t from);
+int bitmap_reload(db_bitmap_t *bm);
+int64_t bitmap_last(const db_bitmap_t *bm);
+bool bitmap_page_empty(const db_bitmap_t *bm, uint64_t page);
+int scan_live(int fd, scan_cb_t cb, void *arg);
+int scan_live_range(int fd, int64_t lo, int64_t hi, scan_cb_t cb, void *arg);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbbloom.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(bloom_hdr_t) == BLOOM_HDR_SIZE, "bloom header size");
+_Static_assert(sizeof(bloom_block_t) == BLOOM_BLOCK_SIZE, "bloom block size");
+
+//splitmix64 finalizer
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static bloom_block_t *key_block(const db_bloom_t *b, uint32_t key)
+{
+    return &b->blocks[mix64(key) & (b->hdr->nblocks - 1)];
+}
+
+//the BLOOM_K bit numbers of key in its block, 9 bits each of a second hash
+static uint64_t key_bits(uint32_t key)
+{
+    return mix64((uint64_t)key + 0x9e3779b97f4a7c15ULL);
+}
+
+static void unmap(db_bloom_t *b)
+{
+    if (b->hdr != NULL)
+        munmap(b->hdr, b->maplen);
+    b->hdr = NULL;
+    b->blocks = NULL;
+    b->maplen = 0;
+}
+
+static int map(db_bloom_t *b, size_t len)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+
+    if (p == MAP_FAILED)
+        return ERR_DB_FILE;
+    b->hdr = p;
+    b->blocks = (bloom_block_t *)((char *)p + BLOOM_HDR_SIZE);
+    b->maplen = len;
+    return NO_ERROR;
+}
+
+/*
+ *  bloom_open
+ *      path:  sidecar file, created if it does not exist
+ *
+ *  Maps the filter if the file holds one.  A new, damaged or truncated
+ *  file is left unmapped, bloom_valid() is false until bloom_reset().
+ *
+ *  returns:  the filter, or NULL if the file cannot be opened
+ */
+db_bloom_t *bloom_open(const char *path)
+{
+    db_bloom_t *b = calloc(1, sizeof(*b));
+    bloom_hdr_t hdr;
+    struct stat st;
+
+    if (b == NULL)
+        return NULL;
+    b->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (b->fd < 0) {
+        free(b);
+        return NULL;
+    }
+
+    if (fstat(b->fd, &st) == 0 &&
+        io_pread(b->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        hdr.magic == BLOOM_MAGIC && hdr.version == BLOOM_VERSION &&
+        hdr.nblocks != 0 && (hdr.nblocks & (hdr.nblocks - 1)) == 0 &&
+        st.st_size == BLOOM_HDR_SIZE + (off_t)hdr.nblocks * BLOOM_BLOCK_SIZE)
+        map(b, st.st_size);
+    return b;
+}
+
+void bloom_close(db_bloom_t *b)
+{
+    if (b == NULL)
+        return;
+    unmap(b);
+    close(b->fd);
+    free(b);
+}
+
+//true if the filter is mapped and can answer bloom_test()
+bool bloom_valid(const db_bloom_t *b)
+{
+    return b != NULL && b->hdr != NULL;
+}
+
+/*
+ *  bloom_reset
+ *      capacity:  ids the filter should hold, at least BLOOM_MIN_KEYS
+ *
+ *  Replaces the filter with an empty one sized for capacity ids.  The
+ *  owner fields of the header are left zero for the caller to fill in.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE, the filter is unmapped on error
+ */
+int bloom_reset(db_bloom_t *b, uint32_t capacity)
+{
+    uint32_t nblocks = 1;
+
+    if (capacity < BLOOM_MIN_KEYS)
+        capacity = BLOOM_MIN_KEYS;
+    uint64_t bits = (uint64_t)capacity * BLOOM_BITS_PER_KEY;
+    while ((uint64_t)nblocks * BLOOM_BLOCK_SIZE * 8 < bits)
+        nblocks <<= 1;
+
+    // truncating first drops the old bits, the new length reads as zeros
+    size_t len = BLOOM_HDR_SIZE + (size_t)nblocks * BLOOM_BLOCK_SIZE;
+    unmap(b);
+    if (ftruncate(b->fd, 0) == -1 || ftruncate(b->fd, len) == -1 || map(b, len) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    b->hdr->magic = BLOOM_MAGIC;
+    b->hdr->version = BLOOM_VERSION;
+    b->hdr->nblocks = nblocks;
+    b->hdr->capacity = capacity;
+    return NO_ERROR;
+}
+
+//set the bits of key, the filter must be valid
+void bloom_add(db_bloom_t *b, uint32_t key)
+{
+    bloom_block_t *blk = key_block(b, key);
+    uint64_t h = key_bits(key);
+
+    for (int i = 0; i < BLOOM_K; i++, h >>= 9)
+        blk->w[(h >> 6) & 7] |= 1ULL << (h & 63);
+    b->hdr->nkeys++;
+}
+
+/*
+ *  bloom_test
+ *      key:  id to look for
+ *
+ *  returns:  false if key was never added, true if it may have been
+ *            (always true for a filter that is not valid)
+ */
+bool bloom_test(const db_bloom_t *b, uint32_t key)
+{
+    if (!bloom_valid(b))
+        return true;
+
+    const bloom_block_t *blk = key_block(b, key);
+    uint64_t h = key_bits(key);
+
+    for (int i = 0; i < BLOOM_K; i++, h >>= 9) {
+        if (!(blk->w[(h >> 6) & 7] & (1ULL << (h & 63))))
+            return false;
+    }
+    return true;
+}
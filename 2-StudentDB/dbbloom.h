@@ -0,0 +1,65 @@
+#ifndef __DBBLOOM_H__
+    #define __DBBLOOM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//Blocked Bloom filter over student ids, kept in a sidecar of the hashed
+//database (HASH_DB_FILE BLOOM_SUFFIX).  student.db does not need one: its
+//occupancy bitmap (dbbitmap.h) is an exact answer for the dense id range
+//and get_student() consults it before reading a slot.  The hashed file
+//takes any 32 bit id, where a bitmap would be 512MB, so a lookup there is
+//answered from the filter first and only an id that may be present costs
+//a bucket read.
+//
+//The filter is an array of 64 byte blocks, one cache line each.  An id
+//picks a block with one hash and sets BLOOM_K bits inside it with
+//another, so a test touches a single line of memory.  The sidecar is
+//mmap()ed, opening it reads nothing and a test faults in one page at most.
+//With BLOOM_BITS_PER_KEY bits per id about one absent id in a hundred
+//still reaches the bucket.
+//
+//Bits can not be cleared, so deleted ids stay in the filter until it is
+//rebuilt from the buckets: by sdbsc --hashed -x, when the ids added since
+//the last rebuild outgrow its capacity, and whenever the sidecar does not
+//match the database it belongs to.
+#define BLOOM_SUFFIX        ".bloom"
+#define BLOOM_MAGIC         0x4d4c4253      // "SBLM"
+#define BLOOM_VERSION       1
+#define BLOOM_HDR_SIZE      64
+#define BLOOM_BLOCK_SIZE    64
+#define BLOOM_K             7
+#define BLOOM_BITS_PER_KEY  10
+#define BLOOM_MIN_KEYS      4096
+
+typedef struct bloom_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t owner_ino;     // inode of the database the filter describes
+    uint32_t owner_nrecs;   // its student count when the filter was updated
+    uint32_t nblocks;       // a power of two
+    uint32_t capacity;      // ids the filter is sized for
+    uint32_t nkeys;         // ids added since the last rebuild
+    char pad[BLOOM_HDR_SIZE - 32];
+} bloom_hdr_t;
+
+typedef struct bloom_block {
+    uint64_t w[BLOOM_BLOCK_SIZE / 8];
+} bloom_block_t;
+
+typedef struct db_bloom {
+    int fd;                 // sidecar file descriptor
+    bloom_hdr_t *hdr;       // start of the mapping, NULL if not mapped
+    bloom_block_t *blocks;  // hdr->nblocks blocks after the header
+    size_t maplen;
+} db_bloom_t;
+
+//prototypes
+db_bloom_t *bloom_open(const char *path);
+void bloom_close(db_bloom_t *b);
+bool bloom_valid(const db_bloom_t *b);
+int bloom_reset(db_bloom_t *b, uint32_t capacity);
+void bloom_add(db_bloom_t *b, uint32_t key);
+bool bloom_test(const db_bloom_t *b, uint32_t key);
+
+#endif
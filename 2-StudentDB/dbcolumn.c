@@ -0,0 +1,630 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define COL_X86_SIMD 1
+#endif
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbwal.h"
+#include "dbcolumn.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(col_hdr_t) == COL_HDR_SIZE, "column header size");
+_Static_assert(sizeof(((student_t *)0)->lname) <= COL_NAME_SIZE &&
+               sizeof(((student_t *)0)->fname) <= COL_NAME_SIZE,
+               "dictionary entries must fit every name");
+
+//rows collected from the database while a snapshot is taken
+typedef struct col_build {
+    size_t n;
+    size_t cap;
+    student_t *rows;
+} col_build_t;
+
+static size_t col_align(size_t off)
+{
+    return (off + COL_ALIGN - 1) & ~(size_t)(COL_ALIGN - 1);
+}
+
+#ifdef COL_X86_SIMD
+static bool col_have_avx2(void)
+{
+    static int have = -1;
+
+    if (have < 0) {
+        __builtin_cpu_init();
+        have = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return have;
+}
+#endif
+
+static int build_cb(const student_t *s, void *arg)
+{
+    col_build_t *b = arg;
+
+    if (b->n == b->cap) {
+        size_t ncap = b->cap ? b->cap * 2 : 1024;
+        student_t *p = realloc(b->rows, ncap * sizeof(*p));
+        if (p == NULL)
+            return ERR_DB_FILE;
+        b->rows = p;
+        b->cap = ncap;
+    }
+    b->rows[b->n++] = *s;
+    return NO_ERROR;
+}
+
+//qsort_r() comparators, arg is the row array, elements are row numbers
+static int cmp_fname(const void *a, const void *b, void *arg)
+{
+    const student_t *rows = arg;
+    return strcmp(rows[*(const uint32_t *)a].fname, rows[*(const uint32_t *)b].fname);
+}
+
+static int cmp_lname(const void *a, const void *b, void *arg)
+{
+    const student_t *rows = arg;
+    return strcmp(rows[*(const uint32_t *)a].lname, rows[*(const uint32_t *)b].lname);
+}
+
+/*
+ *  encode_names
+ *      b:      collected rows
+ *      lname:  encode lname if true, fname otherwise
+ *      order:  scratch space for b->n row numbers
+ *      codes:  receives the code of every row
+ *      dict:   receives the sorted distinct names, at most b->n entries
+ *
+ *  returns:  number of dictionary entries
+ */
+static uint32_t encode_names(const col_build_t *b, bool lname, uint32_t *order,
+                             uint32_t *codes, char *dict)
+{
+    uint32_t ndict = 0;
+    const char *prev = NULL;
+
+    for (size_t i = 0; i < b->n; i++)
+        order[i] = i;
+    qsort_r(order, b->n, sizeof(*order), lname ? cmp_lname : cmp_fname, b->rows);
+
+    for (size_t i = 0; i < b->n; i++) {
+        const student_t *s = &b->rows[order[i]];
+        const char *name = lname ? s->lname : s->fname;
+        size_t size = lname ? sizeof(s->lname) : sizeof(s->fname);
+
+        if (prev == NULL || strcmp(prev, name) != 0) {
+            strncpy(dict + (size_t)ndict * COL_NAME_SIZE, name, size);
+            dict[(size_t)ndict * COL_NAME_SIZE + COL_NAME_SIZE - 1] = '\0';
+            ndict++;
+            prev = name;
+        }
+        codes[order[i]] = ndict - 1;
+    }
+    return ndict;
+}
+
+/*
+ *  column_build
+ *      fd:    database file descriptor
+ *      path:  file the snapshot is written to
+ *
+ *  Reads every valid student and writes the columnar snapshot.  All
+ *  stripes are locked while reading so the snapshot matches the log
+ *  position it is labelled with.  The file is written under a temporary
+ *  name and renamed into place.
+ *
+ *  returns:  number of students in the snapshot, or ERR_DB_FILE
+ */
+static int column_build(int fd, const char *path)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    col_build_t b = { 0 };
+    col_hdr_t hdr;
+    char tmp[PATH_MAX];
+    int rc = NO_ERROR;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = COL_MAGIC;
+    hdr.version = COL_VERSION;
+
+    if (ctx != NULL && db_ctx_lock_all(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (ctx != NULL)
+        rc = db_ctx_refresh(ctx);
+    if (rc == NO_ERROR)
+        rc = db_stamp_get(fd, &hdr.stamp);
+    if (rc == NO_ERROR && ctx != NULL && ctx->wal != NULL)
+        hdr.lsn = ctx->wal->next_lsn;
+    if (rc == NO_ERROR)
+        rc = scan_live(fd, build_cb, &b);
+    if (ctx != NULL)
+        db_ctx_unlock_all(ctx);
+    if (rc != NO_ERROR) {
+        free(b.rows);
+        return ERR_DB_FILE;
+    }
+
+    hdr.n = b.n;
+    hdr.off_id = COL_HDR_SIZE;
+    hdr.off_gpa = col_align(hdr.off_id + b.n * sizeof(int32_t));
+    hdr.off_fname = col_align(hdr.off_gpa + b.n * sizeof(int32_t));
+    hdr.off_lname = col_align(hdr.off_fname + b.n * sizeof(uint32_t));
+    hdr.off_fdict = col_align(hdr.off_lname + b.n * sizeof(uint32_t));
+
+    // dictionaries are at most n entries each, the image is sized for that
+    size_t cap = col_align(hdr.off_fdict + b.n * COL_NAME_SIZE) + b.n * COL_NAME_SIZE;
+    char *img = calloc(1, cap);
+    uint32_t *order = malloc((b.n ? b.n : 1) * sizeof(uint32_t));
+    if (img == NULL || order == NULL) {
+        free(img);
+        free(order);
+        free(b.rows);
+        return ERR_DB_FILE;
+    }
+
+    int32_t *ids = (int32_t *)(img + hdr.off_id);
+    int32_t *gpas = (int32_t *)(img + hdr.off_gpa);
+    for (size_t i = 0; i < b.n; i++) {
+        ids[i] = b.rows[i].id;
+        gpas[i] = b.rows[i].gpa;
+    }
+    hdr.nfname = encode_names(&b, false, order, (uint32_t *)(img + hdr.off_fname),
+                              img + hdr.off_fdict);
+    hdr.off_ldict = col_align(hdr.off_fdict + (size_t)hdr.nfname * COL_NAME_SIZE);
+    hdr.nlname = encode_names(&b, true, order, (uint32_t *)(img + hdr.off_lname),
+                              img + hdr.off_ldict);
+    memcpy(img, &hdr, sizeof(hdr));
+    size_t len = hdr.off_ldict + (size_t)hdr.nlname * COL_NAME_SIZE;
+
+    free(order);
+    free(b.rows);
+
+    rc = sidecar_path(path, ".tmp", tmp, sizeof(tmp));
+    int out = -1;
+    if (rc == NO_ERROR) {
+        out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (out < 0)
+            rc = ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR && pwrite_all(out, img, len, 0) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (out >= 0 && close(out) == -1)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && io_rename(tmp, path) == -1)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR && out >= 0)
+        unlink(tmp);
+
+    free(img);
+    return (rc == NO_ERROR) ? (int)hdr.n : ERR_DB_FILE;
+}
+
+/*
+ *  column_export
+ *      fd:    database file descriptor
+ *      path:  where to write the snapshot, NULL for the sidecar next to
+ *             the database
+ *
+ *  returns:  number of students written, or ERR_DB_FILE
+ *
+ *  console:  M_DB_SNAPSHOT     snapshot written
+ *            M_ERR_DB_READ     error reading the database or writing
+ */
+int column_export(int fd, const char *path)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    char side[PATH_MAX];
+
+    if (path == NULL) {
+        if (sidecar_path((ctx != NULL) ? ctx->path : DB_FILE, COL_SUFFIX,
+                         side, sizeof(side)) != NO_ERROR) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        path = side;
+    }
+
+    int n = column_build(fd, path);
+    if (n < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    printf(M_DB_SNAPSHOT, n);
+    return n;
+}
+
+//map the snapshot at path, false if it is missing or malformed
+static bool column_map(const char *path, col_snap_t *cs)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) == -1 || st.st_size < COL_HDR_SIZE) {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    cs->map = p;
+    cs->len = st.st_size;
+    memcpy(&cs->hdr, p, sizeof(cs->hdr));
+
+    const col_hdr_t *h = &cs->hdr;
+    size_t col = (size_t)h->n * sizeof(int32_t);
+    if (h->magic != COL_MAGIC || h->version != COL_VERSION ||
+        h->off_id + col > cs->len || h->off_gpa + col > cs->len ||
+        h->off_fname + col > cs->len || h->off_lname + col > cs->len ||
+        h->off_fdict + (size_t)h->nfname * COL_NAME_SIZE > cs->len ||
+        h->off_ldict + (size_t)h->nlname * COL_NAME_SIZE > cs->len) {
+        column_close(cs);
+        return false;
+    }
+
+    const char *base = p;
+    cs->id = (const int32_t *)(base + h->off_id);
+    cs->gpa = (const int32_t *)(base + h->off_gpa);
+    cs->fname = (const uint32_t *)(base + h->off_fname);
+    cs->lname = (const uint32_t *)(base + h->off_lname);
+    cs->fdict = base + h->off_fdict;
+    cs->ldict = base + h->off_ldict;
+    return true;
+}
+
+/*
+ *  column_current
+ *      fd:   database file descriptor
+ *      hdr:  header of a snapshot
+ *
+ *  Without a write-ahead log changes cannot be detected and no snapshot
+ *  is ever current.
+ *
+ *  returns:  true if the database did not change since the snapshot
+ */
+bool column_current(int fd, const col_hdr_t *hdr)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    db_stamp_t stamp;
+
+    return ctx != NULL && ctx->wal != NULL && db_ctx_refresh(ctx) == NO_ERROR &&
+           db_stamp_get(fd, &stamp) == NO_ERROR &&
+           db_stamp_equal(&hdr->stamp, &stamp) && hdr->lsn == ctx->wal->next_lsn;
+}
+
+/*
+ *  column_open
+ *      fd:  database file descriptor
+ *      cs:  receives the mapped snapshot
+ *
+ *  Maps the snapshot sidecar, taking a new snapshot first if there is none
+ *  or it is not current.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int column_open(int fd, col_snap_t *cs)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    char path[PATH_MAX];
+
+    memset(cs, 0, sizeof(*cs));
+    if (sidecar_path((ctx != NULL) ? ctx->path : DB_FILE, COL_SUFFIX,
+                     path, sizeof(path)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (column_map(path, cs)) {
+        if (column_current(fd, &cs->hdr))
+            return NO_ERROR;
+        column_close(cs);
+    }
+
+    if (column_build(fd, path) < 0 || !column_map(path, cs))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+void column_close(col_snap_t *cs)
+{
+    if (cs->map != NULL)
+        munmap(cs->map, cs->len);
+    memset(cs, 0, sizeof(*cs));
+}
+
+#ifdef COL_X86_SIMD
+__attribute__((target("avx2")))
+static void gpa_stats_avx2(const int32_t *v, size_t n, col_stats_t *st, size_t *done)
+{
+    __m256i vmin = _mm256_set1_epi32(INT32_MAX);
+    __m256i vmax = _mm256_set1_epi32(INT32_MIN);
+    int32_t lanes[8];
+    size_t i = 0;
+
+    // gpas are at most MAX_STD_GPA, so 32 bit lanes hold the sum of a
+    // block and are widened once per block
+    while (i + 8 <= n) {
+        size_t end = (n - i > COL_SUM_BLOCK) ? i + COL_SUM_BLOCK : n;
+        __m256i vsum = _mm256_setzero_si256();
+
+        for (; i + 8 <= end; i += 8) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+            vsum = _mm256_add_epi32(vsum, x);
+            vmin = _mm256_min_epi32(vmin, x);
+            vmax = _mm256_max_epi32(vmax, x);
+        }
+        _mm256_storeu_si256((__m256i *)lanes, vsum);
+        for (int k = 0; k < 8; k++)
+            st->sum += lanes[k];
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, vmin);
+    for (int k = 0; k < 8; k++)
+        st->min = (lanes[k] < st->min) ? lanes[k] : st->min;
+    _mm256_storeu_si256((__m256i *)lanes, vmax);
+    for (int k = 0; k < 8; k++)
+        st->max = (lanes[k] > st->max) ? lanes[k] : st->max;
+    *done = i;
+}
+
+__attribute__((target("avx2")))
+static size_t count_codes_avx2(const uint32_t *c, size_t n, uint32_t lo, uint32_t hi,
+                               size_t *done)
+{
+    // lo <= code < hi  is  (code - lo) < (hi - lo)  as unsigned, and AVX2
+    // only compares signed, so both sides get the sign bit flipped
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    const __m256i vlo = _mm256_set1_epi32(lo);
+    const __m256i span = _mm256_set1_epi32((hi - lo) ^ 0x80000000u);
+    __m256i acc = _mm256_setzero_si256();
+    int32_t lanes[8];
+    size_t i = 0;
+    size_t count = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(c + i));
+        x = _mm256_xor_si256(_mm256_sub_epi32(x, vlo), bias);
+        acc = _mm256_sub_epi32(acc, _mm256_cmpgt_epi32(span, x));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    for (int k = 0; k < 8; k++)
+        count += (uint32_t)lanes[k];
+    *done = i;
+    return count;
+}
+#endif
+
+/*
+ *  col_gpa_stats
+ *      gpa:  gpa column
+ *      n:    number of values
+ *      st:   receives count, sum, min and max
+ *
+ *  Reduces the column eight values at a time with AVX2 when the cpu has
+ *  it, the remainder (or everything) is done one value at a time.
+ */
+void col_gpa_stats(const int32_t *gpa, size_t n, col_stats_t *st)
+{
+    size_t i = 0;
+
+    st->n = n;
+    st->sum = 0;
+    st->min = INT32_MAX;
+    st->max = INT32_MIN;
+
+#ifdef COL_X86_SIMD
+    if (col_have_avx2())
+        gpa_stats_avx2(gpa, n, st, &i);
+#endif
+    for (; i < n; i++) {
+        st->sum += gpa[i];
+        if (gpa[i] < st->min)
+            st->min = gpa[i];
+        if (gpa[i] > st->max)
+            st->max = gpa[i];
+    }
+}
+
+/*
+ *  col_gpa_hist
+ *      gpa:      gpa column
+ *      n:        number of values
+ *      width:    bucket width in gpa points
+ *      buckets:  MAX_STD_GPA / width + 1 counters, zeroed here
+ *
+ *  Buckets come from a table indexed by gpa instead of a division per
+ *  value, and four partial histograms keep consecutive increments of the
+ *  same bucket from waiting on each other.  Out of range values are not
+ *  counted.
+ */
+void col_gpa_hist(const int32_t *gpa, size_t n, int width, uint32_t *buckets)
+{
+    int nb = MAX_STD_GPA / width + 1;
+    uint16_t bucket_of[MAX_STD_GPA + 1];
+    uint32_t *part = calloc(4 * (size_t)nb, sizeof(uint32_t));
+    size_t i = 0;
+
+    memset(buckets, 0, nb * sizeof(*buckets));
+    for (int g = MIN_STD_GPA; g <= MAX_STD_GPA; g++)
+        bucket_of[g] = g / width;
+
+#define GPA_OK(g)   ((uint32_t)((g) - MIN_STD_GPA) <= (uint32_t)(MAX_STD_GPA - MIN_STD_GPA))
+    if (part != NULL) {
+        for (; i + 4 <= n; i += 4) {
+            for (int k = 0; k < 4; k++) {
+                if (GPA_OK(gpa[i + k]))
+                    part[k * nb + bucket_of[gpa[i + k]]]++;
+            }
+        }
+        for (int b = 0; b < nb; b++)
+            buckets[b] = part[b] + part[nb + b] + part[2 * nb + b] + part[3 * nb + b];
+        free(part);
+    }
+    for (; i < n; i++) {
+        if (GPA_OK(gpa[i]))
+            buckets[bucket_of[gpa[i]]]++;
+    }
+#undef GPA_OK
+}
+
+/*
+ *  col_count_codes
+ *      codes:   dictionary coded column
+ *      n:       number of values
+ *      lo, hi:  code range [lo, hi)
+ *
+ *  returns:  number of values in the range
+ */
+size_t col_count_codes(const uint32_t *codes, size_t n, uint32_t lo, uint32_t hi)
+{
+    size_t i = 0;
+    size_t count = 0;
+
+    if (hi <= lo)
+        return 0;
+#ifdef COL_X86_SIMD
+    if (col_have_avx2())
+        count = count_codes_avx2(codes, n, lo, hi, &i);
+#endif
+    for (; i < n; i++)
+        count += (codes[i] - lo) < (hi - lo);
+    return count;
+}
+
+//first dictionary entry whose first plen bytes compare >= (or > if after)
+//the prefix; entries are sorted so the matches are [lower, upper)
+static uint32_t dict_bound(const char *dict, uint32_t ndict, const char *prefix,
+                           size_t plen, bool after)
+{
+    uint32_t lo = 0, hi = ndict;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = strncmp(dict + (size_t)mid * COL_NAME_SIZE, prefix, plen);
+        if (c < 0 || (after && c == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ *  aggregate_gpa
+ *      fd:  database file descriptor
+ *
+ *  Prints the number of students and the average, lowest and highest gpa.
+ *
+ *  returns:  number of students, or ERR_DB_FILE
+ *
+ *  console:  M_AGG_GPA         the aggregates
+ *            M_DB_EMPTY        no students
+ *            M_ERR_DB_READ     error reading the database
+ */
+int aggregate_gpa(int fd)
+{
+    col_snap_t cs;
+    col_stats_t st;
+
+    if (column_open(fd, &cs) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    col_gpa_stats(cs.gpa, cs.hdr.n, &st);
+    column_close(&cs);
+
+    if (st.n == 0) {
+        printf(M_DB_EMPTY);
+        return 0;
+    }
+    printf(M_AGG_GPA, st.n, st.sum / 100.0 / st.n, st.min / 100.0, st.max / 100.0);
+    return st.n;
+}
+
+/*
+ *  aggregate_hist
+ *      fd:     database file descriptor
+ *      width:  bucket width in gpa points, 1 to MAX_STD_GPA
+ *
+ *  Prints how many students fall in each gpa bucket.
+ *
+ *  returns:  number of students, or ERR_DB_FILE
+ *
+ *  console:  M_AGG_HIST        one line per bucket
+ *            M_DB_EMPTY        no students
+ *            M_ERR_DB_READ     error reading the database
+ */
+int aggregate_hist(int fd, int width)
+{
+    col_snap_t cs;
+    uint32_t buckets[MAX_STD_GPA + 1];
+
+    if (column_open(fd, &cs) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    int n = cs.hdr.n;
+    col_gpa_hist(cs.gpa, n, width, buckets);
+    column_close(&cs);
+
+    if (n == 0) {
+        printf(M_DB_EMPTY);
+        return 0;
+    }
+    for (int b = 0; b <= MAX_STD_GPA / width; b++) {
+        int lo = b * width;
+        int hi = (lo + width - 1 < MAX_STD_GPA) ? lo + width - 1 : MAX_STD_GPA;
+        printf(M_AGG_HIST, lo / 100.0, hi / 100.0, buckets[b]);
+    }
+    return n;
+}
+
+/*
+ *  aggregate_prefix
+ *      fd:      database file descriptor
+ *      prefix:  start of a last name, case sensitive
+ *
+ *  Counts the students whose last name starts with prefix.  The prefix
+ *  selects a range of the sorted lname dictionary, then the lname column
+ *  is counted against that range.
+ *
+ *  returns:  number of matching students, or ERR_DB_FILE
+ *
+ *  console:  M_AGG_PREFIX      the count
+ *            M_ERR_DB_READ     error reading the database
+ */
+int aggregate_prefix(int fd, const char *prefix)
+{
+    col_snap_t cs;
+    size_t plen = strlen(prefix);
+    size_t count = 0;
+
+    if (column_open(fd, &cs) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (plen < COL_NAME_SIZE) {
+        uint32_t lo = dict_bound(cs.ldict, cs.hdr.nlname, prefix, plen, false);
+        uint32_t hi = dict_bound(cs.ldict, cs.hdr.nlname, prefix, plen, true);
+        count = col_count_codes(cs.lname, cs.hdr.n, lo, hi);
+    }
+    column_close(&cs);
+
+    printf(M_AGG_PREFIX, (int)count, prefix);
+    return count;
+}
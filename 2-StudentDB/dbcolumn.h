@@ -0,0 +1,87 @@
+#ifndef __DBCOLUMN_H__
+    #define __DBCOLUMN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "db.h"
+#include "dbctx.h"
+
+//Columnar snapshot of the database for aggregate queries.  Instead of one
+//64 byte row per student the snapshot stores each field as its own array,
+//in id order:
+//
+//    [ header | id[n] | gpa[n] | fname code[n] | lname code[n] |
+//      fname dictionary | lname dictionary ]
+//
+//Names are dictionary encoded: every distinct name is stored once in a
+//sorted array of COL_NAME_SIZE byte entries and the column holds its
+//position.  Because the dictionary is sorted all names sharing a prefix
+//form one range of codes, so counting a prefix is a range test over the
+//code column.  Every section starts on a 64 byte boundary.
+//
+//sdbsc -s writes a snapshot on request.  The aggregate queries (-q) keep
+//one next to the database (student.db.col) and rebuild it when the
+//database changed since it was taken, which is detected with the file
+//stamp and the write-ahead log position.
+#define COL_SUFFIX          ".col"
+#define COL_MAGIC           0x4c4f4353      // "SCOL"
+#define COL_VERSION         2
+#define COL_HDR_SIZE        128
+#define COL_NAME_SIZE       32              // dictionary entry, fits lname
+#define COL_ALIGN           64
+#define COL_HIST_WIDTH      50              // default histogram bucket, 0.50
+#define COL_SUM_BLOCK       (64 * 1024)     // values summed in 32 bit lanes
+
+typedef struct col_hdr {
+    uint32_t magic;
+    uint32_t version;
+    db_stamp_t stamp;       // database file the snapshot was taken from
+    uint64_t lsn;           // write-ahead log position, 0 if no log
+    uint32_t n;             // students
+    uint32_t nfname;        // dictionary entries
+    uint32_t nlname;
+    uint32_t pad0;
+    uint64_t off_id;        // section offsets in the file
+    uint64_t off_gpa;
+    uint64_t off_fname;
+    uint64_t off_lname;
+    uint64_t off_fdict;
+    uint64_t off_ldict;
+    char pad[COL_HDR_SIZE - 112];
+} col_hdr_t;
+
+//a snapshot mapped read only
+typedef struct col_snap {
+    void *map;
+    size_t len;
+    col_hdr_t hdr;
+    const int32_t *id;
+    const int32_t *gpa;
+    const uint32_t *fname;
+    const uint32_t *lname;
+    const char *fdict;      // hdr.nfname entries of COL_NAME_SIZE bytes
+    const char *ldict;
+} col_snap_t;
+
+typedef struct col_stats {
+    uint32_t n;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+} col_stats_t;
+
+//prototypes
+int column_export(int fd, const char *path);
+bool column_current(int fd, const col_hdr_t *hdr);
+int column_open(int fd, col_snap_t *cs);
+void column_close(col_snap_t *cs);
+void col_gpa_stats(const int32_t *gpa, size_t n, col_stats_t *st);
+void col_gpa_hist(const int32_t *gpa, size_t n, int width, uint32_t *buckets);
+size_t col_count_codes(const uint32_t *codes, size_t n, uint32_t lo, uint32_t hi);
+int aggregate_gpa(int fd);
+int aggregate_hist(int fd, int width);
+int aggregate_prefix(int fd, const char *prefix);
+
+#endif
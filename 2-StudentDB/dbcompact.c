@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbscan.h"
+#include "dbbitmap.h"
+#include "dbcompact.h"
+#include "dblock.h"
+#include "dbpool.h"
+#include "dbiostat.h"
+
+_Static_assert(COMPACT_PAGE_SIZE % sizeof(student_t) == 0,
+               "a page must hold whole records");
+_Static_assert(COMPACT_PAGE_RECORDS == 64,
+               "one bitmap word must describe one page");
+
+//true if page holds no valid student, from the bitmap when there is one
+static int page_empty(db_ctx_t *ctx, int fd, off_t page, bool *empty)
+{
+    if (ctx != NULL && ctx->bitmap != NULL) {
+        *empty = bitmap_page_empty(ctx->bitmap, page);
+        return NO_ERROR;
+    }
+
+    student_t recs[COMPACT_PAGE_RECORDS];
+    ssize_t n = io_pread(fd, recs, sizeof(recs), page * COMPACT_PAGE_SIZE);
+    if (n < 0)
+        return ERR_DB_FILE;
+    *empty = count_nonempty(recs, n / STUDENT_RECORD_SIZE) == 0;
+    return NO_ERROR;
+}
+
+static int compact_extents(db_ctx_t *ctx, int fd, compact_state_t *cs, int max_extents);
+static int truncate_tail(db_ctx_t *ctx, int fd, compact_state_t *cs);
+
+//give the pages [first, first + n) back to the filesystem
+static int punch_pages(int fd, off_t first, off_t n)
+{
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  first * COMPACT_PAGE_SIZE, n * COMPACT_PAGE_SIZE) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  compact_step
+ *      ctx:          database context, may be NULL
+ *      fd:           database file descriptor
+ *      cs:           compaction state, zero it before the first step
+ *      max_extents:  number of data extents to look at in this step
+ *
+ *  Walks the allocated extents of the database (holes are skipped with
+ *  SEEK_DATA and SEEK_HOLE) starting at cs->cursor and punches every run
+ *  of whole pages that hold no valid student.  Only pages that lie
+ *  completely inside the file are punched, the end of the file is left to
+ *  compact_tail().  Every stripe is locked for the duration of the step so
+ *  no other process fills a page between the check and the punch.
+ *
+ *  returns:  1 if there is more work, 0 when the whole file was visited,
+ *            ERR_DB_FILE on an I/O error.  errno is EOPNOTSUPP when the
+ *            filesystem cannot punch holes.
+ */
+int compact_step(db_ctx_t *ctx, int fd, compact_state_t *cs, int max_extents)
+{
+    int rc;
+
+    if (ctx == NULL)
+        return compact_extents(NULL, fd, cs, max_extents);
+
+    if (db_ctx_lock_all(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = db_ctx_refresh(ctx);
+    if (rc == NO_ERROR)
+        rc = compact_extents(ctx, fd, cs, max_extents);
+    // punching changes the file times, the sidecars must follow
+    if (rc >= 0 && db_ctx_stamp(ctx) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    db_ctx_unlock_all(ctx);
+    return rc;
+}
+
+static int compact_extents(db_ctx_t *ctx, int fd, compact_state_t *cs, int max_extents)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    off_t last_page = st.st_size / COMPACT_PAGE_SIZE;    // first partial page
+
+    for (int e = 0; e < max_extents; e++) {
+        off_t data = io_lseek(fd, cs->cursor, SEEK_DATA);
+        if (data == -1)
+            return errno == ENXIO ? 0 : ERR_DB_FILE;
+        off_t hole = io_lseek(fd, data, SEEK_HOLE);
+        if (hole == -1)
+            return ERR_DB_FILE;
+
+        off_t first = data / COMPACT_PAGE_SIZE;
+        off_t end = (hole + COMPACT_PAGE_SIZE - 1) / COMPACT_PAGE_SIZE;
+        if (end > last_page)
+            end = last_page;
+
+        off_t run = -1;
+        for (off_t page = first; page <= end; page++) {
+            bool empty = false;
+            if (page < end && page_empty(ctx, fd, page, &empty) != NO_ERROR)
+                return ERR_DB_FILE;
+
+            if (empty && run < 0) {
+                run = page;
+            } else if (!empty && run >= 0) {
+                if (punch_pages(fd, run, page - run) != NO_ERROR)
+                    return ERR_DB_FILE;
+                cs->pages_freed += page - run;
+                run = -1;
+            }
+        }
+
+        cs->cursor = hole;
+        if (hole >= st.st_size)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ *  compact_tail
+ *      ctx:  database context, may be NULL
+ *      fd:   database file descriptor
+ *      cs:   compaction state, tail_freed is updated
+ *
+ *  Truncates the database right after the last valid student.  The new
+ *  file size is recorded in the sidecars.  Runs with every stripe and the
+ *  meta lock held since the file size is shared by all ids.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int compact_tail(db_ctx_t *ctx, int fd, compact_state_t *cs)
+{
+    int rc;
+
+    if (ctx == NULL)
+        return truncate_tail(NULL, fd, cs);
+
+    if (db_ctx_lock_all(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_ctx_lock_meta(ctx) != NO_ERROR) {
+        db_ctx_unlock_all(ctx);
+        return ERR_DB_FILE;
+    }
+    rc = truncate_tail(ctx, fd, cs);
+    db_ctx_unlock_meta(ctx, true);
+    db_ctx_unlock_all(ctx);
+    return rc;
+}
+
+static int truncate_tail(db_ctx_t *ctx, int fd, compact_state_t *cs)
+{
+    struct stat st;
+    int64_t last = -1;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    if (ctx != NULL && ctx->bitmap != NULL) {
+        last = bitmap_last(ctx->bitmap);
+    } else {
+        // no bitmap, read back from the end of the file one page at a time
+        student_t recs[COMPACT_PAGE_RECORDS];
+        off_t page = (st.st_size - 1) / COMPACT_PAGE_SIZE;
+        for (; page >= 0 && last < 0; page--) {
+            ssize_t n = io_pread(fd, recs, sizeof(recs), page * COMPACT_PAGE_SIZE);
+            if (n < 0)
+                return ERR_DB_FILE;
+            for (int i = n / STUDENT_RECORD_SIZE - 1; i >= 0; i--) {
+                if (!record_is_empty(&recs[i])) {
+                    last = page * COMPACT_PAGE_RECORDS + i;
+                    break;
+                }
+            }
+        }
+    }
+
+    off_t size = (off_t)(last + 1) * STUDENT_RECORD_SIZE;
+    if (size >= st.st_size)
+        return NO_ERROR;
+    if (ftruncate(fd, size) == -1)
+        return ERR_DB_FILE;
+    cs->tail_freed += st.st_size - size;
+    if (ctx != NULL && ctx->pool != NULL)
+        pool_truncate(ctx->pool, size);
+
+    if (ctx != NULL)
+        return db_ctx_stamp(ctx);
+    return NO_ERROR;
+}
+
+/*
+ *  compact_db
+ *      fd:  database file descriptor
+ *      cs:  receives what was freed
+ *
+ *  Runs compact_step() over the whole file and then compact_tail().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE (errno is EOPNOTSUPP when the
+ *            filesystem cannot punch holes)
+ */
+int compact_db(int fd, compact_state_t *cs)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int rc;
+
+    memset(cs, 0, sizeof(*cs));
+    do {
+        rc = compact_step(ctx, fd, cs, COMPACT_STEP_EXTENTS);
+    } while (rc > 0);
+
+    if (rc != NO_ERROR)
+        return rc;
+    return compact_tail(ctx, fd, cs);
+}
+
+/*
+ *  compact_page
+ *      ctx:  database context
+ *      id:   id of a student that was just deleted
+ *
+ *  Frees the page that held the student if no valid student is left in
+ *  it.  Needs the occupancy bitmap, without it nothing is done.  Called
+ *  with the stripe of id held, see apply_student().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int compact_page(db_ctx_t *ctx, int id)
+{
+    struct stat st;
+    off_t page = id / COMPACT_PAGE_RECORDS;
+
+    if (ctx->bitmap == NULL || !bitmap_page_empty(ctx->bitmap, page))
+        return NO_ERROR;
+    if (fstat(ctx->fd, &st) == -1)
+        return ERR_DB_FILE;
+    if ((page + 1) * COMPACT_PAGE_SIZE > st.st_size)
+        return NO_ERROR;    // partial last page, left to compact_tail()
+
+    // the punch changes the page like a write, cached copies must notice
+    if (ctx->lock != NULL)
+        lock_write_begin(ctx->lock, id);
+    int rc = punch_pages(ctx->fd, page, 1);
+    if (ctx->lock != NULL)
+        lock_write_end(ctx->lock, id);
+    if (rc != NO_ERROR)
+        return (errno == EOPNOTSUPP) ? NO_ERROR : ERR_DB_FILE;
+
+    // the cached page is all empty slots too, writing it back would only
+    // allocate the punched blocks again
+    if (ctx->pool != NULL)
+        pool_discard(ctx->pool, page);
+    return db_ctx_stamp(ctx);
+}
@@ -0,0 +1,38 @@
+#ifndef __DBCOMPACT_H__
+    #define __DBCOMPACT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "db.h"
+#include "dbctx.h"
+
+//Online compaction.  Instead of copying the database into a new file, the
+//4K pages that no longer hold any valid student are handed back to the
+//filesystem with fallocate(FALLOC_FL_PUNCH_HOLE), and empty records at the
+//end of the file are cut off with ftruncate().  A punched page reads back
+//as zeros, which is exactly what an empty record looks like, so readers and
+//writers never see the difference and the database can stay in use while
+//compaction runs.
+//
+//The work is split into steps of at most a few data extents so a caller
+//that serves requests (see compact_step()) can interleave it with other
+//work.  del_student() also frees the page of the deleted student right
+//away when it was the last one in that page.
+#define COMPACT_PAGE_SIZE       4096
+#define COMPACT_PAGE_RECORDS    (COMPACT_PAGE_SIZE / (int)sizeof(student_t))
+#define COMPACT_STEP_EXTENTS    8
+
+typedef struct compact_state {
+    off_t cursor;           // where the next step starts, 0 when starting
+    int64_t pages_freed;    // pages punched so far
+    int64_t tail_freed;     // bytes cut off the end of the file
+} compact_state_t;
+
+//prototypes
+int compact_step(db_ctx_t *ctx, int fd, compact_state_t *cs, int max_extents);
+int compact_tail(db_ctx_t *ctx, int fd, compact_state_t *cs);
+int compact_db(int fd, compact_state_t *cs);
+int compact_page(db_ctx_t *ctx, int id);
+
+#endif
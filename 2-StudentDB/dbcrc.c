@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbcrc.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(crc_hdr_t) == CRC_HDR_SIZE, "crc header size");
+_Static_assert(CRC_VERIFY_CHUNK % CRC_PAGE_SIZE == 0, "verify chunks must be whole pages");
+
+static uint32_t crc_table[8][256];
+static uint32_t zero_page_crc;
+static bool crc_hw;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+//byte at a time for the ends, eight bytes through eight tables in between
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        w ^= crc;
+        crc = crc_table[7][w & 0xff] ^ crc_table[6][(w >> 8) & 0xff] ^
+              crc_table[5][(w >> 16) & 0xff] ^ crc_table[4][(w >> 24) & 0xff] ^
+              crc_table[3][(w >> 32) & 0xff] ^ crc_table[2][(w >> 40) & 0xff] ^
+              crc_table[1][(w >> 48) & 0xff] ^ crc_table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c = crc;
+
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        c = __builtin_ia32_crc32di(c, w);
+        p += 8;
+        len -= 8;
+    }
+    crc = c;
+    while (len--)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
+
+static void crc_init(void)
+{
+    static const unsigned char zeros[CRC_PAGE_SIZE];
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; t++) {
+        for (int i = 0; i < 256; i++)
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+    }
+#if defined(__x86_64__)
+    crc_hw = __builtin_cpu_supports("sse4.2");
+#endif
+    zero_page_crc = ~crc32c_sw(~0U, zeros, sizeof(zeros));
+}
+
+/*
+ *  crc32c
+ *      crc:  running crc, 0 to start
+ *      buf:  data to checksum
+ *      len:  number of bytes in buf
+ *
+ *  CRC-32C (Castagnoli polynomial), with the crc32 instruction when the
+ *  CPU has SSE4.2.
+ *
+ *  returns:  the updated crc
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&crc_once, crc_init);
+#if defined(__x86_64__)
+    if (crc_hw)
+        return ~crc32c_hw(~crc, buf, len);
+#endif
+    return ~crc32c_sw(~crc, buf, len);
+}
+
+//the value stored for a page, 0 for a page of zeros
+static uint32_t page_sum(const void *page)
+{
+    return crc32c(0, page, CRC_PAGE_SIZE) ^ zero_page_crc;
+}
+
+//read pages [first, first + n), zero filled past the end of the file
+static int read_pages(int fd, char *buf, int64_t first, int n)
+{
+    size_t len = (size_t)n * CRC_PAGE_SIZE;
+    ssize_t got = io_pread(fd, buf, len, first * CRC_PAGE_SIZE);
+
+    if (got < 0)
+        return ERR_DB_FILE;
+    memset(buf + got, 0, len - got);
+    return NO_ERROR;
+}
+
+//read the entries of pages [first, first + n), a hole or a short sidecar
+//reads as zero pages
+static int read_sums(int cfd, uint32_t *sums, int64_t first, int n)
+{
+    size_t len = (size_t)n * sizeof(uint32_t);
+    ssize_t got = io_pread(cfd, sums, len, CRC_HDR_SIZE + first * (off_t)sizeof(uint32_t));
+
+    if (got < 0)
+        return ERR_DB_FILE;
+    memset((char *)sums + got, 0, len - got);
+    return NO_ERROR;
+}
+
+static int crc_write_hdr(db_crc_t *cs)
+{
+    return pwrite_all(cs->fd, &cs->hdr, sizeof(cs->hdr), 0);
+}
+
+static int crc_load(db_crc_t *cs, const db_stamp_t *stamp)
+{
+    if (io_pread(cs->fd, &cs->hdr, sizeof(cs->hdr), 0) != sizeof(cs->hdr))
+        return ERR_DB_FILE;
+    if (cs->hdr.magic != CRC_MAGIC || cs->hdr.version != CRC_VERSION ||
+        cs->hdr.page_size != CRC_PAGE_SIZE)
+        return ERR_DB_FILE;
+    // a rewrite behind our back is what the checksums are there to catch,
+    // only a different or resized file makes them stale
+    if (!db_stamp_same_file(&cs->hdr.stamp, stamp))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+//recreate the sidecar from the database file, a fresh database has no
+//pages to checksum
+static int crc_rebuild(db_crc_t *cs, int dbfd, const db_stamp_t *stamp, bool fresh)
+{
+    int64_t npages = (stamp->size + CRC_PAGE_SIZE - 1) / CRC_PAGE_SIZE;
+    int per_chunk = CRC_VERIFY_CHUNK / CRC_PAGE_SIZE;
+    int rc = NO_ERROR;
+
+    memset(&cs->hdr, 0, sizeof(cs->hdr));
+    cs->hdr.magic = CRC_MAGIC;
+    cs->hdr.version = CRC_VERSION;
+    cs->hdr.stamp = *stamp;
+    cs->hdr.page_size = CRC_PAGE_SIZE;
+    cs->rebuilt = !fresh;
+    if (ftruncate(cs->fd, 0) == -1)
+        return ERR_DB_FILE;
+
+    char *buf = malloc(CRC_VERIFY_CHUNK);
+    uint32_t *sums = malloc(per_chunk * sizeof(uint32_t));
+    if (buf == NULL || sums == NULL)
+        rc = ERR_DB_FILE;
+    for (int64_t p = 0; !fresh && p < npages && rc == NO_ERROR; p += per_chunk) {
+        int n = (npages - p < per_chunk) ? npages - p : per_chunk;
+        rc = read_pages(dbfd, buf, p, n);
+        for (int i = 0; i < n && rc == NO_ERROR; i++)
+            sums[i] = page_sum(buf + (size_t)i * CRC_PAGE_SIZE);
+        if (rc == NO_ERROR)
+            rc = pwrite_all(cs->fd, sums, n * sizeof(uint32_t),
+                            CRC_HDR_SIZE + p * (off_t)sizeof(uint32_t));
+    }
+    free(buf);
+    free(sums);
+    if (rc != NO_ERROR)
+        return rc;
+    return crc_write_hdr(cs);
+}
+
+/*
+ *  crc_open
+ *      dbpath:  path of the database file
+ *      dbfd:    open file descriptor of the database
+ *      fresh:   true if the database was just created or truncated
+ *
+ *  Opens the checksum sidecar of a database.  If it does not exist, is
+ *  damaged or describes a different database file it is rebuilt from the
+ *  database, and cs->rebuilt is set: there was nothing to check the
+ *  database against.
+ *
+ *  returns:  the sidecar, or NULL if it is not available
+ */
+db_crc_t *crc_open(const char *dbpath, int dbfd, bool fresh)
+{
+    char path[PATH_MAX];
+    db_stamp_t stamp;
+
+    if (sidecar_path(dbpath, CRC_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return NULL;
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return NULL;
+
+    db_crc_t *cs = calloc(1, sizeof(*cs));
+    if (cs == NULL)
+        return NULL;
+
+    cs->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (cs->fd < 0) {
+        free(cs);
+        return NULL;
+    }
+
+    if (!fresh && crc_load(cs, &stamp) == NO_ERROR)
+        return cs;
+
+    if (crc_rebuild(cs, dbfd, &stamp, fresh) != NO_ERROR) {
+        crc_close(cs);
+        return NULL;
+    }
+    return cs;
+}
+
+void crc_close(db_crc_t *cs)
+{
+    if (cs == NULL)
+        return;
+    close(cs->fd);
+    free(cs->pending);
+    free(cs);
+}
+
+/*
+ *  crc_mark
+ *      page:  page of the database that was written
+ *
+ *  Queues the page for crc_update(), which must run once the page is in
+ *  the file (after the page cache is flushed, see db_ctx_flush()).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int crc_mark(db_crc_t *cs, int64_t page)
+{
+    if (cs->npending > 0 && cs->pending[cs->npending - 1] == page)
+        return NO_ERROR;
+    if (cs->npending == cs->cap) {
+        int ncap = cs->cap ? cs->cap * 2 : 64;
+        int64_t *p = realloc(cs->pending, ncap * sizeof(int64_t));
+        if (p == NULL)
+            return ERR_DB_FILE;
+        cs->pending = p;
+        cs->cap = ncap;
+    }
+    cs->pending[cs->npending++] = page;
+    return NO_ERROR;
+}
+
+static int page_cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  crc_update
+ *      dbfd:  database file descriptor
+ *
+ *  Checksums the pages queued by crc_mark() as they are now in the file.
+ *  Called with the stripes of the pages held.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int crc_update(db_crc_t *cs, int dbfd)
+{
+    char page[CRC_PAGE_SIZE];
+    int rc = NO_ERROR;
+
+    qsort(cs->pending, cs->npending, sizeof(int64_t), page_cmp);
+    for (int i = 0; i < cs->npending && rc == NO_ERROR; i++) {
+        if (i > 0 && cs->pending[i] == cs->pending[i - 1])
+            continue;
+        rc = read_pages(dbfd, page, cs->pending[i], 1);
+        if (rc == NO_ERROR) {
+            uint32_t sum = page_sum(page);
+            rc = pwrite_all(cs->fd, &sum, sizeof(sum),
+                            CRC_HDR_SIZE + cs->pending[i] * (off_t)sizeof(sum));
+        }
+    }
+    cs->npending = 0;
+    return rc;
+}
+
+/*
+ *  crc_stamp
+ *      dbfd:  database file descriptor
+ *
+ *  Records the current identity of the database file in the sidecar
+ *  header, same as bitmap_stamp().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int crc_stamp(db_crc_t *cs, int dbfd)
+{
+    db_stamp_t stamp;
+
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_stamp_equal(&stamp, &cs->hdr.stamp))
+        return NO_ERROR;
+    cs->hdr.stamp = stamp;
+    return crc_write_hdr(cs);
+}
+
+//one thread's share of --verify
+struct crc_part {
+    int fd;
+    int cfd;
+    int64_t lo, hi;         // pages checked
+    int64_t *bad;           // pages that failed
+    int nbad;
+    int cap;
+    int rc;
+};
+
+static void *verify_part(void *arg)
+{
+    struct crc_part *p = arg;
+    int per_chunk = CRC_VERIFY_CHUNK / CRC_PAGE_SIZE;
+    char *buf = aligned_alloc(64, CRC_VERIFY_CHUNK);
+    uint32_t *sums = malloc(per_chunk * sizeof(uint32_t));
+
+    p->rc = (buf != NULL && sums != NULL) ? NO_ERROR : ERR_DB_FILE;
+    for (int64_t first = p->lo; first < p->hi && p->rc == NO_ERROR; first += per_chunk) {
+        int n = (p->hi - first < per_chunk) ? p->hi - first : per_chunk;
+        p->rc = read_pages(p->fd, buf, first, n);
+        if (p->rc == NO_ERROR)
+            p->rc = read_sums(p->cfd, sums, first, n);
+        for (int i = 0; i < n && p->rc == NO_ERROR; i++) {
+            if (page_sum(buf + (size_t)i * CRC_PAGE_SIZE) == sums[i])
+                continue;
+            if (p->nbad == p->cap) {
+                int ncap = p->cap ? p->cap * 2 : 64;
+                int64_t *b = realloc(p->bad, ncap * sizeof(int64_t));
+                if (b == NULL) {
+                    p->rc = ERR_DB_FILE;
+                    break;
+                }
+                p->bad = b;
+                p->cap = ncap;
+            }
+            p->bad[p->nbad++] = first + i;
+        }
+    }
+    free(buf);
+    free(sums);
+    return NULL;
+}
+
+//check a page again with no writer in its stripe
+static int recheck_page(db_ctx_t *ctx, int64_t page, bool *bad)
+{
+    char buf[CRC_PAGE_SIZE];
+    uint32_t sum;
+    int rc;
+
+    if (db_ctx_lock_id(ctx, page * CRC_PAGE_RECORDS) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = read_pages(ctx->fd, buf, page, 1);
+    if (rc == NO_ERROR)
+        rc = read_sums(ctx->crc->fd, &sum, page, 1);
+    db_ctx_unlock_id(ctx, page * CRC_PAGE_RECORDS);
+    *bad = (rc == NO_ERROR && page_sum(buf) != sum);
+    return rc;
+}
+
+/*
+ *  crc_verify
+ *      fd:  database file descriptor
+ *
+ *  Checks every page of the database against its checksum, see dbcrc.h.
+ *
+ *  returns:  number of bad pages, or ERR_DB_FILE
+ *
+ *  console:  M_CRC_BAD        for each bad page
+ *            M_CRC_VERIFIED   the number of pages checked and found bad
+ *            M_CRC_REBUILT    the checksums were missing or stale
+ *            M_ERR_CRC        the sidecar is not available
+ *            M_ERR_DB_READ    error reading the database or the sidecar
+ */
+int crc_verify(int fd)
+{
+    struct crc_part parts[CRC_MAX_THREADS];
+    pthread_t tids[CRC_MAX_THREADS];
+    bool started[CRC_MAX_THREADS] = { false };
+    db_ctx_t *ctx = db_ctx_get(fd);
+    struct stat st;
+    int nbad = 0;
+    int rc = NO_ERROR;
+
+    if (ctx == NULL || ctx->crc == NULL) {
+        printf(M_ERR_CRC);
+        return ERR_DB_FILE;
+    }
+    if (ctx->crc->rebuilt) {
+        printf(M_CRC_REBUILT);
+        return 0;
+    }
+    if (fstat(fd, &st) == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    int64_t npages = (st.st_size + CRC_PAGE_SIZE - 1) / CRC_PAGE_SIZE;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = npages / (CRC_VERIFY_CHUNK / CRC_PAGE_SIZE);
+    if (nthreads > ncpu)
+        nthreads = ncpu;
+    if (nthreads > CRC_MAX_THREADS)
+        nthreads = CRC_MAX_THREADS;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    memset(parts, 0, sizeof(parts));
+    for (int i = 0; i < nthreads; i++) {
+        parts[i].fd = fd;
+        parts[i].cfd = ctx->crc->fd;
+        parts[i].lo = npages * i / nthreads;
+        parts[i].hi = npages * (i + 1) / nthreads;
+    }
+    for (int i = 1; i < nthreads; i++)
+        started[i] = (pthread_create(&tids[i], NULL, verify_part, &parts[i]) == 0);
+    verify_part(&parts[0]);
+    for (int i = 1; i < nthreads; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        else
+            verify_part(&parts[i]);
+    }
+
+    // parts are in page order, so are the reports
+    for (int i = 0; i < nthreads && rc == NO_ERROR; i++) {
+        rc = parts[i].rc;
+        for (int k = 0; k < parts[i].nbad && rc == NO_ERROR; k++) {
+            int64_t page = parts[i].bad[k];
+            bool bad;
+            rc = recheck_page(ctx, page, &bad);
+            if (rc != NO_ERROR || !bad)
+                continue;
+            if (nbad++ < CRC_MAX_REPORTED)
+                printf(M_CRC_BAD, (long long)page, (long long)page * CRC_PAGE_RECORDS,
+                       (long long)(page + 1) * CRC_PAGE_RECORDS - 1);
+        }
+    }
+    for (int i = 0; i < nthreads; i++)
+        free(parts[i].bad);
+
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    printf(M_CRC_VERIFIED, (long long)npages, nbad);
+    return nbad;
+}
@@ -0,0 +1,65 @@
+#ifndef __DBCRC_H__
+    #define __DBCRC_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "dbctx.h"
+
+//CRC-32C checksums.  crc32c() uses the SSE4.2 crc32 instruction when the
+//CPU has it and a slicing-by-8 table otherwise; both give the same values,
+//so files written on one machine check out on another.
+//
+//Every 4K page of student.db (the 64 students of one stripe) has a
+//checksum in the student.db.crc sidecar, kept up to date by the same
+//writers that maintain the bitmap (see db_ctx_added()).  A page is
+//checksummed as it reads, zero filled past the end of the file, so
+//punching or truncating empty pages does not change it.  Entries are
+//stored xor the checksum of an all zero page, so a hole in the sidecar
+//stands for a hole in the database and pages that were never written need
+//no entry.
+//
+//sdbsc --verify checks every page against its entry with one thread per
+//CPU (up to CRC_MAX_THREADS), reading CRC_VERIFY_CHUNK bytes at a time, so
+//a large file is verified at the speed it can be read.  A page that fails
+//is read again under its stripe lock before it is reported, a writer may
+//have been between the page and its entry.
+#define CRC_SUFFIX          ".crc"
+#define CRC_MAGIC           0x43524353      // "SCRC"
+#define CRC_VERSION         2
+#define CRC_HDR_SIZE        64
+#define CRC_PAGE_SIZE       4096
+#define CRC_PAGE_RECORDS    (CRC_PAGE_SIZE / (int)sizeof(student_t))
+#define CRC_VERIFY_CHUNK    (1024 * 1024)
+#define CRC_MAX_THREADS     8
+#define CRC_MAX_REPORTED    1000    // bad pages listed, the rest are counted
+
+typedef struct crc_hdr {
+    uint32_t magic;
+    uint32_t version;
+    db_stamp_t stamp;       // database file the checksums describe
+    uint32_t page_size;
+    char pad[CRC_HDR_SIZE - 44];
+} crc_hdr_t;
+
+typedef struct db_crc {
+    int fd;                 // sidecar file descriptor
+    crc_hdr_t hdr;
+    bool rebuilt;           // recomputed from the database when opened
+    int64_t *pending;       // pages written since the last crc_update()
+    int npending;
+    int cap;
+} db_crc_t;
+
+//prototypes
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+db_crc_t *crc_open(const char *dbpath, int dbfd, bool fresh);
+void crc_close(db_crc_t *cs);
+int crc_mark(db_crc_t *cs, int64_t page);
+int crc_update(db_crc_t *cs, int dbfd);
+int crc_stamp(db_crc_t *cs, int dbfd);
+int crc_verify(int fd);
+
+#endif
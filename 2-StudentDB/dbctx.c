@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbindex.h"
+#include "dbwal.h"
+#include "dblock.h"
+#include "dbpool.h"
+#include "dbmvcc.h"
+#include "dbcrc.h"
+#include "dbiostat.h"
+
+static db_ctx_t db_ctxs[MAX_OPEN_DBS];
+static bool db_ctxs_ready = false;
+
+static void db_ctx_init_table(void)
+{
+    if (db_ctxs_ready)
+        return;
+    for (int i = 0; i < MAX_OPEN_DBS; i++)
+        db_ctxs[i].fd = -1;
+    db_ctxs_ready = true;
+}
+
+/*
+ *  db_ctx_new
+ *      fd:     database file descriptor returned by open()
+ *      path:   path the database was opened with
+ *      fresh:  true if the database file was just created or truncated, in
+ *              which case any existing sidecar files are reset
+ *
+ *  Creates the context for an open database and loads its sidecar state,
+ *  the occupancy bitmap and the secondary indexes, then replays the
+ *  write-ahead log over the database and the sidecars if no other process
+ *  has the database open.  Sidecars that cannot be opened are simply left
+ *  out (the pointer stays NULL) and callers fall back to working on the
+ *  database file alone.
+ *
+ *  returns:  pointer to the new context, or NULL if the table is full
+ */
+db_ctx_t *db_ctx_new(int fd, const char *path, bool fresh)
+{
+    db_ctx_init_table();
+
+    db_ctx_t *ctx = NULL;
+    for (int i = 0; i < MAX_OPEN_DBS; i++) {
+        if (db_ctxs[i].fd == -1) {
+            ctx = &db_ctxs[i];
+            break;
+        }
+    }
+    if (ctx == NULL)
+        return NULL;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->fd = fd;
+    snprintf(ctx->path, sizeof(ctx->path), "%s", path);
+    ctx->lock = lock_open(path);
+    if (ctx->lock != NULL)
+        lock_meta(ctx->lock);
+
+    ctx->bitmap = bitmap_open(path, fd, fresh);
+    ctx->crc = crc_open(path, fd, fresh);
+    ctx->lname_idx = index_open(path, fd, INDEX_LNAME, fresh);
+    ctx->gpa_idx = index_open(path, fd, INDEX_GPA, fresh);
+    ctx->wal = wal_open(path, fd, fresh);
+
+    // a process that is in the middle of a write has its changes in the
+    // log but not yet in the database, so only replay when alone
+    if (ctx->lock == NULL || lock_alive_exclusive(ctx->lock)) {
+        if (wal_recover(ctx) != NO_ERROR)
+            printf(M_ERR_WAL_RECOVER);
+    }
+
+    if (ctx->lock != NULL) {
+        lock_alive_shared(ctx->lock);
+        if (fresh)
+            lock_gen_bump(ctx->lock);
+        ctx->seen_gen = lock_gen(ctx->lock);
+        unlock_meta(ctx->lock);
+    }
+    return ctx;
+}
+
+/*
+ *  db_ctx_get
+ *      fd:     database file descriptor
+ *
+ *  returns:  the context of the database open on fd, or NULL if fd was not
+ *            opened through open_db()
+ */
+db_ctx_t *db_ctx_get(int fd)
+{
+    if (fd < 0 || !db_ctxs_ready)
+        return NULL;
+    for (int i = 0; i < MAX_OPEN_DBS; i++) {
+        if (db_ctxs[i].fd == fd)
+            return &db_ctxs[i];
+    }
+    return NULL;
+}
+
+/*
+ *  db_ctx_rebind
+ *      ctx:    an existing context
+ *      newfd:  file descriptor now used for the same logical database
+ *
+ *  Used when the database file is replaced, for example by compress_db(),
+ *  and the data it holds is unchanged so the sidecar state is still valid.
+ *  The write-ahead log must have been checkpointed before the file was
+ *  replaced, it is restarted for the new file.
+ */
+void db_ctx_rebind(db_ctx_t *ctx, int newfd)
+{
+    ctx->fd = newfd;
+    db_ctx_stamp(ctx);
+    if (ctx->wal != NULL)
+        wal_reset(ctx->wal, newfd);
+    if (ctx->pool != NULL) {
+        pool_truncate(ctx->pool, 0);
+        ctx->pool->fd = newfd;
+    }
+}
+
+/*
+ *  db_ctx_free
+ *      fd:     database file descriptor
+ *
+ *  Releases the context (and closes the sidecars) of the database open on
+ *  fd.  Does not close fd itself.
+ */
+void db_ctx_free(int fd)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    if (ctx == NULL)
+        return;
+
+    if (ctx->bitmap != NULL)
+        bitmap_close(ctx->bitmap);
+    crc_close(ctx->crc);
+    index_close(ctx->lname_idx);
+    index_close(ctx->gpa_idx);
+    wal_close(ctx->wal);
+    pool_destroy(ctx->pool);
+    if (ctx->mvcc != NULL) {
+        mvcc_close(ctx->mvcc);
+        free(ctx->mvcc);
+    }
+    lock_close(ctx->lock);
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->fd = -1;
+}
+
+//checksum the pages written since the last call, unless they are still
+//waiting in the page cache, db_ctx_flush() does it then
+static int db_ctx_checksum(db_ctx_t *ctx)
+{
+    if (ctx->crc == NULL || ctx->pool != NULL)
+        return NO_ERROR;
+    return crc_update(ctx->crc, ctx->fd);
+}
+
+/*
+ *  db_ctx_added
+ *      ctx:   database context
+ *      recs:  students that were just written to the database
+ *      n:     number of students in recs
+ *
+ *  Brings the sidecar state up to date after students were added: sets
+ *  their bits in the occupancy bitmap, appends them to the secondary
+ *  indexes, checksums their pages and records the new identity of the
+ *  database file.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE on a sidecar I/O error
+ */
+int db_ctx_added(db_ctx_t *ctx, const student_t *recs, int n)
+{
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < n && ctx->crc != NULL && rc == NO_ERROR; i++)
+        rc = crc_mark(ctx->crc, recs[i].id / CRC_PAGE_RECORDS);
+    if (rc == NO_ERROR)
+        rc = db_ctx_checksum(ctx);
+
+    if (rc == NO_ERROR && ctx->bitmap != NULL) {
+        if (n == 1)
+            rc = bitmap_set(ctx->bitmap, recs[0].id, true);
+        else
+            rc = bitmap_set_bulk(ctx->bitmap, recs, n);
+    }
+    if (rc == NO_ERROR && ctx->lname_idx != NULL)
+        rc = index_add(ctx->lname_idx, recs, n);
+    if (rc == NO_ERROR && ctx->gpa_idx != NULL)
+        rc = index_add(ctx->gpa_idx, recs, n);
+    if (rc == NO_ERROR)
+        rc = db_ctx_stamp(ctx);
+    return rc;
+}
+
+/*
+ *  db_ctx_deleted
+ *      ctx:  database context
+ *      id:   id of the student that was just deleted
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE on a sidecar I/O error
+ */
+int db_ctx_deleted(db_ctx_t *ctx, int id)
+{
+    int rc = NO_ERROR;
+
+    if (ctx->crc != NULL)
+        rc = crc_mark(ctx->crc, id / CRC_PAGE_RECORDS);
+    if (rc == NO_ERROR)
+        rc = db_ctx_checksum(ctx);
+
+    if (rc == NO_ERROR && ctx->bitmap != NULL)
+        rc = bitmap_set(ctx->bitmap, id, false);
+    if (rc == NO_ERROR && ctx->lname_idx != NULL)
+        rc = index_del(ctx->lname_idx, id);
+    if (rc == NO_ERROR && ctx->gpa_idx != NULL)
+        rc = index_del(ctx->gpa_idx, id);
+    if (rc == NO_ERROR)
+        rc = db_ctx_stamp(ctx);
+    return rc;
+}
+
+/*
+ *  db_ctx_stamp
+ *      ctx:  database context
+ *
+ *  Records the current identity of the database file in every sidecar.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE on a sidecar I/O error
+ */
+int db_ctx_stamp(db_ctx_t *ctx)
+{
+    int rc = NO_ERROR;
+
+    if (ctx->bitmap != NULL)
+        rc = bitmap_stamp(ctx->bitmap, ctx->fd);
+    if (rc == NO_ERROR && ctx->crc != NULL)
+        rc = crc_stamp(ctx->crc, ctx->fd);
+    if (rc == NO_ERROR && ctx->lname_idx != NULL)
+        rc = index_stamp(ctx->lname_idx, ctx->fd);
+    if (rc == NO_ERROR && ctx->gpa_idx != NULL)
+        rc = index_stamp(ctx->gpa_idx, ctx->fd);
+    return rc;
+}
+
+/*
+ *  db_ctx_log
+ *      ctx:  database context
+ *      id:   slot about to be written
+ *      s:    image the slot will hold, NULL when the student is deleted
+ *
+ *  Logs a change in the write-ahead log before it is made to the database.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the change could not be logged
+ */
+int db_ctx_log(db_ctx_t *ctx, int id, const student_t *s)
+{
+    if (ctx->wal == NULL)
+        return NO_ERROR;
+    return wal_log(ctx->wal, id, s);
+}
+
+/*
+ *  db_ctx_sync
+ *      ctx:  database context
+ *
+ *  Makes the database file and every sidecar durable.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_sync(db_ctx_t *ctx)
+{
+    if (io_fdatasync(ctx->fd) == -1)
+        return ERR_DB_FILE;
+    if (ctx->bitmap != NULL && io_fdatasync(ctx->bitmap->fd) == -1)
+        return ERR_DB_FILE;
+    if (ctx->crc != NULL && io_fdatasync(ctx->crc->fd) == -1)
+        return ERR_DB_FILE;
+    if (ctx->lname_idx != NULL && io_fdatasync(ctx->lname_idx->fd) == -1)
+        return ERR_DB_FILE;
+    if (ctx->gpa_idx != NULL && io_fdatasync(ctx->gpa_idx->fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  db_ctx_flush
+ *      ctx:  database context
+ *
+ *  Writes the pages changed in the page cache back to the database,
+ *  checksums them and records the identity of the file, which may have grown, in every
+ *  sidecar.  Called by writers before they release their stripe locks.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_flush(db_ctx_t *ctx)
+{
+    if (ctx->pool == NULL)
+        return NO_ERROR;
+    if (pool_flush(ctx->pool) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (ctx->crc != NULL && crc_update(ctx->crc, ctx->fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    return db_ctx_stamp(ctx);
+}
+
+//reload the cached sidecar state after another process changed it
+static int db_ctx_reload(db_ctx_t *ctx)
+{
+    int rc = NO_ERROR;
+
+    if (ctx->bitmap != NULL && bitmap_reload(ctx->bitmap) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (ctx->lname_idx != NULL && index_refresh(ctx->lname_idx, ctx->fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (ctx->gpa_idx != NULL && index_refresh(ctx->gpa_idx, ctx->fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (ctx->wal != NULL && wal_refresh(ctx->wal) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    ctx->seen_gen = lock_gen(ctx->lock);
+    return rc;
+}
+
+/*
+ *  db_ctx_lock_meta
+ *      ctx:  database context
+ *
+ *  Takes the meta lock (see dblock.h) that every update of the database
+ *  file and its sidecars runs under, and reloads the cached sidecar state
+ *  if another process changed it since this process last looked.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_lock_meta(db_ctx_t *ctx)
+{
+    if (ctx->lock == NULL)
+        return NO_ERROR;
+    if (lock_meta(ctx->lock) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (lock_gen(ctx->lock) != ctx->seen_gen && db_ctx_reload(ctx) != NO_ERROR) {
+        unlock_meta(ctx->lock);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_ctx_unlock_meta
+ *      ctx:      database context
+ *      changed:  true if the sidecars were updated, other processes then
+ *                reload them
+ */
+void db_ctx_unlock_meta(db_ctx_t *ctx, bool changed)
+{
+    if (ctx->lock == NULL)
+        return;
+    if (changed)
+        lock_gen_bump(ctx->lock);
+    ctx->seen_gen = lock_gen(ctx->lock);
+    unlock_meta(ctx->lock);
+}
+
+/*
+ *  db_ctx_refresh
+ *      ctx:  database context
+ *
+ *  Makes sure the cached sidecar state (bitmap, indexes, log position) is
+ *  current before it is used to answer a query.  Costs one load from the
+ *  shared lock page when nothing changed.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_refresh(db_ctx_t *ctx)
+{
+    if (ctx->lock == NULL || lock_gen(ctx->lock) == ctx->seen_gen)
+        return NO_ERROR;
+    if (db_ctx_lock_meta(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    db_ctx_unlock_meta(ctx, false);
+    return NO_ERROR;
+}
+
+/*
+ *  db_ctx_lock_id / db_ctx_unlock_id
+ *      ctx:  database context
+ *      id:   student id
+ *
+ *  Lock the stripe of id for a check-then-write sequence such as adding a
+ *  student only if the slot is empty.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_lock_id(db_ctx_t *ctx, int id)
+{
+    if (ctx->lock == NULL)
+        return NO_ERROR;
+    return lock_stripe(ctx->lock, id);
+}
+
+void db_ctx_unlock_id(db_ctx_t *ctx, int id)
+{
+    if (ctx->lock != NULL)
+        unlock_stripe(ctx->lock, id);
+}
+
+/*
+ *  db_ctx_lock_all / db_ctx_unlock_all
+ *      ctx:  database context
+ *
+ *  Lock every stripe, for operations on many ids at once.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_lock_all(db_ctx_t *ctx)
+{
+    if (ctx->lock == NULL)
+        return NO_ERROR;
+    return lock_all_stripes(ctx->lock);
+}
+
+void db_ctx_unlock_all(db_ctx_t *ctx)
+{
+    if (ctx->lock != NULL)
+        unlock_all_stripes(ctx->lock);
+}
+
+/*
+ *  db_ctx_checkpoint
+ *      ctx:    database context
+ *      force:  checkpoint even if the log is small
+ *
+ *  Checkpoints the write-ahead log when it grew past WAL_CHECKPOINT_BYTES,
+ *  or always if force is set.  Every stripe is locked first so no other
+ *  writer is between logging a change and writing it to the database.
+ *  Must be called without holding any lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_checkpoint(db_ctx_t *ctx, bool force)
+{
+    db_wal_t *wal = ctx->wal;
+    int rc;
+
+    if (wal == NULL || (!force && wal->end - WAL_HDR_SIZE < WAL_CHECKPOINT_BYTES))
+        return NO_ERROR;
+
+    if (db_ctx_lock_all(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_ctx_lock_meta(ctx) != NO_ERROR) {
+        db_ctx_unlock_all(ctx);
+        return ERR_DB_FILE;
+    }
+    rc = force ? wal_checkpoint(ctx) : wal_maybe_checkpoint(ctx);
+    db_ctx_unlock_meta(ctx, true);
+    db_ctx_unlock_all(ctx);
+    return rc;
+}
+
+//save every page that holds a student for the open snapshots
+static int db_ctx_preserve_all(db_ctx_t *ctx)
+{
+    struct stat st;
+
+    if (ctx->lock == NULL || lock_snap_max(ctx->lock) == 0)
+        return NO_ERROR;
+    if (fstat(ctx->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    int64_t npages = (st.st_size + MVCC_PAGE_SIZE - 1) / MVCC_PAGE_SIZE;
+    for (int64_t p = 0; p < npages; p++) {
+        if (ctx->bitmap != NULL) {
+            int64_t id = bitmap_next(ctx->bitmap, p * MVCC_PAGE_RECORDS);
+            if (id < 0)
+                break;
+            p = id / MVCC_PAGE_RECORDS;
+            if (p >= npages)
+                break;
+        }
+        if (mvcc_preserve(ctx, p) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_ctx_zero
+ *      ctx:  database context
+ *
+ *  Removes every student: the database is truncated to nothing and its
+ *  sidecars start over empty.  Every stripe and the meta lock are held
+ *  throughout, and the pages an open snapshot still reads are saved as
+ *  versions first, so scans in other processes keep their view.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_ctx_zero(db_ctx_t *ctx)
+{
+    int rc;
+
+    if (db_ctx_lock_all(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_ctx_lock_meta(ctx) != NO_ERROR) {
+        db_ctx_unlock_all(ctx);
+        return ERR_DB_FILE;
+    }
+
+    rc = db_ctx_preserve_all(ctx);
+    if (rc == NO_ERROR && ftruncate(ctx->fd, 0) == -1)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR) {
+        if (ctx->pool != NULL)
+            pool_truncate(ctx->pool, 0);
+        if (ctx->bitmap != NULL)
+            bitmap_close(ctx->bitmap);
+        crc_close(ctx->crc);
+        index_close(ctx->lname_idx);
+        index_close(ctx->gpa_idx);
+        ctx->bitmap = bitmap_open(ctx->path, ctx->fd, true);
+        ctx->crc = crc_open(ctx->path, ctx->fd, true);
+        ctx->lname_idx = index_open(ctx->path, ctx->fd, INDEX_LNAME, true);
+        ctx->gpa_idx = index_open(ctx->path, ctx->fd, INDEX_GPA, true);
+        if (ctx->wal != NULL)
+            rc = wal_reset(ctx->wal, ctx->fd);
+    }
+
+    db_ctx_unlock_meta(ctx, true);
+    db_ctx_unlock_all(ctx);
+    return rc;
+}
+
+/*
+ *  db_stamp_get
+ *      fd:     database file descriptor
+ *      stamp:  filled in with the identity of the file
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the file cannot be stat'ed
+ */
+int db_stamp_get(int fd, db_stamp_t *stamp)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    stamp->ino = st.st_ino;
+    stamp->size = st.st_size;
+    stamp->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    stamp->ctime_ns = (uint64_t)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+    return NO_ERROR;
+}
+
+//same file and size, whatever was written to it since
+bool db_stamp_same_file(const db_stamp_t *a, const db_stamp_t *b)
+{
+    return a->ino == b->ino && a->size == b->size;
+}
+
+bool db_stamp_equal(const db_stamp_t *a, const db_stamp_t *b)
+{
+    return a->ino == b->ino && a->size == b->size &&
+           a->mtime_ns == b->mtime_ns && a->ctime_ns == b->ctime_ns;
+}
+
+/*
+ *  sidecar_path
+ *      dbpath:  path of the database file
+ *      suffix:  suffix of the sidecar, for example ".bitmap"
+ *      out:     buffer receiving the sidecar path
+ *      len:     size of out
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the path does not fit
+ */
+int sidecar_path(const char *dbpath, const char *suffix, char *out, size_t len)
+{
+    int n = snprintf(out, len, "%s%s", dbpath, suffix);
+
+    if (n < 0 || (size_t)n >= len)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  pwrite_all
+ *      fd, buf, len, off:  as for pwrite()
+ *
+ *  pwrite() that keeps going after short writes and EINTR.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = io_pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return ERR_DB_FILE;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
@@ -0,0 +1,84 @@
+#ifndef __DBCTX_H__
+    #define __DBCTX_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#include "db.h"
+
+//Every database opened with open_db() gets a context that holds the state
+//kept alongside the database file, for example the occupancy bitmap.  The
+//public API in sdbsc.h is based on file descriptors, so contexts are looked
+//up by the fd returned from open_db().  Code must cope with db_ctx_get()
+//returning NULL, for example when it is handed an fd that did not come
+//from open_db(), by falling back to reading the database file directly.
+//
+//Several processes may have the same database open, see dblock.h for the
+//locking rules.  The sidecar state cached in a context is reloaded when
+//another process changed it, which db_ctx_lock_meta() and db_ctx_refresh()
+//take care of.
+#define MAX_OPEN_DBS    64
+
+struct db_bitmap;
+struct db_index;
+struct db_wal;
+struct db_lock;
+struct db_pool;
+struct db_mvcc;
+struct db_crc;
+
+typedef struct db_ctx {
+    int fd;                         // fd of the database file, -1 if unused
+    char path[PATH_MAX];            // path the database was opened with
+    struct db_bitmap *bitmap;       // occupancy bitmap, NULL if unavailable
+    struct db_crc *crc;             // page checksums, NULL if unavailable
+    struct db_index *lname_idx;     // secondary index on lname
+    struct db_index *gpa_idx;       // secondary index on gpa
+    struct db_wal *wal;             // write-ahead log, NULL if unavailable
+    struct db_lock *lock;           // locks shared with other processes
+    struct db_pool *pool;           // page cache, NULL unless enabled
+    struct db_mvcc *mvcc;           // page versions, opened by the first writer
+    uint64_t seen_gen;              // sidecar generation cached in memory
+} db_ctx_t;
+
+//sidecar files store the identity of the database file they describe, so a
+//stale sidecar (db deleted, replaced, extended or rewritten in place behind
+//our back) is detected when it is loaded and rebuilt from the database.
+//Every write through this code is followed by a new stamp (db_ctx_stamp()),
+//so the times only differ from the stamp after a write made elsewhere.
+typedef struct db_stamp {
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;      // st_mtim, catches same size rewrites
+    uint64_t ctime_ns;      // st_ctim, catches a restored st_mtim
+} db_stamp_t;
+
+//prototypes
+db_ctx_t *db_ctx_new(int fd, const char *path, bool fresh);
+db_ctx_t *db_ctx_get(int fd);
+void db_ctx_rebind(db_ctx_t *ctx, int newfd);
+void db_ctx_free(int fd);
+int db_ctx_added(db_ctx_t *ctx, const student_t *recs, int n);
+int db_ctx_deleted(db_ctx_t *ctx, int id);
+int db_ctx_stamp(db_ctx_t *ctx);
+int db_ctx_log(db_ctx_t *ctx, int id, const student_t *s);
+int db_ctx_sync(db_ctx_t *ctx);
+int db_ctx_flush(db_ctx_t *ctx);
+int db_ctx_lock_meta(db_ctx_t *ctx);
+void db_ctx_unlock_meta(db_ctx_t *ctx, bool changed);
+int db_ctx_refresh(db_ctx_t *ctx);
+int db_ctx_lock_id(db_ctx_t *ctx, int id);
+void db_ctx_unlock_id(db_ctx_t *ctx, int id);
+int db_ctx_lock_all(db_ctx_t *ctx);
+void db_ctx_unlock_all(db_ctx_t *ctx);
+int db_ctx_checkpoint(db_ctx_t *ctx, bool force);
+int db_ctx_zero(db_ctx_t *ctx);
+int db_stamp_get(int fd, db_stamp_t *stamp);
+bool db_stamp_equal(const db_stamp_t *a, const db_stamp_t *b);
+bool db_stamp_same_file(const db_stamp_t *a, const db_stamp_t *b);
+int sidecar_path(const char *dbpath, const char *suffix, char *out, size_t len);
+int pwrite_all(int fd, const void *buf, size_t len, off_t off);
+
+#endif
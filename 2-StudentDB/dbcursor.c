@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbscan.h"
+#include "dbcursor.h"
+#include "dbiostat.h"
+
+/*
+ *  db_cursor_open
+ *      fd:      linux file descriptor of the database
+ *      lo_id:   first id of the range
+ *      hi_id:   last id of the range, inclusive
+ *
+ *  Opens a cursor over the students with lo_id <= id <= hi_id, see
+ *  db_cursor_next_batch().  Nothing is read until the first batch.
+ *
+ *  returns:  the cursor, or NULL if the database cant be read or there is
+ *            no memory
+ *
+ *  console:  Does not produce any console I/O
+ */
+db_cursor_t *db_cursor_open(int fd, int lo_id, int hi_id)
+{
+    struct stat st;
+    db_cursor_t *cur;
+
+    if (fstat(fd, &st) == -1)
+        return NULL;
+    cur = calloc(1, sizeof(*cur));
+    if (cur == NULL)
+        return NULL;
+
+    cur->fd = fd;
+    cur->pos = (lo_id > 0) ? (off_t)lo_id * STUDENT_RECORD_SIZE : 0;
+    cur->end = ((off_t)hi_id + 1) * STUDENT_RECORD_SIZE;
+    if (cur->end > st.st_size - st.st_size % STUDENT_RECORD_SIZE)
+        cur->end = st.st_size - st.st_size % STUDENT_RECORD_SIZE;
+    cur->hole = cur->pos;
+    cur->eof = (cur->pos >= cur->end);
+    if (cur->eof)
+        return cur;
+
+    // a short range needs no more than its own size
+    cur->ra_size = CURSOR_READ_AHEAD;
+    if ((off_t)cur->ra_size > cur->end - cur->pos)
+        cur->ra_size = cur->end - cur->pos;
+    cur->ra = aligned_alloc(64, cur->ra_size);
+    if (cur->ra == NULL) {
+        free(cur);
+        return NULL;
+    }
+    posix_fadvise(fd, cur->pos, cur->end - cur->pos, POSIX_FADV_SEQUENTIAL);
+    return cur;
+}
+
+/*
+ *  cursor_fill
+ *
+ *  Reads the next block of the range into the read-ahead buffer, jumping
+ *  to the next data extent when the current one is used up.  Sets eof
+ *  when only holes are left.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int cursor_fill(db_cursor_t *cur)
+{
+    cur->nra = cur->ira = 0;
+    while (cur->pos < cur->end) {
+        if (cur->pos >= cur->hole) {
+            off_t data = io_lseek(cur->fd, cur->pos, SEEK_DATA);
+
+            if (data == -1) {
+                if (errno == ENXIO)
+                    break;      // only a hole is left until the end
+                if (errno != EINVAL)
+                    return ERR_DB_FILE;
+                data = cur->pos;        // no SEEK_DATA support
+                cur->hole = cur->end;
+            } else {
+                cur->hole = io_lseek(cur->fd, data, SEEK_HOLE);
+                if (cur->hole == -1 || cur->hole > cur->end)
+                    cur->hole = cur->end;
+            }
+            data -= data % STUDENT_RECORD_SIZE;
+            if (data > cur->pos)
+                cur->pos = data;
+            if (cur->pos >= cur->end)
+                break;
+        }
+
+        size_t want = cur->ra_size;
+        if ((off_t)want > cur->hole - cur->pos)
+            want = cur->hole - cur->pos;
+
+        ssize_t n = io_pread(cur->fd, cur->ra, want, cur->pos);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return ERR_DB_FILE;
+        }
+        if (n == 0)
+            break;              // file shrank under us
+        if (n % STUDENT_RECORD_SIZE != 0)
+            return ERR_DB_FILE;
+        cur->nra = n / STUDENT_RECORD_SIZE;
+        cur->pos += n;
+        return NO_ERROR;
+    }
+    cur->eof = true;
+    return NO_ERROR;
+}
+
+/*
+ *  db_cursor_next_batch
+ *      cur:  cursor from db_cursor_open()
+ *      buf:  receives the next students of the range, in id order
+ *      n:    room in buf
+ *
+ *  Copies up to n students to buf, reading ahead as needed.  A batch is
+ *  only short at the end of the range.
+ *
+ *  returns:  <number>       students copied to buf, 0 at the end
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int db_cursor_next_batch(db_cursor_t *cur, student_t *buf, int n)
+{
+    int got = 0;
+
+    while (got < n) {
+        if (cur->ira == cur->nra) {
+            if (cur->eof)
+                break;
+            if (cursor_fill(cur) != NO_ERROR)
+                return ERR_DB_FILE;
+            continue;
+        }
+        int i = next_nonempty(cur->ra, cur->ira, cur->nra);
+        if (i < cur->nra)
+            buf[got++] = cur->ra[i++];
+        cur->ira = i;
+    }
+    return got;
+}
+
+//free a cursor, NULL is ignored
+void db_cursor_close(db_cursor_t *cur)
+{
+    if (cur == NULL)
+        return;
+    free(cur->ra);
+    free(cur);
+}
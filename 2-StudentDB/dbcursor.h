@@ -0,0 +1,40 @@
+#ifndef __DBCURSOR_H__
+    #define __DBCURSOR_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "db.h"
+
+//Cursors hand out the students of an id range in batches, for callers that
+//want to work through a range without one read per record and without
+//going through the printing functions.  A cursor reads the database ahead
+//of the caller, up to CURSOR_READ_AHEAD bytes per pread(), skips the holes
+//of the sparse file with SEEK_DATA/SEEK_HOLE like the scan engine does and
+//drops empty slots before they are copied out.
+//
+//The range ends where the database file ended when the cursor was opened.
+//Records come straight from the file without locks, so a batch may miss a
+//student added or show one deleted while the cursor was open, like any
+//other unlocked read (see dbmvcc.h for a consistent view of the database).
+#define CURSOR_READ_AHEAD   (256 * 1024)    // bytes read per pread()
+#define CURSOR_BATCH        256             // students per batch of sdbsc -r
+
+typedef struct db_cursor {
+    int fd;
+    off_t pos;              // next byte of the database to read
+    off_t end;              // end of the range, clamped to the file size
+    off_t hole;             // end of the data extent pos is in
+    student_t *ra;          // read-ahead buffer
+    size_t ra_size;
+    int nra;                // records in ra
+    int ira;                // next record of ra to look at
+    bool eof;
+} db_cursor_t;
+
+//prototypes
+db_cursor_t *db_cursor_open(int fd, int lo_id, int hi_id);
+int db_cursor_next_batch(db_cursor_t *cur, student_t *buf, int n);
+void db_cursor_close(db_cursor_t *cur);
+
+#endif
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbhash.h"
+#include "dbbloom.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(hash_bucket_t) == HASH_PAGE_SIZE, "a bucket must fill one page");
+_Static_assert(sizeof(hash_hdr_t) <= HASH_PAGE_SIZE, "the header must fit one page");
+
+//murmur3 finalizer, a bijection so distinct ids never share every hash bit
+static uint32_t hash_id(int id)
+{
+    uint32_t h = (uint32_t)id;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t dir_slot(const hash_db_t *h, int id)
+{
+    return hash_id(id) & ((1u << h->hdr.global_depth) - 1);
+}
+
+static int read_page(hash_db_t *h, uint32_t page, void *buf)
+{
+    ssize_t n = io_pread(h->fd, buf, HASH_PAGE_SIZE, (off_t)page * HASH_PAGE_SIZE);
+    return (n == HASH_PAGE_SIZE) ? NO_ERROR : ERR_DB_FILE;
+}
+
+static int write_page(hash_db_t *h, uint32_t page, const void *buf)
+{
+    return pwrite_all(h->fd, buf, HASH_PAGE_SIZE, (off_t)page * HASH_PAGE_SIZE);
+}
+
+static int read_bucket(hash_db_t *h, uint32_t page, hash_bucket_t *b)
+{
+    if (read_page(h, page, b) != NO_ERROR || b->magic != HASH_BUCKET_MAGIC ||
+        b->count > HASH_BUCKET_RECORDS)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+//the student count in the Bloom filter follows the header
+static int write_hdr(hash_db_t *h)
+{
+    if (pwrite_all(h->fd, &h->hdr, sizeof(h->hdr), 0) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (bloom_valid(h->bloom))
+        h->bloom->hdr->owner_nrecs = h->hdr.nrecs;
+    return NO_ERROR;
+}
+
+//a page for a new bucket, from the free list if it has one
+static int alloc_page(hash_db_t *h, uint32_t *page)
+{
+    hash_free_t fr;
+
+    if (h->hdr.free_page == 0) {
+        *page = h->hdr.npages++;
+        return NO_ERROR;
+    }
+    if (io_pread(h->fd, &fr, sizeof(fr), (off_t)h->hdr.free_page * HASH_PAGE_SIZE) != sizeof(fr) ||
+        fr.magic != HASH_FREE_MAGIC)
+        return ERR_DB_FILE;
+    *page = h->hdr.free_page;
+    h->hdr.free_page = fr.next;
+    return NO_ERROR;
+}
+
+static int free_page(hash_db_t *h, uint32_t page)
+{
+    hash_free_t fr = { HASH_FREE_MAGIC, h->hdr.free_page };
+
+    if (pwrite_all(h->fd, &fr, sizeof(fr), (off_t)page * HASH_PAGE_SIZE) != NO_ERROR)
+        return ERR_DB_FILE;
+    h->hdr.free_page = page;
+    return NO_ERROR;
+}
+
+/*
+ *  write_dir
+ *
+ *  Stores the directory and then the header.  A directory that outgrew its
+ *  pages moves to the end of the file, the old pages go on the free list.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_dir(hash_db_t *h)
+{
+    size_t len = ((size_t)1 << h->hdr.global_depth) * sizeof(uint32_t);
+    uint32_t need = (len + HASH_PAGE_SIZE - 1) / HASH_PAGE_SIZE;
+
+    if (need > h->hdr.dir_pages) {
+        for (uint32_t p = 0; p < h->hdr.dir_pages; p++) {
+            if (free_page(h, h->hdr.dir_page + p) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+        h->hdr.dir_page = h->hdr.npages;
+        h->hdr.dir_pages = need;
+        h->hdr.npages += need;
+    }
+    if (pwrite_all(h->fd, h->dir, len, (off_t)h->hdr.dir_page * HASH_PAGE_SIZE) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_hdr(h);
+}
+
+//lay out an empty hashed database: header, a one page directory, one bucket
+static int hash_init(hash_db_t *h)
+{
+    static char zero[HASH_PAGE_SIZE];
+    hash_bucket_t b;
+
+    memset(&h->hdr, 0, sizeof(h->hdr));
+    h->hdr.magic = HASH_MAGIC;
+    h->hdr.version = HASH_VERSION;
+    h->hdr.page_size = HASH_PAGE_SIZE;
+    h->hdr.dir_page = 1;
+    h->hdr.dir_pages = 1;
+    h->hdr.npages = 3;
+
+    h->dir = malloc(sizeof(uint32_t));
+    if (h->dir == NULL)
+        return ERR_DB_FILE;
+    h->dir[0] = 2;
+
+    memset(&b, 0, sizeof(b));
+    b.magic = HASH_BUCKET_MAGIC;
+    if (write_page(h, 0, zero) != NO_ERROR || write_page(h, 1, zero) != NO_ERROR ||
+        write_page(h, 2, &b) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_dir(h);
+}
+
+static int hash_load(hash_db_t *h)
+{
+    hash_hdr_t *hdr = &h->hdr;
+
+    if (io_pread(h->fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+        hdr->magic != HASH_MAGIC || hdr->version != HASH_VERSION ||
+        hdr->page_size != HASH_PAGE_SIZE || hdr->global_depth > HASH_MAX_DEPTH)
+        return ERR_DB_FILE;
+
+    size_t len = ((size_t)1 << hdr->global_depth) * sizeof(uint32_t);
+    h->dir = malloc(len);
+    if (h->dir == NULL ||
+        io_pread(h->fd, h->dir, len, (off_t)hdr->dir_page * HASH_PAGE_SIZE) != (ssize_t)len)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  hash_filter_rebuild
+ *      h:  hashed database, locked exclusively
+ *
+ *  Refills the Bloom filter (dbbloom.h) from the buckets, sized for twice
+ *  the students so that adds have room before the next rebuild.  A filter
+ *  that cannot be rebuilt is dropped and lookups read the buckets.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int hash_filter_rebuild(hash_db_t *h)
+{
+    uint64_t capacity = 2 * (uint64_t)h->hdr.nrecs;
+    hash_bucket_t b;
+    struct stat st;
+
+    if (h->bloom == NULL)
+        return ERR_DB_FILE;
+    if (capacity > INT32_MAX)
+        capacity = INT32_MAX;
+    if (fstat(h->fd, &st) == -1 || bloom_reset(h->bloom, capacity) != NO_ERROR)
+        goto fail;
+
+    for (uint32_t p = 1; p < h->hdr.npages; p++) {
+        if (p == h->hdr.dir_page) {
+            p += h->hdr.dir_pages - 1;
+            continue;
+        }
+        if (read_page(h, p, &b) != NO_ERROR || b.count > HASH_BUCKET_RECORDS)
+            goto fail;
+        if (b.magic != HASH_BUCKET_MAGIC)
+            continue;
+        for (int i = 0; i < b.count; i++)
+            bloom_add(h->bloom, b.recs[i].id);
+    }
+    h->bloom->hdr->owner_ino = st.st_ino;
+    h->bloom->hdr->owner_nrecs = h->hdr.nrecs;
+    return NO_ERROR;
+
+fail:
+    bloom_close(h->bloom);
+    h->bloom = NULL;
+    return ERR_DB_FILE;
+}
+
+//open the filter of path, rebuilt if it does not describe the database
+static void hash_filter_open(hash_db_t *h, const char *path, const struct stat *st)
+{
+    char side[PATH_MAX];
+
+    if (sidecar_path(path, BLOOM_SUFFIX, side, sizeof(side)) != NO_ERROR)
+        return;
+    h->bloom = bloom_open(side);
+    if (h->bloom == NULL)
+        return;
+
+    // a crash between a bucket write and the count below leaves them apart
+    bloom_hdr_t *bh = h->bloom->hdr;
+    if (bloom_valid(h->bloom) && bh->owner_ino == (uint64_t)st->st_ino &&
+        bh->owner_nrecs == h->hdr.nrecs && bh->nkeys <= bh->capacity)
+        return;
+    hash_filter_rebuild(h);
+}
+
+/*
+ *  hash_open
+ *      path:   hashed database file, created if it does not exist
+ *      write:  true if the caller will change the database
+ *
+ *  Opens the database and reads its directory, holding an flock() on the
+ *  file until hash_close(): exclusive for writers, shared for readers.
+ *  The Bloom filter sidecar is opened too and rebuilt while the lock is
+ *  still exclusive if it is stale.
+ *
+ *  returns:  the database, or NULL on an I/O error or if path is not a
+ *            hashed database
+ */
+hash_db_t *hash_open(const char *path, bool write)
+{
+    hash_db_t *h = calloc(1, sizeof(*h));
+    struct stat st;
+    int rc;
+
+    if (h == NULL)
+        return NULL;
+    h->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (h->fd < 0) {
+        free(h);
+        return NULL;
+    }
+
+    // a new file is laid out by whoever gets the exclusive lock first
+    rc = (flock(h->fd, LOCK_EX) == 0 && fstat(h->fd, &st) == 0) ? NO_ERROR : ERR_DB_FILE;
+    if (rc == NO_ERROR)
+        rc = (st.st_size == 0) ? hash_init(h) : hash_load(h);
+    if (rc == NO_ERROR)
+        hash_filter_open(h, path, &st);
+    if (rc == NO_ERROR && !write && flock(h->fd, LOCK_SH) != 0)
+        rc = ERR_DB_FILE;
+
+    if (rc != NO_ERROR) {
+        hash_close(h);
+        return NULL;
+    }
+    return h;
+}
+
+void hash_close(hash_db_t *h)
+{
+    if (h == NULL)
+        return;
+    bloom_close(h->bloom);
+    close(h->fd);
+    free(h->dir);
+    free(h);
+}
+
+//position of id in the bucket, or -1
+static int bucket_find(const hash_bucket_t *b, int id)
+{
+    for (int i = 0; i < b->count; i++) {
+        if (b->recs[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ *  hash_get
+ *      id:  student id
+ *      s:   receives the student
+ *
+ *  An id the Bloom filter has never seen is not found without reading
+ *  anything.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ */
+int hash_get(hash_db_t *h, int id, student_t *s)
+{
+    hash_bucket_t b;
+
+    if (!bloom_test(h->bloom, id))
+        return SRCH_NOT_FOUND;
+    if (read_bucket(h, h->dir[dir_slot(h, id)], &b) != NO_ERROR)
+        return ERR_DB_FILE;
+    int i = bucket_find(&b, id);
+    if (i < 0)
+        return SRCH_NOT_FOUND;
+    *s = b.recs[i];
+    return NO_ERROR;
+}
+
+/*
+ *  split_bucket
+ *      page:  page of a full bucket
+ *      b:     its contents
+ *
+ *  Moves the ids whose next hash bit is set to a new bucket and points
+ *  the directory entries with that bit at it, doubling the directory
+ *  first if the bucket already uses every bit.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE (also when the directory would grow
+ *            past HASH_MAX_DEPTH)
+ */
+static int split_bucket(hash_db_t *h, uint32_t page, hash_bucket_t *b)
+{
+    hash_bucket_t nb;
+    uint32_t npage;
+
+    if (b->depth == h->hdr.global_depth) {
+        uint32_t n = 1u << h->hdr.global_depth;
+        if (h->hdr.global_depth == HASH_MAX_DEPTH)
+            return ERR_DB_FILE;
+        uint32_t *dir = realloc(h->dir, 2 * (size_t)n * sizeof(uint32_t));
+        if (dir == NULL)
+            return ERR_DB_FILE;
+        memcpy(dir + n, dir, n * sizeof(uint32_t));
+        h->dir = dir;
+        h->hdr.global_depth++;
+    }
+    if (alloc_page(h, &npage) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    uint32_t bit = 1u << b->depth;
+    int keep = 0;
+
+    memset(&nb, 0, sizeof(nb));
+    nb.magic = HASH_BUCKET_MAGIC;
+    nb.depth = ++b->depth;
+    for (int i = 0; i < b->count; i++) {
+        if (hash_id(b->recs[i].id) & bit)
+            nb.recs[nb.count++] = b->recs[i];
+        else
+            b->recs[keep++] = b->recs[i];
+    }
+    memset(&b->recs[keep], 0, (b->count - keep) * sizeof(student_t));
+    b->count = keep;
+
+    for (uint32_t i = 0; i < (1u << h->hdr.global_depth); i++) {
+        if (h->dir[i] == page && (i & bit))
+            h->dir[i] = npage;
+    }
+
+    // the new bucket is written before anything points at it
+    if (write_page(h, npage, &nb) != NO_ERROR || write_page(h, page, b) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_dir(h);
+}
+
+/*
+ *  hash_put
+ *      s:  student to add, s->id is the key
+ *
+ *  The id goes into the Bloom filter before the bucket is written, so the
+ *  filter never misses a student that is in the file.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the id already exists, or ERR_DB_FILE
+ */
+int hash_put(hash_db_t *h, const student_t *s)
+{
+    hash_bucket_t b;
+
+    if (bloom_valid(h->bloom) && h->bloom->hdr->nkeys >= h->bloom->hdr->capacity)
+        hash_filter_rebuild(h);
+
+    for (;;) {
+        uint32_t page = h->dir[dir_slot(h, s->id)];
+
+        if (read_bucket(h, page, &b) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (bucket_find(&b, s->id) >= 0)
+            return ERR_DB_OP;
+        if (b.count < HASH_BUCKET_RECORDS) {
+            b.recs[b.count++] = *s;
+            h->hdr.nrecs++;
+            if (bloom_valid(h->bloom))
+                bloom_add(h->bloom, s->id);
+            if (write_page(h, page, &b) != NO_ERROR)
+                return ERR_DB_FILE;
+            return write_hdr(h);
+        }
+        // ids differ in some hash bit, so splitting makes room eventually
+        if (split_bucket(h, page, &b) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+}
+
+/*
+ *  hash_del
+ *      id:  student to delete
+ *
+ *  An emptied bucket is merged into its buddy, the bucket that differs in
+ *  its last hash bit, when the buddy has the same depth.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ */
+int hash_del(hash_db_t *h, int id)
+{
+    uint32_t slot = dir_slot(h, id);
+    uint32_t page = h->dir[slot];
+    hash_bucket_t b, buddy;
+
+    if (read_bucket(h, page, &b) != NO_ERROR)
+        return ERR_DB_FILE;
+    int i = bucket_find(&b, id);
+    if (i < 0)
+        return SRCH_NOT_FOUND;
+    b.recs[i] = b.recs[--b.count];
+    memset(&b.recs[b.count], 0, sizeof(student_t));
+    h->hdr.nrecs--;
+
+    if (b.count == 0 && b.depth > 0) {
+        uint32_t bpage = h->dir[slot ^ (1u << (b.depth - 1))];
+        if (read_bucket(h, bpage, &buddy) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (buddy.depth == b.depth) {
+            for (uint32_t k = 0; k < (1u << h->hdr.global_depth); k++) {
+                if (h->dir[k] == page)
+                    h->dir[k] = bpage;
+            }
+            buddy.depth--;
+            if (write_page(h, bpage, &buddy) != NO_ERROR || free_page(h, page) != NO_ERROR)
+                return ERR_DB_FILE;
+            return write_dir(h);
+        }
+    }
+
+    if (write_page(h, page, &b) != NO_ERROR)
+        return ERR_DB_FILE;
+    return write_hdr(h);
+}
+
+static int cmp_id(const void *a, const void *b)
+{
+    const student_t *x = a, *y = b;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/*
+ *  hash_scan
+ *      cb:   called for every student in id order, a non zero return
+ *            stops the scan
+ *      arg:  passed to cb
+ *
+ *  Buckets are read in file order and their students sorted by id.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int hash_scan(hash_db_t *h, scan_cb_t cb, void *arg)
+{
+    student_t *recs = malloc(((size_t)h->hdr.nrecs + 1) * sizeof(student_t));
+    hash_bucket_t b;
+    uint32_t n = 0;
+    int rc = NO_ERROR;
+
+    if (recs == NULL)
+        return ERR_DB_FILE;
+    for (uint32_t p = 1; p < h->hdr.npages && rc == NO_ERROR; p++) {
+        if (p == h->hdr.dir_page) {
+            p += h->hdr.dir_pages - 1;
+            continue;
+        }
+        if (read_page(h, p, &b) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        else if (b.magic == HASH_BUCKET_MAGIC) {
+            if (b.count > HASH_BUCKET_RECORDS || n + b.count > h->hdr.nrecs)
+                rc = ERR_DB_FILE;
+            else {
+                memcpy(recs + n, b.recs, b.count * sizeof(student_t));
+                n += b.count;
+            }
+        }
+    }
+
+    if (rc == NO_ERROR) {
+        qsort(recs, n, sizeof(student_t), cmp_id);
+        for (uint32_t i = 0; i < n; i++) {
+            if (cb(&recs[i], arg) != 0)
+                break;
+        }
+    }
+    free(recs);
+    return rc;
+}
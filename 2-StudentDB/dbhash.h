@@ -0,0 +1,89 @@
+#ifndef __DBHASH_H__
+    #define __DBHASH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "dbscan.h"
+
+//Hashed database for ids that do not fit the fixed slot layout.  student.db
+//keeps student id at offset id * 64, which is only sensible while ids stay
+//small (MAX_STD_ID); a nine digit university id would ask for a file of
+//tens of gigabytes.  sdbsc --hashed runs the usual commands against a
+//separate file (HASH_DB_FILE) organised as an extendible hash instead,
+//where any id up to HASH_MAX_ID is accepted and the file grows with the
+//number of students.  The bound is that of student_t.id, a signed 32 bit
+//int in the 64 byte record both files share, so ids stay positive and
+//below 2^31.
+//
+//    [ header | directory | bucket | bucket | ... ]
+//
+//Every page is HASH_PAGE_SIZE bytes.  A bucket page holds up to
+//HASH_BUCKET_RECORDS students in the usual 64 byte layout.  The directory
+//has 2^global_depth entries, each the page of a bucket, and the bucket of
+//an id is directory[hash(id) & (2^global_depth - 1)], so a lookup is one
+//page read once the directory is in memory.  A full bucket is split in
+//two on the next bit of the hash, doubling the directory first if the
+//bucket already uses every bit of it.  A bucket emptied by deletes is
+//merged back into its buddy and its page reused for the next split.
+//
+//The hashed file does not use the sidecars, write-ahead log or stripe
+//locks of student.db.  Each command holds an flock() on the file instead,
+//shared for reads and exclusive for writes.  Its one sidecar is a Bloom
+//filter of the ids (HASH_DB_FILE BLOOM_SUFFIX, see dbbloom.h) that answers
+//most lookups of absent ids without a bucket read.
+#define HASH_DB_FILE        "student.hdb"
+#define HASH_MAGIC          0x58484553      // "SEHX"
+#define HASH_BUCKET_MAGIC   0x42484553      // "SEHB"
+#define HASH_FREE_MAGIC     0x46484553      // "SEHF"
+#define HASH_VERSION        1
+#define HASH_PAGE_SIZE      4096
+#define HASH_BUCKET_RECORDS 63
+#define HASH_MAX_DEPTH      24              // 16M directory entries
+#define HASH_MAX_ID         INT32_MAX       // largest student_t.id
+
+typedef struct hash_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t global_depth;
+    uint32_t npages;        // pages in the file, the header included
+    uint32_t nrecs;         // students in all buckets
+    uint32_t dir_page;      // first page of the directory
+    uint32_t dir_pages;     // pages reserved for the directory
+    uint32_t free_page;     // first page on the free list, 0 if none
+} hash_hdr_t;
+
+//a bucket, the records fill the rest of the page after the 64 byte header
+typedef struct hash_bucket {
+    uint32_t magic;
+    uint16_t depth;         // hash bits shared by every id in the bucket
+    uint16_t count;         // records in use, recs[0 .. count)
+    uint8_t pad[sizeof(student_t) - 8];
+    student_t recs[HASH_BUCKET_RECORDS];
+} hash_bucket_t;
+
+//a page on the free list
+typedef struct hash_free {
+    uint32_t magic;
+    uint32_t next;          // next free page, 0 at the end
+} hash_free_t;
+
+typedef struct hash_db {
+    int fd;
+    hash_hdr_t hdr;
+    uint32_t *dir;          // 2^global_depth bucket pages
+    struct db_bloom *bloom; // id filter, NULL if the sidecar is unusable
+} hash_db_t;
+
+//prototypes
+hash_db_t *hash_open(const char *path, bool write);
+void hash_close(hash_db_t *h);
+int hash_get(hash_db_t *h, int id, student_t *s);
+int hash_put(hash_db_t *h, const student_t *s);
+int hash_del(hash_db_t *h, int id);
+int hash_scan(hash_db_t *h, scan_cb_t cb, void *arg);
+int hash_filter_rebuild(hash_db_t *h);
+
+#endif
@@ -0,0 +1,664 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbwal.h"
+#include "dblock.h"
+#include "dbbitmap.h"
+#include "dbmvcc.h"
+#include "dbwire.h"
+#include "dbimport.h"
+#include "dbiostat.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+//used to bridge small runs of empty slots between imported students so
+//they go out in the same pwritev() call
+static const student_t zero_gap[IMPORT_GAP_RECORDS];
+
+//records parsed from the csv file, in file order
+typedef struct import_set {
+    student_t *recs;
+    int n;
+    int cap;
+} import_set_t;
+
+static int import_push(import_set_t *set, const student_t *s)
+{
+    if (set->n == set->cap) {
+        int cap = set->cap ? set->cap * 2 : 4096;
+        student_t *recs = realloc(set->recs, cap * sizeof(student_t));
+        if (recs == NULL)
+            return ERR_DB_FILE;
+        set->recs = recs;
+        set->cap = cap;
+    }
+    set->recs[set->n++] = *s;
+    return NO_ERROR;
+}
+
+//parse a non-negative decimal number that spans exactly [p, end)
+static bool parse_uint(const char *p, const char *end, int *out)
+{
+    int v = 0;
+
+    if (p == end || end - p > 9)
+        return false;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return false;
+        v = v * 10 + (*p - '0');
+    }
+    *out = v;
+    return true;
+}
+
+/*
+ *  parse_line
+ *      line, len:  one csv line without its newline
+ *      s:          receives the parsed student
+ *
+ *  returns:  NO_ERROR         line parsed and in range
+ *            ERR_DB_OP        line is malformed
+ *            EXIT_FAIL_ARGS   id or gpa is out of range (see validate_range)
+ */
+static int parse_line(const char *line, int len, student_t *s)
+{
+    const char *field[4];
+    const char *fend[4];
+    const char *p = line;
+    const char *end = line + len;
+    int nf = 0;
+
+    if (len > 0 && end[-1] == '\r')
+        end--;
+
+    while (nf < 4) {
+        const char *comma = memchr(p, ',', end - p);
+        field[nf] = p;
+        fend[nf] = comma ? comma : end;
+        nf++;
+        if (comma == NULL)
+            break;
+        p = comma + 1;
+    }
+    if (nf != 4 || memchr(field[3], ',', end - field[3]) != NULL)
+        return ERR_DB_OP;
+
+    int id, gpa;
+    if (!parse_uint(field[0], fend[0], &id) || !parse_uint(field[3], fend[3], &gpa))
+        return ERR_DB_OP;
+    if (fend[1] == field[1] || fend[2] == field[2])
+        return ERR_DB_OP;
+    if (validate_range(id, gpa) != NO_ERROR)
+        return EXIT_FAIL_ARGS;
+
+    // same truncation rules as add_student()
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->gpa = gpa;
+    size_t fl = fend[1] - field[1];
+    size_t ll = fend[2] - field[2];
+    if (fl > sizeof(s->fname) - 1)
+        fl = sizeof(s->fname) - 1;
+    if (ll > sizeof(s->lname) - 1)
+        ll = sizeof(s->lname) - 1;
+    memcpy(s->fname, field[1], fl);
+    memcpy(s->lname, field[2], ll);
+    return NO_ERROR;
+}
+
+//true if a student already lives at id in the database passed as arg
+static bool db_has_student(int id, void *arg)
+{
+    int fd = *(int *)arg;
+    db_ctx_t *ctx = db_ctx_get(fd);
+    student_t existing;
+
+    if (ctx != NULL && ctx->bitmap != NULL)
+        return bitmap_test(ctx->bitmap, id);
+    return get_student(fd, id, &existing) == NO_ERROR;
+}
+
+//read and validate the whole csv file, ids for which exists() is true are
+//duplicates.  Prints the failure message itself.
+static int import_parse(const char *path, import_exists_t exists, void *arg,
+                        import_set_t *set)
+{
+    int cfd = open(path, O_RDONLY);
+    if (cfd < 0) {
+        printf(M_ERR_IMPORT_OPEN, path);
+        return ERR_DB_FILE;
+    }
+    posix_fadvise(cfd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    uint64_t *seen = calloc((MAX_STD_ID + 64) / 64, sizeof(uint64_t));
+    char *buf = malloc(IMPORT_READ_SIZE + IMPORT_MAX_LINE);
+    int rc = NO_ERROR;
+    int lineno = 0;
+    size_t carry = 0;
+    bool eof = false;
+
+    if (seen == NULL || buf == NULL)
+        rc = ERR_DB_FILE;
+
+    while (rc == NO_ERROR && !eof) {
+        ssize_t n = io_read(cfd, buf + carry, IMPORT_READ_SIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            printf(M_ERR_IMPORT_OPEN, path);
+            rc = ERR_DB_FILE;
+            break;
+        }
+        eof = (n == 0);
+        size_t avail = carry + n;
+        char *p = buf;
+        char *end = buf + avail;
+
+        while (p < end) {
+            char *nl = memchr(p, '\n', end - p);
+            if (nl == NULL) {
+                if (!eof)
+                    break;      // partial line, wait for the next read
+                nl = end;       // last line without a newline
+            }
+
+            int len = nl - p;
+            lineno++;
+            if (len > IMPORT_MAX_LINE) {
+                printf(M_ERR_IMPORT_LINE, lineno);
+                rc = ERR_DB_OP;
+                break;
+            }
+
+            student_t s;
+            int prc = NO_ERROR;
+            bool header = (set->n == 0 && lineno == 1 && len >= 2 &&
+                           p[0] == 'i' && p[1] == 'd');
+            bool blank = (len == 0 || (len == 1 && p[0] == '\r'));
+            if (!header && !blank)
+                prc = parse_line(p, len, &s);
+
+            if (prc == ERR_DB_OP) {
+                printf(M_ERR_IMPORT_LINE, lineno);
+                rc = ERR_DB_OP;
+                break;
+            }
+            if (prc == EXIT_FAIL_ARGS) {
+                printf(M_ERR_IMPORT_RNG, lineno);
+                rc = ERR_DB_OP;
+                break;
+            }
+            if (!header && !blank) {
+                bool dup = (seen[s.id / 64] >> (s.id % 64)) & 1;
+                if (!dup && exists != NULL)
+                    dup = exists(s.id, arg);
+                if (dup) {
+                    printf(M_ERR_IMPORT_DUP, s.id, lineno);
+                    rc = ERR_DB_OP;
+                    break;
+                }
+                seen[s.id / 64] |= 1ULL << (s.id % 64);
+                if (import_push(set, &s) != NO_ERROR) {
+                    rc = ERR_DB_FILE;
+                    break;
+                }
+            }
+            p = (nl < end) ? nl + 1 : end;
+        }
+
+        if (rc != NO_ERROR)
+            break;
+
+        // move the partial line to the front of the buffer
+        carry = end - p;
+        if (carry > IMPORT_MAX_LINE) {
+            printf(M_ERR_IMPORT_LINE, lineno + 1);
+            rc = ERR_DB_OP;
+            break;
+        }
+        memmove(buf, p, carry);
+    }
+
+    free(buf);
+    free(seen);
+    close(cfd);
+    return rc;
+}
+
+//pwritev() that retries short writes by advancing through the iovecs
+static int pwritev_all(int fd, struct iovec *iov, int niov, off_t off)
+{
+    while (niov > 0) {
+        ssize_t n = io_pwritev(fd, iov, niov, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return ERR_DB_FILE;
+        }
+        off += n;
+        while (niov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return NO_ERROR;
+}
+
+//true if every slot in [lo, hi) is empty and can be overwritten with zeros
+static bool gap_is_free(db_bitmap_t *bm, int lo, int hi)
+{
+    if (bm == NULL)
+        return false;
+    int64_t next = bitmap_next(bm, lo);
+    return next < 0 || next >= hi;
+}
+
+/*
+ *  import_write
+ *
+ *  Writes the validated students in id order.  The records are placed with
+ *  a counting sort (ids are bounded by MAX_STD_ID), then each run of
+ *  consecutive ids is written with one pwritev() whose iovecs point
+ *  straight at the parsed records.  Short runs of empty slots between two
+ *  runs are bridged with zeros so that both go out in the same call.
+ *  The whole set is first committed to the write-ahead log as one group,
+ *  so an import costs a single log sync however many rows it has.  The
+ *  caller holds every stripe and the meta lock.
+ */
+static int import_write(int fd, import_set_t *set)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    db_bitmap_t *bm = (ctx != NULL) ? ctx->bitmap : NULL;
+    int *slot = calloc(MAX_STD_ID + 1, sizeof(int));
+    struct iovec iov[IOV_MAX];
+    int niov = 0;
+    int run_start = 0;
+    int next_id = 0;
+    int rc = NO_ERROR;
+
+    if (slot == NULL)
+        return ERR_DB_FILE;
+
+    if (ctx != NULL && ctx->wal != NULL &&
+        wal_log_bulk(ctx->wal, set->recs, set->n) != NO_ERROR) {
+        free(slot);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < set->n; i++)
+        slot[set->recs[i].id] = i + 1;
+    for (int id = MIN_STD_ID, last = -1; id <= MAX_STD_ID && rc == NO_ERROR; id++) {
+        if (slot[id] != 0 && id / MVCC_PAGE_RECORDS != last) {
+            last = id / MVCC_PAGE_RECORDS;
+            rc = mvcc_preserve(ctx, last);
+        }
+    }
+    if (rc != NO_ERROR) {
+        free(slot);
+        return rc;
+    }
+
+    if (ctx != NULL && ctx->lock != NULL)
+        lock_write_begin_all(ctx->lock);
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID && rc == NO_ERROR; id++) {
+        if (slot[id] == 0)
+            continue;
+        student_t *s = &set->recs[slot[id] - 1];
+
+        if (niov > 0 && id == next_id && niov < IOV_MAX) {
+            iov[niov].iov_base = s;
+            iov[niov].iov_len = STUDENT_RECORD_SIZE;
+            niov++;
+            next_id++;
+            continue;
+        }
+        if (niov > 0 && id > next_id && id - next_id <= IMPORT_GAP_RECORDS &&
+            niov + 2 <= IOV_MAX && gap_is_free(bm, next_id, id)) {
+            iov[niov].iov_base = (void *)zero_gap;
+            iov[niov].iov_len = (size_t)(id - next_id) * STUDENT_RECORD_SIZE;
+            iov[niov + 1].iov_base = s;
+            iov[niov + 1].iov_len = STUDENT_RECORD_SIZE;
+            niov += 2;
+            next_id = id + 1;
+            continue;
+        }
+
+        if (niov > 0)
+            rc = pwritev_all(fd, iov, niov, (off_t)run_start * STUDENT_RECORD_SIZE);
+        iov[0].iov_base = s;
+        iov[0].iov_len = STUDENT_RECORD_SIZE;
+        niov = 1;
+        run_start = id;
+        next_id = id + 1;
+    }
+    if (rc == NO_ERROR && niov > 0)
+        rc = pwritev_all(fd, iov, niov, (off_t)run_start * STUDENT_RECORD_SIZE);
+    if (ctx != NULL && ctx->lock != NULL)
+        lock_write_end_all(ctx->lock);
+
+    free(slot);
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (ctx != NULL && set->n > 0)
+        rc = db_ctx_added(ctx, set->recs, set->n);
+    return rc;
+}
+
+//write a validated set, called with every stripe held
+static int import_commit(int fd, import_set_t *set)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int rc;
+
+    if (ctx != NULL && db_ctx_lock_meta(ctx) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+    } else {
+        rc = import_write(fd, set);
+        if (ctx != NULL)
+            db_ctx_unlock_meta(ctx, true);
+    }
+    if (rc != NO_ERROR)
+        printf(M_ERR_DB_WRITE);
+    return rc;
+}
+
+//drop the stripes taken for an import and report how it went
+static int import_finish(int fd, import_set_t *set, int rc)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+
+    if (ctx != NULL) {
+        db_ctx_unlock_all(ctx);
+        if (rc == NO_ERROR && db_ctx_checkpoint(ctx, false) != NO_ERROR) {
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+        }
+    }
+
+    if (rc == NO_ERROR) {
+        printf(M_DB_IMPORTED, set->n);
+        rc = set->n;
+    }
+    return rc;
+}
+
+/*
+ *  import_csv
+ *      fd:    linux file descriptor of the database
+ *      path:  csv file to import
+ *
+ *  Streams the csv file in IMPORT_READ_SIZE blocks, validates every record
+ *  with the same rules as -a (validate_range() and duplicate detection,
+ *  both within the file and against the database) and then writes all of
+ *  them in id order with large coalesced pwritev() calls.  Nothing is
+ *  written unless the whole file is valid.
+ *
+ *  returns:  <number>       number of students imported
+ *            ERR_DB_FILE    database or csv file I/O issue
+ *            ERR_DB_OP      the csv file holds a bad or duplicate record
+ *
+ *  console:  M_DB_IMPORTED     on success
+ *            M_ERR_IMPORT_*    describing the first bad line
+ *            M_ERR_DB_WRITE    error writing the database
+ */
+int import_csv(int fd, const char *path)
+{
+    import_set_t set = { 0 };
+    db_ctx_t *ctx = db_ctx_get(fd);
+
+    // the duplicate check and the writes cover many ids, so every stripe
+    // is held for the whole import
+    if (ctx != NULL && db_ctx_lock_all(ctx) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    int rc = import_parse(path, db_has_student, &fd, &set);
+    if (rc == NO_ERROR)
+        rc = import_commit(fd, &set);
+    rc = import_finish(fd, &set, rc);
+
+    free(set.recs);
+    return rc;
+}
+
+/*
+ *  import_read
+ *      path:    csv file to read
+ *      exists:  tells whether an id is already taken, NULL if none are
+ *      arg:     passed through to exists
+ *      recs:    receives the students, free() them
+ *      n:       receives the number of students
+ *
+ *  The parsing and validation half of import_csv(), for callers that
+ *  write the students themselves (see dbshard.h).
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP for a bad or duplicate record, or
+ *            ERR_DB_FILE
+ *
+ *  console:  M_ERR_IMPORT_*    describing the first bad line
+ */
+int import_read(const char *path, import_exists_t exists, void *arg,
+                student_t **recs, int *n)
+{
+    import_set_t set = { 0 };
+    int rc = import_parse(path, exists, arg, &set);
+
+    if (rc != NO_ERROR) {
+        free(set.recs);
+        return rc;
+    }
+    *recs = set.recs;
+    *n = set.n;
+    return NO_ERROR;
+}
+
+/*
+ *  import_locked
+ *      fd:    linux file descriptor of the database
+ *      recs:  validated students that are not in the database yet
+ *      n:     number of students
+ *
+ *  The writing half of import_csv(), called with every stripe of the
+ *  database held (db_ctx_lock_all()).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_WRITE    error writing the database
+ */
+int import_locked(int fd, student_t *recs, int n)
+{
+    import_set_t set = { recs, n, n };
+
+    return import_commit(fd, &set);
+}
+
+/*
+ *  import_students
+ *      fd:    linux file descriptor of the database
+ *      recs:  students to add, each already checked with validate_range()
+ *      n:     number of students
+ *
+ *  Same as import_csv() for students that are already in memory, for
+ *  example read back from a packed file.  Nothing is written if any of
+ *  the ids is used twice or is already in the database.
+ *
+ *  returns:  <number>       number of students imported
+ *            ERR_DB_FILE    database I/O issue
+ *            ERR_DB_OP      duplicate student
+ *
+ *  console:  M_DB_IMPORTED     on success
+ *            M_ERR_UNPACK_DUP  the first duplicate id
+ *            M_ERR_DB_WRITE    error writing the database
+ */
+int import_students(int fd, student_t *recs, int n)
+{
+    import_set_t set = { recs, n, n };
+    db_ctx_t *ctx = db_ctx_get(fd);
+    uint64_t *seen = calloc((MAX_STD_ID + 64) / 64, sizeof(uint64_t));
+    int rc = NO_ERROR;
+
+    if (seen == NULL)
+        return ERR_DB_FILE;
+    if (ctx != NULL && db_ctx_lock_all(ctx) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        free(seen);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < n && rc == NO_ERROR; i++) {
+        int id = recs[i].id;
+        bool dup = (seen[id / 64] >> (id % 64)) & 1;
+        if (!dup) {
+            if (ctx != NULL && ctx->bitmap != NULL) {
+                dup = bitmap_test(ctx->bitmap, id);
+            } else {
+                student_t existing;
+                dup = (get_student(fd, id, &existing) == NO_ERROR);
+            }
+        }
+        if (dup) {
+            printf(M_ERR_UNPACK_DUP, id);
+            rc = ERR_DB_OP;
+        }
+        seen[id / 64] |= 1ULL << (id % 64);
+    }
+    free(seen);
+
+    if (rc == NO_ERROR)
+        rc = import_commit(fd, &set);
+    return import_finish(fd, &set, rc);
+}
+
+typedef struct export_state {
+    int out;
+    char *buf;
+    size_t used;
+    int count;
+} export_state_t;
+
+static int write_out(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = io_write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return ERR_DB_FILE;
+        }
+        buf += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+static int export_cb(const student_t *s, void *arg)
+{
+    export_state_t *st = arg;
+
+    // worst case line: 10 digit id, both names, 10 digit gpa, separators
+    if (st->used + 96 > EXPORT_BUF_SIZE) {
+        if (write_out(st->out, st->buf, st->used) != NO_ERROR)
+            return 1;
+        st->used = 0;
+    }
+
+    char *p = st->buf + st->used;
+    p = wire_put_uint(p, (uint32_t)s->id);
+    *p++ = ',';
+    size_t fl = strnlen(s->fname, sizeof(s->fname));
+    memcpy(p, s->fname, fl);
+    p += fl;
+    *p++ = ',';
+    size_t ll = strnlen(s->lname, sizeof(s->lname));
+    memcpy(p, s->lname, ll);
+    p += ll;
+    *p++ = ',';
+    p = wire_put_uint(p, (uint32_t)s->gpa);
+    *p++ = '\n';
+
+    st->used = p - st->buf;
+    st->count++;
+    return 0;
+}
+
+/*
+ *  export_csv
+ *      fd:    linux file descriptor of the database
+ *      path:  csv file to create, or NULL to write to stdout
+ *
+ *  Writes every student in id order as csv.  Lines are formatted by hand
+ *  into an EXPORT_BUF_SIZE buffer that is written out with one write()
+ *  each time it fills up.  The rows come from a snapshot, see dbmvcc.h.
+ *
+ *  returns:  <number>       number of students exported
+ *            ERR_DB_FILE    database or csv file I/O issue
+ *
+ *  console:  M_DB_EXPORTED    on success when writing to a file
+ *            M_ERR_IMPORT_OPEN if the csv file cannot be created
+ *            M_ERR_DB_READ    error reading the database
+ */
+int export_csv(int fd, const char *path)
+{
+    export_state_t st = { 0 };
+
+    if (path != NULL) {
+        st.out = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (st.out < 0) {
+            printf(M_ERR_IMPORT_OPEN, path);
+            return ERR_DB_FILE;
+        }
+    } else {
+        fflush(stdout);
+        st.out = STDOUT_FILENO;
+    }
+
+    st.buf = malloc(EXPORT_BUF_SIZE);
+    if (st.buf == NULL) {
+        if (path != NULL)
+            close(st.out);
+        return ERR_DB_FILE;
+    }
+
+    memcpy(st.buf, CSV_HEADER, strlen(CSV_HEADER));
+    st.used = strlen(CSV_HEADER);
+
+    int rc = scan_snapshot(fd, export_cb, &st);
+    if (rc == NO_ERROR)
+        rc = write_out(st.out, st.buf, st.used);
+
+    free(st.buf);
+    if (path != NULL && close(st.out) == -1)
+        rc = ERR_DB_FILE;
+
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (path != NULL)
+        printf(M_DB_EXPORTED, st.count);
+    return st.count;
+}
@@ -0,0 +1,35 @@
+#ifndef __DBIMPORT_H__
+    #define __DBIMPORT_H__
+
+#include <stdbool.h>
+
+#include "db.h"
+
+//Bulk import and export of students as CSV, one student per line:
+//
+//    id,first_name,last_name,gpa
+//
+//where gpa is the 3 digit integer form used by -a.  Exported files start
+//with a header line, import skips a first line that starts with "id".
+//Import validates the whole file (ranges, duplicates within the file and
+//against the database) before writing anything, so a bad file leaves the
+//database untouched.
+#define IMPORT_READ_SIZE    (1024 * 1024)   // bytes read from csv per read()
+#define IMPORT_MAX_LINE     256             // longest accepted csv line
+#define IMPORT_GAP_RECORDS  63              // empty slots bridged by a pwritev
+#define EXPORT_BUF_SIZE     (1024 * 1024)   // csv bytes buffered per write()
+
+#define CSV_HEADER          "id,fname,lname,gpa\n"
+
+//tells import_read() whether a student already lives at id
+typedef bool (*import_exists_t)(int id, void *arg);
+
+//prototypes
+int import_csv(int fd, const char *path);
+int import_read(const char *path, import_exists_t exists, void *arg,
+                student_t **recs, int *n);
+int import_locked(int fd, student_t *recs, int n);
+int import_students(int fd, student_t *recs, int n);
+int export_csv(int fd, const char *path);
+
+#endif
@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbindex.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(idx_hdr_t) == INDEX_HDR_SIZE, "index header size");
+_Static_assert(sizeof(idx_entry_t) == 16, "index entry size");
+
+/*
+ *  index_key
+ *      kind:  INDEX_LNAME or INDEX_GPA
+ *      s:     student
+ *
+ *  The lname key is a 64 bit FNV-1a hash of the last name, so lookups must
+ *  compare the actual name of each hit to weed out hash collisions.  The
+ *  gpa key is the integer gpa itself which keeps the gpa index in gpa order
+ *  for range queries.
+ *
+ *  returns:  the index key of s
+ */
+uint64_t index_key(int kind, const student_t *s)
+{
+    if (kind == INDEX_GPA)
+        return (uint64_t)s->gpa;
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t len = strnlen(s->lname, sizeof(s->lname));
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s->lname[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    const idx_entry_t *x = a;
+    const idx_entry_t *y = b;
+
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+//deltas are ordered by id, and by position in the log for the same id
+typedef struct delta {
+    idx_entry_t e;
+    size_t seq;
+} delta_t;
+
+static int delta_cmp(const void *a, const void *b)
+{
+    const delta_t *x = a;
+    const delta_t *y = b;
+
+    if (x->e.id != y->e.id)
+        return (x->e.id > y->e.id) - (x->e.id < y->e.id);
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+
+static const char *index_suffix(int kind)
+{
+    return (kind == INDEX_GPA) ? GPA_INDEX_SUFFIX : LNAME_INDEX_SUFFIX;
+}
+
+//write the merged entries as the new base of the index.  The new file is
+//built next to the old one and renamed over it so the swap is atomic.
+static int index_write_base(db_index_t *ix)
+{
+    char tmp[PATH_MAX];
+
+    if (sidecar_path(ix->path, ".tmp", tmp, sizeof(tmp)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    ix->hdr.nbase = ix->n;
+    if (pwrite_all(fd, &ix->hdr, sizeof(ix->hdr), 0) != NO_ERROR ||
+        pwrite_all(fd, ix->ents, ix->n * sizeof(idx_entry_t), INDEX_HDR_SIZE) != NO_ERROR ||
+        io_rename(tmp, ix->path) == -1) {
+        close(fd);
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+
+    close(ix->fd);
+    ix->fd = fd;
+    ix->end = INDEX_HDR_SIZE + (off_t)ix->n * sizeof(idx_entry_t);
+    return NO_ERROR;
+}
+
+struct rebuild_state {
+    db_index_t *ix;
+    size_t cap;
+};
+
+static int rebuild_cb(const student_t *s, void *arg)
+{
+    struct rebuild_state *st = arg;
+    db_index_t *ix = st->ix;
+
+    if (ix->n == st->cap) {
+        size_t cap = st->cap ? st->cap * 2 : 4096;
+        idx_entry_t *ents = realloc(ix->ents, cap * sizeof(idx_entry_t));
+        if (ents == NULL)
+            return 1;
+        ix->ents = ents;
+        st->cap = cap;
+    }
+    ix->ents[ix->n].key = index_key(ix->kind, s);
+    ix->ents[ix->n].id = s->id;
+    ix->ents[ix->n].op = INDEX_OP_ADD;
+    ix->n++;
+    return 0;
+}
+
+//recreate the index from the students in the database
+static int index_rebuild(db_index_t *ix, int dbfd)
+{
+    struct rebuild_state st = { ix, 0 };
+
+    free(ix->ents);
+    ix->ents = NULL;
+    ix->n = 0;
+
+    if (scan_live(dbfd, rebuild_cb, &st) != NO_ERROR)
+        return ERR_DB_FILE;
+    qsort(ix->ents, ix->n, sizeof(idx_entry_t), entry_cmp);
+
+    memset(&ix->hdr, 0, sizeof(ix->hdr));
+    ix->hdr.magic = INDEX_MAGIC;
+    ix->hdr.version = INDEX_VERSION;
+    ix->hdr.kind = ix->kind;
+    if (db_stamp_get(dbfd, &ix->hdr.stamp) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (index_write_base(ix) != NO_ERROR)
+        return ERR_DB_FILE;
+    ix->valid = true;
+    return NO_ERROR;
+}
+
+/*
+ *  index_merge
+ *      base:    sorted base entries
+ *      nbase:   number of base entries
+ *      log:     delta entries in the order they were appended
+ *      nlog:    number of delta entries
+ *
+ *  Applies the delta log to the base.  For each id only the last delta
+ *  counts: base entries of every id named in the log are dropped, and the
+ *  ids whose last delta is an add are merged back in key order.
+ *
+ *  returns:  NO_ERROR and the merged entries in ix, or ERR_DB_FILE
+ */
+static int index_merge(db_index_t *ix, const idx_entry_t *base, size_t nbase,
+                       const idx_entry_t *log, size_t nlog)
+{
+    delta_t *d = malloc(nlog * sizeof(delta_t));
+    int *touched = malloc(nlog * sizeof(int));
+    idx_entry_t *adds = malloc(nlog * sizeof(idx_entry_t));
+    idx_entry_t *out = malloc((nbase + nlog) * sizeof(idx_entry_t));
+    size_t ntouched = 0, nadds = 0, n = 0;
+
+    if (d == NULL || touched == NULL || adds == NULL || out == NULL) {
+        free(d);
+        free(touched);
+        free(adds);
+        free(out);
+        return ERR_DB_FILE;
+    }
+
+    for (size_t i = 0; i < nlog; i++) {
+        d[i].e = log[i];
+        d[i].seq = i;
+    }
+    qsort(d, nlog, sizeof(delta_t), delta_cmp);
+
+    for (size_t i = 0; i < nlog; i++) {
+        if (i + 1 < nlog && d[i + 1].e.id == d[i].e.id)
+            continue;   // a later delta for this id wins
+        touched[ntouched++] = d[i].e.id;
+        if (d[i].e.op == INDEX_OP_ADD)
+            adds[nadds++] = d[i].e;
+    }
+    qsort(adds, nadds, sizeof(idx_entry_t), entry_cmp);
+
+    // touched is sorted because d was sorted by id
+    size_t a = 0;
+    for (size_t i = 0; i < nbase; i++) {
+        if (bsearch(&base[i].id, touched, ntouched, sizeof(int), int_cmp) != NULL)
+            continue;
+        while (a < nadds && entry_cmp(&adds[a], &base[i]) < 0)
+            out[n++] = adds[a++];
+        out[n++] = base[i];
+    }
+    while (a < nadds)
+        out[n++] = adds[a++];
+
+    free(d);
+    free(touched);
+    free(adds);
+    free(ix->ents);
+    ix->ents = out;
+    ix->n = n;
+    return NO_ERROR;
+}
+
+/*
+ *  index_load
+ *      dbfd:  database file descriptor
+ *
+ *  Loads the index for a query.  A stale index is rebuilt from the
+ *  database, otherwise the base and the delta log are read with one read
+ *  and merged, and the merged result is written back once the log is big
+ *  enough to be worth compacting.  On success ix->ents holds ix->n entries
+ *  sorted by (key, id).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int index_load(db_index_t *ix, int dbfd)
+{
+    db_stamp_t stamp;
+
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (!ix->valid || !db_stamp_equal(&stamp, &ix->hdr.stamp))
+        return index_rebuild(ix, dbfd);
+
+    size_t total = (ix->end - INDEX_HDR_SIZE) / sizeof(idx_entry_t);
+    idx_entry_t *all = malloc(total * sizeof(idx_entry_t) + 1);
+    if (all == NULL)
+        return ERR_DB_FILE;
+    size_t len = total * sizeof(idx_entry_t);
+    if (io_pread(ix->fd, all, len, INDEX_HDR_SIZE) != (ssize_t)len) {
+        free(all);
+        return index_rebuild(ix, dbfd);
+    }
+
+    size_t nbase = ix->hdr.nbase;
+    size_t nlog = total - nbase;
+    if (nlog == 0) {
+        free(ix->ents);
+        ix->ents = all;
+        ix->n = nbase;
+        return NO_ERROR;
+    }
+
+    int rc = index_merge(ix, all, nbase, all + nbase, nlog);
+    free(all);
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (nlog > INDEX_COMPACT_MIN && nlog > nbase / INDEX_COMPACT_RATIO)
+        index_write_base(ix);   // best effort, the merged view is correct
+    return NO_ERROR;
+}
+
+//read the header back, the index is valid if it describes the database
+static void index_read_hdr(db_index_t *ix, const db_stamp_t *stamp)
+{
+    struct stat st;
+
+    ix->valid = false;
+    if (io_pread(ix->fd, &ix->hdr, sizeof(ix->hdr), 0) == sizeof(ix->hdr) &&
+        fstat(ix->fd, &st) == 0 &&
+        ix->hdr.magic == INDEX_MAGIC && ix->hdr.version == INDEX_VERSION &&
+        ix->hdr.kind == (uint32_t)ix->kind &&
+        db_stamp_equal(&ix->hdr.stamp, stamp) &&
+        (st.st_size - INDEX_HDR_SIZE) % sizeof(idx_entry_t) == 0 &&
+        (uint64_t)(st.st_size - INDEX_HDR_SIZE) / sizeof(idx_entry_t) >= ix->hdr.nbase) {
+        ix->valid = true;
+        ix->end = st.st_size;
+    }
+}
+
+/*
+ *  index_open
+ *      dbpath:  path of the database file
+ *      dbfd:    database file descriptor
+ *      kind:    INDEX_LNAME or INDEX_GPA
+ *      fresh:   true if the database was just created or truncated
+ *
+ *  Opens an index sidecar for maintenance.  Only the header is read: if it
+ *  does not describe the current database the index is marked stale, its
+ *  updates are skipped, and the next query rebuilds it.
+ *
+ *  returns:  the index, or NULL if it is not available
+ */
+db_index_t *index_open(const char *dbpath, int dbfd, int kind, bool fresh)
+{
+    db_index_t *ix = calloc(1, sizeof(*ix));
+    db_stamp_t stamp;
+
+    if (ix == NULL)
+        return NULL;
+    ix->kind = kind;
+    if (sidecar_path(dbpath, index_suffix(kind), ix->path, sizeof(ix->path)) != NO_ERROR ||
+        db_stamp_get(dbfd, &stamp) != NO_ERROR) {
+        free(ix);
+        return NULL;
+    }
+
+    ix->fd = open(ix->path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (ix->fd < 0) {
+        free(ix);
+        return NULL;
+    }
+
+    if (fresh) {
+        ix->hdr.magic = INDEX_MAGIC;
+        ix->hdr.version = INDEX_VERSION;
+        ix->hdr.kind = kind;
+        ix->hdr.stamp = stamp;
+        if (ftruncate(ix->fd, 0) == -1 ||
+            pwrite_all(ix->fd, &ix->hdr, sizeof(ix->hdr), 0) != NO_ERROR) {
+            index_close(ix);
+            return NULL;
+        }
+        ix->valid = true;
+        ix->end = INDEX_HDR_SIZE;
+        return ix;
+    }
+
+    index_read_hdr(ix, &stamp);
+    return ix;
+}
+
+void index_close(db_index_t *ix)
+{
+    if (ix == NULL)
+        return;
+    close(ix->fd);
+    free(ix->ents);
+    free(ix);
+}
+
+/*
+ *  index_refresh
+ *      dbfd:  database file descriptor
+ *
+ *  Picks up changes made by other processes (see dblock.h): reopens the
+ *  sidecar if it was compacted into a new file, then re-reads the header
+ *  and the end of the delta log.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int index_refresh(db_index_t *ix, int dbfd)
+{
+    struct stat cur, st;
+    db_stamp_t stamp;
+
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (stat(ix->path, &st) == 0 && fstat(ix->fd, &cur) == 0 && st.st_ino != cur.st_ino) {
+        int fd = open(ix->path, O_RDWR);
+        if (fd < 0)
+            return ERR_DB_FILE;
+        close(ix->fd);
+        ix->fd = fd;
+    }
+    index_read_hdr(ix, &stamp);
+    return NO_ERROR;
+}
+
+static int index_append(db_index_t *ix, const idx_entry_t *e, size_t n)
+{
+    if (pwrite_all(ix->fd, e, n * sizeof(idx_entry_t), ix->end) != NO_ERROR)
+        return ERR_DB_FILE;
+    ix->end += n * sizeof(idx_entry_t);
+    return NO_ERROR;
+}
+
+/*
+ *  index_add
+ *      recs:  students that were added to the database
+ *      n:     number of students in recs
+ *
+ *  Appends an add entry for each student with a single write.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int index_add(db_index_t *ix, const student_t *recs, int n)
+{
+    idx_entry_t one;
+    idx_entry_t *e = &one;
+
+    if (!ix->valid || n <= 0)
+        return NO_ERROR;
+    if (n > 1 && (e = malloc(n * sizeof(idx_entry_t))) == NULL)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++) {
+        e[i].key = index_key(ix->kind, &recs[i]);
+        e[i].id = recs[i].id;
+        e[i].op = INDEX_OP_ADD;
+    }
+    int rc = index_append(ix, e, n);
+
+    if (e != &one)
+        free(e);
+    return rc;
+}
+
+/*
+ *  index_del
+ *      id:  id of the student that was deleted
+ *
+ *  Appends a delete entry.  Deletes only carry the id so the deleted
+ *  record does not have to be read to compute its key.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int index_del(db_index_t *ix, int id)
+{
+    idx_entry_t e = { 0, id, INDEX_OP_DEL };
+
+    if (!ix->valid)
+        return NO_ERROR;
+    return index_append(ix, &e, 1);
+}
+
+/*
+ *  index_stamp
+ *      dbfd:  database file descriptor
+ *
+ *  Records the current identity of the database in the index header, see
+ *  bitmap_stamp().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int index_stamp(db_index_t *ix, int dbfd)
+{
+    db_stamp_t stamp;
+
+    if (!ix->valid)
+        return NO_ERROR;
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_stamp_equal(&stamp, &ix->hdr.stamp))
+        return NO_ERROR;
+    ix->hdr.stamp = stamp;
+    return pwrite_all(ix->fd, &ix->hdr, sizeof(ix->hdr), 0);
+}
+
+/*
+ *  index_lower_bound
+ *      key:  key to search for
+ *
+ *  returns:  position of the first loaded entry whose key is >= key, or
+ *            ix->n if there is none
+ */
+size_t index_lower_bound(const db_index_t *ix, uint64_t key)
+{
+    size_t lo = 0, hi = ix->n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ix->ents[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
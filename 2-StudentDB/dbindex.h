@@ -0,0 +1,74 @@
+#ifndef __DBINDEX_H__
+    #define __DBINDEX_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "db.h"
+#include "dbctx.h"
+
+//Secondary indexes map a key derived from a student (a hash of lname, or
+//the integer gpa) to student ids.  Each index is a sidecar file holding a
+//sorted "base" array of entries followed by an append-only log of changes:
+//
+//    [ header | base entries sorted by (key, id) | delta entries ... ]
+//
+//add_student() and del_student() append one 16 byte delta entry with a
+//single write, so updates never rewrite the index and a reader never sees
+//a half written change.  Queries merge the deltas into the base in memory,
+//and once the log grows past INDEX_COMPACT_RATIO of the base the merged
+//index is written to a temp file that is renamed over the old one.
+#define LNAME_INDEX_SUFFIX  ".lname.idx"
+#define GPA_INDEX_SUFFIX    ".gpa.idx"
+#define INDEX_MAGIC         0x58444e49      // "INDX"
+#define INDEX_VERSION       2
+#define INDEX_HDR_SIZE      64
+#define INDEX_COMPACT_MIN   1024            // deltas always tolerated
+#define INDEX_COMPACT_RATIO 8               // compact when deltas > base/8
+
+#define INDEX_LNAME         1
+#define INDEX_GPA           2
+
+#define INDEX_OP_ADD        1
+#define INDEX_OP_DEL        -1
+
+typedef struct idx_entry {
+    uint64_t key;           // unused for INDEX_OP_DEL entries
+    int32_t id;
+    int32_t op;             // INDEX_OP_ADD or INDEX_OP_DEL, base is all adds
+} idx_entry_t;
+
+typedef struct idx_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;          // INDEX_LNAME or INDEX_GPA
+    uint32_t pad0;
+    db_stamp_t stamp;       // database file the index describes
+    uint64_t nbase;         // number of sorted base entries
+    char pad[INDEX_HDR_SIZE - 56];
+} idx_hdr_t;
+
+typedef struct db_index {
+    int fd;
+    int kind;
+    char path[PATH_MAX];
+    bool valid;             // false if stale, rebuilt by the next query
+    off_t end;              // where the next delta entry is appended
+    idx_hdr_t hdr;
+    idx_entry_t *ents;      // merged entries after index_load()
+    size_t n;
+} db_index_t;
+
+//prototypes
+db_index_t *index_open(const char *dbpath, int dbfd, int kind, bool fresh);
+void index_close(db_index_t *ix);
+uint64_t index_key(int kind, const student_t *s);
+int index_add(db_index_t *ix, const student_t *recs, int n);
+int index_del(db_index_t *ix, int id);
+int index_stamp(db_index_t *ix, int dbfd);
+int index_load(db_index_t *ix, int dbfd);
+int index_refresh(db_index_t *ix, int dbfd);
+size_t index_lower_bound(const db_index_t *ix, uint64_t key);
+
+#endif
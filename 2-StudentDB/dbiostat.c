@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbiostat.h"
+
+static const char *op_names[IO_NOPS] = { "read", "write", "seek", "sync", "rename" };
+
+static bool io_on;
+static io_stats_t io_stats;
+
+//turn counting on or off for the whole process, off by default
+void iostat_enable(bool on)
+{
+    io_on = on;
+}
+
+bool iostat_enabled(void)
+{
+    return io_on;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ *  io_done
+ *      op:  IO_READ .. IO_RENAME
+ *      t0:  now_ns() before the call
+ *      rc:  what the call returned, bytes for reads and writes
+ *
+ *  Adds one call to the totals of op.  Shard threads make calls at the
+ *  same time, so every total is updated atomically.  errno is kept.
+ */
+static void io_done(int op, uint64_t t0, ssize_t rc)
+{
+    int saved = errno;
+    io_op_stats_t *st = &io_stats.op[op];
+    uint64_t ns = now_ns() - t0;
+    uint64_t us = ns / 1000;
+    int b = 0;
+
+    while (b < IOSTAT_BUCKETS - 1 && (us >> b) != 0)
+        b++;
+    __atomic_fetch_add(&st->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->hist[b], 1, __ATOMIC_RELAXED);
+    if (rc < 0)
+        __atomic_fetch_add(&st->errors, 1, __ATOMIC_RELAXED);
+    else if (op == IO_READ || op == IO_WRITE)
+        __atomic_fetch_add(&st->bytes, (uint64_t)rc, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&st->max_ns, &max, ns, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    errno = saved;
+}
+
+ssize_t io_pread(int fd, void *buf, size_t len, off_t off)
+{
+    if (!io_on)
+        return pread(fd, buf, len, off);
+    uint64_t t0 = now_ns();
+    ssize_t n = pread(fd, buf, len, off);
+    io_done(IO_READ, t0, n);
+    return n;
+}
+
+ssize_t io_pwrite(int fd, const void *buf, size_t len, off_t off)
+{
+    if (!io_on)
+        return pwrite(fd, buf, len, off);
+    uint64_t t0 = now_ns();
+    ssize_t n = pwrite(fd, buf, len, off);
+    io_done(IO_WRITE, t0, n);
+    return n;
+}
+
+ssize_t io_pwritev(int fd, const struct iovec *iov, int niov, off_t off)
+{
+    if (!io_on)
+        return pwritev(fd, iov, niov, off);
+    uint64_t t0 = now_ns();
+    ssize_t n = pwritev(fd, iov, niov, off);
+    io_done(IO_WRITE, t0, n);
+    return n;
+}
+
+ssize_t io_read(int fd, void *buf, size_t len)
+{
+    if (!io_on)
+        return read(fd, buf, len);
+    uint64_t t0 = now_ns();
+    ssize_t n = read(fd, buf, len);
+    io_done(IO_READ, t0, n);
+    return n;
+}
+
+ssize_t io_write(int fd, const void *buf, size_t len)
+{
+    if (!io_on)
+        return write(fd, buf, len);
+    uint64_t t0 = now_ns();
+    ssize_t n = write(fd, buf, len);
+    io_done(IO_WRITE, t0, n);
+    return n;
+}
+
+off_t io_lseek(int fd, off_t off, int whence)
+{
+    if (!io_on)
+        return lseek(fd, off, whence);
+    uint64_t t0 = now_ns();
+    off_t pos = lseek(fd, off, whence);
+    io_done(IO_SEEK, t0, (pos < 0) ? -1 : 0);
+    return pos;
+}
+
+int io_fsync(int fd)
+{
+    if (!io_on)
+        return fsync(fd);
+    uint64_t t0 = now_ns();
+    int rc = fsync(fd);
+    io_done(IO_SYNC, t0, rc);
+    return rc;
+}
+
+int io_fdatasync(int fd)
+{
+    if (!io_on)
+        return fdatasync(fd);
+    uint64_t t0 = now_ns();
+    int rc = fdatasync(fd);
+    io_done(IO_SYNC, t0, rc);
+    return rc;
+}
+
+int io_rename(const char *from, const char *to)
+{
+    if (!io_on)
+        return rename(from, to);
+    uint64_t t0 = now_ns();
+    int rc = rename(from, to);
+    io_done(IO_RENAME, t0, rc);
+    return rc;
+}
+
+//copy of the totals since the process started counting
+void iostat_get(io_stats_t *out)
+{
+    for (int op = 0; op < IO_NOPS; op++) {
+        const io_op_stats_t *st = &io_stats.op[op];
+        io_op_stats_t *o = &out->op[op];
+
+        o->calls = __atomic_load_n(&st->calls, __ATOMIC_RELAXED);
+        o->errors = __atomic_load_n(&st->errors, __ATOMIC_RELAXED);
+        o->bytes = __atomic_load_n(&st->bytes, __ATOMIC_RELAXED);
+        o->ns = __atomic_load_n(&st->ns, __ATOMIC_RELAXED);
+        o->max_ns = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+        for (int b = 0; b < IOSTAT_BUCKETS; b++)
+            o->hist[b] = __atomic_load_n(&st->hist[b], __ATOMIC_RELAXED);
+    }
+}
+
+//upper bound in microseconds of the bucket holding percentile pct of calls
+static uint64_t hist_percentile(const io_op_stats_t *st, int pct)
+{
+    uint64_t want = (st->calls * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int b = 0; b < IOSTAT_BUCKETS; b++) {
+        seen += st->hist[b];
+        if (seen >= want)
+            return (uint64_t)1 << b;
+    }
+    return (uint64_t)1 << (IOSTAT_BUCKETS - 1);
+}
+
+/*
+ *  iostat_print
+ *      out:      where the statistics go
+ *      command:  the sdbsc option they belong to, for example "-a"
+ *      json:     one JSON object instead of a table
+ *
+ *  Prints the totals of every kind of call.  Percentiles are the upper
+ *  bound of the histogram bucket they fall in; the JSON object carries
+ *  the histograms themselves.
+ */
+void iostat_print(FILE *out, const char *command, bool json)
+{
+    io_stats_t s;
+
+    iostat_get(&s);
+    if (json) {
+        fprintf(out, "{\"command\":\"%s\"", command);
+        for (int op = 0; op < IO_NOPS; op++) {
+            const io_op_stats_t *st = &s.op[op];
+
+            fprintf(out, ",\"%s\":{\"calls\":%llu,\"errors\":%llu,\"bytes\":%llu,"
+                    "\"ns\":%llu,\"max_ns\":%llu,\"hist_us_log2\":[",
+                    op_names[op], (unsigned long long)st->calls,
+                    (unsigned long long)st->errors, (unsigned long long)st->bytes,
+                    (unsigned long long)st->ns, (unsigned long long)st->max_ns);
+            for (int b = 0; b < IOSTAT_BUCKETS; b++)
+                fprintf(out, "%s%llu", b ? "," : "", (unsigned long long)st->hist[b]);
+            fprintf(out, "]}");
+        }
+        fprintf(out, "}\n");
+        return;
+    }
+
+    fprintf(out, "I/O statistics for %s:\n", command);
+    fprintf(out, "%-8s %8s %8s %12s %10s %10s %10s %10s\n",
+            "call", "count", "errors", "bytes", "total us", "max us", "p50 us", "p99 us");
+    for (int op = 0; op < IO_NOPS; op++) {
+        const io_op_stats_t *st = &s.op[op];
+
+        if (st->calls == 0) {
+            fprintf(out, "%-8s %8d %8s %12s %10s %10s %10s %10s\n",
+                    op_names[op], 0, "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+        fprintf(out, "%-8s %8llu %8llu %12llu %10llu %10llu %10llu %10llu\n",
+                op_names[op], (unsigned long long)st->calls,
+                (unsigned long long)st->errors, (unsigned long long)st->bytes,
+                (unsigned long long)(st->ns / 1000), (unsigned long long)(st->max_ns / 1000),
+                (unsigned long long)hist_percentile(st, 50),
+                (unsigned long long)hist_percentile(st, 99));
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef __DBIOSTAT_H__
+    #define __DBIOSTAT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//I/O statistics.  The database modules make their file system calls
+//through the io_* wrappers below instead of calling pread(), lseek(),
+//fdatasync() and friends directly.  While statistics are on, each wrapper
+//counts the call, its errors and the bytes moved, and puts its latency in
+//a log2 histogram of microseconds, per kind of call:
+//
+//  read    pread(), preadv(), read()
+//  write   pwrite(), pwritev(), write()
+//  seek    lseek(), SEEK_DATA and SEEK_HOLE included
+//  sync    fsync(), fdatasync()
+//  rename  rename()
+//
+//Accesses to mmap()ed sidecars and writes submitted through io_uring
+//(dbbatch.h) do not go through a system call per record and are not
+//counted, nor is the socket traffic of --serve.
+//
+//sdbsc --stats <command> runs the command as usual and then prints the
+//totals to stderr, --stats --json <command> prints them as one JSON
+//object instead.  A --serve process always counts and returns its totals
+//since start for an SRV_OP_IOSTATS request (dbserver.h).
+#define IO_READ             0
+#define IO_WRITE            1
+#define IO_SEEK             2
+#define IO_SYNC             3
+#define IO_RENAME           4
+#define IO_NOPS             5
+
+#define IOSTAT_BUCKETS      24      // bucket b: under 2^b microseconds
+
+typedef struct io_op_stats {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytes;         // moved by read and write calls
+    uint64_t ns;            // total latency
+    uint64_t max_ns;
+    uint64_t hist[IOSTAT_BUCKETS];  // the last bucket also takes the rest
+} io_op_stats_t;
+
+typedef struct io_stats {
+    io_op_stats_t op[IO_NOPS];
+} io_stats_t;
+
+//prototypes
+void iostat_enable(bool on);
+bool iostat_enabled(void);
+void iostat_get(io_stats_t *out);
+void iostat_print(FILE *out, const char *command, bool json);
+
+ssize_t io_pread(int fd, void *buf, size_t len, off_t off);
+ssize_t io_pwrite(int fd, const void *buf, size_t len, off_t off);
+ssize_t io_pwritev(int fd, const struct iovec *iov, int niov, off_t off);
+ssize_t io_read(int fd, void *buf, size_t len);
+ssize_t io_write(int fd, const void *buf, size_t len);
+off_t io_lseek(int fd, off_t off, int whence);
+int io_fsync(int fd);
+int io_fdatasync(int fd);
+int io_rename(const char *from, const char *to);
+
+#endif
@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dblock.h"
+
+_Static_assert(sizeof(lock_shm_t) <= LOCK_SHM_SIZE, "lock page too small");
+
+//take or release an OFD lock on [off, off + len) of the lock sidecar
+static int ofd_lock(int fd, short type, off_t off, off_t len, bool wait)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = off;
+    fl.l_len = len;
+
+    while (fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl) == -1) {
+        if (errno != EINTR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  lock_open
+ *      dbpath:  path of the database file
+ *
+ *  Opens (creating it if needed) the lock sidecar and maps its shared page.
+ *  The sidecar is never reset, other processes may be using it.
+ *
+ *  returns:  the lock state, or NULL if it is not available
+ */
+db_lock_t *lock_open(const char *dbpath)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (sidecar_path(dbpath, LOCK_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return NULL;
+
+    db_lock_t *lk = calloc(1, sizeof(*lk));
+    if (lk == NULL)
+        return NULL;
+
+    lk->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (lk->fd < 0) {
+        free(lk);
+        return NULL;
+    }
+
+    // growing a short file to the page size is harmless if two processes race
+    if (fstat(lk->fd, &st) == -1 ||
+        (st.st_size < LOCK_SHM_SIZE && ftruncate(lk->fd, LOCK_SHM_SIZE) == -1)) {
+        close(lk->fd);
+        free(lk);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, LOCK_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, lk->fd, 0);
+    if (p == MAP_FAILED) {
+        close(lk->fd);
+        free(lk);
+        return NULL;
+    }
+    lk->shm = p;
+
+    for (int i = 0; i < DB_LOCK_STRIPES; i++)
+        pthread_mutex_init(&lk->stripe_mu[i], NULL);
+    pthread_mutex_init(&lk->meta_mu, NULL);
+
+    if (lock_meta(lk) == NO_ERROR) {
+        if (lk->shm->magic != LOCK_MAGIC || lk->shm->version != LOCK_VERSION) {
+            memset(lk->shm, 0, sizeof(*lk->shm));
+            lk->shm->magic = LOCK_MAGIC;
+            lk->shm->version = LOCK_VERSION;
+            lk->shm->epoch = 1;
+        }
+        unlock_meta(lk);
+    }
+    return lk;
+}
+
+void lock_close(db_lock_t *lk)
+{
+    if (lk == NULL)
+        return;
+    munmap(lk->shm, LOCK_SHM_SIZE);
+    close(lk->fd);      // drops every OFD lock still held
+    for (int i = 0; i < DB_LOCK_STRIPES; i++)
+        pthread_mutex_destroy(&lk->stripe_mu[i]);
+    pthread_mutex_destroy(&lk->meta_mu);
+    free(lk);
+}
+
+int lock_stripe_of(int id)
+{
+    return (id / 64) % DB_LOCK_STRIPES;
+}
+
+//a writer that died inside lock_write_begin() left its stripe odd
+static void stripe_repair(db_lock_t *lk, int s)
+{
+    uint32_t seq = __atomic_load_n(&lk->shm->seq[s], __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        __atomic_store_n(&lk->shm->seq[s], seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ *  lock_stripe
+ *      id:  student id, its page selects the stripe
+ *
+ *  Blocks until the stripe of id is held exclusively by this thread.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int lock_stripe(db_lock_t *lk, int id)
+{
+    int s = lock_stripe_of(id);
+
+    pthread_mutex_lock(&lk->stripe_mu[s]);
+    if (ofd_lock(lk->fd, F_WRLCK, LOCK_STRIPE_OFF + s, 1, true) != NO_ERROR) {
+        pthread_mutex_unlock(&lk->stripe_mu[s]);
+        return ERR_DB_FILE;
+    }
+    stripe_repair(lk, s);
+    return NO_ERROR;
+}
+
+/*
+ *  lock_stripe_try
+ *      id:  student id, its page selects the stripe
+ *
+ *  Same as lock_stripe() but does not wait.  Used by callers that already
+ *  hold other stripes, waiting there could deadlock with another process
+ *  doing the same.
+ *
+ *  returns:  true if the stripe is now held
+ */
+bool lock_stripe_try(db_lock_t *lk, int id)
+{
+    int s = lock_stripe_of(id);
+
+    if (pthread_mutex_trylock(&lk->stripe_mu[s]) != 0)
+        return false;
+    if (ofd_lock(lk->fd, F_WRLCK, LOCK_STRIPE_OFF + s, 1, false) != NO_ERROR) {
+        pthread_mutex_unlock(&lk->stripe_mu[s]);
+        return false;
+    }
+    stripe_repair(lk, s);
+    return true;
+}
+
+void unlock_stripe(db_lock_t *lk, int id)
+{
+    int s = lock_stripe_of(id);
+
+    ofd_lock(lk->fd, F_UNLCK, LOCK_STRIPE_OFF + s, 1, true);
+    pthread_mutex_unlock(&lk->stripe_mu[s]);
+}
+
+/*
+ *  lock_all_stripes
+ *
+ *  Locks every stripe, for operations on the whole database such as bulk
+ *  import, compaction of the file tail and checkpoints.  The OFD lock
+ *  covers all stripes with one range so it is taken atomically.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int lock_all_stripes(db_lock_t *lk)
+{
+    for (int s = 0; s < DB_LOCK_STRIPES; s++)
+        pthread_mutex_lock(&lk->stripe_mu[s]);
+    if (ofd_lock(lk->fd, F_WRLCK, LOCK_STRIPE_OFF, DB_LOCK_STRIPES, true) != NO_ERROR) {
+        for (int s = DB_LOCK_STRIPES; s-- > 0;)
+            pthread_mutex_unlock(&lk->stripe_mu[s]);
+        return ERR_DB_FILE;
+    }
+    for (int s = 0; s < DB_LOCK_STRIPES; s++)
+        stripe_repair(lk, s);
+    return NO_ERROR;
+}
+
+void unlock_all_stripes(db_lock_t *lk)
+{
+    ofd_lock(lk->fd, F_UNLCK, LOCK_STRIPE_OFF, DB_LOCK_STRIPES, true);
+    for (int s = DB_LOCK_STRIPES; s-- > 0;)
+        pthread_mutex_unlock(&lk->stripe_mu[s]);
+}
+
+int lock_meta(db_lock_t *lk)
+{
+    pthread_mutex_lock(&lk->meta_mu);
+    if (ofd_lock(lk->fd, F_WRLCK, LOCK_META_OFF, 1, true) != NO_ERROR) {
+        pthread_mutex_unlock(&lk->meta_mu);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+void unlock_meta(db_lock_t *lk)
+{
+    ofd_lock(lk->fd, F_UNLCK, LOCK_META_OFF, 1, true);
+    pthread_mutex_unlock(&lk->meta_mu);
+}
+
+/*
+ *  lock_alive_exclusive / lock_alive_shared
+ *
+ *  Called with the meta lock held while opening the database.  The
+ *  exclusive attempt succeeds only if no other process has the database
+ *  open, the shared lock is then kept until lock_close().
+ *
+ *  returns:  true if this is the only process using the database
+ */
+bool lock_alive_exclusive(db_lock_t *lk)
+{
+    return ofd_lock(lk->fd, F_WRLCK, LOCK_ALIVE_OFF, 1, false) == NO_ERROR;
+}
+
+void lock_alive_shared(db_lock_t *lk)
+{
+    ofd_lock(lk->fd, F_RDLCK, LOCK_ALIVE_OFF, 1, true);
+}
+
+/*
+ *  lock_write_begin / lock_write_end
+ *      id:  slot being written, its stripe must be held
+ *
+ *  Bracket an in place write of a slot so optimistic readers of the
+ *  stripe retry instead of using a torn record.
+ */
+void lock_write_begin(db_lock_t *lk, int id)
+{
+    __atomic_add_fetch(&lk->shm->seq[lock_stripe_of(id)], 1, __ATOMIC_ACQ_REL);
+}
+
+void lock_write_end(db_lock_t *lk, int id)
+{
+    __atomic_add_fetch(&lk->shm->seq[lock_stripe_of(id)], 1, __ATOMIC_RELEASE);
+}
+
+//same for a write that spans every stripe, such as a bulk import
+void lock_write_begin_all(db_lock_t *lk)
+{
+    for (int s = 0; s < DB_LOCK_STRIPES; s++)
+        __atomic_add_fetch(&lk->shm->seq[s], 1, __ATOMIC_ACQ_REL);
+}
+
+void lock_write_end_all(db_lock_t *lk)
+{
+    for (int s = 0; s < DB_LOCK_STRIPES; s++)
+        __atomic_add_fetch(&lk->shm->seq[s], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ *  lock_read_begin / lock_read_valid
+ *      id:   slot being read without a lock
+ *      seq:  value returned by lock_read_begin()
+ *
+ *  A read is valid if the stripe was not being written when it started
+ *  and nothing was written to the stripe while it ran.
+ */
+uint32_t lock_read_begin(db_lock_t *lk, int id)
+{
+    uint32_t seq;
+    int spins = 0;
+
+    while ((seq = __atomic_load_n(&lk->shm->seq[lock_stripe_of(id)], __ATOMIC_ACQUIRE)) & 1) {
+        if (++spins > LOCK_READ_SPINS)
+            break;
+        sched_yield();
+    }
+    return seq;
+}
+
+bool lock_read_valid(db_lock_t *lk, int id, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(seq & 1) &&
+           __atomic_load_n(&lk->shm->seq[lock_stripe_of(id)], __ATOMIC_ACQUIRE) == seq;
+}
+
+/*
+ *  lock_snap_claim
+ *
+ *  Takes a free snapshot slot and stamps it with the current epoch.  The
+ *  caller holds every stripe and the meta lock, so no write is half done
+ *  and no other process is claiming a slot, and has called
+ *  lock_snap_prune() to free the slots of dead processes.
+ *
+ *  returns:  the slot, or -1 if all LOCK_MAX_SNAPSHOTS are in use
+ */
+int lock_snap_claim(db_lock_t *lk)
+{
+    for (int i = 0; i < LOCK_MAX_SNAPSHOTS; i++) {
+        if (lk->shm->snap[i] != 0)
+            continue;
+        if (ofd_lock(lk->fd, F_WRLCK, LOCK_SNAP_OFF + i, 1, false) != NO_ERROR)
+            continue;
+        lk->snap_own |= 1ULL << i;
+        __atomic_store_n(&lk->shm->snap[i], __atomic_load_n(&lk->shm->epoch, __ATOMIC_ACQUIRE),
+                         __ATOMIC_RELEASE);
+        return i;
+    }
+    return -1;
+}
+
+void lock_snap_release(db_lock_t *lk, int slot)
+{
+    __atomic_store_n(&lk->shm->snap[slot], 0, __ATOMIC_RELEASE);
+    lk->snap_own &= ~(1ULL << slot);
+    ofd_lock(lk->fd, F_UNLCK, LOCK_SNAP_OFF + slot, 1, true);
+}
+
+/*
+ *  lock_snap_prune
+ *      min:  receives the oldest epoch of an open snapshot, 0 if none
+ *
+ *  Frees the slots whose owner died without releasing them: nobody holds
+ *  their lock any more.  Called with the meta lock held.
+ *
+ *  returns:  number of open snapshots
+ */
+int lock_snap_prune(db_lock_t *lk, uint64_t *min)
+{
+    int open = 0;
+
+    *min = 0;
+    for (int i = 0; i < LOCK_MAX_SNAPSHOTS; i++) {
+        uint64_t e = __atomic_load_n(&lk->shm->snap[i], __ATOMIC_ACQUIRE);
+        if (e == 0)
+            continue;
+        if (!(lk->snap_own & (1ULL << i))) {
+            struct flock fl;
+            memset(&fl, 0, sizeof(fl));
+            fl.l_type = F_WRLCK;
+            fl.l_whence = SEEK_SET;
+            fl.l_start = LOCK_SNAP_OFF + i;
+            fl.l_len = 1;
+            if (fcntl(lk->fd, F_OFD_GETLK, &fl) == 0 && fl.l_type == F_UNLCK) {
+                __atomic_store_n(&lk->shm->snap[i], 0, __ATOMIC_RELEASE);
+                continue;
+            }
+        }
+        open++;
+        if (*min == 0 || e < *min)
+            *min = e;
+    }
+    return open;
+}
+
+//newest epoch of an open snapshot, 0 if there is none
+uint64_t lock_snap_max(db_lock_t *lk)
+{
+    uint64_t max = 0;
+
+    for (int i = 0; i < LOCK_MAX_SNAPSHOTS; i++) {
+        uint64_t e = __atomic_load_n(&lk->shm->snap[i], __ATOMIC_ACQUIRE);
+        max = (e > max) ? e : max;
+    }
+    return max;
+}
+
+//current sequence counter of the stripe of id, odd while it is written
+uint32_t lock_seq(db_lock_t *lk, int id)
+{
+    return __atomic_load_n(&lk->shm->seq[lock_stripe_of(id)], __ATOMIC_ACQUIRE);
+}
+
+uint64_t lock_gen(db_lock_t *lk)
+{
+    return __atomic_load_n(&lk->shm->gen, __ATOMIC_ACQUIRE);
+}
+
+void lock_gen_bump(db_lock_t *lk)
+{
+    __atomic_add_fetch(&lk->shm->gen, 1, __ATOMIC_RELEASE);
+}
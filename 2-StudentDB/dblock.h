@@ -0,0 +1,94 @@
+#ifndef __DBLOCK_H__
+    #define __DBLOCK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+//Concurrency control for several processes and threads working on the same
+//database.  Locks are fcntl() OFD byte-range locks on the lock sidecar
+//(student.db.lck), paired with a pthread mutex for the same range because
+//OFD locks do not exclude threads sharing one open file description.
+//
+//  stripe locks   one per DB_LOCK_STRIPES, page p (ids p*64 .. p*64+63)
+//                 belongs to stripe p % DB_LOCK_STRIPES.  Held from the
+//                 duplicate check of an add or delete until the slot is
+//                 written, so check-then-write cannot race.  One bitmap
+//                 word describes one page, so it is only changed by the
+//                 holder of that page's stripe.
+//  meta lock      serializes updates of the shared sidecars (write-ahead
+//                 log, bitmap and index files).  Always taken after any
+//                 stripe lock, never before.
+//  alive lock     shared while a process has the database open.  The
+//                 write-ahead log is only replayed by a process that gets
+//                 it exclusively, that is when no other process can be in
+//                 the middle of a write.
+//
+//  snapshot locks one per open snapshot slot (see dbmvcc.h), held by the
+//                 process that owns the slot so a slot left behind by a
+//                 process that died can be told apart and reused.
+//
+//The first page of the sidecar is mapped shared by every process.  It
+//holds a sequence counter per stripe for optimistic reads (odd while a slot
+//of the stripe is being written), a generation counter bumped after every
+//sidecar update, which tells other processes to reload their cached
+//sidecar state, and the epochs of the open snapshots.
+#define LOCK_SUFFIX         ".lck"
+#define LOCK_MAGIC          0x4b434c53      // "SLCK"
+#define LOCK_VERSION        2
+#define LOCK_SHM_SIZE       4096
+#define DB_LOCK_STRIPES     64
+#define LOCK_READ_SPINS     64      // optimistic read attempts before locking
+#define LOCK_MAX_SNAPSHOTS  32      // snapshots open at once over all processes
+
+#define LOCK_STRIPE_OFF     0
+#define LOCK_META_OFF       DB_LOCK_STRIPES
+#define LOCK_ALIVE_OFF      (DB_LOCK_STRIPES + 1)
+#define LOCK_SNAP_OFF       (DB_LOCK_STRIPES + 2)
+
+typedef struct lock_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t gen;                       // bumped after every sidecar update
+    uint32_t seq[DB_LOCK_STRIPES];      // seqlock per stripe
+    uint64_t epoch;                     // bumped by writes while snapshots are open
+    uint64_t vers_gen;                  // bumped when the page versions are dropped
+    uint64_t snap[LOCK_MAX_SNAPSHOTS];  // epoch of each open snapshot, 0 if free
+} lock_shm_t;
+
+typedef struct db_lock {
+    int fd;
+    lock_shm_t *shm;
+    pthread_mutex_t stripe_mu[DB_LOCK_STRIPES];
+    pthread_mutex_t meta_mu;
+    uint64_t snap_own;                  // snapshot slots owned by this process
+} db_lock_t;
+
+//prototypes
+db_lock_t *lock_open(const char *dbpath);
+void lock_close(db_lock_t *lk);
+int lock_stripe_of(int id);
+int lock_stripe(db_lock_t *lk, int id);
+bool lock_stripe_try(db_lock_t *lk, int id);
+void unlock_stripe(db_lock_t *lk, int id);
+int lock_all_stripes(db_lock_t *lk);
+void unlock_all_stripes(db_lock_t *lk);
+int lock_meta(db_lock_t *lk);
+void unlock_meta(db_lock_t *lk);
+bool lock_alive_exclusive(db_lock_t *lk);
+void lock_alive_shared(db_lock_t *lk);
+void lock_write_begin(db_lock_t *lk, int id);
+void lock_write_end(db_lock_t *lk, int id);
+void lock_write_begin_all(db_lock_t *lk);
+void lock_write_end_all(db_lock_t *lk);
+uint32_t lock_read_begin(db_lock_t *lk, int id);
+bool lock_read_valid(db_lock_t *lk, int id, uint32_t seq);
+uint32_t lock_seq(db_lock_t *lk, int id);
+int lock_snap_claim(db_lock_t *lk);
+void lock_snap_release(db_lock_t *lk, int slot);
+int lock_snap_prune(db_lock_t *lk, uint64_t *min);
+uint64_t lock_snap_max(db_lock_t *lk);
+uint64_t lock_gen(db_lock_t *lk);
+void lock_gen_bump(db_lock_t *lk);
+
+#endif
@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbscan.h"
+#include "dbbitmap.h"
+#include "dblock.h"
+#include "dbmvcc.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(mvcc_ver_t) == 16, "mvcc_ver_t is stored on disk");
+_Static_assert(SCAN_BLOCK_SIZE % MVCC_PAGE_SIZE == 0, "scan blocks must be whole pages");
+
+static int mvcc_open(db_ctx_t *ctx, db_mvcc_t *mv)
+{
+    char path[PATH_MAX];
+
+    memset(mv, 0, sizeof(*mv));
+    mv->vfd = mv->ifd = -1;
+    if (sidecar_path(ctx->path, MVCC_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return ERR_DB_FILE;
+    mv->vfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (sidecar_path(ctx->path, MVCC_IDX_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return ERR_DB_FILE;
+    mv->ifd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (mv->vfd < 0 || mv->ifd < 0) {
+        mvcc_close(mv);
+        return ERR_DB_FILE;
+    }
+    mv->seen_gen = __atomic_load_n(&ctx->lock->shm->vers_gen, __ATOMIC_ACQUIRE);
+    return NO_ERROR;
+}
+
+void mvcc_close(db_mvcc_t *mv)
+{
+    if (mv->vfd >= 0)
+        close(mv->vfd);
+    if (mv->ifd >= 0)
+        close(mv->ifd);
+    free(mv->vers);
+    free(mv->prev);
+    free(mv->slots);
+    memset(mv, 0, sizeof(*mv));
+    mv->vfd = mv->ifd = -1;
+}
+
+static uint32_t page_hash(uint32_t page, uint32_t nslots)
+{
+    return (page * 0x9e3779b1u) & (nslots - 1);
+}
+
+//slot of page in the hash, holding its newest version or MVCC_NONE
+static uint32_t *ver_slot(db_mvcc_t *mv, uint32_t page)
+{
+    uint32_t k = page_hash(page, mv->nslots);
+
+    while (mv->slots[k] != MVCC_NONE && mv->vers[mv->slots[k]].page != page)
+        k = (k + 1) & (mv->nslots - 1);
+    return &mv->slots[k];
+}
+
+//newest version of page, older ones follow through prev[]
+static uint32_t ver_newest(const db_mvcc_t *mv, uint32_t page)
+{
+    if (mv->nslots == 0)
+        return MVCC_NONE;
+    return *ver_slot((db_mvcc_t *)mv, page);
+}
+
+//forget every version, the files were emptied
+static void ver_clear(db_mvcc_t *mv)
+{
+    mv->nvers = 0;
+    if (mv->nslots != 0)
+        memset(mv->slots, 0xff, (size_t)mv->nslots * sizeof(*mv->slots));
+}
+
+//room for n versions in vers[] and prev[]
+static int ver_reserve(db_mvcc_t *mv, uint32_t n)
+{
+    if (n <= mv->cap)
+        return NO_ERROR;
+    uint32_t ncap = mv->cap ? mv->cap : 64;
+    while (ncap < n)
+        ncap *= 2;
+    mvcc_ver_t *v = realloc(mv->vers, (size_t)ncap * sizeof(*v));
+    if (v == NULL)
+        return ERR_DB_FILE;
+    mv->vers = v;
+    uint32_t *p = realloc(mv->prev, (size_t)ncap * sizeof(*p));
+    if (p == NULL)
+        return ERR_DB_FILE;
+    mv->prev = p;
+    mv->cap = ncap;
+    return NO_ERROR;
+}
+
+/*
+ *  ver_chain
+ *      from:  first version not chained yet, nvers already counts them
+ *
+ *  Links versions [from, nvers) into the chains of their pages.  The hash
+ *  is rebuilt twice as large when it would become more than half full.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int ver_chain(db_mvcc_t *mv, uint32_t from)
+{
+    if ((uint64_t)mv->nvers * 2 > mv->nslots) {
+        uint32_t n = mv->nslots ? mv->nslots : 256;
+        while ((uint64_t)mv->nvers * 2 > n)
+            n *= 2;
+        uint32_t *slots = malloc((size_t)n * sizeof(*slots));
+        if (slots == NULL)
+            return ERR_DB_FILE;
+        free(mv->slots);
+        mv->slots = slots;
+        mv->nslots = n;
+        from = 0;
+    }
+    if (from == 0)
+        memset(mv->slots, 0xff, (size_t)mv->nslots * sizeof(*mv->slots));
+
+    for (uint32_t i = from; i < mv->nvers; i++) {
+        uint32_t *slot = ver_slot(mv, mv->vers[i].page);
+        mv->prev[i] = *slot;
+        *slot = i;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  mvcc_load
+ *      gen:  vers_gen of the lock page
+ *
+ *  Reads the index entries appended since the last call, or all of them
+ *  if the version files were emptied in the meantime.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int mvcc_load(db_mvcc_t *mv, uint64_t gen)
+{
+    struct stat st;
+
+    if (gen != mv->seen_gen) {
+        ver_clear(mv);
+        mv->seen_gen = gen;
+    }
+    if (fstat(mv->ifd, &st) == -1)
+        return ERR_DB_FILE;
+
+    uint32_t n = st.st_size / sizeof(mvcc_ver_t);
+    if (n < mv->nvers)
+        ver_clear(mv);
+    if (n == mv->nvers)
+        return NO_ERROR;
+
+    if (ver_reserve(mv, n) != NO_ERROR)
+        return ERR_DB_FILE;
+    uint32_t from = mv->nvers;
+    size_t len = (size_t)(n - from) * sizeof(mvcc_ver_t);
+    if (io_pread(mv->ifd, mv->vers + from, len, (off_t)from * sizeof(mvcc_ver_t)) != (ssize_t)len)
+        return ERR_DB_FILE;
+    mv->nvers = n;
+    return ver_chain(mv, from);
+}
+
+//the process wide index used by writers, opened on first use
+static db_mvcc_t *ctx_mvcc(db_ctx_t *ctx)
+{
+    if (ctx->mvcc == NULL) {
+        db_mvcc_t *mv = malloc(sizeof(*mv));
+        if (mv == NULL || mvcc_open(ctx, mv) != NO_ERROR) {
+            free(mv);
+            return NULL;
+        }
+        ctx->mvcc = mv;
+    }
+    return ctx->mvcc;
+}
+
+//drop every version, called with the meta lock held and no snapshot open
+static int mvcc_reset(db_ctx_t *ctx)
+{
+    db_mvcc_t *mv = ctx_mvcc(ctx);
+
+    if (mv == NULL || ftruncate(mv->ifd, 0) == -1 || ftruncate(mv->vfd, 0) == -1)
+        return ERR_DB_FILE;
+    mv->seen_gen = __atomic_add_fetch(&ctx->lock->shm->vers_gen, 1, __ATOMIC_ACQ_REL);
+    ver_clear(mv);
+    return NO_ERROR;
+}
+
+/*
+ *  mvcc_preserve
+ *      ctx:   database context
+ *      page:  page (MVCC_PAGE_RECORDS slots) about to be changed
+ *
+ *  Copies the page to the version files if an open snapshot may still
+ *  need it.  Called before any change to a slot of the page, with its
+ *  stripe and the meta lock held.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int mvcc_preserve(db_ctx_t *ctx, int64_t page)
+{
+    char img[MVCC_PAGE_SIZE];
+
+    if (ctx == NULL || ctx->lock == NULL)
+        return NO_ERROR;
+    uint64_t newest = lock_snap_max(ctx->lock);
+    if (newest == 0)
+        return NO_ERROR;
+
+    db_mvcc_t *mv = ctx_mvcc(ctx);
+    if (mv == NULL ||
+        mvcc_load(mv, __atomic_load_n(&ctx->lock->shm->vers_gen, __ATOMIC_ACQUIRE)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    uint64_t end = __atomic_add_fetch(&ctx->lock->shm->epoch, 1, __ATOMIC_ACQ_REL);
+    // a copy taken after the newest snapshot is what every snapshot sees,
+    // versions are appended in epoch order so the newest one tells
+    uint32_t last = ver_newest(mv, page);
+    if (last != MVCC_NONE && mv->vers[last].end > newest)
+        return NO_ERROR;
+
+    ssize_t n = io_pread(ctx->fd, img, sizeof(img), page * MVCC_PAGE_SIZE);
+    if (n < 0)
+        return ERR_DB_FILE;
+    memset(img + n, 0, sizeof(img) - n);
+
+    if (ver_reserve(mv, mv->nvers + 1) != NO_ERROR)
+        return ERR_DB_FILE;
+    mvcc_ver_t *v = &mv->vers[mv->nvers];
+    v->page = page;
+    v->pad = 0;
+    v->end = end;
+
+    // the copy goes first, readers only look at it once its entry exists
+    if (pwrite_all(mv->vfd, img, sizeof(img), (off_t)mv->nvers * MVCC_PAGE_SIZE) != NO_ERROR ||
+        pwrite_all(mv->ifd, v, sizeof(*v), (off_t)mv->nvers * sizeof(*v)) != NO_ERROR)
+        return ERR_DB_FILE;
+    mv->nvers++;
+    return ver_chain(mv, mv->nvers - 1);
+}
+
+static void page_set(uint64_t *live, int64_t first, int64_t end)
+{
+    for (int64_t p = first; p < end; p++)
+        live[p / 64] |= 1ULL << (p % 64);
+}
+
+/*
+ *  snap_map_pages
+ *
+ *  Records in snap->live the pages of the database that hold a student,
+ *  called by snap_begin() with every stripe held.  The occupancy bitmap
+ *  answers exactly; without it the data extents of the file are taken,
+ *  or every page if the filesystem can not tell them.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int snap_map_pages(db_ctx_t *ctx, db_snap_t *snap)
+{
+    int64_t npages = (snap->size + MVCC_PAGE_SIZE - 1) / MVCC_PAGE_SIZE;
+
+    snap->live = calloc(npages / 64 + 1, sizeof(uint64_t));
+    if (snap->live == NULL)
+        return ERR_DB_FILE;
+
+    if (ctx->bitmap != NULL) {
+        int64_t id = bitmap_next(ctx->bitmap, 0);
+        while (id >= 0 && id / MVCC_PAGE_RECORDS < npages) {
+            int64_t p = id / MVCC_PAGE_RECORDS;
+            page_set(snap->live, p, p + 1);
+            id = bitmap_next(ctx->bitmap, (p + 1) * MVCC_PAGE_RECORDS);
+        }
+        return NO_ERROR;
+    }
+
+    off_t pos = 0;
+    while (pos < snap->size) {
+        off_t data = io_lseek(ctx->fd, pos, SEEK_DATA);
+        if (data == -1) {
+            if (errno == ENXIO)
+                break;
+            if (errno != EINVAL)
+                return ERR_DB_FILE;
+            page_set(snap->live, pos / MVCC_PAGE_SIZE, npages);
+            break;
+        }
+        off_t hole = io_lseek(ctx->fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > snap->size)
+            hole = snap->size;
+        page_set(snap->live, data / MVCC_PAGE_SIZE,
+                 (hole + MVCC_PAGE_SIZE - 1) / MVCC_PAGE_SIZE);
+        pos = hole;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  snap_begin
+ *      ctx:   database context
+ *      snap:  receives the snapshot
+ *
+ *  Opens a snapshot at the current epoch.  Every stripe is taken while
+ *  the slot is claimed so no write straddles the snapshot.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the database is not shared through
+ *            the lock sidecar or every snapshot slot is in use, or
+ *            ERR_DB_FILE
+ */
+int snap_begin(db_ctx_t *ctx, db_snap_t *snap)
+{
+    struct stat st;
+    uint64_t oldest;
+    int rc = NO_ERROR;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->slot = -1;
+    if (ctx == NULL || ctx->lock == NULL)
+        return ERR_DB_OP;
+    if (db_ctx_lock_all(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_ctx_lock_meta(ctx) != NO_ERROR) {
+        db_ctx_unlock_all(ctx);
+        return ERR_DB_FILE;
+    }
+
+    // versions left from snapshots that are gone belong to no one
+    if (lock_snap_prune(ctx->lock, &oldest) == 0)
+        rc = mvcc_reset(ctx);
+    if (rc == NO_ERROR && fstat(ctx->fd, &st) == -1)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR) {
+        snap->size = st.st_size;
+        rc = snap_map_pages(ctx, snap);
+    }
+    if (rc == NO_ERROR) {
+        snap->slot = lock_snap_claim(ctx->lock);
+        if (snap->slot < 0)
+            rc = ERR_DB_OP;
+    }
+
+    db_ctx_unlock_meta(ctx, false);
+    db_ctx_unlock_all(ctx);
+    if (rc != NO_ERROR) {
+        free(snap->live);
+        snap->live = NULL;
+        return rc;
+    }
+
+    snap->ctx = ctx;
+    snap->epoch = ctx->lock->shm->snap[snap->slot];
+    pthread_mutex_init(&snap->mu, NULL);
+    if (mvcc_open(ctx, &snap->mv) != NO_ERROR) {
+        snap_end(snap);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  snap_end
+ *
+ *  Closes the snapshot and reclaims the versions no open snapshot needs
+ *  any more: all of them if this was the last one, otherwise those that
+ *  replaced a page before the oldest open snapshot was taken.
+ */
+void snap_end(db_snap_t *snap)
+{
+    db_ctx_t *ctx = snap->ctx;
+    uint64_t oldest;
+
+    if (ctx == NULL)
+        return;
+    bool locked = (db_ctx_lock_meta(ctx) == NO_ERROR);
+    lock_snap_release(ctx->lock, snap->slot);
+
+    if (locked) {
+        if (lock_snap_prune(ctx->lock, &oldest) == 0) {
+            mvcc_reset(ctx);
+        } else if (mvcc_load(&snap->mv, snap->mv.seen_gen) == NO_ERROR) {
+            for (uint32_t i = 0; i < snap->mv.nvers; i++) {
+                mvcc_ver_t *v = &snap->mv.vers[i];
+                if (v->end == 0 || v->end > oldest)
+                    continue;
+                v->end = 0;
+                fallocate(snap->mv.vfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          (off_t)i * MVCC_PAGE_SIZE, MVCC_PAGE_SIZE);
+                pwrite_all(snap->mv.ifd, v, sizeof(*v), (off_t)i * sizeof(*v));
+            }
+        }
+        db_ctx_unlock_meta(ctx, false);
+    }
+
+    mvcc_close(&snap->mv);
+    pthread_mutex_destroy(&snap->mu);
+    free(snap->live);
+    snap->live = NULL;
+    snap->ctx = NULL;
+}
+
+/*
+ *  snap_overlay
+ *      buf:   pages [p0, p0 + np) just read from the database
+ *
+ *  Replaces the pages changed since the snapshot with their versions.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int snap_overlay(db_snap_t *snap, char *buf, int64_t p0, int np)
+{
+    int32_t best[SCAN_BLOCK_SIZE / MVCC_PAGE_SIZE];
+    int rc = NO_ERROR;
+
+    for (int k = 0; k < np; k++)
+        best[k] = -1;
+
+    pthread_mutex_lock(&snap->mu);
+    if (mvcc_load(&snap->mv, snap->mv.seen_gen) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    // a chain runs from the newest version down, the last one that ended
+    // after the snapshot is the page as it was.  Reclaimed versions ended
+    // before every open snapshot, so nothing older is needed past them.
+    for (int k = 0; k < np && rc == NO_ERROR; k++) {
+        for (uint32_t i = ver_newest(&snap->mv, p0 + k);
+             i != MVCC_NONE && snap->mv.vers[i].end > snap->epoch; i = snap->mv.prev[i])
+            best[k] = i;
+    }
+    for (int k = 0; k < np && rc == NO_ERROR; k++) {
+        if (best[k] >= 0 &&
+            io_pread(snap->mv.vfd, buf + (size_t)k * MVCC_PAGE_SIZE, MVCC_PAGE_SIZE,
+                  (off_t)best[k] * MVCC_PAGE_SIZE) != MVCC_PAGE_SIZE)
+            rc = ERR_DB_FILE;
+    }
+    pthread_mutex_unlock(&snap->mu);
+    return rc;
+}
+
+static bool page_live(const uint64_t *live, int64_t p)
+{
+    return (live[p / 64] >> (p % 64)) & 1;
+}
+
+//first page >= p in the snapshot that held a student, pend if none
+static int64_t snap_next_page(const db_snap_t *snap, int64_t p, int64_t pend)
+{
+    while (p < pend) {
+        uint64_t w = snap->live[p / 64] >> (p % 64);
+        if (w != 0)
+            return (p + __builtin_ctzll(w) < pend) ? p + __builtin_ctzll(w) : pend;
+        p = (p / 64 + 1) * 64;
+    }
+    return pend;
+}
+
+/*
+ *  snap_scan
+ *      snap:     open snapshot
+ *      lo, hi:   ids [lo, hi) to scan
+ *      cb, arg:  as for scan_db()
+ *
+ *  scan_range() as of the snapshot.  Only the pages that held a student
+ *  when the snapshot was taken are read, runs of them a block at a time;
+ *  a page empty then reads as empty in the snapshot whatever happened to
+ *  it since.  Several threads may scan parts of one snapshot at once.
+ *
+ *  returns:  same as scan_db()
+ */
+int snap_scan(db_snap_t *snap, int64_t lo, int64_t hi, scan_cb_t cb, void *arg)
+{
+    int64_t end = snap->size / STUDENT_RECORD_SIZE;
+    int rc = NO_ERROR;
+
+    if (hi > end)
+        hi = end;
+    if (lo >= hi)
+        return NO_ERROR;
+
+    char *buf = aligned_alloc(64, SCAN_BLOCK_SIZE);
+    if (buf == NULL)
+        return ERR_DB_FILE;
+
+    int64_t pend = (hi + MVCC_PAGE_RECORDS - 1) / MVCC_PAGE_RECORDS;
+    for (int64_t p = lo / MVCC_PAGE_RECORDS; p < pend && rc == NO_ERROR;) {
+        p = snap_next_page(snap, p, pend);
+        if (p == pend)
+            break;
+        int64_t np = 1;
+        while (np < SCAN_BLOCK_SIZE / MVCC_PAGE_SIZE && p + np < pend &&
+               page_live(snap->live, p + np))
+            np++;
+        int64_t first = p * MVCC_PAGE_RECORDS;
+        size_t len = np * MVCC_PAGE_SIZE;
+
+        // the database first, then the versions, see dbmvcc.h
+        ssize_t n = io_pread(snap->ctx->fd, buf, len, first * STUDENT_RECORD_SIZE);
+        if (n < 0) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        memset(buf + n, 0, len - n);
+        rc = snap_overlay(snap, buf, first / MVCC_PAGE_RECORDS, np);
+
+        const student_t *recs = (const student_t *)buf;
+        for (int64_t id = (first > lo) ? first : lo;
+             id < first + np * MVCC_PAGE_RECORDS && id < hi && rc == NO_ERROR; id++) {
+            if (!record_is_empty(&recs[id - first]))
+                rc = cb(&recs[id - first], arg);
+        }
+        p += np;
+    }
+
+    free(buf);
+    return rc;
+}
+
+/*
+ *  scan_snapshot
+ *      fd:       database file descriptor
+ *      cb, arg:  as for scan_db()
+ *
+ *  scan_live() over a consistent view of the database: a snapshot if
+ *  one can be opened, otherwise the scan holds every stripe.
+ *
+ *  returns:  same as scan_db()
+ */
+int scan_snapshot(int fd, scan_cb_t cb, void *arg)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    db_snap_t snap;
+    int rc;
+
+    if (ctx != NULL && snap_begin(ctx, &snap) == NO_ERROR) {
+        rc = snap_scan(&snap, 0, INT64_MAX, cb, arg);
+        snap_end(&snap);
+        return rc;
+    }
+
+    if (ctx != NULL && db_ctx_lock_all(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = scan_live(fd, cb, arg);
+    if (ctx != NULL)
+        db_ctx_unlock_all(ctx);
+    return rc;
+}
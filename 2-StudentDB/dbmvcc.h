@@ -0,0 +1,89 @@
+#ifndef __DBMVCC_H__
+    #define __DBMVCC_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "db.h"
+#include "dbctx.h"
+#include "dbscan.h"
+
+//Snapshot isolation for long scans such as -p, -e and -k.  A scan that
+//reads student.db while other processes add and delete students would
+//otherwise see some of their changes and miss others.
+//
+//  epoch       a counter in the shared lock page (see dblock.h).  Opening
+//              a snapshot records the current epoch in a slot of the lock
+//              page; it takes every stripe for a moment, so no write is
+//              half done at that point.  While any snapshot is open every
+//              write first bumps the epoch.
+//  versions    before a writer changes a page it copies the page as it is
+//              now to the .mvcc sidecar, unless a copy made after the
+//              newest open snapshot exists already, and appends
+//              mvcc_ver_t{page, end} to .mvcc.idx, where end is the epoch
+//              of the write.  Version i is page slot i of .mvcc.
+//  reading     a snapshot taken at epoch E reads a page from the database
+//              and then looks it up in the index: the version with the
+//              smallest end > E, if there is one, is the page as it was at
+//              E.  The index is read after the page, and versions are
+//              written before the page is changed, so a change that races
+//              with the read always has its version in place.  Only pages
+//              that held a student at E are read at all: snap_begin()
+//              records them from the occupancy bitmap (or the data extents
+//              of the file without one) while every stripe is held.
+//  reclaim     closing a snapshot punches the versions no open snapshot
+//              needs (end <= oldest open epoch) out of .mvcc, and the last
+//              snapshot to close truncates both files.
+//
+//Each process chains the versions it loaded by page, with a small hash of
+//page to newest version, so neither a writer nor a reader looks at the
+//versions of other pages.
+//
+//Readers never wait for writers while scanning, writers only pay for a
+//page copy when a snapshot is open.  Versions are only kept for databases
+//shared through the lock sidecar; without it scans lock every stripe.
+#define MVCC_SUFFIX         ".mvcc"
+#define MVCC_IDX_SUFFIX     ".mvcc.idx"
+#define MVCC_PAGE_SIZE      4096
+#define MVCC_PAGE_RECORDS   (MVCC_PAGE_SIZE / (int)sizeof(student_t))
+#define MVCC_NONE           UINT32_MAX      // end of a version chain
+
+typedef struct mvcc_ver {
+    uint32_t page;
+    uint32_t pad;
+    uint64_t end;           // epoch of the write that replaced it, 0 if reclaimed
+} mvcc_ver_t;
+
+//the version index as loaded by one process
+typedef struct db_mvcc {
+    int vfd;                // page copies
+    int ifd;                // mvcc_ver_t per copy
+    mvcc_ver_t *vers;
+    uint32_t *prev;         // per version, the older version of its page
+    uint32_t nvers;
+    uint32_t cap;
+    uint32_t *slots;        // hash of page to its newest version
+    uint32_t nslots;        // a power of two, at least twice nvers
+    uint64_t seen_gen;      // vers_gen of the lock page when loaded
+} db_mvcc_t;
+
+typedef struct db_snap {
+    db_ctx_t *ctx;
+    int slot;               // slot in the lock page
+    uint64_t epoch;
+    off_t size;             // database size when the snapshot was taken
+    uint64_t *live;         // bit per page, set if it held a student then
+    db_mvcc_t mv;           // own copy of the index, grown while reading
+    pthread_mutex_t mu;     // guards mv for scans split over threads
+} db_snap_t;
+
+//prototypes
+int snap_begin(db_ctx_t *ctx, db_snap_t *snap);
+void snap_end(db_snap_t *snap);
+int snap_scan(db_snap_t *snap, int64_t lo, int64_t hi, scan_cb_t cb, void *arg);
+int scan_snapshot(int fd, scan_cb_t cb, void *arg);
+int mvcc_preserve(db_ctx_t *ctx, int64_t page);
+void mvcc_close(db_mvcc_t *mv);
+
+#endif
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbimport.h"
+#include "dbcrc.h"
+#include "dbmvcc.h"
+#include "dbpack.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(pack_hdr_t) == PACK_HDR_SIZE, "pack header size");
+_Static_assert(sizeof(pack_page_hdr_t) == 8, "page header size");
+_Static_assert(PACK_PAGE_SIZE <= UINT16_MAX, "slots are 16 bit offsets");
+
+//state of pack_db() while the database is scanned
+typedef struct pack_writer {
+    char *out;              // pages followed by the dictionary
+    size_t len;
+    size_t cap;
+    char page[PACK_PAGE_SIZE];
+    pack_page_hdr_t ph;     // header of the page being filled
+    int prev_id;
+    uint32_t npages;
+    uint32_t nrecs;
+    char *names;            // interned names, each NUL terminated
+    size_t names_len;
+    size_t names_cap;
+    uint32_t *name_off;     // code -> offset in names
+    uint32_t nnames;
+    uint32_t name_cap;
+    uint32_t *hash;         // open addressing, code + 1, 0 is empty
+    uint32_t hash_size;
+} pack_writer_t;
+
+static int grow(void **buf, size_t *cap, size_t need, size_t elem)
+{
+    if (need <= *cap)
+        return NO_ERROR;
+
+    size_t ncap = *cap ? *cap : 1024;
+    while (ncap < need)
+        ncap *= 2;
+    void *p = realloc(*buf, ncap * elem);
+    if (p == NULL)
+        return ERR_DB_FILE;
+    *buf = p;
+    *cap = ncap;
+    return NO_ERROR;
+}
+
+static char *put_varint(char *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+    return p;
+}
+
+//decode a varint from [*p, end), false if it runs past end or 32 bits
+static bool get_varint(const unsigned char **p, const unsigned char *end, uint32_t *v)
+{
+    uint32_t x = 0;
+
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*p >= end)
+            return false;
+        unsigned char b = *(*p)++;
+        x |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t name_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static int intern_rehash(pack_writer_t *w)
+{
+    uint32_t size = w->hash_size ? w->hash_size * 2 : PACK_HASH_MIN;
+    uint32_t *hash = calloc(size, sizeof(*hash));
+
+    if (hash == NULL)
+        return ERR_DB_FILE;
+    for (uint32_t code = 0; code < w->nnames; code++) {
+        uint32_t h = name_hash(w->names + w->name_off[code]) & (size - 1);
+        while (hash[h] != 0)
+            h = (h + 1) & (size - 1);
+        hash[h] = code + 1;
+    }
+    free(w->hash);
+    w->hash = hash;
+    w->hash_size = size;
+    return NO_ERROR;
+}
+
+/*
+ *  intern
+ *      name:  fname or lname of a student
+ *      code:  receives the dictionary code of the name
+ *
+ *  Returns the code of name, adding it to the dictionary the first time
+ *  it is seen.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE when out of memory
+ */
+static int intern(pack_writer_t *w, const char *name, uint32_t *code)
+{
+    if (2 * (w->nnames + 1) > w->hash_size && intern_rehash(w) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    uint32_t h = name_hash(name) & (w->hash_size - 1);
+    for (; w->hash[h] != 0; h = (h + 1) & (w->hash_size - 1)) {
+        if (strcmp(w->names + w->name_off[w->hash[h] - 1], name) == 0) {
+            *code = w->hash[h] - 1;
+            return NO_ERROR;
+        }
+    }
+
+    size_t len = strlen(name) + 1;
+    size_t ncap = w->name_cap;
+    if (grow((void **)&w->names, &w->names_cap, w->names_len + len, 1) != NO_ERROR ||
+        grow((void **)&w->name_off, &ncap, w->nnames + 1, sizeof(uint32_t)) != NO_ERROR)
+        return ERR_DB_FILE;
+    w->name_cap = ncap;
+
+    memcpy(w->names + w->names_len, name, len);
+    w->name_off[w->nnames] = w->names_len;
+    w->names_len += len;
+    w->hash[h] = w->nnames + 1;
+    *code = w->nnames++;
+    return NO_ERROR;
+}
+
+//append the page being filled to the output and start an empty one
+static int flush_page(pack_writer_t *w)
+{
+    if (w->ph.nslots == 0)
+        return NO_ERROR;
+    if (grow((void **)&w->out, &w->cap, w->len + PACK_PAGE_SIZE, 1) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    memcpy(w->page, &w->ph, sizeof(w->ph));
+    memcpy(w->out + w->len, w->page, PACK_PAGE_SIZE);
+    w->len += PACK_PAGE_SIZE;
+    w->npages++;
+
+    memset(w->page, 0, sizeof(w->page));
+    memset(&w->ph, 0, sizeof(w->ph));
+    return NO_ERROR;
+}
+
+static int pack_cb(const student_t *s, void *arg)
+{
+    pack_writer_t *w = arg;
+    char rec[PACK_REC_MAX];
+    uint32_t fcode, lcode;
+
+    if (intern(w, s->fname, &fcode) != NO_ERROR ||
+        intern(w, s->lname, &lcode) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // a record needs its bytes and a slot; the delta of slot 0 is 0
+    int delta = (w->ph.nslots == 0) ? 0 : s->id - w->prev_id;
+    size_t len = put_varint(put_varint(put_varint(put_varint(rec, delta), fcode),
+                                       lcode), s->gpa) - rec;
+    size_t slots = 2 * (w->ph.nslots + 1);
+    if (w->ph.nslots > 0 && w->ph.data_end + len + slots > PACK_PAGE_SIZE) {
+        if (flush_page(w) != NO_ERROR)
+            return ERR_DB_FILE;
+        len = put_varint(put_varint(put_varint(put_varint(rec, 0), fcode),
+                                    lcode), s->gpa) - rec;
+    }
+    if (w->ph.nslots == 0) {
+        w->ph.first_id = s->id;
+        w->ph.data_end = sizeof(pack_page_hdr_t);
+    }
+
+    uint16_t off = w->ph.data_end;
+    memcpy(w->page + off, rec, len);
+    memcpy(w->page + PACK_PAGE_SIZE - 2 * (w->ph.nslots + 1), &off, sizeof(off));
+    w->ph.data_end += len;
+    w->ph.nslots++;
+    w->prev_id = s->id;
+    w->nrecs++;
+    return NO_ERROR;
+}
+
+//write the header and body to path through a temporary file
+static int pack_write_file(const char *path, const pack_hdr_t *hdr,
+                           const char *body, size_t len)
+{
+    char tmp[PATH_MAX];
+
+    if (sidecar_path(path, ".tmp", tmp, sizeof(tmp)) != NO_ERROR)
+        return ERR_DB_FILE;
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (out < 0)
+        return ERR_DB_FILE;
+
+    int rc = pwrite_all(out, hdr, sizeof(*hdr), 0);
+    if (rc == NO_ERROR)
+        rc = pwrite_all(out, body, len, sizeof(*hdr));
+    if (close(out) == -1)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && io_rename(tmp, path) == -1)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+        unlink(tmp);
+    return rc;
+}
+
+/*
+ *  pack_db
+ *      fd:    database file descriptor
+ *      path:  packed file to write
+ *
+ *  Writes every valid student to path in the packed format.  The database
+ *  is read through a snapshot so the file is a consistent copy while
+ *  writers carry on, see dbmvcc.h.
+ *
+ *  returns:  number of students written, or ERR_DB_FILE
+ *
+ *  console:  M_DB_PACKED       on success
+ *            M_ERR_DB_READ     error reading the database or writing path
+ */
+int pack_db(int fd, const char *path)
+{
+    pack_writer_t *w = calloc(1, sizeof(*w));
+    pack_hdr_t hdr;
+    int rc;
+
+    if (w == NULL) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = scan_snapshot(fd, pack_cb, w);
+    if (rc == NO_ERROR)
+        rc = flush_page(w);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = PACK_MAGIC;
+    hdr.version = PACK_VERSION;
+    hdr.page_size = PACK_PAGE_SIZE;
+    hdr.npages = w->npages;
+    hdr.nrecs = w->nrecs;
+    hdr.nnames = w->nnames;
+    hdr.dict_off = PACK_HDR_SIZE + w->len;
+
+    for (uint32_t code = 0; code < w->nnames && rc == NO_ERROR; code++) {
+        const char *name = w->names + w->name_off[code];
+        uint32_t len = strlen(name);
+        if (grow((void **)&w->out, &w->cap, w->len + 5 + len, 1) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        w->len = put_varint(w->out + w->len, len) - w->out;
+        memcpy(w->out + w->len, name, len);
+        w->len += len;
+    }
+    hdr.dict_len = PACK_HDR_SIZE + w->len - hdr.dict_off;
+    hdr.crc = crc32c(0, w->out, w->len);
+
+    if (rc == NO_ERROR)
+        rc = pack_write_file(path, &hdr, w->out, w->len);
+
+    free(w->out);
+    free(w->names);
+    free(w->name_off);
+    free(w->hash);
+    free(w);
+
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    printf(M_DB_PACKED, (int)hdr.nrecs, path, (long long)(hdr.dict_off + hdr.dict_len));
+    return hdr.nrecs;
+}
+
+//decode one record of a page, prev is the id of the previous slot
+static bool unpack_rec(const unsigned char *page, const pack_page_hdr_t *ph, int slot,
+                       int prev, const unsigned char **names, const uint32_t *name_len,
+                       uint32_t nnames, student_t *s)
+{
+    uint16_t off;
+    uint32_t delta, fcode, lcode, gpa;
+
+    memcpy(&off, page + PACK_PAGE_SIZE - 2 * (slot + 1), sizeof(off));
+    if (off < sizeof(pack_page_hdr_t) || off >= ph->data_end)
+        return false;
+
+    const unsigned char *p = page + off;
+    const unsigned char *end = page + ph->data_end;
+    if (!get_varint(&p, end, &delta) || !get_varint(&p, end, &fcode) ||
+        !get_varint(&p, end, &lcode) || !get_varint(&p, end, &gpa))
+        return false;
+    if ((slot == 0) ? delta != 0 : delta == 0)
+        return false;
+    if (fcode >= nnames || lcode >= nnames ||
+        name_len[fcode] >= sizeof(s->fname) || name_len[lcode] >= sizeof(s->lname))
+        return false;
+
+    int64_t id = (slot == 0) ? (int64_t)ph->first_id : (int64_t)prev + delta;
+    if (id > MAX_STD_ID || validate_range(id, gpa) != NO_ERROR)
+        return false;
+
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->gpa = gpa;
+    memcpy(s->fname, names[fcode], name_len[fcode]);
+    memcpy(s->lname, names[lcode], name_len[lcode]);
+    return true;
+}
+
+/*
+ *  pack_scan
+ *      path:  packed file
+ *      cb:    called for every student, in id order
+ *      arg:   passed to cb
+ *
+ *  Checks the header and crc of the packed file, then decodes it page by
+ *  page.  Same contract as scan_db(): a non-zero return from cb stops the
+ *  scan and is returned.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE if the file cannot be read, ERR_DB_OP
+ *            if it is not a valid packed file, or the value from cb
+ */
+int pack_scan(const char *path, scan_cb_t cb, void *arg)
+{
+    struct stat st;
+    pack_hdr_t hdr;
+    int rc = ERR_DB_OP;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return ERR_DB_FILE;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    if (st.st_size < PACK_HDR_SIZE) {
+        close(fd);
+        return ERR_DB_OP;
+    }
+    unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return ERR_DB_FILE;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    memcpy(&hdr, map, sizeof(hdr));
+    if (hdr.magic != PACK_MAGIC || hdr.version != PACK_VERSION ||
+        hdr.page_size != PACK_PAGE_SIZE ||
+        hdr.dict_off != PACK_HDR_SIZE + (uint64_t)hdr.npages * PACK_PAGE_SIZE ||
+        hdr.dict_off + hdr.dict_len != (uint64_t)st.st_size ||
+        hdr.nnames > hdr.dict_len ||
+        crc32c(0, map + PACK_HDR_SIZE, st.st_size - PACK_HDR_SIZE) != hdr.crc) {
+        munmap(map, st.st_size);
+        return ERR_DB_OP;
+    }
+
+    const unsigned char **names = malloc((hdr.nnames + 1) * sizeof(*names));
+    uint32_t *name_len = malloc((hdr.nnames + 1) * sizeof(*name_len));
+    if (names == NULL || name_len == NULL) {
+        rc = ERR_DB_FILE;
+        goto out;
+    }
+
+    const unsigned char *p = map + hdr.dict_off;
+    const unsigned char *end = p + hdr.dict_len;
+    for (uint32_t code = 0; code < hdr.nnames; code++) {
+        if (!get_varint(&p, end, &name_len[code]) || name_len[code] > (size_t)(end - p))
+            goto out;
+        names[code] = p;
+        p += name_len[code];
+    }
+
+    int prev = 0;
+    uint32_t nrecs = 0;
+    for (uint32_t pg = 0; pg < hdr.npages; pg++) {
+        const unsigned char *page = map + PACK_HDR_SIZE + (size_t)pg * PACK_PAGE_SIZE;
+        pack_page_hdr_t ph;
+
+        memcpy(&ph, page, sizeof(ph));
+        if (ph.nslots == 0 || ph.data_end < sizeof(ph) ||
+            ph.data_end + 2 * (size_t)ph.nslots > PACK_PAGE_SIZE ||
+            (int64_t)ph.first_id <= prev)
+            goto out;
+
+        for (int slot = 0; slot < ph.nslots; slot++) {
+            student_t s;
+            if (!unpack_rec(page, &ph, slot, prev, names, name_len, hdr.nnames, &s))
+                goto out;
+            prev = s.id;
+            nrecs++;
+            int cbrc = cb(&s, arg);
+            if (cbrc != 0) {
+                rc = cbrc;
+                goto out;
+            }
+        }
+    }
+    rc = (nrecs == hdr.nrecs) ? NO_ERROR : ERR_DB_OP;
+
+out:
+    free(names);
+    free(name_len);
+    munmap(map, st.st_size);
+    return rc;
+}
+
+//collects the students of a packed file for unpack_db()
+typedef struct unpack_set {
+    student_t *recs;
+    size_t n;
+    size_t cap;
+} unpack_set_t;
+
+static int unpack_cb(const student_t *s, void *arg)
+{
+    unpack_set_t *set = arg;
+
+    if (grow((void **)&set->recs, &set->cap, set->n + 1, sizeof(student_t)) != NO_ERROR)
+        return ERR_DB_FILE;
+    set->recs[set->n++] = *s;
+    return NO_ERROR;
+}
+
+/*
+ *  unpack_db
+ *      fd:    database file descriptor
+ *      path:  packed file to load
+ *
+ *  Adds every student of the packed file to the database, with the same
+ *  all or nothing duplicate check as a csv import.
+ *
+ *  returns:  number of students added, ERR_DB_FILE or ERR_DB_OP
+ *
+ *  console:  M_DB_IMPORTED     on success
+ *            M_ERR_IMPORT_OPEN the file cannot be read
+ *            M_ERR_PACK_FILE   the file is not a valid packed database
+ *            see import_students() for the other messages
+ */
+int unpack_db(int fd, const char *path)
+{
+    unpack_set_t set = { 0 };
+
+    int rc = pack_scan(path, unpack_cb, &set);
+    if (rc == ERR_DB_OP) {
+        printf(M_ERR_PACK_FILE, path);
+    } else if (rc != NO_ERROR) {
+        printf(M_ERR_IMPORT_OPEN, path);
+        rc = ERR_DB_FILE;
+    } else {
+        rc = import_students(fd, set.recs, set.n);
+    }
+    free(set.recs);
+    return rc;
+}
@@ -0,0 +1,59 @@
+#ifndef __DBPACK_H__
+    #define __DBPACK_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "dbscan.h"
+
+//Packed database format, an alternative to the fixed 64 byte records for
+//moving a database around or scanning it.  sdbsc -k writes one from the
+//database, sdbsc -u loads one back, and sdbsc -p file prints one.
+//
+//    [ header | page | page | ... | name dictionary ]
+//
+//Pages are PACK_PAGE_SIZE byte slotted pages.  Records are packed upward
+//after the page header and a directory of 16 bit record offsets grows
+//down from the end of the page, so any record can be found without
+//decoding the ones before it:
+//
+//    [ pack_page_hdr_t | rec | rec | ... free ... | slot 1 | slot 0 ]
+//
+//A record is four LEB128 varints: the id as a delta from the previous
+//record of the page (from first_id for slot 0), the fname and lname codes
+//and the gpa.  Every distinct name is stored once in the dictionary at
+//the end of the file (a varint length then the bytes), its code is its
+//position there.  A typical student takes about 10 bytes instead of 64.
+//The header carries a crc32c of everything after it.
+#define PACK_MAGIC          0x4b415053      // "SPAK"
+#define PACK_VERSION        1
+#define PACK_HDR_SIZE       64
+#define PACK_PAGE_SIZE      4096
+#define PACK_REC_MAX        20              // four varints, worst case
+#define PACK_HASH_MIN       1024            // initial name hash slots
+
+typedef struct pack_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t npages;
+    uint32_t nrecs;
+    uint32_t nnames;        // dictionary entries
+    uint64_t dict_off;      // file offset of the dictionary
+    uint64_t dict_len;
+    uint32_t crc;           // crc32c of the pages and the dictionary
+    char pad[PACK_HDR_SIZE - 44];
+} pack_hdr_t;
+
+typedef struct pack_page_hdr {
+    uint32_t first_id;      // id of slot 0
+    uint16_t nslots;
+    uint16_t data_end;      // end of the record bytes
+} pack_page_hdr_t;
+
+//prototypes
+int pack_db(int fd, const char *path);
+int unpack_db(int fd, const char *path);
+int pack_scan(const char *path, scan_cb_t cb, void *arg);
+
+#endif
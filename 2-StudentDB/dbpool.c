@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dblock.h"
+#include "dbpool.h"
+#include "dbiostat.h"
+
+_Static_assert(POOL_PAGE_SIZE % sizeof(student_t) == 0, "a page must hold whole records");
+_Static_assert(POOL_PAGE_RECORDS == 64, "one page must map to one stripe");
+
+static int page_bucket(const db_pool_t *pool, off_t page)
+{
+    return (uint32_t)((uint64_t)page * 2654435761u) & (pool->nbuckets - 1);
+}
+
+static char *frame_data(const db_pool_t *pool, int f)
+{
+    return pool->data + (size_t)f * POOL_PAGE_SIZE;
+}
+
+/*
+ *  pool_create
+ *      fd:       database file descriptor
+ *      lock:     shared lock state, NULL if no other process uses the file
+ *      nframes:  number of POOL_PAGE_SIZE frames
+ *
+ *  returns:  the pool, or NULL when out of memory
+ */
+db_pool_t *pool_create(int fd, struct db_lock *lock, int nframes)
+{
+    db_pool_t *pool = calloc(1, sizeof(*pool));
+
+    if (pool == NULL)
+        return NULL;
+    pool->fd = fd;
+    pool->lock = lock;
+    pool->nframes = nframes;
+    pool->nbuckets = 1;
+    while (pool->nbuckets < 2 * nframes)
+        pool->nbuckets *= 2;
+
+    pool->data = aligned_alloc(POOL_PAGE_SIZE, (size_t)nframes * POOL_PAGE_SIZE);
+    pool->frames = calloc(nframes, sizeof(pool_frame_t));
+    pool->buckets = malloc(pool->nbuckets * sizeof(int32_t));
+    if (pool->data == NULL || pool->frames == NULL || pool->buckets == NULL) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    for (int f = 0; f < nframes; f++)
+        pool->frames[f].page = POOL_NO_PAGE;
+    for (int b = 0; b < pool->nbuckets; b++)
+        pool->buckets[b] = -1;
+    return pool;
+}
+
+//frees the pool, dirty frames are lost so flush first
+void pool_destroy(db_pool_t *pool)
+{
+    if (pool == NULL)
+        return;
+    free(pool->data);
+    free(pool->frames);
+    free(pool->buckets);
+    free(pool);
+}
+
+static int pool_lookup(const db_pool_t *pool, off_t page)
+{
+    for (int f = pool->buckets[page_bucket(pool, page)]; f >= 0; f = pool->frames[f].next) {
+        if (pool->frames[f].page == page)
+            return f;
+    }
+    return -1;
+}
+
+static void pool_unhash(db_pool_t *pool, int f)
+{
+    int32_t *link = &pool->buckets[page_bucket(pool, pool->frames[f].page)];
+
+    while (*link != f)
+        link = &pool->frames[*link].next;
+    *link = pool->frames[f].next;
+    pool->frames[f].page = POOL_NO_PAGE;
+    pool->frames[f].dirty = false;
+    pool->frames[f].ref = false;
+}
+
+//true if no other process wrote the page since the frame was read
+static bool frame_valid(const db_pool_t *pool, const pool_frame_t *fr)
+{
+    if (pool->lock == NULL || fr->dirty)
+        return true;
+    return lock_seq(pool->lock, fr->page * POOL_PAGE_RECORDS) == fr->seq;
+}
+
+/*
+ *  frame_fill
+ *
+ *  Reads the page into frame f, retrying while a writer of its stripe is
+ *  active the same way get_student() does.  Bytes past the end of the
+ *  file read as empty slots.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or POOL_BUSY if the stripe never
+ *            stayed still long enough
+ */
+static int frame_fill(db_pool_t *pool, int f, off_t page)
+{
+    pool_frame_t *fr = &pool->frames[f];
+    char *data = frame_data(pool, f);
+    int id = page * POOL_PAGE_RECORDS;
+
+    for (int tries = 0; tries < LOCK_READ_SPINS; tries++) {
+        uint32_t seq = (pool->lock != NULL) ? lock_read_begin(pool->lock, id) : 0;
+        ssize_t n = io_pread(pool->fd, data, POOL_PAGE_SIZE, page * POOL_PAGE_SIZE);
+        if (n < 0)
+            return ERR_DB_FILE;
+        memset(data + n, 0, POOL_PAGE_SIZE - n);
+        if (pool->lock == NULL || lock_read_valid(pool->lock, id, seq)) {
+            fr->seq = seq;
+            return NO_ERROR;
+        }
+    }
+    return POOL_BUSY;
+}
+
+/*
+ *  frame_writeback
+ *
+ *  Writes the dirty bytes of frame f to the file.  The caller holds the
+ *  stripe of the page, so the only change to its sequence counter is this
+ *  write and every frame of the stripe read before it is still current.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int frame_writeback(db_pool_t *pool, int f)
+{
+    pool_frame_t *fr = &pool->frames[f];
+    int id = fr->page * POOL_PAGE_RECORDS;
+    uint32_t before = 0;
+    int rc;
+
+    if (pool->lock != NULL) {
+        before = lock_seq(pool->lock, id);
+        lock_write_begin(pool->lock, id);
+    }
+    rc = pwrite_all(pool->fd, frame_data(pool, f) + fr->dirty_lo,
+                    fr->dirty_hi - fr->dirty_lo,
+                    fr->page * POOL_PAGE_SIZE + fr->dirty_lo);
+    if (pool->lock != NULL) {
+        lock_write_end(pool->lock, id);
+        int stripe = lock_stripe_of(id);
+        for (int g = 0; g < pool->nframes; g++) {
+            pool_frame_t *o = &pool->frames[g];
+            if (o->page != POOL_NO_PAGE && o->seq == before &&
+                lock_stripe_of(o->page * POOL_PAGE_RECORDS) == stripe)
+                o->seq = before + 2;
+        }
+    }
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+
+    fr->dirty = false;
+    pool->stats.writebacks++;
+    return NO_ERROR;
+}
+
+//pick a frame to reuse with the CLOCK hand, writing it back if dirty
+static int pool_victim(db_pool_t *pool)
+{
+    for (;;) {
+        int f = pool->hand;
+        pool_frame_t *fr = &pool->frames[f];
+
+        pool->hand = (pool->hand + 1) % pool->nframes;
+        if (fr->page == POOL_NO_PAGE)
+            return f;
+        if (fr->ref) {
+            fr->ref = false;
+            continue;
+        }
+        if (fr->dirty && frame_writeback(pool, f) != NO_ERROR)
+            return -1;
+        pool_unhash(pool, f);
+        pool->stats.evictions++;
+        return f;
+    }
+}
+
+/*
+ *  pool_get
+ *      page:  page number
+ *      f:     receives the frame holding the page
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE or POOL_BUSY
+ */
+static int pool_get(db_pool_t *pool, off_t page, int *f)
+{
+    int rc;
+
+    *f = pool_lookup(pool, page);
+    if (*f >= 0 && frame_valid(pool, &pool->frames[*f])) {
+        pool->stats.hits++;
+        pool->frames[*f].ref = true;
+        return NO_ERROR;
+    }
+    pool->stats.misses++;
+
+    if (*f < 0) {
+        *f = pool_victim(pool);
+        if (*f < 0)
+            return ERR_DB_FILE;
+        pool_frame_t *fr = &pool->frames[*f];
+        int b = page_bucket(pool, page);
+        fr->page = page;
+        fr->next = pool->buckets[b];
+        pool->buckets[b] = *f;
+    }
+
+    rc = frame_fill(pool, *f, page);
+    if (rc != NO_ERROR) {
+        pool_unhash(pool, *f);
+        return rc;
+    }
+    pool->frames[*f].ref = true;
+    return NO_ERROR;
+}
+
+/*
+ *  pool_read
+ *      off:  file offset, [off, off + len) must lie in one page
+ *      buf:  receives the bytes
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or POOL_BUSY when the page is being
+ *            written by another process, read it directly then
+ */
+int pool_read(db_pool_t *pool, off_t off, void *buf, size_t len)
+{
+    off_t page = off / POOL_PAGE_SIZE;
+    int f;
+
+    if (off % POOL_PAGE_SIZE + len > POOL_PAGE_SIZE)
+        return ERR_DB_FILE;
+    int rc = pool_get(pool, page, &f);
+    if (rc != NO_ERROR)
+        return rc;
+    memcpy(buf, frame_data(pool, f) + off % POOL_PAGE_SIZE, len);
+    return NO_ERROR;
+}
+
+/*
+ *  pool_write
+ *      off:  file offset, [off, off + len) must lie in one page
+ *      buf:  bytes to write
+ *
+ *  Changes the cached page only, the caller holds the stripe of the page
+ *  until pool_flush() wrote it back.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int pool_write(db_pool_t *pool, off_t off, const void *buf, size_t len)
+{
+    off_t page = off / POOL_PAGE_SIZE;
+    size_t lo = off % POOL_PAGE_SIZE;
+    int f;
+
+    if (lo + len > POOL_PAGE_SIZE || pool_get(pool, page, &f) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    pool_frame_t *fr = &pool->frames[f];
+    memcpy(frame_data(pool, f) + lo, buf, len);
+    if (!fr->dirty) {
+        fr->dirty = true;
+        fr->dirty_lo = lo;
+        fr->dirty_hi = lo + len;
+    } else {
+        fr->dirty_lo = (lo < fr->dirty_lo) ? lo : fr->dirty_lo;
+        fr->dirty_hi = (lo + len > fr->dirty_hi) ? lo + len : fr->dirty_hi;
+    }
+    return NO_ERROR;
+}
+
+//write back every dirty frame
+int pool_flush(db_pool_t *pool)
+{
+    int rc = NO_ERROR;
+
+    for (int f = 0; f < pool->nframes; f++) {
+        if (pool->frames[f].page != POOL_NO_PAGE && pool->frames[f].dirty &&
+            frame_writeback(pool, f) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    return rc;
+}
+
+//forget a page without writing it back, for pages punched out of the file
+void pool_discard(db_pool_t *pool, off_t page)
+{
+    int f = pool_lookup(pool, page);
+
+    if (f >= 0)
+        pool_unhash(pool, f);
+}
+
+//forget every page that is not completely inside a file of size bytes
+void pool_truncate(db_pool_t *pool, off_t size)
+{
+    for (int f = 0; f < pool->nframes; f++) {
+        off_t page = pool->frames[f].page;
+        if (page != POOL_NO_PAGE && (page + 1) * POOL_PAGE_SIZE > size)
+            pool_unhash(pool, f);
+    }
+}
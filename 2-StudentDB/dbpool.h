@@ -0,0 +1,76 @@
+#ifndef __DBPOOL_H__
+    #define __DBPOOL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "db.h"
+
+//Buffer pool for processes that keep the database open, such as
+//sdbsc --serve.  The database is cached in POOL_PAGE_SIZE frames (one page
+//holds the 64 students of one bitmap word) so repeated lookups are a hash
+//probe and a memcpy instead of a pread() each.
+//
+//  eviction    CLOCK: every frame has a reference bit set on access, the
+//              hand clears bits until it finds a frame without one
+//  dirty       pool_write() only changes the frame; pool_flush() writes
+//              dirty frames back, so many writes to one page in a group
+//              commit cost one pwrite().  A dirty frame is also written
+//              back when it is evicted.
+//  coherence   other processes write the file directly.  A frame remembers
+//              the stripe sequence counter (see dblock.h) it was read
+//              under and is used only while the counter is unchanged.
+//              Write-back is bracketed by lock_write_begin/end like any
+//              other write.
+//
+//Dirty frames must only exist while the writer holds the stripe locks of
+//their pages, every write path flushes before letting go of them.  The
+//pool is not thread safe.
+#define POOL_PAGE_SIZE      4096
+#define POOL_PAGE_RECORDS   (POOL_PAGE_SIZE / (int)sizeof(student_t))
+#define POOL_FRAMES         1024            // 4MB, default for the server
+#define POOL_NO_PAGE        ((off_t)-1)
+#define POOL_BUSY           1               // pool_read(): read uncached
+
+struct db_lock;
+
+typedef struct pool_frame {
+    off_t page;             // page number, POOL_NO_PAGE if the frame is free
+    uint32_t seq;           // stripe sequence the contents were read under
+    bool ref;               // CLOCK reference bit
+    bool dirty;
+    uint16_t dirty_lo;      // bytes [dirty_lo, dirty_hi) of the page to
+    uint16_t dirty_hi;      // write back, never past what was written
+    int32_t next;           // hash chain, -1 at the end
+} pool_frame_t;
+
+typedef struct pool_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+} pool_stats_t;
+
+typedef struct db_pool {
+    int fd;                 // database file
+    struct db_lock *lock;   // NULL if the database is not shared
+    int nframes;
+    char *data;             // nframes * POOL_PAGE_SIZE
+    pool_frame_t *frames;
+    int32_t *buckets;       // hash of page -> first frame, -1 if none
+    int nbuckets;
+    int hand;               // CLOCK hand
+    pool_stats_t stats;
+} db_pool_t;
+
+//prototypes
+db_pool_t *pool_create(int fd, struct db_lock *lock, int nframes);
+void pool_destroy(db_pool_t *pool);
+int pool_read(db_pool_t *pool, off_t off, void *buf, size_t len);
+int pool_write(db_pool_t *pool, off_t off, const void *buf, size_t len);
+int pool_flush(db_pool_t *pool);
+void pool_discard(db_pool_t *pool, off_t page);
+void pool_truncate(db_pool_t *pool, off_t size);
+
+#endif
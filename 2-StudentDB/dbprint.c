@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbmvcc.h"
+#include "dbwire.h"
+#include "dbprint.h"
+
+//one thread's share of the work
+struct print_part {
+    int fd;
+    db_snap_t *snap;            // read through this snapshot if set
+    int64_t lo, hi;             // ids scanned
+    int sort;
+    print_buf_t out;            // formatted rows
+    student_t *recs;            // --sort-by: students of the range
+    uint32_t nrecs;
+    uint32_t cap;
+    const print_key_t *keys;    // --sort-by: sorted keys to format
+    const student_t *all;
+    uint32_t nkeys;
+    int rows;
+    int rc;
+};
+
+//runs fn on n argument structs of size bytes each, the first one on the
+//calling thread; a thread that cannot be started runs inline instead
+static void run_parallel(int n, void *(*fn)(void *), void *args, size_t size)
+{
+    pthread_t tids[PRINT_MAX_THREADS];
+    bool started[PRINT_MAX_THREADS] = { false };
+
+    for (int i = 1; i < n; i++) {
+        void *arg = (char *)args + i * size;
+        started[i] = (pthread_create(&tids[i], NULL, fn, arg) == 0);
+        if (!started[i])
+            fn(arg);
+    }
+    fn(args);
+    for (int i = 1; i < n; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    }
+}
+
+static int format_row(print_buf_t *b, const student_t *s)
+{
+    if (b->cap - b->len < WIRE_ROW_MAX) {
+        size_t ncap = b->cap ? b->cap * 2 : PRINT_BUF_MIN;
+        char *p = realloc(b->data, ncap);
+        if (p == NULL)
+            return ERR_DB_FILE;
+        b->data = p;
+        b->cap = ncap;
+    }
+    // the same formatter as print_db_cb(), so the output matches
+    b->len += wire_row(b->data + b->len, s);
+    return NO_ERROR;
+}
+
+static int part_row_cb(const student_t *s, void *arg)
+{
+    struct print_part *p = arg;
+
+    if (p->sort == PRINT_SORT_ID) {
+        if (format_row(&p->out, s) != NO_ERROR)
+            return ERR_DB_FILE;
+    } else {
+        if (p->nrecs == p->cap) {
+            uint32_t ncap = p->cap ? p->cap * 2 : 1024;
+            student_t *r = realloc(p->recs, (size_t)ncap * sizeof(student_t));
+            if (r == NULL)
+                return ERR_DB_FILE;
+            p->recs = r;
+            p->cap = ncap;
+        }
+        p->recs[p->nrecs++] = *s;
+    }
+    p->rows++;
+    return NO_ERROR;
+}
+
+static void *scan_part(void *arg)
+{
+    struct print_part *p = arg;
+
+    if (p->snap != NULL)
+        p->rc = snap_scan(p->snap, p->lo, p->hi, part_row_cb, p);
+    else
+        p->rc = scan_live_range(p->fd, p->lo, p->hi, part_row_cb, p);
+    return NULL;
+}
+
+static void *format_part(void *arg)
+{
+    struct print_part *p = arg;
+
+    p->rc = NO_ERROR;
+    for (uint32_t i = 0; i < p->nkeys && p->rc == NO_ERROR; i++)
+        p->rc = format_row(&p->out, &p->all[p->keys[i].row]);
+    return NULL;
+}
+
+/*
+ *  print_sort_key
+ *      name:  argument of --sort-by
+ *
+ *  returns:  PRINT_SORT_* for id, lname or gpa, or -1
+ */
+int print_sort_key(const char *name)
+{
+    if (strcmp(name, "id") == 0)
+        return PRINT_SORT_ID;
+    if (strcmp(name, "lname") == 0)
+        return PRINT_SORT_LNAME;
+    if (strcmp(name, "gpa") == 0)
+        return PRINT_SORT_GPA;
+    return -1;
+}
+
+static uint64_t extract_key(const student_t *s, int sort)
+{
+    uint64_t key = 0;
+
+    if (sort == PRINT_SORT_GPA)
+        return ((uint64_t)(uint32_t)s->gpa << 32) | (uint32_t)s->id;
+    // big endian, so comparing keys compares the first 8 letters
+    for (int i = 0; i < 8; i++)
+        key = (key << 8) | (unsigned char)s->lname[i];
+    return key;
+}
+
+static int key_cmp(const void *a, const void *b, void *arg)
+{
+    const print_key_t *x = a, *y = b;
+    const student_t *recs = arg;
+
+    if (x->key != y->key)
+        return (x->key < y->key) ? -1 : 1;
+    int c = strncmp(recs[x->row].lname, recs[y->row].lname, sizeof(recs->lname));
+    if (c != 0)
+        return c;
+    return (recs[x->row].id > recs[y->row].id) - (recs[x->row].id < recs[y->row].id);
+}
+
+//a run of the merge sort: keys [lo, hi) of src, merged into dst
+struct sort_run {
+    print_key_t *src;
+    print_key_t *dst;
+    const student_t *recs;
+    uint32_t lo, mid, hi;   // mid == hi for a single run that is copied
+};
+
+static void *sort_run(void *arg)
+{
+    struct sort_run *r = arg;
+
+    qsort_r(r->src + r->lo, r->hi - r->lo, sizeof(print_key_t), key_cmp, (void *)r->recs);
+    return NULL;
+}
+
+static void *merge_runs(void *arg)
+{
+    struct sort_run *r = arg;
+    uint32_t i = r->lo, j = r->mid, k = r->lo;
+
+    while (i < r->mid && j < r->hi) {
+        if (key_cmp(&r->src[j], &r->src[i], (void *)r->recs) < 0)
+            r->dst[k++] = r->src[j++];
+        else
+            r->dst[k++] = r->src[i++];
+    }
+    while (i < r->mid)
+        r->dst[k++] = r->src[i++];
+    while (j < r->hi)
+        r->dst[k++] = r->src[j++];
+    return NULL;
+}
+
+/*
+ *  sort_keys
+ *      keys:      one key per student, sorted on return
+ *      tmp:       scratch space for n keys
+ *      nthreads:  runs sorted at once
+ *
+ *  returns:  keys or tmp, whichever holds the result
+ */
+static print_key_t *sort_keys(print_key_t *keys, print_key_t *tmp, uint32_t n,
+                              const student_t *recs, int nthreads)
+{
+    struct sort_run runs[PRINT_MAX_THREADS];
+    uint32_t bounds[PRINT_MAX_THREADS + 1];
+    int nruns = nthreads;
+
+    for (int i = 0; i <= nruns; i++)
+        bounds[i] = (uint64_t)n * i / nruns;
+    for (int i = 0; i < nruns; i++)
+        runs[i] = (struct sort_run){ keys, tmp, recs, bounds[i], bounds[i + 1], bounds[i + 1] };
+    run_parallel(nruns, sort_run, runs, sizeof(runs[0]));
+
+    while (nruns > 1) {
+        int npairs = (nruns + 1) / 2;
+        for (int p = 0; p < npairs; p++) {
+            uint32_t lo = bounds[2 * p];
+            uint32_t mid = bounds[(2 * p + 1 <= nruns) ? 2 * p + 1 : nruns];
+            uint32_t hi = bounds[(2 * p + 2 <= nruns) ? 2 * p + 2 : nruns];
+            runs[p] = (struct sort_run){ keys, tmp, recs, lo, mid, hi };
+        }
+        run_parallel(npairs, merge_runs, runs, sizeof(runs[0]));
+
+        for (int p = 0; p <= npairs; p++)
+            bounds[p] = bounds[(2 * p <= nruns) ? 2 * p : nruns];
+        nruns = npairs;
+        print_key_t *t = keys;
+        keys = tmp;
+        tmp = t;
+    }
+    return keys;
+}
+
+/*
+ *  sort_parts
+ *
+ *  Gathers the students found by the scan threads, sorts them by key and
+ *  formats them again split over the threads, replacing their output.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE when out of memory
+ */
+static int sort_parts(struct print_part *parts, int nthreads, int sort)
+{
+    uint32_t n = 0;
+
+    for (int i = 0; i < nthreads; i++)
+        n += parts[i].nrecs;
+
+    student_t *all = malloc(((size_t)n + 1) * sizeof(student_t));
+    print_key_t *keys = malloc(((size_t)n + 1) * sizeof(print_key_t));
+    print_key_t *tmp = malloc(((size_t)n + 1) * sizeof(print_key_t));
+    int rc = ERR_DB_FILE;
+
+    if (all != NULL && keys != NULL && tmp != NULL) {
+        uint32_t k = 0;
+        for (int i = 0; i < nthreads; i++) {
+            memcpy(all + k, parts[i].recs, (size_t)parts[i].nrecs * sizeof(student_t));
+            k += parts[i].nrecs;
+        }
+        for (uint32_t r = 0; r < n; r++) {
+            keys[r].key = extract_key(&all[r], sort);
+            keys[r].row = r;
+        }
+
+        const print_key_t *sorted = sort_keys(keys, tmp, n, all, nthreads);
+        for (int i = 0; i < nthreads; i++) {
+            uint32_t lo = (uint64_t)n * i / nthreads;
+            uint32_t hi = (uint64_t)n * (i + 1) / nthreads;
+            parts[i].keys = sorted + lo;
+            parts[i].nkeys = hi - lo;
+            parts[i].all = all;
+        }
+        run_parallel(nthreads, format_part, parts, sizeof(parts[0]));
+
+        rc = NO_ERROR;
+        for (int i = 0; i < nthreads; i++) {
+            if (parts[i].rc != NO_ERROR)
+                rc = ERR_DB_FILE;
+        }
+    }
+    free(all);
+    free(keys);
+    free(tmp);
+    return rc;
+}
+
+/*
+ *  print_parallel
+ *      fd:    database file descriptor
+ *      sort:  PRINT_SORT_ID, PRINT_SORT_LNAME or PRINT_SORT_GPA
+ *
+ *  Prints every student, with the header line first, in the order given
+ *  by sort.  Nothing is printed when the database is empty.  The scan
+ *  reads a snapshot when the database is shared, see dbmvcc.h.
+ *
+ *  returns:  number of students printed, or ERR_DB_FILE
+ *
+ *  console:  STUDENT_PRINT_HDR_STRING and one STUDENT_PRINT_FMT_STRING
+ *            line per student
+ */
+int print_parallel(int fd, int sort)
+{
+    struct print_part parts[PRINT_MAX_THREADS];
+    db_ctx_t *ctx = db_ctx_get(fd);
+    db_snap_t snap;
+    bool snapped = false;
+    struct stat st;
+    int rows = 0;
+    int rc = NO_ERROR;
+
+    if (ctx != NULL && ctx->lock != NULL)
+        snapped = (snap_begin(ctx, &snap) == NO_ERROR);
+    if (snapped) {
+        st.st_size = snap.size;
+    } else {
+        if (fstat(fd, &st) == -1)
+            return ERR_DB_FILE;
+        // the threads only read the bitmap, it is brought up to date here
+        if (ctx != NULL && db_ctx_refresh(ctx) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    int64_t nids = st.st_size / STUDENT_RECORD_SIZE;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = nids / PRINT_MIN_IDS;
+    if (nthreads > ncpu)
+        nthreads = ncpu;
+    if (nthreads > PRINT_MAX_THREADS)
+        nthreads = PRINT_MAX_THREADS;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    memset(parts, 0, sizeof(parts));
+    for (int i = 0; i < nthreads; i++) {
+        parts[i].fd = fd;
+        parts[i].snap = snapped ? &snap : NULL;
+        parts[i].sort = sort;
+        parts[i].lo = (nids * i / nthreads) & ~63LL;
+        parts[i].hi = (i + 1 < nthreads) ? (nids * (i + 1) / nthreads) & ~63LL : INT64_MAX;
+    }
+    run_parallel(nthreads, scan_part, parts, sizeof(parts[0]));
+    if (snapped)
+        snap_end(&snap);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (parts[i].rc != NO_ERROR)
+            rc = ERR_DB_FILE;
+        rows += parts[i].rows;
+    }
+    if (rc == NO_ERROR && sort != PRINT_SORT_ID && rows > 0)
+        rc = sort_parts(parts, nthreads, sort);
+
+    if (rc == NO_ERROR && rows > 0) {
+        if (wire_get_format() == WIRE_TEXT)
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        for (int i = 0; i < nthreads; i++)
+            fwrite(parts[i].out.data, 1, parts[i].out.len, stdout);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        free(parts[i].out.data);
+        free(parts[i].recs);
+    }
+    return (rc == NO_ERROR) ? rows : ERR_DB_FILE;
+}
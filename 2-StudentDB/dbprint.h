@@ -0,0 +1,46 @@
+#ifndef __DBPRINT_H__
+    #define __DBPRINT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db.h"
+
+//Parallel printing for sdbsc -p.  The id space is cut into one range per
+//thread (a multiple of 64 ids), each thread scans its range and
+//formats its rows into its own buffer, and the buffers are written out in
+//range order so the output is the same as a single threaded scan.
+//
+//-p --sort-by lname|gpa prints in another order.  The threads then collect
+//their students, a sort key (the first 8 bytes of the last name, or the
+//gpa and id) is extracted for each, and the keys are sorted by a parallel
+//merge sort: every thread sorts one run with qsort() and runs are merged
+//pairwise, one thread per pair, until one is left.  Ties are broken by
+//the full last name and then the id, so the order is stable from run to
+//run.
+#define PRINT_MAX_THREADS   8
+#define PRINT_MIN_IDS       16384   // ids per thread, smaller scans run alone
+#define PRINT_BUF_MIN       (64 * 1024)
+
+#define PRINT_SORT_ID       0
+#define PRINT_SORT_LNAME    1
+#define PRINT_SORT_GPA      2
+
+//a sort key and the student it was taken from
+typedef struct print_key {
+    uint64_t key;
+    uint32_t row;
+} print_key_t;
+
+//growable output of one thread
+typedef struct print_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+} print_buf_t;
+
+//prototypes
+int print_parallel(int fd, int sort);
+int print_sort_key(const char *name);
+
+#endif
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbscan.h"
+#include "dbiostat.h"
+
+//the vector code below assumes a record is exactly two 32 byte AVX2 lanes
+_Static_assert(sizeof(student_t) == 64, "student_t must be 64 bytes");
+_Static_assert(SCAN_BLOCK_SIZE % sizeof(student_t) == 0,
+               "SCAN_BLOCK_SIZE must be a multiple of the record size");
+
+//a block handler gets a buffer of whole records read from the database
+typedef int (*block_fn_t)(const student_t *recs, int n, void *arg);
+
+/*
+ *  record_is_empty
+ *      *s:  record to test
+ *
+ *  A record is empty (never written or deleted) when all 64 of its bytes
+ *  are zero.  This ORs the record together 8 bytes at a time which is a lot
+ *  cheaper than a memcmp() against EMPTY_STUDENT_RECORD.
+ *
+ *  returns:  true if every byte of the record is zero
+ */
+bool record_is_empty(const student_t *s)
+{
+    uint64_t w[8];
+
+    memcpy(w, s, sizeof(w));
+    return (w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7]) == 0;
+}
+
+__attribute__((target("avx2")))
+static inline int avx2_record_is_empty(const char *p)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+    __m256i v = _mm256_or_si256(a, b);
+
+    return _mm256_testz_si256(v, v);
+}
+
+//returns the index of the first non-empty record at or after i, or n if
+//there are none left.  Runs of deleted records are skipped 4 at a time.
+__attribute__((target("avx2")))
+static int next_nonempty_avx2(const student_t *recs, int i, int n)
+{
+    const char *base = (const char *)recs;
+
+    while (i + 4 <= n) {
+        const __m256i *p = (const __m256i *)(base + (size_t)i * sizeof(student_t));
+        __m256i v = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+            _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+        v = _mm256_or_si256(v,
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_loadu_si256(p + 4), _mm256_loadu_si256(p + 5)),
+                _mm256_or_si256(_mm256_loadu_si256(p + 6), _mm256_loadu_si256(p + 7))));
+        if (!_mm256_testz_si256(v, v))
+            break;
+        i += 4;
+    }
+
+    for (; i < n; i++) {
+        if (!avx2_record_is_empty(base + (size_t)i * sizeof(student_t)))
+            return i;
+    }
+    return n;
+}
+
+static int next_nonempty_scalar(const student_t *recs, int i, int n)
+{
+    for (; i < n; i++) {
+        if (!record_is_empty(&recs[i]))
+            return i;
+    }
+    return n;
+}
+
+/*
+ *  next_nonempty
+ *      *recs:  array of records
+ *      i:      index to start at
+ *      n:      number of records in the array
+ *
+ *  returns:  index of the first record at or after i that is not all
+ *            zero, n if there is none
+ */
+int next_nonempty(const student_t *recs, int i, int n)
+{
+    if (__builtin_cpu_supports("avx2"))
+        return next_nonempty_avx2(recs, i, n);
+    return next_nonempty_scalar(recs, i, n);
+}
+
+/*
+ *  count_nonempty
+ *      *recs:  array of records
+ *      n:      number of records in the array
+ *
+ *  returns:  the number of records in recs that are not all zero
+ */
+int count_nonempty(const student_t *recs, int n)
+{
+    int count = 0;
+    int i = 0;
+
+    while ((i = next_nonempty(recs, i, n)) < n) {
+        count++;
+        i++;
+    }
+    return count;
+}
+
+/*
+ *  scan_blocks
+ *      fd:      linux file descriptor
+ *      lo, hi:  only the slots of ids [lo, hi) are read
+ *      fn:      handler called for each block of records read
+ *      arg:     passed through to fn
+ *
+ *  Walks the data extents of the database file, using SEEK_DATA/SEEK_HOLE
+ *  to jump over the holes of the sparse file, and reads each extent in
+ *  blocks of up to SCAN_BLOCK_SIZE bytes with pread().  If the filesystem
+ *  does not support SEEK_DATA the whole range is treated as one extent.
+ *
+ *  returns:  NO_ERROR       whole range was scanned
+ *            ERR_DB_FILE    database file I/O issue, or the file size is not
+ *                           a multiple of STUDENT_RECORD_SIZE
+ *            <other>        the non-zero value returned by fn to stop early
+ */
+static int scan_blocks(int fd, int64_t lo, int64_t hi, block_fn_t fn, void *arg)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (st.st_size % STUDENT_RECORD_SIZE != 0)
+        return ERR_DB_FILE;
+
+    off_t end = st.st_size;
+    if (hi < end / STUDENT_RECORD_SIZE)
+        end = hi * STUDENT_RECORD_SIZE;
+    if (lo * STUDENT_RECORD_SIZE >= end)
+        return NO_ERROR;
+
+    student_t *buf = aligned_alloc(64, SCAN_BLOCK_SIZE);
+    if (buf == NULL)
+        return ERR_DB_FILE;
+
+    posix_fadvise(fd, lo * STUDENT_RECORD_SIZE, end - lo * STUDENT_RECORD_SIZE,
+                  POSIX_FADV_SEQUENTIAL);
+
+    int rc = NO_ERROR;
+    off_t pos = lo * STUDENT_RECORD_SIZE;
+    while (pos < end && rc == NO_ERROR) {
+        off_t data = io_lseek(fd, pos, SEEK_DATA);
+        off_t hole;
+
+        if (data == -1) {
+            if (errno == ENXIO)
+                break;          // only a hole is left until the end
+            if (errno != EINVAL) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            data = pos;         // no SEEK_DATA support, read everything
+            hole = end;
+        } else {
+            hole = io_lseek(fd, data, SEEK_HOLE);
+            if (hole == -1 || hole > end)
+                hole = end;
+        }
+
+        // extents are block aligned, but be safe about record alignment
+        data -= data % STUDENT_RECORD_SIZE;
+
+        while (data < hole) {
+            size_t want = SCAN_BLOCK_SIZE;
+            if ((off_t)want > hole - data)
+                want = hole - data;
+
+            ssize_t n = io_pread(fd, buf, want, data);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                rc = ERR_DB_FILE;
+                break;
+            }
+            if (n == 0)
+                break;          // file shrank under us
+            if (n % STUDENT_RECORD_SIZE != 0) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+
+            rc = fn(buf, n / STUDENT_RECORD_SIZE, arg);
+            if (rc != NO_ERROR)
+                break;
+            data += n;
+        }
+        pos = hole;
+    }
+
+    free(buf);
+    return rc;
+}
+
+struct scan_cb_args {
+    scan_cb_t cb;
+    void *arg;
+};
+
+static int scan_block_cb(const student_t *recs, int n, void *arg)
+{
+    struct scan_cb_args *a = arg;
+    int i = 0;
+
+    while ((i = next_nonempty(recs, i, n)) < n) {
+        int rc = a->cb(&recs[i], a->arg);
+        if (rc != 0)
+            return rc;
+        i++;
+    }
+    return NO_ERROR;
+}
+
+static int count_block_cb(const student_t *recs, int n, void *arg)
+{
+    *(int *)arg += count_nonempty(recs, n);
+    return NO_ERROR;
+}
+
+/*
+ *  scan_db
+ *      fd:     linux file descriptor
+ *      cb:     called with each non-empty record, in id order
+ *      arg:    passed through to cb
+ *
+ *  Calls cb for every valid student in the database.  Record pointers
+ *  passed to cb are only valid for the duration of the call.  Callbacks
+ *  should return positive values to stop early so that they are not
+ *  confused with the error codes in sdbsc.h.
+ *
+ *  returns:  NO_ERROR       every record was visited
+ *            ERR_DB_FILE    database file I/O issue
+ *            <other>        the value returned by cb to stop the scan
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_db(int fd, scan_cb_t cb, void *arg)
+{
+    struct scan_cb_args a = { cb, arg };
+
+    return scan_blocks(fd, 0, INT64_MAX, scan_block_cb, &a);
+}
+
+/*
+ *  scan_range
+ *      fd:      linux file descriptor
+ *      lo, hi:  ids [lo, hi) to scan
+ *      cb, arg: as for scan_db()
+ *
+ *  scan_db() limited to a range of ids, so several threads can each scan
+ *  a part of the database.
+ *
+ *  returns:  same as scan_db()
+ */
+int scan_range(int fd, int64_t lo, int64_t hi, scan_cb_t cb, void *arg)
+{
+    struct scan_cb_args a = { cb, arg };
+
+    return scan_blocks(fd, lo, hi, scan_block_cb, &a);
+}
+
+/*
+ *  scan_count
+ *      fd:     linux file descriptor
+ *
+ *  returns:  <number>       the number of valid students in the database
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_count(int fd)
+{
+    int count = 0;
+    int rc = scan_blocks(fd, 0, INT64_MAX, count_block_cb, &count);
+
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+    return count;
+}
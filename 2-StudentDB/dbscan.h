@@ -0,0 +1,28 @@
+#ifndef __DBSCAN_H__
+    #define __DBSCAN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h" //get student record type
+
+//The scan engine reads the database in large blocks instead of one record
+//per read() call.  Holes in the sparse file are skipped with SEEK_DATA and
+//SEEK_HOLE so they cost no I/O at all.  SCAN_BLOCK_SIZE must be a multiple
+//of STUDENT_RECORD_SIZE.
+#define SCAN_BLOCK_SIZE     (4 * 1024 * 1024)
+
+//callback invoked for every non-empty record found by scan_db().  Return
+//zero to continue scanning, or any other value to stop the scan early, that
+//value is then returned from scan_db().
+typedef int (*scan_cb_t)(const student_t *s, void *arg);
+
+//prototypes
+int scan_db(int fd, scan_cb_t cb, void *arg);
+int scan_range(int fd, int64_t lo, int64_t hi, scan_cb_t cb, void *arg);
+int scan_count(int fd);
+bool record_is_empty(const student_t *s);
+int next_nonempty(const student_t *recs, int i, int n);
+int count_nonempty(const student_t *recs, int n);
+
+#endif
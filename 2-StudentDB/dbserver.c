@@ -0,0 +1,773 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbscan.h"
+#include "dbbitmap.h"
+#include "dbwal.h"
+#include "dbcompact.h"
+#include "dbtrie.h"
+#include "dblock.h"
+#include "dbpool.h"
+#include "dbserver.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(srv_req_t) == 16, "request header size");
+_Static_assert(sizeof(srv_resp_t) == 16, "response header size");
+
+//largest payload a request may carry
+#define SRV_MAX_PAYLOAD     ((uint32_t)sizeof(student_t))
+
+typedef struct srv_client {
+    int fd;                 // -1 if the slot is free
+    int out_fd;             // where responses go, fd except for --binary
+    bool closing;           // peer hung up or sent garbage
+    char *in;               // bytes received, not yet handled
+    size_t in_len;
+    size_t in_cap;
+    char *out;              // responses not yet sent
+    size_t out_len;
+    size_t out_off;         // bytes of out already sent
+    size_t out_cap;
+} srv_client_t;
+
+//a write waiting for the group commit
+typedef struct srv_write {
+    int client;             // slot in srv_t.clients
+    size_t resp_off;        // its response header in the client out buffer
+    int id;
+    bool del;
+    student_t s;
+    int status;             // result, patched into the response on commit
+} srv_write_t;
+
+typedef struct srv {
+    int dbfd;
+    db_ctx_t *ctx;
+    uint64_t held;          // stripes locked for the batched writes
+    srv_client_t clients[SRV_MAX_CLIENTS];
+    srv_write_t batch[SRV_BATCH_MAX];
+    int nbatch;
+    compact_state_t cs;
+    bool compact_dirty;     // deletes since the last compaction pass
+    name_trie_t *trie;      // built by the first name search
+    uint64_t *rowmask;      // scratch for name searches
+    size_t rowmask_words;
+    bool stop;
+} srv_t;
+
+static volatile sig_atomic_t srv_signalled = 0;
+
+static void srv_on_signal(int sig)
+{
+    (void)sig;
+    srv_signalled = 1;
+}
+
+/*
+ *  srv_read
+ *      id:  student id
+ *      s:   receives the student
+ *
+ *  Reads a student.  The bitmap answers for empty slots without touching
+ *  the file, other slots are read with the optimistic path of
+ *  get_student() so writers in other processes are never waited for.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ */
+static int srv_read(srv_t *srv, int id, student_t *s)
+{
+    if (srv->ctx != NULL) {
+        if (db_ctx_refresh(srv->ctx) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (srv->ctx->bitmap != NULL && !bitmap_test(srv->ctx->bitmap, id))
+            return SRCH_NOT_FOUND;
+    }
+    return get_student(srv->dbfd, id, s);
+}
+
+static int buf_reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return NO_ERROR;
+
+    size_t ncap = *cap ? *cap : 4096;
+    while (ncap < need)
+        ncap *= 2;
+    char *p = realloc(*buf, ncap);
+    if (p == NULL)
+        return ERR_DB_FILE;
+    *buf = p;
+    *cap = ncap;
+    return NO_ERROR;
+}
+
+/*
+ *  srv_respond
+ *
+ *  Queues a response on a client.
+ *
+ *  returns:  offset of the response header in the out buffer, or -1 when
+ *            out of memory (the client is dropped)
+ */
+static long srv_respond(srv_client_t *c, int status, uint32_t count, int next,
+                        const void *payload, uint32_t len)
+{
+    srv_resp_t resp = { status, count, next, len };
+    size_t off = c->out_len;
+
+    if (buf_reserve(&c->out, &c->out_cap, off + sizeof(resp) + len) != NO_ERROR) {
+        c->closing = true;
+        return -1;
+    }
+    memcpy(c->out + off, &resp, sizeof(resp));
+    if (len > 0)
+        memcpy(c->out + off + sizeof(resp), payload, len);
+    c->out_len += sizeof(resp) + len;
+    return (long)off;
+}
+
+//true if a write to id is waiting in the current batch
+static bool srv_pending(const srv_t *srv, int id)
+{
+    for (int i = 0; i < srv->nbatch; i++) {
+        if (srv->batch[i].id == id)
+            return true;
+    }
+    return false;
+}
+
+//drop every stripe taken by srv_hold()
+static void srv_release(srv_t *srv)
+{
+    for (int s = 0; srv->held != 0; s++) {
+        if (srv->held & (1ULL << s)) {
+            unlock_stripe(srv->ctx->lock, s * 64);
+            srv->held &= ~(1ULL << s);
+        }
+    }
+}
+
+/*
+ *  srv_commit
+ *
+ *  Group commit of the batched writes: they are logged with one
+ *  fdatasync() of the write-ahead log, then applied to the database, and
+ *  only then get their final status in the queued responses.  The stripes
+ *  of the batched ids stay locked until the writes are applied.
+ */
+static void srv_commit(srv_t *srv)
+{
+    db_ctx_t *ctx = srv->ctx;
+    bool locked = false;
+    int rc = NO_ERROR;
+
+    if (srv->nbatch == 0) {
+        srv_release(srv);
+        return;
+    }
+
+    // the log and the in place writes go under the meta lock, which also
+    // reloads the sidecars if another process changed them
+    if (ctx != NULL) {
+        rc = db_ctx_lock_meta(ctx);
+        locked = (rc == NO_ERROR);
+    }
+
+    if (rc == NO_ERROR && ctx != NULL && ctx->wal != NULL) {
+        wal_group_begin(ctx->wal);
+        for (int i = 0; i < srv->nbatch && rc == NO_ERROR; i++) {
+            srv_write_t *w = &srv->batch[i];
+            rc = wal_log(ctx->wal, w->id, w->del ? NULL : &w->s);
+        }
+        if (wal_group_end(ctx->wal) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < srv->nbatch; i++) {
+        srv_write_t *w = &srv->batch[i];
+
+        w->status = rc;
+        if (w->status == NO_ERROR)
+            w->status = apply_student(srv->dbfd, w->id, w->del ? NULL : &w->s);
+        if (w->status == NO_ERROR && w->del)
+            srv->compact_dirty = true;
+    }
+
+    // the writes went to the page cache, one pwrite() per changed page
+    bool flushed = (ctx == NULL || db_ctx_flush(ctx) == NO_ERROR);
+
+    for (int i = 0; i < srv->nbatch; i++) {
+        srv_write_t *w = &srv->batch[i];
+        int status = flushed ? w->status : ERR_DB_FILE;
+
+        srv_client_t *c = &srv->clients[w->client];
+        if (c->fd >= 0 && w->resp_off + sizeof(srv_resp_t) <= c->out_len)
+            memcpy(c->out + w->resp_off, &status, sizeof(status));
+    }
+    srv->nbatch = 0;
+
+    if (ctx != NULL) {
+        if (locked)
+            db_ctx_unlock_meta(ctx, true);
+        srv_release(srv);
+        db_ctx_checkpoint(ctx, false);
+    }
+}
+
+/*
+ *  srv_hold
+ *      id:  id about to be checked and written
+ *
+ *  Locks the stripe of id until the next srv_commit().  While other
+ *  stripes are held only a try lock is safe, when it fails the batch is
+ *  committed first so nothing is held while waiting.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int srv_hold(srv_t *srv, int id)
+{
+    if (srv->ctx == NULL || srv->ctx->lock == NULL)
+        return NO_ERROR;
+
+    uint64_t bit = 1ULL << lock_stripe_of(id);
+    if (srv->held & bit)
+        return NO_ERROR;
+    if (!lock_stripe_try(srv->ctx->lock, id)) {
+        srv_commit(srv);
+        if (lock_stripe(srv->ctx->lock, id) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    srv->held |= bit;
+    return NO_ERROR;
+}
+
+//queue a write, the response is filled in by srv_commit()
+static void srv_enqueue(srv_t *srv, int ci, int id, const student_t *s)
+{
+    if (srv->nbatch == SRV_BATCH_MAX)
+        srv_commit(srv);
+
+    long off = srv_respond(&srv->clients[ci], ERR_DB_FILE, 0, 0, NULL, 0);
+    if (off < 0)
+        return;
+
+    srv_write_t *w = &srv->batch[srv->nbatch++];
+    w->client = ci;
+    w->resp_off = off;
+    w->id = id;
+    w->del = (s == NULL);
+    if (s != NULL)
+        w->s = *s;
+}
+
+static void srv_scan(srv_t *srv, srv_client_t *c, int first, int max)
+{
+    student_t recs[SRV_SCAN_MAX];
+    struct stat st;
+    int n = 0;
+    int id = first < MIN_STD_ID ? MIN_STD_ID : first;
+    db_bitmap_t *bm = (srv->ctx != NULL) ? srv->ctx->bitmap : NULL;
+
+    if (max <= 0 || max > SRV_SCAN_MAX)
+        max = SRV_SCAN_MAX;
+    if ((srv->ctx != NULL && db_ctx_refresh(srv->ctx) != NO_ERROR) ||
+        fstat(srv->dbfd, &st) == -1) {
+        srv_respond(c, ERR_DB_FILE, 0, -1, NULL, 0);
+        return;
+    }
+
+    while (n < max) {
+        if (bm != NULL) {
+            int64_t next = bitmap_next(bm, id);
+            if (next < 0)
+                break;
+            id = (int)next;
+        } else if ((off_t)id * STUDENT_RECORD_SIZE >= st.st_size) {
+            break;
+        }
+
+        int rc = srv_read(srv, id, &recs[n]);
+        if (rc == NO_ERROR) {
+            n++;
+        } else if (rc != SRCH_NOT_FOUND) {
+            srv_respond(c, ERR_DB_FILE, 0, -1, NULL, 0);
+            return;
+        }
+        id++;
+    }
+
+    int next = (n == max) ? id : -1;
+    srv_respond(c, NO_ERROR, n, next, recs, n * STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  srv_names
+ *      text:     name text, len bytes, not NUL terminated
+ *      maxdist:  edit distance, 0 for a prefix search
+ *
+ *  Answers a name search from the trie, which is kept between requests
+ *  and rebuilt only after the database changed.
+ */
+static void srv_names(srv_t *srv, srv_client_t *c, const char *text, uint32_t len,
+                      int maxdist)
+{
+    char name[TRIE_NAME_MAX];
+    int32_t ids[SRV_SCAN_MAX];
+    uint32_t n = 0, total = 0;
+
+    if (len >= sizeof(name) || maxdist < 0 || maxdist > TRIE_MAX_DIST) {
+        srv_respond(c, SRV_ERR_BAD_REQ, 0, 0, NULL, 0);
+        return;
+    }
+    memcpy(name, text, len);
+    name[len] = '\0';
+
+    if (srv->trie != NULL && !trie_current(srv->dbfd, srv->trie)) {
+        trie_free(srv->trie);
+        srv->trie = NULL;
+    }
+    if (srv->trie == NULL)
+        srv->trie = trie_open(srv->dbfd);
+    if (srv->trie == NULL) {
+        srv_respond(c, ERR_DB_FILE, 0, 0, NULL, 0);
+        return;
+    }
+
+    size_t words = srv->trie->snap.hdr.n / 64 + 1;
+    if (words > srv->rowmask_words) {
+        uint64_t *p = realloc(srv->rowmask, words * sizeof(uint64_t));
+        if (p == NULL) {
+            srv_respond(c, ERR_DB_FILE, 0, 0, NULL, 0);
+            return;
+        }
+        srv->rowmask = p;
+        srv->rowmask_words = words;
+    }
+    memset(srv->rowmask, 0, words * sizeof(uint64_t));
+
+    trie_search(srv->trie, name, maxdist, srv->rowmask);
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = srv->rowmask[w]; bits != 0; bits &= bits - 1) {
+            if (n < SRV_SCAN_MAX)
+                ids[n++] = srv->trie->snap.id[w * 64 + __builtin_ctzll(bits)];
+            total++;
+        }
+    }
+    srv_respond(c, NO_ERROR, n, total, ids, n * sizeof(int32_t));
+}
+
+/*
+ *  srv_handle
+ *      ci:       slot of the client that sent the request
+ *      req:      request header
+ *      payload:  req->len bytes following the header
+ *
+ *  Reads are answered right away.  A read or a write of an id with a write
+ *  still in the batch, and any count or scan, first commits the batch so
+ *  every client sees its own writes.  A write holds the stripe of its id
+ *  from the existence check until it is applied.
+ */
+static void srv_handle(srv_t *srv, int ci, const srv_req_t *req, const char *payload)
+{
+    srv_client_t *c = &srv->clients[ci];
+    student_t s;
+    pool_stats_t st;
+    io_stats_t io;
+    int rc;
+
+    switch (req->op) {
+    case SRV_OP_GET:
+        if (validate_range(req->id, MIN_STD_GPA) != NO_ERROR) {
+            srv_respond(c, SRV_ERR_BAD_REQ, 0, 0, NULL, 0);
+            break;
+        }
+        if (srv_pending(srv, req->id))
+            srv_commit(srv);
+        rc = srv_read(srv, req->id, &s);
+        if (rc == NO_ERROR)
+            srv_respond(c, NO_ERROR, 1, 0, &s, sizeof(s));
+        else
+            srv_respond(c, rc, 0, 0, NULL, 0);
+        break;
+
+    case SRV_OP_ADD:
+        if (req->len != sizeof(student_t)) {
+            srv_respond(c, SRV_ERR_BAD_REQ, 0, 0, NULL, 0);
+            break;
+        }
+        memcpy(&s, payload, sizeof(s));
+        s.fname[sizeof(s.fname) - 1] = '\0';
+        s.lname[sizeof(s.lname) - 1] = '\0';
+        if (validate_range(s.id, s.gpa) != NO_ERROR) {
+            srv_respond(c, SRV_ERR_BAD_REQ, 0, 0, NULL, 0);
+            break;
+        }
+        if (srv_pending(srv, s.id))
+            srv_commit(srv);
+        rc = srv_hold(srv, s.id);
+        if (rc == NO_ERROR)
+            rc = student_exists(srv->dbfd, s.id);
+        if (rc == NO_ERROR)
+            srv_respond(c, ERR_DB_OP, 0, 0, NULL, 0);
+        else if (rc != SRCH_NOT_FOUND)
+            srv_respond(c, ERR_DB_FILE, 0, 0, NULL, 0);
+        else
+            srv_enqueue(srv, ci, s.id, &s);
+        break;
+
+    case SRV_OP_DEL:
+        if (validate_range(req->id, MIN_STD_GPA) != NO_ERROR) {
+            srv_respond(c, SRV_ERR_BAD_REQ, 0, 0, NULL, 0);
+            break;
+        }
+        if (srv_pending(srv, req->id))
+            srv_commit(srv);
+        rc = srv_hold(srv, req->id);
+        if (rc == NO_ERROR)
+            rc = student_exists(srv->dbfd, req->id);
+        if (rc == NO_ERROR)
+            srv_enqueue(srv, ci, req->id, NULL);
+        else
+            srv_respond(c, rc, 0, 0, NULL, 0);
+        break;
+
+    case SRV_OP_COUNT:
+        srv_commit(srv);
+        if (srv->ctx != NULL && db_ctx_refresh(srv->ctx) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        else if (srv->ctx != NULL && srv->ctx->bitmap != NULL)
+            rc = bitmap_count(srv->ctx->bitmap);
+        else
+            rc = scan_count(srv->dbfd);
+        if (rc < 0)
+            srv_respond(c, ERR_DB_FILE, 0, 0, NULL, 0);
+        else
+            srv_respond(c, NO_ERROR, rc, 0, NULL, 0);
+        break;
+
+    case SRV_OP_SCAN:
+        srv_commit(srv);
+        srv_scan(srv, c, req->id, req->arg);
+        break;
+
+    case SRV_OP_NAME:
+        srv_commit(srv);
+        srv_names(srv, c, payload, req->len, req->arg);
+        break;
+
+    case SRV_OP_STATS:
+        memset(&st, 0, sizeof(st));
+        if (srv->ctx != NULL && srv->ctx->pool != NULL)
+            st = srv->ctx->pool->stats;
+        srv_respond(c, NO_ERROR, 0, 0, &st, sizeof(st));
+        break;
+
+    case SRV_OP_IOSTATS:
+        iostat_get(&io);
+        srv_respond(c, NO_ERROR, 0, 0, &io, sizeof(io));
+        break;
+
+    case SRV_OP_SHUTDOWN:
+        srv->stop = true;
+        srv_respond(c, NO_ERROR, 0, 0, NULL, 0);
+        break;
+
+    default:
+        srv_respond(c, SRV_ERR_BAD_REQ, 0, 0, NULL, 0);
+        break;
+    }
+}
+
+//read what the client sent and handle every complete request
+static void srv_client_read(srv_t *srv, int ci)
+{
+    srv_client_t *c = &srv->clients[ci];
+    bool hangup = false;
+
+    for (;;) {
+        if (buf_reserve(&c->in, &c->in_cap, c->in_len + SRV_READ_SIZE) != NO_ERROR) {
+            c->closing = true;
+            return;
+        }
+        ssize_t n = read(c->fd, c->in + c->in_len, SRV_READ_SIZE);
+        if (n > 0) {
+            c->in_len += n;
+            // a blocking stdin must not wait here for more than it has
+            struct pollfd more = { c->fd, POLLIN, 0 };
+            if (n < SRV_READ_SIZE || poll(&more, 1, 0) != 1)
+                break;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            hangup = true;
+        break;
+    }
+
+    size_t pos = 0;
+    while (c->in_len - pos >= sizeof(srv_req_t) && !c->closing) {
+        srv_req_t req;
+        memcpy(&req, c->in + pos, sizeof(req));
+        if (req.len > SRV_MAX_PAYLOAD) {
+            c->closing = true;
+            break;
+        }
+        if (c->in_len - pos < sizeof(req) + req.len)
+            break;
+        srv_handle(srv, ci, &req, c->in + pos + sizeof(req));
+        pos += sizeof(req) + req.len;
+    }
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+    // requests sent before the hang up are still answered
+    if (hangup)
+        c->closing = true;
+}
+
+//send queued responses, as much as the socket takes
+static void srv_client_flush(srv_client_t *c)
+{
+    while (c->out_off < c->out_len) {
+        ssize_t n = write(c->out_fd, c->out + c->out_off, c->out_len - c->out_off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                c->closing = true;
+            return;
+        }
+        c->out_off += n;
+    }
+    c->out_off = 0;
+    c->out_len = 0;
+}
+
+static void srv_client_close(srv_client_t *c)
+{
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+static void srv_accept(srv_t *srv, int lfd)
+{
+    for (;;) {
+        int cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0)
+            return;
+
+        int ci = 0;
+        while (ci < SRV_MAX_CLIENTS && srv->clients[ci].fd >= 0)
+            ci++;
+        if (ci == SRV_MAX_CLIENTS) {
+            close(cfd);
+            continue;
+        }
+        srv->clients[ci].fd = cfd;
+        srv->clients[ci].out_fd = cfd;
+    }
+}
+
+//one bounded piece of online compaction, run while no request is waiting
+static void srv_compact(srv_t *srv)
+{
+    int rc = compact_step(srv->ctx, srv->dbfd, &srv->cs, COMPACT_STEP_EXTENTS);
+
+    if (rc > 0)
+        return;
+    if (rc == NO_ERROR)
+        compact_tail(srv->ctx, srv->dbfd, &srv->cs);
+    memset(&srv->cs, 0, sizeof(srv->cs));
+    srv->compact_dirty = false;
+}
+
+static int srv_listen(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0)
+        return -1;
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(lfd, SRV_MAX_CLIENTS) == -1) {
+        close(lfd);
+        return -1;
+    }
+    return lfd;
+}
+
+//set up the server state for the database fd
+static void srv_init(srv_t *srv, int fd)
+{
+    memset(srv, 0, sizeof(*srv));
+    srv->dbfd = fd;
+    srv->ctx = db_ctx_get(fd);
+    // a server counts its I/O for SRV_OP_IOSTATS for as long as it runs
+    iostat_enable(true);
+    // a server keeps the database open, so pages are worth caching; without
+    // memory for the pool it simply runs uncached
+    if (srv->ctx != NULL && srv->ctx->pool == NULL)
+        srv->ctx->pool = pool_create(fd, srv->ctx->lock, POOL_FRAMES);
+    for (int i = 0; i < SRV_MAX_CLIENTS; i++)
+        srv->clients[i].fd = -1;
+}
+
+/*
+ *  serve_db
+ *      fd:         database file descriptor returned by open_db()
+ *      sock_path:  Unix domain socket to listen on
+ *
+ *  Runs the request loop of sdbsc --serve until a client sends
+ *  SRV_OP_SHUTDOWN or the process gets SIGINT or SIGTERM.  When no request
+ *  is waiting the database is compacted a few extents at a time.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the socket cannot be set up
+ *
+ *  console:  M_SRV_READY       once the socket accepts connections
+ *            M_ERR_SRV_SOCK    error creating the socket
+ */
+int serve_db(int fd, const char *sock_path)
+{
+    static srv_t srv;
+    struct pollfd pfds[SRV_MAX_CLIENTS + 1];
+    int slot[SRV_MAX_CLIENTS + 1];
+    struct sigaction sa;
+
+    srv_init(&srv, fd);
+
+    int lfd = srv_listen(sock_path);
+    if (lfd < 0) {
+        printf(M_ERR_SRV_SOCK);
+        return ERR_DB_FILE;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = srv_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf(M_SRV_READY, sock_path);
+    fflush(stdout);
+
+    while (!srv.stop && !srv_signalled) {
+        int n = 0;
+        pfds[n].fd = lfd;
+        pfds[n].events = POLLIN;
+        slot[n++] = -1;
+        for (int i = 0; i < SRV_MAX_CLIENTS; i++) {
+            srv_client_t *c = &srv.clients[i];
+            if (c->fd < 0)
+                continue;
+            pfds[n].fd = c->fd;
+            pfds[n].events = POLLIN | (c->out_len > c->out_off ? POLLOUT : 0);
+            slot[n++] = i;
+        }
+
+        int ready = poll(pfds, n, srv.compact_dirty ? SRV_IDLE_MS : -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ready == 0) {
+            srv_compact(&srv);
+            continue;
+        }
+
+        // every request that arrived in this wakeup joins one group commit
+        for (int k = 1; k < n; k++) {
+            if (pfds[k].revents & (POLLIN | POLLHUP | POLLERR))
+                srv_client_read(&srv, slot[k]);
+        }
+        srv_commit(&srv);
+
+        for (int i = 0; i < SRV_MAX_CLIENTS; i++) {
+            srv_client_t *c = &srv.clients[i];
+            if (c->fd < 0)
+                continue;
+            srv_client_flush(c);
+            if (c->closing)
+                srv_client_close(c);
+        }
+
+        if (pfds[0].revents & POLLIN)
+            srv_accept(&srv, lfd);
+    }
+
+    srv_commit(&srv);
+    for (int i = 0; i < SRV_MAX_CLIENTS; i++) {
+        if (srv.clients[i].fd >= 0) {
+            srv_client_flush(&srv.clients[i]);
+            srv_client_close(&srv.clients[i]);
+        }
+    }
+    close(lfd);
+    unlink(sock_path);
+    trie_free(srv.trie);
+    free(srv.rowmask);
+    return NO_ERROR;
+}
+
+/*
+ *  serve_stdio
+ *      fd:  database file descriptor returned by open_db()
+ *
+ *  sdbsc --binary: answers the requests of the --serve protocol read from
+ *  stdin, writing the responses to stdout, until stdin ends or a request
+ *  is SRV_OP_SHUTDOWN.  Whatever arrived in one read is group committed
+ *  like the requests of one poll() wakeup of serve_db().
+ *
+ *  returns:  NO_ERROR
+ *
+ *  console:  only the binary responses
+ */
+int serve_stdio(int fd)
+{
+    static srv_t srv;
+    srv_client_t *c = &srv.clients[0];
+
+    srv_init(&srv, fd);
+    c->fd = STDIN_FILENO;
+    c->out_fd = STDOUT_FILENO;
+    signal(SIGPIPE, SIG_IGN);
+    fflush(stdout);
+
+    while (!srv.stop && !c->closing) {
+        srv_client_read(&srv, 0);
+        srv_commit(&srv);
+        srv_client_flush(c);
+    }
+    srv_commit(&srv);
+    srv_client_flush(c);
+
+    free(c->in);
+    free(c->out);
+    trie_free(srv.trie);
+    free(srv.rowmask);
+    return NO_ERROR;
+}
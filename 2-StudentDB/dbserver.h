@@ -0,0 +1,69 @@
+#ifndef __DBSERVER_H__
+    #define __DBSERVER_H__
+
+#include <stdint.h>
+
+#include "db.h"
+
+//sdbsc --serve keeps the database open in a long running process and
+//answers requests on a Unix domain socket (student.db.sock by default).
+//The bitmap and indexes stay loaded between requests and pages of the
+//database are cached in a buffer pool (see dbpool.h), so a repeated lookup
+//is a bitmap test and a memcpy.  Other sdbsc processes may use the same
+//database at the same time, see dblock.h.
+//
+//Every request is a fixed srv_req_t header followed by len payload bytes,
+//every response a srv_resp_t header followed by len payload bytes.  All
+//fields are in host byte order, the socket is local.  Requests may be
+//pipelined, responses come back in request order on each connection.
+//
+//sdbsc --binary speaks the same protocol over stdin and stdout, one
+//client per process, see serve_stdio().
+//
+//Writes are group committed: all the writes read from the clients in one
+//poll() wakeup share a single fdatasync() of the write-ahead log, and none
+//of them is acknowledged before that sync completed.
+#define SRV_SOCK_SUFFIX     ".sock"
+#define SRV_MAX_CLIENTS     64
+#define SRV_BATCH_MAX       256     // writes per group commit
+#define SRV_SCAN_MAX        1024    // students per SRV_OP_SCAN response
+#define SRV_IDLE_MS         100     // idle time before compaction steps
+#define SRV_READ_SIZE       (64 * 1024)
+
+//request opcodes
+#define SRV_OP_GET          1   // id                  -> one student
+#define SRV_OP_ADD          2   // payload: student_t  -> status only
+#define SRV_OP_DEL          3   // id                  -> status only
+#define SRV_OP_COUNT        4   //                     -> count
+#define SRV_OP_SCAN         5   // id = first id, arg = max students
+                                //                     -> count students, next
+#define SRV_OP_SHUTDOWN     6   // stops the server after this batch
+#define SRV_OP_NAME         7   // payload: name text, arg = edit distance
+                                //   -> count ids (int32, at most
+                                //      SRV_SCAN_MAX), next = all matches
+#define SRV_OP_STATS        8   //   -> pool_stats_t of the page cache
+#define SRV_OP_IOSTATS      9   //   -> io_stats_t since the server started
+
+//response status, in addition to the codes from sdbsc.h: NO_ERROR,
+//ERR_DB_FILE, ERR_DB_OP (student already exists) and SRCH_NOT_FOUND
+#define SRV_ERR_BAD_REQ     -4  // unknown op, bad length or out of range
+
+typedef struct srv_req {
+    uint32_t op;
+    int32_t id;
+    int32_t arg;
+    uint32_t len;           // payload bytes that follow
+} srv_req_t;
+
+typedef struct srv_resp {
+    int32_t status;
+    uint32_t count;         // students in the payload, or the record count
+    int32_t next;           // SRV_OP_SCAN: id to continue from, -1 at the end
+    uint32_t len;           // payload bytes that follow
+} srv_resp_t;
+
+//prototypes
+int serve_db(int fd, const char *sock_path);
+int serve_stdio(int fd);
+
+#endif
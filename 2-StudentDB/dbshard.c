@@ -0,0 +1,602 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbscan.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbcompact.h"
+#include "dbimport.h"
+#include "dbmvcc.h"
+#include "dbshard.h"
+#include "dbiostat.h"
+
+//the work of one thread in shard_run()
+struct shard_job {
+    shard_db_t *sh;
+    int k;                  // shard the job is for
+    int rc;                 // result, a count or an error code
+    student_t *recs;        // students read from or going to the shard
+    int n;
+    int cap;
+};
+
+//murmur3 finalizer, spreads consecutive pages over the shards
+static uint32_t shard_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
+
+/*
+ *  shard_of
+ *      m:   manifest of the sharded database
+ *      id:  student id
+ *
+ *  returns:  the shard that holds id
+ */
+int shard_of(const shard_manifest_t *m, int id)
+{
+    if (m->mode == SHARD_BY_HASH)
+        return shard_hash((uint32_t)(id / SHARD_PAGE_RECORDS)) % m->nshards;
+
+    int k = id / (int)m->width;
+    return (k < (int)m->nshards) ? k : (int)m->nshards - 1;
+}
+
+//open shard k if it is not open yet, returns its fd or ERR_DB_FILE
+static int shard_open_k(shard_db_t *sh, int k, bool truncate)
+{
+    char path[PATH_MAX];
+
+    if (sh->fd[k] >= 0 && !truncate)
+        return sh->fd[k];
+    if (sh->fd[k] >= 0) {
+        close_db(sh->fd[k]);
+        sh->fd[k] = -1;
+    }
+    snprintf(path, sizeof(path), SHARD_FILE_FMT, k);
+    sh->fd[k] = open_db(path, truncate);
+    return (sh->fd[k] < 0) ? ERR_DB_FILE : sh->fd[k];
+}
+
+//open every shard, done before any thread starts as open_db() sets up
+//shared state
+static int shard_open_all(shard_db_t *sh)
+{
+    for (uint32_t k = 0; k < sh->m.nshards; k++) {
+        if (shard_open_k(sh, k, false) < 0)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_run
+ *
+ *  Runs fn on one thread per shard and waits for all of them.  A shard
+ *  whose thread cant be started runs on the calling thread.
+ *
+ *  returns:  NO_ERROR, or the first error code left in a job
+ */
+static int shard_run(shard_db_t *sh, struct shard_job *jobs, void *(*fn)(void *))
+{
+    pthread_t tid[SHARD_MAX];
+    bool started[SHARD_MAX];
+    int rc = NO_ERROR;
+
+    for (uint32_t k = 0; k < sh->m.nshards; k++) {
+        jobs[k].sh = sh;
+        jobs[k].k = k;
+        started[k] = (sh->m.nshards > 1 &&
+                      pthread_create(&tid[k], NULL, fn, &jobs[k]) == 0);
+        if (!started[k])
+            fn(&jobs[k]);
+    }
+    for (uint32_t k = 0; k < sh->m.nshards; k++) {
+        if (started[k])
+            pthread_join(tid[k], NULL);
+        if (jobs[k].rc < 0 && rc == NO_ERROR)
+            rc = jobs[k].rc;
+    }
+    return rc;
+}
+
+static int job_push(struct shard_job *job, const student_t *s)
+{
+    if (job->n == job->cap) {
+        int cap = job->cap ? job->cap * 2 : 1024;
+        student_t *recs = realloc(job->recs, (size_t)cap * sizeof(student_t));
+        if (recs == NULL)
+            return ERR_DB_FILE;
+        job->recs = recs;
+        job->cap = cap;
+    }
+    job->recs[job->n++] = *s;
+    return NO_ERROR;
+}
+
+static int collect_cb(const student_t *s, void *arg)
+{
+    return job_push(arg, s);
+}
+
+static void free_jobs(struct shard_job *jobs)
+{
+    for (int k = 0; k < SHARD_MAX; k++)
+        free(jobs[k].recs);
+}
+
+//write a manifest, replacing the old one in one rename()
+static int write_manifest(const shard_manifest_t *m)
+{
+    char tmp[PATH_MAX];
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", SHARD_MANIFEST);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd < 0)
+        return ERR_DB_FILE;
+    if (pwrite_all(fd, m, sizeof(*m), 0) != NO_ERROR || io_fdatasync(fd) == -1) {
+        close(fd);
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+    close(fd);
+    if (io_rename(tmp, SHARD_MANIFEST) == -1) {
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_open
+ *
+ *  Loads the manifest of the sharded database.  No shard is opened yet,
+ *  see shard_fd().
+ *
+ *  returns:  the sharded database, or NULL if there is no valid manifest
+ */
+shard_db_t *shard_open(void)
+{
+    shard_db_t *sh = calloc(1, sizeof(*sh));
+    int fd = open(SHARD_MANIFEST, O_RDONLY);
+
+    if (sh == NULL || fd < 0) {
+        free(sh);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    ssize_t n = io_pread(fd, &sh->m, sizeof(sh->m), 0);
+    close(fd);
+    if (n != sizeof(sh->m) || sh->m.magic != SHARD_MAGIC || sh->m.version != SHARD_VERSION ||
+        sh->m.nshards < 1 || sh->m.nshards > SHARD_MAX ||
+        (sh->m.mode != SHARD_BY_RANGE && sh->m.mode != SHARD_BY_HASH) || sh->m.width == 0) {
+        free(sh);
+        return NULL;
+    }
+    for (int k = 0; k < SHARD_MAX; k++)
+        sh->fd[k] = -1;
+    return sh;
+}
+
+//close the open shards, NULL is ignored
+void shard_close(shard_db_t *sh)
+{
+    if (sh == NULL)
+        return;
+    for (int k = 0; k < SHARD_MAX; k++) {
+        if (sh->fd[k] >= 0)
+            close_db(sh->fd[k]);
+    }
+    free(sh);
+}
+
+/*
+ *  shard_fd
+ *      sh:  sharded database
+ *      id:  student id
+ *
+ *  Opens the shard that holds id, no other shard is touched.
+ *
+ *  returns:  its fd, usable with the functions of sdbsc.h, or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_OPEN   the shard cant be opened
+ */
+int shard_fd(shard_db_t *sh, int id)
+{
+    return shard_open_k(sh, shard_of(&sh->m, id), false);
+}
+
+static void *count_job(void *arg)
+{
+    struct shard_job *job = arg;
+    int fd = job->sh->fd[job->k];
+    db_ctx_t *ctx = db_ctx_get(fd);
+
+    if (ctx != NULL && ctx->bitmap != NULL && db_ctx_refresh(ctx) == NO_ERROR)
+        job->rc = bitmap_count(ctx->bitmap);
+    else
+        job->rc = scan_count(fd);
+    return NULL;
+}
+
+/*
+ *  shard_count
+ *      sh:  sharded database
+ *
+ *  Counts the students of every shard in parallel.
+ *
+ *  returns:  <number>       students in all shards
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_OPEN   a shard cant be opened
+ */
+int shard_count(shard_db_t *sh)
+{
+    struct shard_job jobs[SHARD_MAX] = { 0 };
+    int total = 0;
+
+    if (shard_open_all(sh) != NO_ERROR || shard_run(sh, jobs, count_job) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (uint32_t k = 0; k < sh->m.nshards; k++)
+        total += jobs[k].rc;
+    return total;
+}
+
+static void *scan_job(void *arg)
+{
+    struct shard_job *job = arg;
+
+    job->rc = scan_snapshot(job->sh->fd[job->k], collect_cb, job);
+    return NULL;
+}
+
+/*
+ *  shard_scan
+ *      sh:   sharded database
+ *      cb:   called with each student, in id order
+ *      arg:  passed through to cb
+ *
+ *  Reads every shard in parallel, each from a snapshot (see dbmvcc.h),
+ *  then merges the shards into id order for cb on the calling thread.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or the value returned by cb to stop
+ *
+ *  console:  M_ERR_DB_OPEN   a shard cant be opened
+ */
+int shard_scan(shard_db_t *sh, scan_cb_t cb, void *arg)
+{
+    struct shard_job jobs[SHARD_MAX] = { 0 };
+    int head[SHARD_MAX] = { 0 };
+    int rc;
+
+    if (shard_open_all(sh) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = shard_run(sh, jobs, scan_job);
+
+    while (rc == NO_ERROR) {
+        int best = -1;
+        for (uint32_t k = 0; k < sh->m.nshards; k++) {
+            if (head[k] < jobs[k].n &&
+                (best < 0 || jobs[k].recs[head[k]].id < jobs[best].recs[head[best]].id))
+                best = k;
+        }
+        if (best < 0)
+            break;
+        rc = cb(&jobs[best].recs[head[best]++], arg);
+    }
+    free_jobs(jobs);
+    return rc;
+}
+
+static void *compact_job(void *arg)
+{
+    struct shard_job *job = arg;
+    compact_state_t cs;
+
+    job->rc = compact_db(job->sh->fd[job->k], &cs);
+    // without hole punching there is nothing to give back
+    if (job->rc != NO_ERROR && errno == EOPNOTSUPP)
+        job->rc = NO_ERROR;
+    return NULL;
+}
+
+/*
+ *  shard_compact
+ *      sh:  sharded database
+ *
+ *  Runs compact_db() on every shard in parallel.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_OPEN   a shard cant be opened
+ */
+int shard_compact(shard_db_t *sh)
+{
+    struct shard_job jobs[SHARD_MAX] = { 0 };
+
+    if (shard_open_all(sh) != NO_ERROR)
+        return ERR_DB_FILE;
+    return shard_run(sh, jobs, compact_job);
+}
+
+//true if the shard of id already has a student there, for import_read()
+static bool shard_has_student(int id, void *arg)
+{
+    shard_db_t *sh = arg;
+    int fd = sh->fd[shard_of(&sh->m, id)];
+    db_ctx_t *ctx = db_ctx_get(fd);
+    student_t existing;
+
+    if (ctx != NULL && ctx->bitmap != NULL)
+        return bitmap_test(ctx->bitmap, id);
+    return get_student(fd, id, &existing) == NO_ERROR;
+}
+
+static void *import_job(void *arg)
+{
+    struct shard_job *job = arg;
+
+    job->rc = (job->n > 0) ? import_locked(job->sh->fd[job->k], job->recs, job->n) : NO_ERROR;
+    return NULL;
+}
+
+/*
+ *  shard_write
+ *
+ *  Splits students that are already checked by shard and imports every
+ *  part into its shard in parallel.  Called with every shard locked.
+ */
+static int shard_write(shard_db_t *sh, const student_t *recs, int n)
+{
+    struct shard_job jobs[SHARD_MAX] = { 0 };
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < n && rc == NO_ERROR; i++)
+        rc = job_push(&jobs[shard_of(&sh->m, recs[i].id)], &recs[i]);
+    if (rc == NO_ERROR)
+        rc = shard_run(sh, jobs, import_job);
+    free_jobs(jobs);
+    return rc;
+}
+
+//lock (or unlock) every stripe of every shard, always in shard order
+static int shard_lock_all(shard_db_t *sh, bool lock)
+{
+    for (uint32_t k = 0; k < sh->m.nshards; k++) {
+        db_ctx_t *ctx = db_ctx_get(sh->fd[k]);
+
+        if (ctx == NULL)
+            continue;
+        if (!lock) {
+            db_ctx_unlock_all(ctx);
+            db_ctx_checkpoint(ctx, false);
+        } else if (db_ctx_lock_all(ctx) != NO_ERROR) {
+            while (k-- > 0) {
+                if ((ctx = db_ctx_get(sh->fd[k])) != NULL)
+                    db_ctx_unlock_all(ctx);
+            }
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_import
+ *      sh:    sharded database
+ *      path:  csv file to import, see dbimport.h
+ *
+ *  Same as import_csv() on a sharded database.  Every shard is locked
+ *  while the file is checked, duplicates are looked up in the shard of
+ *  their id, then all shards are written in parallel.  Nothing is written
+ *  unless the whole file is valid.
+ *
+ *  returns:  <number>       number of students imported
+ *            ERR_DB_FILE    database or csv file I/O issue
+ *            ERR_DB_OP      the csv file holds a bad or duplicate record
+ *
+ *  console:  M_DB_IMPORTED     on success
+ *            M_ERR_IMPORT_*    describing the first bad line
+ *            M_ERR_DB_WRITE    error writing a shard
+ */
+int shard_import(shard_db_t *sh, const char *path)
+{
+    student_t *recs = NULL;
+    int n = 0;
+    int rc;
+
+    if (shard_open_all(sh) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (shard_lock_all(sh, true) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    rc = import_read(path, shard_has_student, sh, &recs, &n);
+    if (rc == NO_ERROR)
+        rc = shard_write(sh, recs, n);
+    shard_lock_all(sh, false);
+    free(recs);
+
+    if (rc != NO_ERROR)
+        return rc;
+    printf(M_DB_IMPORTED, n);
+    return n;
+}
+
+/*
+ *  shard_zero
+ *      sh:  sharded database
+ *
+ *  Removes every student from every shard, like -z.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_OPEN   a shard cant be opened
+ *            M_ERR_DB_WRITE  a shard cant be truncated
+ */
+int shard_zero(shard_db_t *sh)
+{
+    for (uint32_t k = 0; k < sh->m.nshards; k++) {
+        int fd = shard_open_k(sh, k, false);
+        if (fd < 0)
+            return ERR_DB_FILE;
+        if (db_ctx_zero(db_ctx_get(fd)) != NO_ERROR) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_merge
+ *      sh:  sharded database
+ *
+ *  Undoes --sharded --init: the students of every shard replace the ones
+ *  in student.db, then the manifest is removed so plain commands work on
+ *  student.db again.  Like shard_init() it reads the shards once and is
+ *  meant to be run while no other sdbsc works on them.  The shard files
+ *  are left as they are, the next --sharded --init empties them.
+ *
+ *  returns:  <number>       students copied into student.db
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_OPEN   a database file cant be opened
+ *            M_ERR_DB_READ   error reading a shard
+ *            M_ERR_DB_WRITE  error writing student.db or removing the manifest
+ */
+int shard_merge(shard_db_t *sh)
+{
+    struct shard_job all = { 0 };
+    int rc = shard_scan(sh, collect_cb, &all);
+
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        free(all.recs);
+        return ERR_DB_FILE;
+    }
+
+    int fd = open_db(DB_FILE, false);
+    if (fd < 0) {
+        free(all.recs);
+        return ERR_DB_FILE;
+    }
+    // emptied in place like -z, then written like an import
+    db_ctx_t *ctx = db_ctx_get(fd);
+    if (ctx != NULL)
+        rc = db_ctx_zero(ctx);
+    else if (ftruncate(fd, 0) == -1)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && ctx != NULL)
+        rc = db_ctx_lock_all(ctx);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+    } else {
+        if (all.n > 0)
+            rc = import_locked(fd, all.recs, all.n);
+        if (ctx != NULL) {
+            db_ctx_unlock_all(ctx);
+            db_ctx_checkpoint(ctx, false);
+        }
+    }
+    close_db(fd);
+    free(all.recs);
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (unlink(SHARD_MANIFEST) == -1) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    return all.n;
+}
+
+/*
+ *  shard_init
+ *      n:     number of shards, 1 to SHARD_MAX
+ *      mode:  SHARD_BY_RANGE or SHARD_BY_HASH
+ *
+ *  Creates a sharded database of n empty shards and copies the students
+ *  of student.db into it.  student.db itself is left as it is, but once
+ *  the manifest exists sdbsc refuses to run commands on it, so the two
+ *  can not drift apart.  Shards of an earlier layout are emptied.
+ *
+ *  returns:  <number>       students copied from student.db
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_OPEN   a database file cant be opened
+ *            M_ERR_DB_WRITE  error writing the manifest or a shard
+ */
+int shard_init(int n, int mode)
+{
+    struct shard_job src = { 0 };
+    shard_db_t *sh = calloc(1, sizeof(*sh));
+    int rc = NO_ERROR;
+
+    if (sh == NULL)
+        return ERR_DB_FILE;
+    for (int k = 0; k < SHARD_MAX; k++)
+        sh->fd[k] = -1;
+
+    if (access(DB_FILE, F_OK) == 0) {
+        int fd = open_db(DB_FILE, false);
+        if (fd < 0) {
+            free(sh);
+            return ERR_DB_FILE;
+        }
+        rc = scan_snapshot(fd, collect_cb, &src);
+        close_db(fd);
+        if (rc != NO_ERROR) {
+            printf(M_ERR_DB_READ);
+            free(src.recs);
+            free(sh);
+            return ERR_DB_FILE;
+        }
+    }
+
+    int width = (MAX_STD_ID + n) / n;
+    width = (width + SHARD_PAGE_RECORDS - 1) / SHARD_PAGE_RECORDS * SHARD_PAGE_RECORDS;
+    sh->m.magic = SHARD_MAGIC;
+    sh->m.version = SHARD_VERSION;
+    sh->m.nshards = n;
+    sh->m.mode = mode;
+    sh->m.width = width;
+
+    for (int k = 0; k < n && rc == NO_ERROR; k++) {
+        if (shard_open_k(sh, k, true) < 0)
+            rc = ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR && write_manifest(&sh->m) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR && src.n > 0) {
+        rc = shard_lock_all(sh, true);
+        if (rc == NO_ERROR) {
+            rc = shard_write(sh, src.recs, src.n);
+            shard_lock_all(sh, false);
+        }
+    }
+
+    shard_close(sh);
+    free(src.recs);
+    return (rc == NO_ERROR) ? src.n : rc;
+}
@@ -0,0 +1,76 @@
+#ifndef __DBSHARD_H__
+    #define __DBSHARD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "dbscan.h"
+
+//Sharded database.  sdbsc --sharded --init n range|hash splits the
+//students of student.db into n files, SHARD_FILE_FMT with the shard
+//number, described by a manifest (SHARD_MANIFEST).  Every shard is an
+//ordinary database opened with open_db(), with its own sidecars,
+//write-ahead log and locks, and keeps a student at offset id * 64 like
+//student.db, so only the pages of its own ids hold data and the rest of
+//the file is a hole.  The shard of an id is
+//
+//  range   id / width, width is MAX_STD_ID / n rounded up to whole pages,
+//          so shard files follow each other in id order
+//  hash    a hash of the page of the id (SHARD_PAGE_RECORDS students),
+//          which spreads runs of neighbouring ids over all shards
+//
+//whole pages stay in one shard either way, so page compaction and the
+//page checksums work unchanged.  Being ordinary databases the shards have
+//the sidecars of student.db too, named after the shard file (for example
+//student.db.shard0.bitmap, .crc, .lname.idx, .gpa.idx, .wal, .lck, .mvcc
+//and .mvcc.idx), so a split into n shards adds about 9 * n files.
+//
+//student.db is kept after the split but only the shards are current: while
+//SHARD_MANIFEST exists plain sdbsc commands on student.db are refused and
+//have to be run with --sharded.  sdbsc --sharded --merge copies the shards
+//back into student.db and removes the manifest.
+//
+//sdbsc --sharded runs -a, -d and -f on the one shard of the id.  -c, -p,
+//-x and -i open every shard and work on them in parallel, one thread per
+//shard: counts are added up, printed students are merged back into id
+//order, and an import checks every record against all shards (with all
+//of them locked) before the shards are written at the same time.
+#define SHARD_MANIFEST      "student.db.shards"
+#define SHARD_FILE_FMT      "student.db.shard%d"
+#define SHARD_MAGIC         0x44485353      // "SSHD"
+#define SHARD_VERSION       1
+#define SHARD_MAX           16
+#define SHARD_PAGE_RECORDS  64              // 4K page of 64 byte students
+
+#define SHARD_BY_RANGE      0
+#define SHARD_BY_HASH       1
+
+typedef struct shard_manifest {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nshards;
+    uint32_t mode;          // SHARD_BY_RANGE or SHARD_BY_HASH
+    uint32_t width;         // ids per shard with SHARD_BY_RANGE
+    char pad[44];
+} shard_manifest_t;
+
+typedef struct shard_db {
+    shard_manifest_t m;
+    int fd[SHARD_MAX];      // from open_db(), -1 until the shard is needed
+} shard_db_t;
+
+//prototypes
+int shard_init(int n, int mode);
+shard_db_t *shard_open(void);
+void shard_close(shard_db_t *sh);
+int shard_of(const shard_manifest_t *m, int id);
+int shard_fd(shard_db_t *sh, int id);
+int shard_count(shard_db_t *sh);
+int shard_scan(shard_db_t *sh, scan_cb_t cb, void *arg);
+int shard_compact(shard_db_t *sh);
+int shard_import(shard_db_t *sh, const char *path);
+int shard_zero(shard_db_t *sh);
+int shard_merge(shard_db_t *sh);
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbcolumn.h"
+#include "dbtrie.h"
+
+static int grow(void **buf, uint32_t *cap, uint32_t need, size_t elem)
+{
+    if (need <= *cap)
+        return NO_ERROR;
+
+    uint32_t ncap = *cap ? *cap * 2 : 1024;
+    while (ncap < need)
+        ncap *= 2;
+    void *p = realloc(*buf, (size_t)ncap * elem);
+    if (p == NULL)
+        return ERR_DB_FILE;
+    *buf = p;
+    *cap = ncap;
+    return NO_ERROR;
+}
+
+//child of node for letter ch, or -1
+static int64_t trie_find(const name_trie_t *t, uint32_t node, unsigned char ch)
+{
+    for (uint32_t c = t->nodes[node].child; c != 0; c = t->nodes[c].sibling) {
+        if (t->nodes[c].ch == ch)
+            return c;
+    }
+    return -1;
+}
+
+//child of node for letter ch, created if missing
+static int64_t trie_child(name_trie_t *t, uint32_t node, unsigned char ch)
+{
+    int64_t found = trie_find(t, node, ch);
+    uint32_t c;
+
+    if (found >= 0)
+        return found;
+    if (grow((void **)&t->nodes, &t->node_cap, t->nnodes + 1, sizeof(trie_node_t)) != NO_ERROR)
+        return -1;
+    c = t->nnodes++;
+    t->nodes[c].child = 0;
+    t->nodes[c].hits = -1;
+    t->nodes[c].ch = ch;
+    t->nodes[c].sibling = t->nodes[node].child;
+    t->nodes[node].child = c;
+    return c;
+}
+
+static int trie_insert(name_trie_t *t, const char *name, uint32_t code, bool lname)
+{
+    uint32_t node = 0;
+
+    for (const char *p = name; *p != '\0'; p++) {
+        int64_t c = trie_child(t, node, tolower((unsigned char)*p));
+        if (c < 0)
+            return ERR_DB_FILE;
+        node = c;
+    }
+
+    if (grow((void **)&t->hits, &t->hit_cap, t->nhits + 1, sizeof(trie_hit_t)) != NO_ERROR)
+        return ERR_DB_FILE;
+    trie_hit_t *h = &t->hits[t->nhits];
+    h->code = code;
+    h->lname = lname;
+    h->next = t->nodes[node].hits;
+    t->nodes[node].hits = t->nhits++;
+    return NO_ERROR;
+}
+
+//counting sort of the rows by code
+static int build_postings(trie_postings_t *p, const uint32_t *codes, uint32_t n,
+                          uint32_t ncodes)
+{
+    p->off = calloc((size_t)ncodes + 1, sizeof(uint32_t));
+    p->rows = malloc(((size_t)n + 1) * sizeof(uint32_t));
+    if (p->off == NULL || p->rows == NULL)
+        return ERR_DB_FILE;
+
+    for (uint32_t r = 0; r < n; r++) {
+        if (codes[r] >= ncodes)
+            return ERR_DB_FILE;
+        p->off[codes[r] + 1]++;
+    }
+    for (uint32_t c = 0; c < ncodes; c++)
+        p->off[c + 1] += p->off[c];
+    for (uint32_t r = 0; r < n; r++)
+        p->rows[p->off[codes[r]]++] = r;
+    // the fill advanced every offset to the start of the next code
+    memmove(p->off + 1, p->off, (size_t)ncodes * sizeof(uint32_t));
+    p->off[0] = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  trie_open
+ *      fd:  database file descriptor
+ *
+ *  Builds the name trie and the posting lists from the columnar snapshot,
+ *  which is taken first if it is missing or not current.
+ *
+ *  returns:  the trie, or NULL on an I/O error or when out of memory
+ */
+name_trie_t *trie_open(int fd)
+{
+    name_trie_t *t = calloc(1, sizeof(*t));
+
+    if (t == NULL)
+        return NULL;
+    if (column_open(fd, &t->snap) != NO_ERROR) {
+        free(t);
+        return NULL;
+    }
+
+    const col_hdr_t *h = &t->snap.hdr;
+    int rc = grow((void **)&t->nodes, &t->node_cap, 1, sizeof(trie_node_t));
+    if (rc == NO_ERROR) {
+        t->nnodes = 1;
+        t->nodes[0].child = 0;
+        t->nodes[0].sibling = 0;
+        t->nodes[0].hits = -1;
+        t->nodes[0].ch = 0;
+    }
+    for (uint32_t c = 0; c < h->nfname && rc == NO_ERROR; c++)
+        rc = trie_insert(t, t->snap.fdict + (size_t)c * COL_NAME_SIZE, c, false);
+    for (uint32_t c = 0; c < h->nlname && rc == NO_ERROR; c++)
+        rc = trie_insert(t, t->snap.ldict + (size_t)c * COL_NAME_SIZE, c, true);
+    if (rc == NO_ERROR)
+        rc = build_postings(&t->fname, t->snap.fname, h->n, h->nfname);
+    if (rc == NO_ERROR)
+        rc = build_postings(&t->lname, t->snap.lname, h->n, h->nlname);
+
+    if (rc != NO_ERROR) {
+        trie_free(t);
+        return NULL;
+    }
+    return t;
+}
+
+//true if the trie still describes the database, see column_current()
+bool trie_current(int fd, const name_trie_t *t)
+{
+    return column_current(fd, &t->snap.hdr);
+}
+
+void trie_free(name_trie_t *t)
+{
+    if (t == NULL)
+        return;
+    column_close(&t->snap);
+    free(t->nodes);
+    free(t->hits);
+    free(t->fname.off);
+    free(t->fname.rows);
+    free(t->lname.off);
+    free(t->lname.rows);
+    free(t);
+}
+
+//mark the rows of every name ending at node, returns the names marked
+static int mark_node(const name_trie_t *t, uint32_t node, uint64_t *rowmask)
+{
+    int names = 0;
+
+    for (int32_t i = t->nodes[node].hits; i >= 0; i = t->hits[i].next) {
+        const trie_hit_t *h = &t->hits[i];
+        const trie_postings_t *p = h->lname ? &t->lname : &t->fname;
+        for (uint32_t k = p->off[h->code]; k < p->off[h->code + 1]; k++)
+            rowmask[p->rows[k] / 64] |= 1ULL << (p->rows[k] % 64);
+        names++;
+    }
+    return names;
+}
+
+//mark every name in the subtree of node
+static int mark_subtree(const name_trie_t *t, uint32_t node, uint64_t *rowmask)
+{
+    int names = mark_node(t, node, rowmask);
+
+    for (uint32_t c = t->nodes[node].child; c != 0; c = t->nodes[c].sibling)
+        names += mark_subtree(t, c, rowmask);
+    return names;
+}
+
+/*
+ *  fuzzy_walk
+ *      node:     trie node reached by the letters above
+ *      text:     lower cased search text, m letters
+ *      prev:     edit distance row of the parent: prev[j] is the distance
+ *                from the parent's prefix to the first j letters of text
+ *
+ *  One step of the classic trie walk for Levenshtein distance.  The row
+ *  for node is computed from the parent row, a name ending here matches
+ *  if the last column is within maxdist, and children are only visited
+ *  while some column of the row still is.
+ */
+static int fuzzy_walk(const name_trie_t *t, uint32_t node, const char *text, int m,
+                      const uint8_t *prev, int maxdist, uint64_t *rowmask)
+{
+    uint8_t row[TRIE_NAME_MAX + 1];
+    uint8_t best;
+    int names = 0;
+
+    row[0] = prev[0] + 1;
+    best = row[0];
+    for (int j = 1; j <= m; j++) {
+        uint8_t ins = row[j - 1] + 1;
+        uint8_t del = prev[j] + 1;
+        uint8_t sub = prev[j - 1] + (text[j - 1] != (char)t->nodes[node].ch);
+        row[j] = ins < del ? ins : del;
+        row[j] = sub < row[j] ? sub : row[j];
+        best = row[j] < best ? row[j] : best;
+    }
+
+    if (row[m] <= maxdist)
+        names += mark_node(t, node, rowmask);
+    if (best <= maxdist) {
+        for (uint32_t c = t->nodes[node].child; c != 0; c = t->nodes[c].sibling)
+            names += fuzzy_walk(t, c, text, m, row, maxdist, rowmask);
+    }
+    return names;
+}
+
+/*
+ *  trie_search
+ *      t:        name trie
+ *      text:     search text
+ *      maxdist:  0 for a prefix search, 1 to TRIE_MAX_DIST for a fuzzy one
+ *      rowmask:  one bit per snapshot row, zeroed by the caller; the rows
+ *                of matching students are set
+ *
+ *  returns:  number of distinct first or last names matched
+ */
+int trie_search(const name_trie_t *t, const char *text, int maxdist, uint64_t *rowmask)
+{
+    char low[TRIE_NAME_MAX];
+    int m = strlen(text);
+
+    if (m >= TRIE_NAME_MAX)
+        return 0;
+    for (int j = 0; j <= m; j++)
+        low[j] = tolower((unsigned char)text[j]);
+
+    if (maxdist == 0) {
+        uint32_t node = 0;
+        for (int j = 0; j < m; j++) {
+            int64_t c = trie_find(t, node, low[j]);
+            if (c < 0)
+                return 0;
+            node = c;
+        }
+        return mark_subtree(t, node, rowmask);
+    }
+
+    // the root row is the distance from the empty prefix: j insertions
+    uint8_t row[TRIE_NAME_MAX + 1];
+    int names = 0;
+    for (int j = 0; j <= m; j++)
+        row[j] = j;
+    if (m <= maxdist)
+        names += mark_node(t, 0, rowmask);
+    for (uint32_t c = t->nodes[0].child; c != 0; c = t->nodes[c].sibling)
+        names += fuzzy_walk(t, c, low, m, row, maxdist, rowmask);
+    return names;
+}
+
+//rebuild the student of a snapshot row
+void trie_row(const name_trie_t *t, uint32_t row, student_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->id = t->snap.id[row];
+    s->gpa = t->snap.gpa[row];
+    strncpy(s->fname, t->snap.fdict + (size_t)t->snap.fname[row] * COL_NAME_SIZE,
+            sizeof(s->fname) - 1);
+    strncpy(s->lname, t->snap.ldict + (size_t)t->snap.lname[row] * COL_NAME_SIZE,
+            sizeof(s->lname) - 1);
+}
@@ -0,0 +1,70 @@
+#ifndef __DBTRIE_H__
+    #define __DBTRIE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "db.h"
+#include "dbcolumn.h"
+
+//Name search for type-ahead lookups.  A trie over every distinct first
+//and last name is built in memory from the columnar snapshot (see
+//dbcolumn.h), whose sorted name dictionaries are already on disk next to
+//the database and kept current with it.  Matching is case insensitive
+//for ASCII letters.  Each trie node that ends a name points at the
+//dictionary codes spelled that way, and posting lists built from the code
+//columns turn a code into the rows (students) that carry it.
+//
+//Two searches are supported:
+//
+//    prefix:  every name that starts with the text
+//    fuzzy:   every name within maxdist edits (insert, delete or replace
+//             one letter) of the whole text, found by walking the trie
+//             with one row of the edit distance table per node and
+//             pruning subtrees whose row has no value <= maxdist
+//
+//Nodes are kept as first child / next sibling links in one array.
+#define TRIE_MAX_DIST       3               // largest fuzzy distance
+#define TRIE_NAME_MAX       COL_NAME_SIZE   // longest name + 1
+
+typedef struct trie_node {
+    uint32_t child;         // first child, 0 if none (node 0 is the root)
+    uint32_t sibling;       // next child of the parent, 0 if none
+    int32_t hits;           // first trie_hit_t of names ending here, or -1
+    unsigned char ch;       // letter on the edge from the parent
+} trie_node_t;
+
+//a dictionary code that ends at a node
+typedef struct trie_hit {
+    uint32_t code;
+    bool lname;             // code is in the lname dictionary, else fname
+    int32_t next;           // next hit of the same node, or -1
+} trie_hit_t;
+
+//rows carrying each code, in row order: rows[off[code] .. off[code + 1])
+typedef struct trie_postings {
+    uint32_t *off;
+    uint32_t *rows;
+} trie_postings_t;
+
+typedef struct name_trie {
+    col_snap_t snap;        // kept mapped, results are read from it
+    trie_node_t *nodes;
+    uint32_t nnodes;
+    uint32_t node_cap;
+    trie_hit_t *hits;
+    uint32_t nhits;
+    uint32_t hit_cap;
+    trie_postings_t fname;
+    trie_postings_t lname;
+} name_trie_t;
+
+//prototypes
+name_trie_t *trie_open(int fd);
+bool trie_current(int fd, const name_trie_t *t);
+void trie_free(name_trie_t *t);
+int trie_search(const name_trie_t *t, const char *text, int maxdist, uint64_t *rowmask);
+void trie_row(const name_trie_t *t, uint32_t row, student_t *s);
+
+#endif
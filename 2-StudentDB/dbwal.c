@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbctx.h"
+#include "dbscan.h"
+#include "dbbitmap.h"
+#include "dbwal.h"
+#include "dbcrc.h"
+#include "dbiostat.h"
+
+_Static_assert(sizeof(wal_hdr_t) == WAL_HDR_SIZE, "wal header size");
+_Static_assert(sizeof(wal_rec_t) == 88, "wal record size");
+
+static uint32_t wal_rec_crc(const wal_rec_t *r)
+{
+    return crc32c(0, (const char *)r + sizeof(r->crc), sizeof(*r) - sizeof(r->crc));
+}
+
+/*
+ *  wal_reset
+ *      dbfd:  database file descriptor
+ *
+ *  Empties the log and ties it to the current database file.  The lsn
+ *  sequence continues where it left off.  Only call this when every logged
+ *  change is durable in the database, see wal_checkpoint().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_reset(db_wal_t *wal, int dbfd)
+{
+    db_stamp_t stamp;
+
+    if (db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    memset(&wal->hdr, 0, sizeof(wal->hdr));
+    wal->hdr.magic = WAL_MAGIC;
+    wal->hdr.version = WAL_VERSION;
+    wal->hdr.db_ino = stamp.ino;
+    wal->hdr.start_lsn = wal->next_lsn;
+    wal->end = WAL_HDR_SIZE;
+
+    if (ftruncate(wal->fd, WAL_HDR_SIZE) == -1 ||
+        pwrite_all(wal->fd, &wal->hdr, sizeof(wal->hdr), 0) != NO_ERROR ||
+        io_fdatasync(wal->fd) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  wal_open
+ *      dbpath:  path of the database file
+ *      dbfd:    database file descriptor
+ *      fresh:   true if the database was just created or truncated
+ *
+ *  Opens the log of a database.  A log that belongs to another database
+ *  file (for example one that was deleted and created again) is emptied.
+ *  Replaying the records is done separately by wal_recover() once the rest
+ *  of the context is open.
+ *
+ *  returns:  the log, or NULL if it is not available
+ */
+db_wal_t *wal_open(const char *dbpath, int dbfd, bool fresh)
+{
+    char path[PATH_MAX];
+    db_stamp_t stamp;
+
+    if (sidecar_path(dbpath, WAL_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        db_stamp_get(dbfd, &stamp) != NO_ERROR)
+        return NULL;
+
+    db_wal_t *wal = calloc(1, sizeof(*wal));
+    if (wal == NULL)
+        return NULL;
+
+    wal->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (wal->fd < 0) {
+        free(wal);
+        return NULL;
+    }
+
+    wal->next_lsn = 1;
+    if (!fresh &&
+        io_pread(wal->fd, &wal->hdr, sizeof(wal->hdr), 0) == sizeof(wal->hdr) &&
+        wal->hdr.magic == WAL_MAGIC && wal->hdr.version == WAL_VERSION &&
+        wal->hdr.db_ino == stamp.ino) {
+        wal_refresh(wal);
+        return wal;
+    }
+
+    if (wal_reset(wal, dbfd) != NO_ERROR) {
+        wal_close(wal);
+        return NULL;
+    }
+    return wal;
+}
+
+void wal_close(db_wal_t *wal)
+{
+    if (wal == NULL)
+        return;
+    close(wal->fd);
+    free(wal->pending);
+    free(wal);
+}
+
+//write the pending records with one write and make them durable.  Lsns
+//are handed out here, so a log shared by several processes stays
+//consecutive as long as flushes are serialized (see dblock.h).
+static int wal_flush(db_wal_t *wal)
+{
+    size_t len = (size_t)wal->npending * sizeof(wal_rec_t);
+
+    if (wal->npending == 0)
+        return NO_ERROR;
+
+    for (int i = 0; i < wal->npending; i++) {
+        wal->pending[i].lsn = wal->next_lsn + i;
+        wal->pending[i].crc = wal_rec_crc(&wal->pending[i]);
+    }
+
+    int rc = pwrite_all(wal->fd, wal->pending, len, wal->end);
+    if (rc == NO_ERROR && io_fdatasync(wal->fd) == -1)
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR) {
+        wal->end += len;
+        wal->next_lsn += wal->npending;
+    }
+    wal->npending = 0;
+    return rc;
+}
+
+static int wal_push(db_wal_t *wal, int id, const student_t *s)
+{
+    if (wal->npending == wal->cap) {
+        int cap = wal->cap ? wal->cap * 2 : 64;
+        wal_rec_t *p = realloc(wal->pending, cap * sizeof(wal_rec_t));
+        if (p == NULL)
+            return ERR_DB_FILE;
+        wal->pending = p;
+        wal->cap = cap;
+    }
+
+    wal_rec_t *r = &wal->pending[wal->npending++];
+    memset(r, 0, sizeof(*r));
+    r->op = WAL_OP_WRITE;
+    r->id = id;
+    if (s != NULL)
+        r->s = *s;
+    return NO_ERROR;
+}
+
+/*
+ *  wal_refresh
+ *
+ *  Picks up records appended and checkpoints done by other processes:
+ *  re-reads the header and finds the end of the log from its size.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_refresh(db_wal_t *wal)
+{
+    wal_hdr_t hdr;
+    struct stat st;
+
+    if (io_pread(wal->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fstat(wal->fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (hdr.magic != WAL_MAGIC || hdr.version != WAL_VERSION)
+        return ERR_DB_FILE;
+
+    off_t n = (st.st_size > WAL_HDR_SIZE) ?
+              (st.st_size - WAL_HDR_SIZE) / (off_t)sizeof(wal_rec_t) : 0;
+    wal->hdr = hdr;
+    wal->end = WAL_HDR_SIZE + n * sizeof(wal_rec_t);
+    wal->next_lsn = hdr.start_lsn + n;
+    return NO_ERROR;
+}
+
+/*
+ *  wal_log
+ *      id:  slot being changed
+ *      s:   image the slot will hold, NULL for a deleted (all zero) slot
+ *
+ *  Logs one change.  Outside of a group the change is durable when this
+ *  returns, inside a group it becomes durable at wal_group_end().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_log(db_wal_t *wal, int id, const student_t *s)
+{
+    if (wal_push(wal, id, s) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (wal->group == 0)
+        return wal_flush(wal);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_log_bulk
+ *      recs:  new students
+ *      n:     number of students in recs
+ *
+ *  Logs the addition of many students.  They share one write and one
+ *  fdatasync() of the log, or join the open group.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_log_bulk(db_wal_t *wal, const student_t *recs, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (wal_push(wal, recs[i].id, &recs[i]) != NO_ERROR) {
+            wal->npending = 0;
+            return ERR_DB_FILE;
+        }
+    }
+    if (wal->group == 0)
+        return wal_flush(wal);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_group_begin / wal_group_end
+ *
+ *  Changes logged between these calls are committed together with a
+ *  single fdatasync() when the outermost group ends.  The caller must not
+ *  report any of them as durable before wal_group_end() returns NO_ERROR.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_group_begin(db_wal_t *wal)
+{
+    wal->group++;
+    return NO_ERROR;
+}
+
+int wal_group_end(db_wal_t *wal)
+{
+    if (wal->group > 0 && --wal->group == 0)
+        return wal_flush(wal);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_checkpoint
+ *      ctx:  database context
+ *
+ *  Makes the database and its sidecars durable, after which the logged
+ *  changes are no longer needed and the log is emptied.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_checkpoint(db_ctx_t *ctx)
+{
+    db_wal_t *wal = ctx->wal;
+
+    if (wal == NULL)
+        return NO_ERROR;
+    if (wal_flush(wal) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_ctx_sync(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    return wal_reset(wal, ctx->fd);
+}
+
+/*
+ *  wal_maybe_checkpoint
+ *      ctx:  database context
+ *
+ *  Checkpoints once the log is bigger than WAL_CHECKPOINT_BYTES and no
+ *  group is open.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_maybe_checkpoint(db_ctx_t *ctx)
+{
+    db_wal_t *wal = ctx->wal;
+
+    if (wal == NULL || wal->group > 0)
+        return NO_ERROR;
+    if (wal->end - WAL_HDR_SIZE < WAL_CHECKPOINT_BYTES)
+        return NO_ERROR;
+    return wal_checkpoint(ctx);
+}
+
+//order records by id, and by lsn for the same id
+static int rec_cmp(const void *a, const void *b)
+{
+    const wal_rec_t *x = a;
+    const wal_rec_t *y = b;
+
+    if (x->id != y->id)
+        return (x->id > y->id) - (x->id < y->id);
+    return (x->lsn > y->lsn) - (x->lsn < y->lsn);
+}
+
+/*
+ *  wal_recover
+ *      ctx:  database context, its sidecars already open
+ *
+ *  Replays the log after open_db().  Records are read up to the first one
+ *  with a bad checksum or an unexpected lsn (a torn or stale tail).  For
+ *  each id the last logged image is compared with the database slot and
+ *  with the occupancy bitmap.  Whatever does not match is rewritten and the
+ *  sidecars are updated, and the log is then checkpointed.  After a clean
+ *  shutdown everything matches and nothing is written.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_recover(db_ctx_t *ctx)
+{
+    db_wal_t *wal = ctx->wal;
+    struct stat st;
+
+    if (wal == NULL)
+        return NO_ERROR;
+    if (fstat(wal->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    size_t n = 0;
+    if (st.st_size > WAL_HDR_SIZE)
+        n = (st.st_size - WAL_HDR_SIZE) / sizeof(wal_rec_t);
+    if (n == 0) {
+        if (st.st_size != WAL_HDR_SIZE && ftruncate(wal->fd, WAL_HDR_SIZE) == -1)
+            return ERR_DB_FILE;
+        return NO_ERROR;
+    }
+
+    wal_rec_t *recs = malloc(n * sizeof(wal_rec_t));
+    if (recs == NULL)
+        return ERR_DB_FILE;
+    if (io_pread(wal->fd, recs, n * sizeof(wal_rec_t), WAL_HDR_SIZE) !=
+        (ssize_t)(n * sizeof(wal_rec_t))) {
+        free(recs);
+        return ERR_DB_FILE;
+    }
+
+    size_t valid = 0;
+    uint64_t lsn = wal->hdr.start_lsn;
+    while (valid < n && recs[valid].lsn == lsn && recs[valid].op == WAL_OP_WRITE &&
+           recs[valid].crc == wal_rec_crc(&recs[valid])) {
+        valid++;
+        lsn++;
+    }
+    wal->end = WAL_HDR_SIZE + valid * sizeof(wal_rec_t);
+    wal->next_lsn = lsn;
+
+    qsort(recs, valid, sizeof(wal_rec_t), rec_cmp);
+
+    int rc = NO_ERROR;
+    int repaired = 0;
+    for (size_t i = 0; i < valid && rc == NO_ERROR; i++) {
+        if (i + 1 < valid && recs[i + 1].id == recs[i].id)
+            continue;   // a later image of this slot wins
+
+        wal_rec_t *r = &recs[i];
+        student_t cur = EMPTY_STUDENT_RECORD;
+        off_t off = (off_t)r->id * STUDENT_RECORD_SIZE;
+        if (io_pread(ctx->fd, &cur, sizeof(cur), off) < 0) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        bool live = !record_is_empty(&r->s);
+        bool db_ok = memcmp(&cur, &r->s, sizeof(cur)) == 0;
+        bool bm_ok = ctx->bitmap == NULL || bitmap_test(ctx->bitmap, r->id) == live;
+        if (db_ok && bm_ok)
+            continue;
+
+        repaired++;
+        if (!db_ok)
+            rc = pwrite_all(ctx->fd, &r->s, sizeof(r->s), off);
+        if (rc == NO_ERROR)
+            rc = live ? db_ctx_added(ctx, &r->s, 1) : db_ctx_deleted(ctx, r->id);
+    }
+    free(recs);
+
+    if (rc != NO_ERROR)
+        return rc;
+    if (repaired > 0)
+        return wal_checkpoint(ctx);
+    if ((size_t)st.st_size != (size_t)wal->end && ftruncate(wal->fd, wal->end) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
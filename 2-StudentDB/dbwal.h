@@ -0,0 +1,77 @@
+#ifndef __DBWAL_H__
+    #define __DBWAL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "db.h"
+#include "dbctx.h"
+
+//Write-ahead log.  Every change to a record is first appended to the log
+//(student.db.wal) as the full 64 byte image the slot should end up with,
+//and the log is made durable with fdatasync() before the database file is
+//written in place.  Changes made inside a group (see wal_group_begin())
+//share a single write and fdatasync() of the log, which is how bulk import
+//and the server get durability at a much higher write rate than one sync
+//per operation.
+//
+//The log is redo-only and idempotent.  open_db() replays it: for every id
+//in the log the last image is compared with the database and the occupancy
+//bitmap, and anything that does not match (a write lost or torn by a
+//crash) is rewritten.  A checkpoint syncs the database and its sidecars and
+//then empties the log.  Checkpoints happen when the log grows past
+//WAL_CHECKPOINT_BYTES, after a recovery that had to repair something, and
+//before the database file is replaced by compress_db().
+#define WAL_SUFFIX              ".wal"
+#define WAL_MAGIC               0x4c415753      // "SWAL"
+#define WAL_VERSION             1
+#define WAL_HDR_SIZE            64
+#define WAL_CHECKPOINT_BYTES    (64 * 1024)
+
+#define WAL_OP_WRITE            1   // slot id now holds image s
+
+typedef struct wal_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t db_ino;        // database file the log belongs to
+    uint64_t start_lsn;     // lsn of the first record after the header
+    char pad[WAL_HDR_SIZE - 24];
+} wal_hdr_t;
+
+//records carry consecutive lsns, so stale records left behind a shorter
+//log after a checkpoint are never mistaken for live ones
+typedef struct wal_rec {
+    uint32_t crc;           // crc32c of the rest of the record
+    uint32_t op;
+    uint64_t lsn;
+    int32_t id;
+    uint32_t pad;
+    student_t s;
+} wal_rec_t;
+
+typedef struct db_wal {
+    int fd;
+    wal_hdr_t hdr;
+    uint64_t next_lsn;
+    off_t end;              // where the next record is appended
+    int group;              // nesting depth of wal_group_begin()
+    wal_rec_t *pending;     // records of the open group, not yet written
+    int npending;
+    int cap;
+} db_wal_t;
+
+//prototypes
+db_wal_t *wal_open(const char *dbpath, int dbfd, bool fresh);
+void wal_close(db_wal_t *wal);
+int wal_log(db_wal_t *wal, int id, const student_t *s);
+int wal_log_bulk(db_wal_t *wal, const student_t *recs, int n);
+int wal_group_begin(db_wal_t *wal);
+int wal_group_end(db_wal_t *wal);
+int wal_recover(db_ctx_t *ctx);
+int wal_checkpoint(db_ctx_t *ctx);
+int wal_maybe_checkpoint(db_ctx_t *ctx);
+int wal_reset(db_wal_t *wal, int dbfd);
+int wal_refresh(db_wal_t *wal);
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "dbwire.h"
+
+static int wire_format = WIRE_TEXT;
+
+//"00" .. "99", two digits per table lookup
+static const char digits2[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+//select the format of wire_row() and wire_print(), WIRE_TEXT by default
+void wire_set_format(int format)
+{
+    wire_format = format;
+}
+
+int wire_get_format(void)
+{
+    return wire_format;
+}
+
+/*
+ *  wire_put_uint
+ *      p:  where the digits go, room for 10
+ *      v:  number to format
+ *
+ *  returns:  the end of the digits written
+ */
+char *wire_put_uint(char *p, uint32_t v)
+{
+    char tmp[10];
+    int n = 10;
+
+    while (v >= 100) {
+        n -= 2;
+        memcpy(tmp + n, digits2 + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        n -= 2;
+        memcpy(tmp + n, digits2 + v * 2, 2);
+    } else {
+        tmp[--n] = '0' + v;
+    }
+    memcpy(p, tmp + n, 10 - n);
+    return p + 10 - n;
+}
+
+/*
+ *  wire_put_gpa
+ *      p:    where the text goes
+ *      gpa:  gpa as stored, 0 <= gpa <= WIRE_FAST_GPA_MAX
+ *
+ *  Writes gpa / 100.0 with two decimals, 345 becomes "3.45".
+ *
+ *  returns:  the end of the text written
+ */
+char *wire_put_gpa(char *p, int gpa)
+{
+    p = wire_put_uint(p, gpa / 100);
+    *p++ = '.';
+    memcpy(p, digits2 + (gpa % 100) * 2, 2);
+    return p + 2;
+}
+
+//copy up to max bytes of a name, padded with spaces to width
+static char *put_padded(char *p, const char *name, size_t max, size_t width)
+{
+    size_t len = strnlen(name, max);
+
+    memcpy(p, name, len);
+    if (len < width) {
+        memset(p + len, ' ', width - len);
+        len = width;
+    }
+    return p + len;
+}
+
+//a name as a JSON string
+static char *put_json_name(char *p, const char *name, size_t max)
+{
+    size_t len = strnlen(name, max);
+
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)name[i];
+
+        if (ch == '"' || ch == '\\') {
+            *p++ = '\\';
+            *p++ = ch;
+        } else if (ch < 0x20) {
+            p += sprintf(p, "\\u%04x", ch);
+        } else {
+            *p++ = ch;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+static bool fast_values(const student_t *s)
+{
+    return s->id >= 0 && s->gpa >= 0 && s->gpa <= WIRE_FAST_GPA_MAX;
+}
+
+/*
+ *  wire_row
+ *      out:  room for WIRE_ROW_MAX bytes
+ *      s:    student to format
+ *
+ *  Formats one student in the selected format, for WIRE_TEXT the same
+ *  bytes as STUDENT_PRINT_FMT_STRING.
+ *
+ *  returns:  number of bytes written to out
+ */
+size_t wire_row(char *out, const student_t *s)
+{
+    char *p = out;
+
+    if (wire_format == WIRE_BINARY) {
+        memcpy(out, s, sizeof(*s));
+        return sizeof(*s);
+    }
+    if (!fast_values(s)) {
+        float gpa = s->gpa / 100.0;
+        if (wire_format == WIRE_NDJSON) {
+            p += snprintf(p, WIRE_ROW_MAX, "{\"id\":%d,\"fname\":", s->id);
+            p = put_json_name(p, s->fname, sizeof(s->fname));
+            p += sprintf(p, ",\"lname\":");
+            p = put_json_name(p, s->lname, sizeof(s->lname));
+            p += sprintf(p, ",\"gpa\":%.2f}\n", gpa);
+            return p - out;
+        }
+        return snprintf(out, WIRE_ROW_MAX, STUDENT_PRINT_FMT_STRING,
+                        s->id, s->fname, s->lname, gpa);
+    }
+
+    if (wire_format == WIRE_NDJSON) {
+        memcpy(p, "{\"id\":", 6);
+        p = wire_put_uint(p + 6, s->id);
+        memcpy(p, ",\"fname\":", 9);
+        p = put_json_name(p + 9, s->fname, sizeof(s->fname));
+        memcpy(p, ",\"lname\":", 9);
+        p = put_json_name(p + 9, s->lname, sizeof(s->lname));
+        memcpy(p, ",\"gpa\":", 7);
+        p = wire_put_gpa(p + 7, s->gpa);
+        memcpy(p, "}\n", 2);
+        return p + 2 - out;
+    }
+
+    // "%-6d %-24.24s %-32.32s %-3.2f\n"
+    char *start = p;
+    p = wire_put_uint(p, s->id);
+    if (p - start < 6) {
+        memset(p, ' ', 6 - (p - start));
+        p = start + 6;
+    }
+    *p++ = ' ';
+    p = put_padded(p, s->fname, 24, 24);
+    *p++ = ' ';
+    p = put_padded(p, s->lname, 32, 32);
+    *p++ = ' ';
+    p = wire_put_gpa(p, s->gpa);
+    *p++ = '\n';
+    return p - out;
+}
+
+//print one student to stdout in the selected format
+void wire_print(const student_t *s)
+{
+    char row[WIRE_ROW_MAX];
+
+    fwrite(row, 1, wire_row(row, s), stdout);
+}
+
+//print a note about the result, only in the text format
+void wire_note(const char *msg)
+{
+    if (wire_format == WIRE_TEXT)
+        fputs(msg, stdout);
+}
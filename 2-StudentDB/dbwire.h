@@ -0,0 +1,48 @@
+#ifndef __DBWIRE_H__
+    #define __DBWIRE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db.h"
+
+//Output formats for printed students.  sdbsc prints the table of
+//STUDENT_PRINT_FMT_STRING by default, a leading --ndjson or --binary
+//switches every command that prints students (-p, -f, -l, -g, -n, -r and
+//the --hashed and --sharded forms) to
+//
+//  ndjson  one JSON object per student and line,
+//          {"id":1,"fname":"john","lname":"doe","gpa":3.45}
+//  binary  the 64 byte student_t of every student, in host byte order
+//
+//for scripts that would otherwise parse the table.  Neither has a header,
+//and the notes for an empty result (M_DB_EMPTY, M_NO_MATCH) are left out
+//so that the output holds nothing but students; errors are still printed
+//and reported by the exit code.
+//
+//Rows are built by hand instead of with printf(): integers with a two
+//digit table and gpa / 100.0 as the integer and its last two digits, which
+//is exactly what "%.2f" makes of it for every gpa sdbsc accepts.  Values
+//outside that (a damaged record) fall back to snprintf().
+//
+//sdbsc --binary without a command reads --serve requests (dbserver.h)
+//from stdin and writes the responses to stdout, so a pipeline can
+//exchange records with the database without text in between.
+#define WIRE_TEXT           0
+#define WIRE_NDJSON         1
+#define WIRE_BINARY         2
+
+#define WIRE_ROW_MAX        512     // longest row of any format
+#define WIRE_FAST_GPA_MAX   99999   // larger gpa values go through snprintf()
+
+//prototypes
+void wire_set_format(int format);
+int wire_get_format(void);
+char *wire_put_uint(char *p, uint32_t v);
+char *wire_put_gpa(char *p, int gpa);
+size_t wire_row(char *out, const student_t *s);
+void wire_print(const student_t *s);
+void wire_note(const char *msg);
+
+#endif
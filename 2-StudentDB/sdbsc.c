@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <fcntl.h> //c library for system call file routines
 #include <string.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -9,6 +10,29 @@
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "dbscan.h"
+#include "dbctx.h"
+#include "dbbitmap.h"
+#include "dbimport.h"
+#include "dbindex.h"
+#include "dbwal.h"
+#include "dbcompact.h"
+#include "dbserver.h"
+#include "dblock.h"
+#include "dbcolumn.h"
+#include "dbpack.h"
+#include "dbtrie.h"
+#include "dbpool.h"
+#include "dbhash.h"
+#include "dbprint.h"
+#include "dbmvcc.h"
+#include "dbbench.h"
+#include "dbcrc.h"
+#include "dbbatch.h"
+#include "dbcursor.h"
+#include "dbshard.h"
+#include "dbwire.h"
+#include "dbiostat.h"
 
 /*
  *  open_db
@@ -17,6 +41,11 @@
  *
  *  returns:  File descriptor on success, or ERR_DB_FILE on failure
  *
+ *  The returned database also gets a context (see dbctx.h) holding its
+ *  occupancy bitmap.  If the file is being created or truncated any
+ *  sidecar state left over from a previous database is reset.  Databases
+ *  opened here should be closed with close_db().
+ *
  *  console:  Does not produce any console I/O on success
  *            M_ERR_DB_OPEN on error
  *
@@ -34,6 +63,9 @@ int open_db(char *dbFile, bool should_truncate)
     if (should_truncate)
         flags += O_TRUNC;
 
+    // a database that does not exist yet starts without sidecar state
+    bool fresh = should_truncate || access(dbFile, F_OK) != 0;
+
     // Now open file
     int fd = open(dbFile, flags, mode);
 
@@ -44,9 +76,26 @@ int open_db(char *dbFile, bool should_truncate)
         return ERR_DB_FILE;
     }
 
+    db_ctx_new(fd, dbFile, fresh);
     return fd;
 }
 
+/*
+ *  close_db
+ *      fd:  linux file descriptor returned by open_db()
+ *
+ *  Releases the context of the database and closes the file.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  Does not produce any console I/O
+ */
+void close_db(int fd)
+{
+    db_ctx_free(fd);
+    close(fd);
+}
+
 /*
  *  get_student
  *      fd:  linux file descriptor
@@ -54,6 +103,12 @@ int open_db(char *dbFile, bool should_truncate)
  *      *s:  a pointer where the located (if found) student data will be
  *           copied
  *
+ *  An id whose bit is clear in the occupancy bitmap is not found without
+ *  reading the file.  Otherwise the read takes no lock.  When other
+ *  processes may be writing (see dblock.h) it is validated with the
+ *  seqlock of the student's stripe and retried if a write overlapped it,
+ *  falling back to locking the stripe if writers keep getting in the way.
+ *
  *  returns:  NO_ERROR       student located and copied into *s
  *            ERR_DB_FILE    database file I/O issue
  *            SRCH_NOT_FOUND student was not located in the database
@@ -66,13 +121,45 @@ int get_student(int fd, int id, student_t *s)
         return ERR_DB_FILE;
     }
 
+    db_ctx_t *ctx = db_ctx_get(fd);
     off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+    ssize_t bytes_read;
 
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        return ERR_DB_FILE;
+    if (ctx != NULL && ctx->bitmap != NULL) {
+        if (db_ctx_refresh(ctx) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (!bitmap_test(ctx->bitmap, id))
+            return SRCH_NOT_FOUND;
+    }
+
+    if (ctx != NULL && ctx->pool != NULL) {
+        int rc = pool_read(ctx->pool, offset, s, STUDENT_RECORD_SIZE);
+        if (rc == ERR_DB_FILE)
+            return ERR_DB_FILE;
+        if (rc == NO_ERROR)
+            return record_is_empty(s) ? SRCH_NOT_FOUND : NO_ERROR;
+        // POOL_BUSY: writers keep changing the page, read the slot below
+    }
+
+    if (ctx != NULL && ctx->lock != NULL) {
+        int tries = 0;
+        for (;;) {
+            uint32_t seq = lock_read_begin(ctx->lock, id);
+            bytes_read = io_pread(fd, s, STUDENT_RECORD_SIZE, offset);
+            if (bytes_read < 0 || lock_read_valid(ctx->lock, id, seq))
+                break;
+            if (++tries == LOCK_READ_SPINS) {
+                if (lock_stripe(ctx->lock, id) != NO_ERROR)
+                    return ERR_DB_FILE;
+                bytes_read = io_pread(fd, s, STUDENT_RECORD_SIZE, offset);
+                unlock_stripe(ctx->lock, id);
+                break;
+            }
+        }
+    } else {
+        bytes_read = io_pread(fd, s, STUDENT_RECORD_SIZE, offset);
     }
 
-    ssize_t bytes_read = read(fd, s, STUDENT_RECORD_SIZE);
     if (bytes_read == -1) {
         return ERR_DB_FILE;
     } else if (bytes_read == 0) {
@@ -91,6 +178,192 @@ int get_student(int fd, int id, student_t *s)
     return NO_ERROR;
 }
 
+/*
+ *  student_exists
+ *      fd:     linux file descriptor
+ *      id:     student id
+ *
+ *  Checks whether a student lives at id.  If the database has an occupancy
+ *  bitmap this is a bit test, otherwise the slot is read and checked for
+ *  all zero bytes indicating the space is empty.  Hold the stripe of id
+ *  (see db_ctx_lock_id()) if the answer is used to decide on a write.
+ *
+ *  returns:  NO_ERROR        a student exists at id
+ *            SRCH_NOT_FOUND  the slot is empty
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int student_exists(int fd, int id)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    student_t s;
+
+    if (ctx != NULL && ctx->bitmap != NULL) {
+        if (db_ctx_refresh(ctx) != NO_ERROR)
+            return ERR_DB_FILE;
+        return bitmap_test(ctx->bitmap, id) ? NO_ERROR : SRCH_NOT_FOUND;
+    }
+    return get_student(fd, id, &s);
+}
+
+/*
+ *  apply_student
+ *      fd:     linux file descriptor
+ *      id:     slot being written
+ *      s:      student to store at id, or NULL to clear the slot
+ *
+ *  Writes a slot in place and updates the sidecar state, without logging.
+ *  Only for changes that are already durable in the write-ahead log, use
+ *  put_student() otherwise.  The caller holds the
+ *  stripe of id and the meta lock.  A cleared slot frees its page right
+ *  away if the page is now unused, see dbcompact.h.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int apply_student(int fd, int id, const student_t *s)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    student_t delete_s = EMPTY_STUDENT_RECORD;
+    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+    ssize_t n;
+
+    // open snapshots keep the page as it was, see dbmvcc.h
+    if (mvcc_preserve(ctx, id / MVCC_PAGE_RECORDS) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (ctx != NULL && ctx->pool != NULL) {
+        // written back by db_ctx_flush() before the stripe is released
+        if (pool_write(ctx->pool, offset, s ? s : &delete_s, STUDENT_RECORD_SIZE) != NO_ERROR)
+            return ERR_DB_FILE;
+        n = STUDENT_RECORD_SIZE;
+    } else if (ctx != NULL && ctx->lock != NULL) {
+        lock_write_begin(ctx->lock, id);
+        n = io_pwrite(fd, s ? s : &delete_s, STUDENT_RECORD_SIZE, offset);
+        lock_write_end(ctx->lock, id);
+    } else {
+        n = io_pwrite(fd, s ? s : &delete_s, STUDENT_RECORD_SIZE, offset);
+    }
+    if (n != STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+    if (ctx == NULL)
+        return NO_ERROR;
+
+    if (s != NULL)
+        return db_ctx_added(ctx, s, 1);
+    if (db_ctx_deleted(ctx, id) != NO_ERROR)
+        return ERR_DB_FILE;
+    return compact_page(ctx, id);
+}
+
+/*
+ *  put_student
+ *      fd:     linux file descriptor
+ *      id:     slot being written
+ *      s:      student to store, or NULL to clear the slot
+ *
+ *  Stores a change: the new image is logged in the write-ahead log and
+ *  then written in place with apply_student(), both under the meta lock.
+ *  The caller holds the stripe of id, see insert_student() and
+ *  remove_student().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int put_student(int fd, int id, const student_t *s)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int rc;
+
+    if (ctx == NULL)
+        return apply_student(fd, id, s);
+
+    if (db_ctx_lock_meta(ctx) != NO_ERROR)
+        return ERR_DB_FILE;
+    // write-ahead: the new image is durable in the log before the slot is
+    // written, so a crash part way through is repaired by the next open_db()
+    rc = db_ctx_log(ctx, id, s);
+    if (rc == NO_ERROR)
+        rc = apply_student(fd, id, s);
+    if (rc == NO_ERROR)
+        rc = db_ctx_flush(ctx);
+    db_ctx_unlock_meta(ctx, true);
+    return rc;
+}
+
+/*
+ *  insert_student
+ *      fd:     linux file descriptor
+ *      s:      student to add, s->id selects the slot
+ *
+ *  Adds a student if its slot is empty.  The check and the write happen
+ *  under the stripe lock of the id so two processes adding the same id
+ *  cannot both succeed.
+ *
+ *  returns:  NO_ERROR       student added
+ *            ERR_DB_OP      a student already exists at s->id
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int insert_student(int fd, const student_t *s)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int rc;
+
+    if (ctx != NULL && db_ctx_lock_id(ctx, s->id) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = student_exists(fd, s->id);
+    if (rc == NO_ERROR)
+        rc = ERR_DB_OP;
+    else if (rc == SRCH_NOT_FOUND)
+        rc = put_student(fd, s->id, s);
+
+    if (ctx != NULL) {
+        db_ctx_unlock_id(ctx, s->id);
+        if (rc == NO_ERROR)
+            rc = db_ctx_checkpoint(ctx, false);
+    }
+    return rc;
+}
+
+/*
+ *  remove_student
+ *      fd:     linux file descriptor
+ *      id:     student id to delete
+ *
+ *  Clears the slot of a student if there is one, same locking as
+ *  insert_student().
+ *
+ *  returns:  NO_ERROR        student deleted
+ *            SRCH_NOT_FOUND  no student at id
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int remove_student(int fd, int id)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int rc;
+
+    if (ctx != NULL && db_ctx_lock_id(ctx, id) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = student_exists(fd, id);
+    if (rc == NO_ERROR)
+        rc = put_student(fd, id, NULL);
+
+    if (ctx != NULL) {
+        db_ctx_unlock_id(ctx, id);
+        if (rc == NO_ERROR)
+            rc = db_ctx_checkpoint(ctx, false);
+    }
+    return rc;
+}
+
 /*
  *  add_student
  *      fd:     linux file descriptor
@@ -99,10 +372,9 @@ int get_student(int fd, int id, student_t *s)
  *      lname:  student last name
  *      gpa:    GPA as an integer (range defined in db.h)
  *
- *  Adds a new student to the database.  After calculating the index for the
- *  student, check if there is another student already at that location.  A good
- *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty.
+ *  Adds a new student to the database with insert_student(), which checks
+ *  that no other student is already at that location and stores the new
+ *  one, safe against other processes adding the same id.
  *
  *  returns:  NO_ERROR       student added to database
  *            ERR_DB_FILE    database file I/O issue
@@ -112,28 +384,11 @@ int get_student(int fd, int id, student_t *s)
  *
  *  console:  M_STD_ADDED       on success
  *            M_ERR_DB_ADD_DUP  student already exists
- *            M_ERR_DB_READ     error reading or seeking the database file
- *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *            M_ERR_DB_WRITE    error reading or writing the db file
  *
  */
 int add_student(int fd, int id, char *fname, char *lname, int gpa)
 {
-    // TODO
-    student_t s_existing;
-    int result = get_student(fd, id, &s_existing);
-
-    if (result == NO_ERROR) {
-        // A record already exists at this id, thus it is a duplicate
-        printf(M_ERR_DB_ADD_DUP, id);
-        return ERR_DB_OP;
-    }
-
-    if (result != SRCH_NOT_FOUND) {
-        // I/O issue
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
     student_t new_s = EMPTY_STUDENT_RECORD;
     memset(&new_s, 0, STUDENT_RECORD_SIZE);
     new_s.id = id;
@@ -141,16 +396,15 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
     strncpy(new_s.fname, fname, sizeof(new_s.fname) - 1);
     strncpy(new_s.lname, lname, sizeof(new_s.lname) - 1);
 
-    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+    int result = insert_student(fd, &new_s);
 
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
+    if (result == ERR_DB_OP) {
+        // A record already exists at this id, thus it is a duplicate
+        printf(M_ERR_DB_ADD_DUP, id);
+        return ERR_DB_OP;
     }
 
-    ssize_t bytes_write = write(fd, &new_s, STUDENT_RECORD_SIZE);
-    
-    if (bytes_write != STUDENT_RECORD_SIZE) {
+    if (result != NO_ERROR) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -165,10 +419,8 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
  *      fd:     linux file descriptor
  *      id:     student id to be deleted
  *
- *  Removes a student to the database.  Use the get_student() function to
- *  locate the student to be deleted. If there is a student at that location
- *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
+ *  Removes a student to the database with remove_student(), which clears
+ *  the slot if there is a student at that location.
  *
  *  returns:  NO_ERROR       student deleted from database
  *            ERR_DB_FILE    database file I/O issue
@@ -178,36 +430,18 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
  *
  *  console:  M_STD_DEL_MSG      on success
  *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
- *            M_ERR_DB_READ      error reading or seeking the database file
- *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *            M_ERR_DB_WRITE     error reading or writing the db file
  *
  */
 int del_student(int fd, int id)
 {
-    // TODO
-    student_t current_s;
-    int result = get_student(fd, id, &current_s);
+    int result = remove_student(fd, id);
 
     if (result == SRCH_NOT_FOUND) {
-        // I/O issue
         printf(M_STD_NOT_FND_MSG, id);
         return ERR_DB_OP;
     }
     else if (result != NO_ERROR) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    student_t delete_s = EMPTY_STUDENT_RECORD;
-
-    ssize_t bytes_write = write(fd, &delete_s, STUDENT_RECORD_SIZE);
-    if (bytes_write != STUDENT_RECORD_SIZE) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -220,13 +454,12 @@ int del_student(int fd, int id)
  *  count_db_records
  *      fd:     linux file descriptor
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
+ *  Counts the number of records in the database.  If the database has an
+ *  occupancy bitmap the count is a popcount of the bitmap and the database
+ *  file is not read at all.  Otherwise the counting is done by the scan
+ *  engine in dbscan.c, which reads the file in large blocks, skips the
+ *  holes of the sparse file without doing any I/O and tests records for all
+ *  zero bytes (empty or deleted slots) with vector compares.
  *
  *  returns:  <number>       returns the number of records in db on success
  *            ERR_DB_FILE    database file I/O issue
@@ -242,55 +475,19 @@ int del_student(int fd, int id)
  */
 int count_db_records(int fd)
 {
-    // TODO
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int number;
 
-    // Check if file size should be a multiple of record size
-    int end = lseek(fd, 0, SEEK_END);
-    if (end == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-    if (end % STUDENT_RECORD_SIZE != 0) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
+    if (ctx != NULL && ctx->bitmap != NULL && db_ctx_refresh(ctx) == NO_ERROR)
+        number = bitmap_count(ctx->bitmap);
+    else
+        number = scan_count(fd);
 
-    // Move pointer back to the start
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+    if (number < 0) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    student_t current_s;
-    student_t empty_slot = EMPTY_STUDENT_RECORD;
-    int number = 0;
-
-    while (1) {
-        ssize_t bytes_read = read(fd, &current_s, STUDENT_RECORD_SIZE);
-
-        if (bytes_read < 0) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-
-        if (bytes_read == 0) {
-            // EOF reached
-            break;
-        }
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-
-        if (memcmp(&current_s, &empty_slot, STUDENT_RECORD_SIZE) != 0) {
-            number++;
-        }
-    }
-
     if (number == 0) {
         printf(M_DB_EMPTY);
     } else {
@@ -300,17 +497,36 @@ int count_db_records(int fd)
     return number;
 }
 
+//state shared with print_db_cb() while print_db() scans the database
+struct print_db_state {
+    int first_row;
+};
+
+static int print_db_cb(const student_t *s, void *arg)
+{
+    struct print_db_state *state = arg;
+
+    if (state->first_row == 0) {
+        if (wire_get_format() == WIRE_TEXT)
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        state->first_row = 1;
+    }
+    // same bytes as STUDENT_PRINT_FMT_STRING, or --ndjson/--binary rows
+    wire_print(s);
+    return 0;
+}
+
 /*
  *  print_db
  *      fd:     linux file descriptor
  *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
+ *  Prints all records in the database.  The records are produced in id
+ *  order by print_parallel(), which splits the ids over several threads
+ *  that each use scan_live_range() to jump straight to the live ids with
+ *  the occupancy bitmap (or scan the file if there is none) and skip
+ *  empty or previously deleted slots for us.  Be careful as the database
+ *  might be empty.  On the first real row encountered print the header for
+ *  the required output:
  *
  *     printf(STUDENT_PRINT_HDR_STRING, "ID",
  *                  "FIRST_NAME", "LAST_NAME", "GPA");
@@ -320,10 +536,8 @@ int count_db_records(int fd)
  *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
  *                    student.lname, calculated_gpa_from_student);
  *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
+ *  Dont forget that the GPA in the student structure is an int, to convert
+ *  it into a real gpa divide by 100.0 and store in a float variable.
  *
  *  returns:  NO_ERROR       on success
  *            ERR_DB_FILE    database file I/O issue
@@ -335,176 +549,386 @@ int count_db_records(int fd)
  */
 int print_db(int fd)
 {
-    // TODO
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+    return print_db_sorted(fd, PRINT_SORT_ID);
+}
+
+/*
+ *  print_db_sorted
+ *      fd:    linux file descriptor
+ *      sort:  PRINT_SORT_ID, PRINT_SORT_LNAME or PRINT_SORT_GPA
+ *
+ *  print_db() in the order of sdbsc -p --sort-by, see dbprint.h.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  <see print_db>
+ */
+int print_db_sorted(int fd, int sort)
+{
+    int rows = print_parallel(fd, sort);
+
+    if (rows < 0) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    // Check if file size should be a multiple of record size
-    int end = lseek(fd, 0, SEEK_END);
-    if (end == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
+    if (rows == 0) {
+        wire_note(M_DB_EMPTY);
     }
-    if (end % STUDENT_RECORD_SIZE != 0) {
-        printf(M_ERR_DB_READ);
+
+    return NO_ERROR;
+}
+
+/*
+ *  print_packed
+ *      path:  file written by pack_db()
+ *
+ *  Same output as print_db() for the students of a packed file.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the file cannot be read
+ *            ERR_DB_OP      the file is not a valid packed database
+ *
+ *  console:  <see print_db>   on success
+ *            M_ERR_IMPORT_OPEN the file cannot be read
+ *            M_ERR_PACK_FILE   the file is not a valid packed database
+ */
+int print_packed(const char *path)
+{
+    struct print_db_state state = { 0 };
+
+    int rc = pack_scan(path, print_db_cb, &state);
+    if (rc == ERR_DB_OP) {
+        printf(M_ERR_PACK_FILE, path);
+        return ERR_DB_OP;
+    }
+    if (rc != NO_ERROR) {
+        printf(M_ERR_IMPORT_OPEN, path);
         return ERR_DB_FILE;
     }
 
-    // Move pointer back to the start
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
+    if (state.first_row == 0) {
+        wire_note(M_DB_EMPTY);
     }
 
+    return NO_ERROR;
+}
 
-    student_t current_s;
-    student_t empty_slot = EMPTY_STUDENT_RECORD;
-    int first_row = 0;
+//a secondary index query: students whose index key is in [lo, hi], and
+//for lname queries whose last name really is lname (keys are hashes)
+struct index_query {
+    int kind;
+    uint64_t lo;
+    uint64_t hi;
+    const char *lname;
+    struct print_db_state print;
+};
+
+static bool query_match(const struct index_query *q, const student_t *s)
+{
+    uint64_t key = index_key(q->kind, s);
 
-    while (1) {
-        ssize_t bytes_read = read(fd, &current_s, STUDENT_RECORD_SIZE);
+    if (key < q->lo || key > q->hi)
+        return false;
+    return q->lname == NULL || strncmp(s->lname, q->lname, sizeof(s->lname)) == 0;
+}
 
-        if (bytes_read < 0) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
+static int query_scan_cb(const student_t *s, void *arg)
+{
+    struct index_query *q = arg;
 
-        if (bytes_read == 0) {
-            // EOF reached
-            break;
-        }
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-        if (memcmp(&current_s, &empty_slot, STUDENT_RECORD_SIZE) == 0) {
-            continue;
-        }
+    if (query_match(q, s))
+        print_db_cb(s, &q->print);
+    return 0;
+}
 
-        if (first_row == 0) {
-            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-            first_row = 1;
-        }
-        float gpa = current_s.gpa / 100.0;
-        printf(STUDENT_PRINT_FMT_STRING, current_s.id, current_s.fname, current_s.lname, gpa);
-        
+/*
+ *  run_index_query
+ *      fd:  linux file descriptor
+ *      ix:  index to use, or NULL to fall back to a full scan
+ *      q:   the query
+ *
+ *  Prints every student matching q, in index order (lname queries list the
+ *  matching students by id, gpa queries by gpa and then id).  Each hit in
+ *  the index is fetched with get_student() and checked again, which filters
+ *  out lname hash collisions.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int run_index_query(int fd, db_index_t *ix, struct index_query *q)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int rc = ERR_DB_FILE;
+
+    // loading may compact or rebuild the index file, which other
+    // processes then have to reopen
+    if (ix != NULL && db_ctx_lock_meta(ctx) == NO_ERROR) {
+        int oldfd = ix->fd;
+        rc = index_load(ix, fd);
+        db_ctx_unlock_meta(ctx, ix->fd != oldfd);
     }
 
-    if (first_row == 0) {
-        printf(M_DB_EMPTY);
+    if (rc != NO_ERROR) {
+        if (scan_live(fd, query_scan_cb, q) != NO_ERROR)
+            return ERR_DB_FILE;
+        return NO_ERROR;
     }
 
+    for (size_t i = index_lower_bound(ix, q->lo);
+         i < ix->n && ix->ents[i].key <= q->hi; i++) {
+        student_t s;
+        int rc = get_student(fd, ix->ents[i].id, &s);
+
+        if (rc == SRCH_NOT_FOUND)
+            continue;
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+        if (query_match(q, &s))
+            print_db_cb(&s, &q->print);
+    }
     return NO_ERROR;
 }
 
 /*
- *  print_student
- *      *s:   a pointer to a student_t structure that should
- *            contain a valid student to be printed
- *
- *  Start by ensuring that provided student pointer is valid.  To do this
- *  make sure it is not NULL and that s->id is not zero.  After ensuring
- *  that the student is valid, print it the exact way that is described
- *  in the print_db() function by first printing the header then the
- *  student data:
- *
- *     printf(STUDENT_PRINT_HDR_STRING, "ID",
- *                  "FIRST NAME", "LAST_NAME", "GPA");
- *
- *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
- *                    student.lname, calculated_gpa_from_s);
- *
- *  Dont forget that  the GPA in the student structure is an int, to convert
- *  it into a real gpa divide by 100.0 and store in a float variable.
- *
- *  returns:  nothing, this is a void function
+ *  find_students_lname
+ *      fd:     linux file descriptor
+ *      lname:  last name to look for
  *
+ *  Prints all students with the given last name using the lname index.
  *
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_STD_PRINT  if the function argument s is NULL or if
- *                             s->id is zero
+ *  returns:  NO_ERROR       on success, even if no student matched
+ *            ERR_DB_FILE    database file I/O issue
  *
+ *  console:  the matching students in the print_db() format
+ *            M_NO_MATCH       if no student matched
+ *            M_ERR_DB_READ    error reading the database or the index
  */
-void print_student(student_t *s)
+int find_students_lname(int fd, char *lname)
 {
-    // TODO
-    student_t empty_slot = EMPTY_STUDENT_RECORD;
-    
+    db_ctx_t *ctx = db_ctx_get(fd);
+    student_t probe = EMPTY_STUDENT_RECORD;
+    struct index_query q = { 0 };
 
-    if (s == NULL || s->id == 0) {
-        printf(M_ERR_STD_PRINT);
-        return;
-    }
+    strncpy(probe.lname, lname, sizeof(probe.lname) - 1);
+    q.kind = INDEX_LNAME;
+    q.lo = q.hi = index_key(INDEX_LNAME, &probe);
+    q.lname = probe.lname;
 
+    if (run_index_query(fd, ctx ? ctx->lname_idx : NULL, &q) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (q.print.first_row == 0)
+        wire_note(M_NO_MATCH);
+    return NO_ERROR;
+}
 
-    if (memcmp(s, &empty_slot, STUDENT_RECORD_SIZE) == 0) { 
-        printf(M_ERR_STD_PRINT);
-        return;
+/*
+ *  find_students_gpa
+ *      fd:  linux file descriptor
+ *      lo:  lowest gpa to report, as an integer (range defined in db.h)
+ *      hi:  highest gpa to report
+ *
+ *  Prints all students with lo <= gpa <= hi, ordered by gpa, using the
+ *  gpa index.
+ *
+ *  returns:  NO_ERROR       on success, even if no student matched
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the matching students in the print_db() format
+ *            M_NO_MATCH       if no student matched
+ *            M_ERR_DB_READ    error reading the database or the index
+ */
+int find_students_gpa(int fd, int lo, int hi)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    struct index_query q = { 0 };
+
+    q.kind = INDEX_GPA;
+    q.lo = lo;
+    q.hi = hi;
+
+    if (run_index_query(fd, ctx ? ctx->gpa_idx : NULL, &q) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (q.print.first_row == 0)
+        wire_note(M_NO_MATCH);
+    return NO_ERROR;
+}
+
+/*
+ *  find_students_name
+ *      fd:       linux file descriptor
+ *      text:     start of a first or last name, or a whole name to match
+ *                loosely
+ *      maxdist:  0 for names starting with text, otherwise the number of
+ *                letters that may differ (see dbtrie.h)
+ *
+ *  Prints all students whose first or last name matches, in id order and
+ *  ignoring case, using the name trie.
+ *
+ *  returns:  NO_ERROR       on success, even if no student matched
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the matching students in the print_db() format
+ *            M_NO_MATCH       if no student matched
+ *            M_ERR_DB_READ    error reading the database
+ */
+int find_students_name(int fd, const char *text, int maxdist)
+{
+    struct print_db_state state = { 0 };
+    name_trie_t *t = trie_open(fd);
+
+    if (t == NULL) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
     }
 
-    printf(STUDENT_PRINT_HDR_STRING, "ID",
-                    "FIRST_NAME", "LAST_NAME", "GPA");
+    uint32_t n = t->snap.hdr.n;
+    uint64_t *rowmask = calloc(n / 64 + 1, sizeof(uint64_t));
+    if (rowmask == NULL) {
+        trie_free(t);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
 
-    float gpa = s->gpa / 100.0;
-    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
-    return;
-    
+    if (trie_search(t, text, maxdist, rowmask) > 0) {
+        for (uint32_t w = 0; w <= n / 64; w++) {
+            for (uint64_t bits = rowmask[w]; bits != 0; bits &= bits - 1) {
+                student_t s;
+                trie_row(t, w * 64 + __builtin_ctzll(bits), &s);
+                print_db_cb(&s, &state);
+            }
+        }
+    }
+    if (state.first_row == 0)
+        wire_note(M_NO_MATCH);
+
+    free(rowmask);
+    trie_free(t);
+    return NO_ERROR;
 }
 
 /*
- *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
+ *  print_range
+ *      fd:  linux file descriptor
+ *      lo:  first id to report
+ *      hi:  last id to report, inclusive
  *
- *  compress_db
- *      fd:     linux file descriptor
+ *  Prints all students with lo <= id <= hi in id order, taking them from a
+ *  cursor (see dbcursor.h) CURSOR_BATCH at a time.
  *
- *  This assignment takes advantage of the way Linux handles sparse files
- *  on disk. Thus if there is a large hole between student records, Linux
- *  will not use any physical storage.  However, when a database record is
- *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
- *  db.h - record.
+ *  returns:  NO_ERROR       on success, even if no student matched
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the matching students in the print_db() format
+ *            M_NO_MATCH       if no student matched
+ *            M_ERR_DB_READ    error reading the database
+ */
+int print_range(int fd, int lo, int hi)
+{
+    struct print_db_state state = { 0 };
+    student_t batch[CURSOR_BATCH];
+    db_cursor_t *cur = db_cursor_open(fd, lo, hi);
+    int n;
+
+    if (cur == NULL) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    while ((n = db_cursor_next_batch(cur, batch, CURSOR_BATCH)) > 0) {
+        for (int i = 0; i < n; i++)
+            print_db_cb(&batch[i], &state);
+    }
+    db_cursor_close(cur);
+
+    if (n < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (state.first_row == 0)
+        wire_note(M_NO_MATCH);
+    return NO_ERROR;
+}
+
+/*
+ *  print_student
+ *      *s:   a pointer to a student_t structure that should
+ *            contain a valid student to be printed
  *
- *  Since Linux provides no way to delete data in the middle of a file, and
- *  deleted records take up physical storage, this function will compress the
- *  database by rewriting a new database file that only includes valid student
- *  records. There are a number of ways to do this, but since this is extra credit
- *  you need to figure this out on your own.
+ *  Start by ensuring that provided student pointer is valid.  To do this
+ *  make sure it is not NULL and that s->id is not zero.  After ensuring
+ *  that the student is valid, print it the exact way that is described
+ *  in the print_db() function by first printing the header then the
+ *  student data:
  *
- *  At a high level create a temporary database file then copy all valid students from
- *  the active database (passed in via fd) to the temporary file. When this is done
- *  rename the temporary database file to the name of the real database file. See
- *  the constants in db.h for required file names:
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *                  "FIRST NAME", "LAST_NAME", "GPA");
  *
- *         #define DB_FILE     "student.db"        //name of database file
- *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
+ *                    student.lname, calculated_gpa_from_s);
  *
- *  Note that you are passed in the fd of the database file to be compressed,
- *  it is very likely you will need to close it to overwrite it with the
- *  compressed version of the file.  To ensure the caller can work with the
- *  compressed file after you create it, it is a good design to return the fd
- *  of the new compressed file from this function
+ *  Dont forget that  the GPA in the student structure is an int, to convert
+ *  it into a real gpa divide by 100.0 and store in a float variable.
  *
- *  returns:  <number>       returns the fd of the compressed database file
- *            ERR_DB_FILE    database file I/O issue
+ *  returns:  nothing, this is a void function
  *
  *
- *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
- *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
- *                             this error should also be returned after you
- *                             compressed the database file and if you are unable
- *                             to open it to pass the fd back to the caller
- *            M_ERR_DB_CREATE  error creating the db file. For instance the
- *                             inability to copy the temporary file back as
- *                             the primary database file.
- *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
- *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_STD_PRINT  if the function argument s is NULL or if
+ *                             s->id is zero
  *
  */
-int compress_db(int fd)
+void print_student(student_t *s)
 {
     // TODO
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+    student_t empty_slot = EMPTY_STUDENT_RECORD;
+    
+
+    if (s == NULL || s->id == 0) {
+        printf(M_ERR_STD_PRINT);
+        return;
+    }
+
+
+    if (memcmp(s, &empty_slot, STUDENT_RECORD_SIZE) == 0) { 
+        printf(M_ERR_STD_PRINT);
+        return;
+    }
+
+    if (wire_get_format() == WIRE_TEXT)
+        printf(STUDENT_PRINT_HDR_STRING, "ID",
+                        "FIRST_NAME", "LAST_NAME", "GPA");
+
+    wire_print(s);
+    return;
+    
+}
+
+/*
+ *  rewrite_db
+ *      fd:     linux file descriptor
+ *
+ *  Offline compaction, used by compress_db() on filesystems that cannot
+ *  punch holes.  Copies every valid student into TMP_DB_FILE and renames
+ *  it over DB_FILE, the database cannot be used while this runs.
+ *
+ *  returns:  the fd of the new database file, or ERR_DB_FILE
+ *
+ *  console:  as for compress_db()
+ */
+static int rewrite_db(int fd)
+{
+    // the copy is made from the database file alone, so everything in the
+    // write-ahead log has to be durable there first
+    db_ctx_t *ctx = db_ctx_get(fd);
+    if (ctx != NULL && db_ctx_checkpoint(ctx, true) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    if (io_lseek(fd, 0, SEEK_SET) == -1) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
@@ -521,7 +945,7 @@ int compress_db(int fd)
 
     // Copy valid (non-empty) records from old db to tmp db at their indexed offsets
     while (1) {
-        ssize_t n = read(fd, &current_s, STUDENT_RECORD_SIZE);
+        ssize_t n = io_read(fd, &current_s, STUDENT_RECORD_SIZE);
 
         if (n < 0) {
             printf(M_ERR_DB_READ);
@@ -542,13 +966,13 @@ int compress_db(int fd)
         }
 
         off_t offset = (off_t)current_s.id * STUDENT_RECORD_SIZE;
-        if (lseek(tmpfd, offset, SEEK_SET) == -1) {
+        if (io_lseek(tmpfd, offset, SEEK_SET) == -1) {
             printf(M_ERR_DB_READ);
             close(tmpfd);
             return ERR_DB_FILE;
         }
 
-        ssize_t w = write(tmpfd, &current_s, STUDENT_RECORD_SIZE);
+        ssize_t w = io_write(tmpfd, &current_s, STUDENT_RECORD_SIZE);
         if (w != (ssize_t)STUDENT_RECORD_SIZE) {
             printf(M_ERR_DB_WRITE);
             close(tmpfd);
@@ -557,32 +981,131 @@ int compress_db(int fd)
     }
 
     // Remove temp file to disk
-    if (fsync(tmpfd) == -1) {
+    if (io_fsync(tmpfd) == -1) {
         printf(M_ERR_DB_WRITE);
         close(tmpfd);
         return ERR_DB_FILE;
     }
 
-    // Replace original db with tmp db
+    // Replace original db with tmp db, it holds the same students so the
+    // context (and its bitmap) of the old fd stays valid for the new file
     close(tmpfd);
     close(fd);
 
-    if (rename(TMP_DB_FILE, DB_FILE) == -1) {
+    if (io_rename(TMP_DB_FILE, DB_FILE) == -1) {
+        if (ctx != NULL)
+            db_ctx_free(fd);
         printf(M_ERR_DB_CREATE);
         return ERR_DB_FILE;
     }
 
+    // make the rename itself durable before the log is restarted
+    int dirfd = open(".", O_RDONLY | O_DIRECTORY);
+    if (dirfd >= 0) {
+        io_fsync(dirfd);
+        close(dirfd);
+    }
+
     // Reopen the compressed db and return its fd so caller can keep using it
     int newfd = open(DB_FILE, O_RDWR);
     if (newfd < 0) {
+        if (ctx != NULL)
+            db_ctx_free(fd);
         printf(M_ERR_DB_OPEN);
         return ERR_DB_FILE;
     }
+    if (ctx != NULL)
+        db_ctx_rebind(ctx, newfd);
 
     printf(M_DB_COMPRESSED_OK);
     return newfd;
 }
 
+/*
+ *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
+ *
+ *  compress_db
+ *      fd:     linux file descriptor
+ *
+ *  This assignment takes advantage of the way Linux handles sparse files
+ *  on disk. Thus if there is a large hole between student records, Linux
+ *  will not use any physical storage.  However, when a database record is
+ *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
+ *  db.h - record.
+ *
+ *  The database is compacted in place while it stays usable: every 4K page
+ *  without a valid student is punched out of the file with
+ *  fallocate(FALLOC_FL_PUNCH_HOLE), and empty records at the end of the
+ *  file are truncated, see dbcompact.h.  Only when the filesystem cannot
+ *  punch holes is the database rewritten into TMP_DB_FILE and renamed over
+ *  DB_FILE as before:
+ *
+ *         #define DB_FILE     "student.db"        //name of database file
+ *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *
+ *  To ensure the caller can work with the compressed file in both cases,
+ *  this function returns the fd of the compressed database, which is fd
+ *  itself unless the database had to be rewritten.
+ *
+ *  returns:  <number>       returns the fd of the compressed database file
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
+ *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
+ *                             this error should also be returned after you
+ *                             compressed the database file and if you are unable
+ *                             to open it to pass the fd back to the caller
+ *            M_ERR_DB_CREATE  error creating the db file. For instance the
+ *                             inability to copy the temporary file back as
+ *                             the primary database file.
+ *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
+ *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *
+ */
+int compress_db(int fd)
+{
+    compact_state_t cs;
+
+    if (compact_db(fd, &cs) != NO_ERROR) {
+        if (errno == EOPNOTSUPP)
+            return rewrite_db(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_COMPRESSED_OK);
+    return fd;
+}
+
+/*
+ *  zero_db
+ *      fd:     database file descriptor
+ *
+ *  Removes every student from the database.  The file is truncated in
+ *  place, not reopened with O_TRUNC, so other processes keep working on
+ *  the same file and open snapshots keep their view, see db_ctx_zero().
+ *
+ *  returns:  NO_ERROR       the database is empty
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_ZERO_OK    on success
+ *            M_ERR_DB_WRITE  error truncating the database
+ */
+int zero_db(int fd)
+{
+    db_ctx_t *ctx = db_ctx_get(fd);
+    int rc = NO_ERROR;
+
+    if (ctx != NULL)
+        rc = db_ctx_zero(ctx);
+    else if (ftruncate(fd, 0) == -1)
+        rc = ERR_DB_FILE;
+
+    printf((rc == NO_ERROR) ? M_DB_ZERO_OK : M_ERR_DB_WRITE);
+    return rc;
+}
+
 /*
  *  validate_range
  *      id:  proposed student id
@@ -623,15 +1146,305 @@ int validate_range(int id, int gpa)
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|c|d|f|l|g|r|n|p|x|z|i|b|e|s|q|k|u] options.  Where:\n", exename);
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
     printf("\t-c:  counts the records in the database\n");
     printf("\t-d id:  deletes a student\n");
     printf("\t-f id:  finds and prints a student in the database\n");
-    printf("\t-p:  prints all records in the student database\n");
+    printf("\t-l last_name:  finds and prints all students with a last name\n");
+    printf("\t-g low high:  finds and prints students by gpa range (3 digit ints)\n");
+    printf("\t-r low high:  prints the students with ids from low to high\n");
+    printf("\t-n text [dist]:  finds students by name prefix, or within dist edits\n");
+    printf("\t-p [file]:  prints all records in the student database (or a packed file)\n");
+    printf("\t-p --sort-by id|lname|gpa:  prints all records in another order\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
     printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-i file.csv:  bulk imports students (id,first,last,gpa per line)\n");
+    printf("\t-b file:  runs a batch of adds (a id first last gpa) and deletes (d id)\n");
+    printf("\t-e [file.csv]:  bulk exports all students as csv (default stdout)\n");
+    printf("\t-s [file]:  writes a columnar snapshot (default %s%s)\n", DB_FILE, COL_SUFFIX);
+    printf("\t-q gpa:  prints the average, lowest and highest gpa\n");
+    printf("\t-q hist [width]:  prints a gpa histogram (bucket width, default %d)\n",
+           COL_HIST_WIDTH);
+    printf("\t-q prefix text:  counts students whose last name starts with text\n");
+    printf("\t-k file:  packs the database into a compact file\n");
+    printf("\t-u file:  adds the students of a packed file to the database\n");
+    printf("\t--hashed -a|-c|-d|-f|-p|-x ...:  same commands on %s, ids %d to %d\n",
+           HASH_DB_FILE, MIN_STD_ID, HASH_MAX_ID);
+    printf("\t--sharded --init n range|hash:  splits %s into n shard files\n", DB_FILE);
+    printf("\t--sharded -a|-c|-d|-f|-p|-x|-z|-i ...:  same commands on the shards\n");
+    printf("\t--sharded --merge:  copies the shards back into %s and ends sharding\n", DB_FILE);
+    printf("\t--serve [socket]:  serves requests on a unix socket (default %s%s)\n",
+           DB_FILE, SRV_SOCK_SUFFIX);
+    printf("\t--ndjson|--binary <command>:  prints students as json lines or 64 byte records\n");
+    printf("\t--binary:  answers --serve requests from stdin on stdout\n");
+    printf("\t--stats [--json] <command>:  prints the file system calls of the command to stderr\n");
+    printf("\t--verify:  checks every page of the database against its checksum\n");
+    printf("\t--bench [--records n,...] [--ops n] [--dist zipf|uniform] [--mix r,i,d,s]\n"
+           "\t        [--seed n] [--tag text] [--out file]:  runs the benchmark workload\n");
+}
+
+//an id from MIN_STD_ID to HASH_MAX_ID for the hashed database, or -1
+static int parse_hashed_id(const char *arg)
+{
+    char *end;
+    long long id = strtoll(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || id < MIN_STD_ID || id > HASH_MAX_ID)
+        return -1;
+    return (int)id;
+}
+
+/*
+ *  hashed_main
+ *      argc, argv:  the command line without the leading --hashed
+ *
+ *  Runs -a, -c, -d, -f, -p and -x against the hashed database (see
+ *  dbhash.h) instead of student.db.  Output and exit codes are the same
+ *  as for student.db, but ids may go up to HASH_MAX_ID.  -x
+ *  rebuilds the Bloom filter of the ids, dropping deleted ones.
+ *
+ *  returns:  exit code for the shell
+ */
+static int hashed_main(char *exename, int argc, char *argv[])
+{
+    student_t student = {0};
+    struct print_db_state state = { 0 };
+    hash_db_t *h;
+    char opt;
+    int id = -1;
+    int rc;
+
+    if (argc < 1 || argv[0][0] != '-' || argv[0][1] == '\0' || argv[0][2] != '\0') {
+        usage(exename);
+        return EXIT_FAIL_ARGS;
+    }
+    opt = argv[0][1];
+    if ((opt == 'a' && argc != 5) || ((opt == 'd' || opt == 'f') && argc != 2) ||
+        ((opt == 'c' || opt == 'p' || opt == 'x') && argc != 1) || strchr("acdfpx", opt) == NULL) {
+        usage(exename);
+        return EXIT_FAIL_ARGS;
+    }
+    if (opt == 'a' || opt == 'd' || opt == 'f') {
+        id = parse_hashed_id(argv[1]);
+        if (id < 0 || (opt == 'a' && validate_range(MIN_STD_ID, atoi(argv[4])) != NO_ERROR)) {
+            printf(M_ERR_STD_RNG);
+            return EXIT_FAIL_ARGS;
+        }
+    }
+
+    h = hash_open(HASH_DB_FILE, opt == 'a' || opt == 'd' || opt == 'x');
+    if (h == NULL) {
+        printf(M_ERR_DB_OPEN);
+        return EXIT_FAIL_DB;
+    }
+
+    switch (opt) {
+    case 'a':
+        student.id = id;
+        strncpy(student.fname, argv[2], sizeof(student.fname) - 1);
+        strncpy(student.lname, argv[3], sizeof(student.lname) - 1);
+        student.gpa = atoi(argv[4]);
+        rc = hash_put(h, &student);
+        if (rc == NO_ERROR)
+            printf(M_STD_ADDED, id);
+        else if (rc == ERR_DB_OP)
+            printf(M_ERR_DB_ADD_DUP, id);
+        else
+            printf(M_ERR_DB_WRITE);
+        break;
+
+    case 'c':
+        rc = NO_ERROR;
+        if (h->hdr.nrecs == 0)
+            printf(M_DB_EMPTY);
+        else
+            printf(M_DB_RECORD_CNT, (int)h->hdr.nrecs);
+        break;
+
+    case 'd':
+        rc = hash_del(h, id);
+        if (rc == NO_ERROR)
+            printf(M_STD_DEL_MSG, id);
+        else if (rc == SRCH_NOT_FOUND)
+            printf(M_STD_NOT_FND_MSG, id);
+        else
+            printf(M_ERR_DB_WRITE);
+        break;
+
+    case 'f':
+        rc = hash_get(h, id, &student);
+        if (rc == NO_ERROR)
+            print_student(&student);
+        else if (rc == SRCH_NOT_FOUND)
+            printf(M_STD_NOT_FND_MSG, id);
+        else
+            printf(M_ERR_DB_READ);
+        break;
+
+    case 'x':
+        rc = hash_filter_rebuild(h);
+        printf((rc == NO_ERROR) ? M_DB_COMPRESSED_OK : M_ERR_DB_WRITE);
+        break;
+
+    default:
+        rc = hash_scan(h, print_db_cb, &state);
+        if (rc != NO_ERROR)
+            printf(M_ERR_DB_READ);
+        else if (state.first_row == 0)
+            wire_note(M_DB_EMPTY);
+        break;
+    }
+
+    hash_close(h);
+    return (rc == NO_ERROR) ? EXIT_OK : EXIT_FAIL_DB;
+}
+
+/*
+ *  sharded_main
+ *      argc, argv:  the command line without the leading --sharded
+ *
+ *  Runs --init, --merge, -a, -c, -d, -f, -p, -x, -z and -i against the
+ *  sharded database (see dbshard.h).  Output and exit codes are the same as for
+ *  student.db.
+ *
+ *  returns:  exit code for the shell
+ */
+static int sharded_main(char *exename, int argc, char *argv[])
+{
+    student_t student = {0};
+    struct print_db_state state = { 0 };
+    shard_db_t *sh;
+    char opt;
+    int id = 0;
+    int fd;
+    int rc;
+
+    if (argc >= 1 && strcmp(argv[0], "--init") == 0) {
+        const char *by = (argc == 3) ? argv[2] : "";
+        int n = (argc == 3) ? atoi(argv[1]) : 0;
+        int mode = (strcmp(by, "hash") == 0) ? SHARD_BY_HASH : SHARD_BY_RANGE;
+
+        if (n < 1 || n > SHARD_MAX || (strcmp(by, "range") != 0 && strcmp(by, "hash") != 0)) {
+            printf(M_ERR_SHARD_ARGS, SHARD_MAX);
+            return EXIT_FAIL_ARGS;
+        }
+        rc = shard_init(n, mode);
+        if (rc < 0)
+            return EXIT_FAIL_DB;
+        printf(M_SHARD_INIT, n, by, rc);
+        return EXIT_OK;
+    }
+
+    if (argc == 1 && strcmp(argv[0], "--merge") == 0) {
+        sh = shard_open();
+        if (sh == NULL) {
+            printf(M_ERR_SHARD_NONE);
+            return EXIT_FAIL_DB;
+        }
+        int n = (int)sh->m.nshards;
+        rc = shard_merge(sh);
+        shard_close(sh);
+        if (rc < 0)
+            return EXIT_FAIL_DB;
+        printf(M_SHARD_MERGE, n, DB_FILE, rc);
+        return EXIT_OK;
+    }
+
+    if (argc < 1 || argv[0][0] != '-' || argv[0][1] == '\0' || argv[0][2] != '\0') {
+        usage(exename);
+        return EXIT_FAIL_ARGS;
+    }
+    opt = argv[0][1];
+    if ((opt == 'a' && argc != 5) || ((opt == 'd' || opt == 'f' || opt == 'i') && argc != 2) ||
+        (strchr("cpxz", opt) != NULL && argc != 1) || strchr("acdfpxzi", opt) == NULL) {
+        usage(exename);
+        return EXIT_FAIL_ARGS;
+    }
+    if (opt == 'a' || opt == 'd' || opt == 'f') {
+        id = atoi(argv[1]);
+        if (validate_range(id, (opt == 'a') ? atoi(argv[4]) : MIN_STD_GPA) != NO_ERROR) {
+            printf(M_ERR_STD_RNG);
+            return EXIT_FAIL_ARGS;
+        }
+    }
+
+    sh = shard_open();
+    if (sh == NULL) {
+        printf(M_ERR_SHARD_NONE);
+        return EXIT_FAIL_DB;
+    }
+
+    switch (opt) {
+    case 'a':
+    case 'd':
+    case 'f':
+        // a single id only ever opens its own shard
+        fd = shard_fd(sh, id);
+        if (fd < 0) {
+            rc = ERR_DB_FILE;
+        } else if (opt == 'a') {
+            rc = add_student(fd, id, argv[2], argv[3], atoi(argv[4]));
+        } else if (opt == 'd') {
+            rc = del_student(fd, id);
+        } else {
+            rc = get_student(fd, id, &student);
+            if (rc == NO_ERROR)
+                print_student(&student);
+            else if (rc == SRCH_NOT_FOUND)
+                printf(M_STD_NOT_FND_MSG, id);
+            else
+                printf(M_ERR_DB_READ);
+        }
+        break;
+
+    case 'c':
+        rc = shard_count(sh);
+        if (rc < 0)
+            printf(M_ERR_DB_READ);
+        else if (rc == 0)
+            printf(M_DB_EMPTY);
+        else
+            printf(M_DB_RECORD_CNT, rc);
+        break;
+
+    case 'p':
+        rc = shard_scan(sh, print_db_cb, &state);
+        if (rc != NO_ERROR)
+            printf(M_ERR_DB_READ);
+        else if (state.first_row == 0)
+            wire_note(M_DB_EMPTY);
+        break;
+
+    case 'x':
+        rc = shard_compact(sh);
+        printf((rc == NO_ERROR) ? M_DB_COMPRESSED_OK : M_ERR_DB_WRITE);
+        break;
+
+    case 'z':
+        rc = shard_zero(sh);
+        if (rc == NO_ERROR)
+            printf(M_DB_ZERO_OK);
+        break;
+
+    default:
+        rc = shard_import(sh, argv[1]);
+        break;
+    }
+
+    shard_close(sh);
+    return (rc >= 0) ? EXIT_OK : EXIT_FAIL_DB;
+}
+
+//sdbsc --stats: the command and format of the statistics printed at exit
+static const char *stats_cmd = "";
+static bool stats_json;
+
+static void print_stats(void)
+{
+    fflush(stdout);
+    iostat_print(stderr, stats_cmd, stats_json);
 }
 
 // Welcome to main()
@@ -649,6 +1462,42 @@ int main(int argc, char *argv[])
     // and print_student().
     student_t student = {0};
 
+    //    arv[0]    arv[1]     arv[2] ...
+    // prog_name  --stats  [--json]  <usual command>
+    //---------------------------------------------
+    // example:  prog_name --stats -a 1 john doe 345
+    // counts the file system calls of the command and prints them to
+    // stderr when it exits (see dbiostat.h)
+    if (argc >= 3 && strcmp(argv[1], "--stats") == 0)
+    {
+        stats_json = (strcmp(argv[2], "--json") == 0);
+        argv[stats_json ? 2 : 1] = argv[0];
+        argv += stats_json ? 2 : 1;
+        argc -= stats_json ? 2 : 1;
+        iostat_enable(true);
+        atexit(print_stats);
+    }
+
+    //    arv[0]    arv[1]            arv[2] ...
+    // prog_name  --ndjson|--binary  <usual command>
+    //---------------------------------------------
+    // example:  prog_name --ndjson -p
+    // prints students as json lines or records (see dbwire.h), the rest of
+    // the command line is handled as usual.  --binary alone is a stream of
+    // requests on stdin, see below
+    if (argc >= 3 && (strcmp(argv[1], "--ndjson") == 0 || strcmp(argv[1], "--binary") == 0))
+    {
+        wire_set_format((argv[1][2] == 'n') ? WIRE_NDJSON : WIRE_BINARY);
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    // the label is the command itself, not a --hashed or --sharded in front
+    if (argc >= 2)
+        stats_cmd = argv[1];
+    if (argc >= 3 && (strcmp(argv[1], "--hashed") == 0 || strcmp(argv[1], "--sharded") == 0))
+        stats_cmd = argv[2];
+
     // This function must have at least one arg, and the arg must start
     // with a dash
     if ((argc < 2) || (*argv[1] != '-'))
@@ -668,6 +1517,40 @@ int main(int argc, char *argv[])
         exit(EXIT_OK);
     }
 
+    //    arv[0]    arv[1]  arv[2] ...
+    // prog_name  --hashed  -a|-c|-d|-f|-p|-x  <usual arguments>
+    //----------------------------------------------------
+    // example:  prog_name --hashed -a 900123456 John Doe 341
+    if (strcmp(argv[1], "--hashed") == 0)
+    {
+        exit(hashed_main(argv[0], argc - 2, argv + 2));
+    }
+
+    //    arv[0]     arv[1]  arv[2] ...
+    // prog_name  --sharded  --init n range|hash
+    // prog_name  --sharded  --merge
+    // prog_name  --sharded  -a|-c|-d|-f|-p|-x|-z|-i  <usual arguments>
+    //----------------------------------------------------------------
+    // example:  prog_name --sharded --init 4 range
+    if (strcmp(argv[1], "--sharded") == 0)
+    {
+        exit(sharded_main(argv[0], argc - 2, argv + 2));
+    }
+
+    // the benchmark works on its own files, see dbbench.h
+    if (strcmp(argv[1], "--bench") == 0)
+    {
+        exit(bench_main(argv[0], argc - 2, argv + 2));
+    }
+
+    // once split by --sharded --init the students live in the shards, and
+    // student.db is only the copy they were made from
+    if (access(SHARD_MANIFEST, F_OK) == 0)
+    {
+        printf(M_ERR_SHARDED, SHARD_MANIFEST);
+        exit(EXIT_FAIL_DB);
+    }
+
     // now lets open the file and continue if there is no error
     // note we are not truncating the file using the second
     // parameter
@@ -677,6 +1560,50 @@ int main(int argc, char *argv[])
         exit(EXIT_FAIL_DB);
     }
 
+    //    arv[0]   arv[1]    arv[2]
+    // prog_name  --serve  [socket]
+    //-----------------------------
+    // example:  prog_name --serve /tmp/student.sock
+    if (strcmp(argv[1], "--serve") == 0)
+    {
+        exit_code = EXIT_OK;
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+        }
+        else if (serve_db(fd, (argc == 3) ? argv[2] : DB_FILE SRV_SOCK_SUFFIX) < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+        }
+        close_db(fd);
+        exit(exit_code);
+    }
+
+    //    arv[0]    arv[1]
+    // prog_name  --binary  < requests
+    //--------------------------------
+    // answers --serve requests from stdin on stdout, see dbserver.h
+    if (strcmp(argv[1], "--binary") == 0)
+    {
+        rc = serve_stdio(fd);
+        close_db(fd);
+        exit((rc == NO_ERROR) ? EXIT_OK : EXIT_FAIL_DB);
+    }
+
+    //    arv[0]    arv[1]
+    // prog_name  --verify
+    //--------------------
+    // checks every page of the database against its checksum
+    if (strcmp(argv[1], "--verify") == 0)
+    {
+        rc = (argc == 2) ? crc_verify(fd) : ERR_DB_OP;
+        if (rc == ERR_DB_OP)
+            usage(argv[0]);
+        close_db(fd);
+        exit((rc == ERR_DB_OP) ? EXIT_FAIL_ARGS : (rc == 0) ? EXIT_OK : EXIT_FAIL_DB);
+    }
+
     // set rc to the return code of the operation to ensure the program
     // use that to determine the proper exit_code.  Look at the header
     // sdbsc.h for expected values.
@@ -772,12 +1699,123 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case 'l':
+        //    arv[0] arv[1]     arv[2]
+        // prog_name     -l  last_name
+        //----------------------------
+        // example:  prog_name -l doe
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_students_lname(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'g':
+        //    arv[0] arv[1] arv[2] arv[3]
+        // prog_name     -g    low   high
+        //-------------------------------
+        // example:  prog_name -g 300 400
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        gpa = atoi(argv[2]);
+        id = atoi(argv[3]);     // reused for the upper gpa bound
+        if (validate_range(MIN_STD_ID, gpa) != NO_ERROR ||
+            validate_range(MIN_STD_ID, id) != NO_ERROR || gpa > id)
+        {
+            printf(M_ERR_GPA_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_students_gpa(fd, gpa, id);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'r':
+        //    arv[0] arv[1] arv[2] arv[3]
+        // prog_name     -r    low   high
+        //-------------------------------
+        // example:  prog_name -r 1 100
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        gpa = atoi(argv[3]);    // reused for the upper id bound
+        if (validate_range(id, MIN_STD_GPA) != NO_ERROR ||
+            validate_range(gpa, MIN_STD_GPA) != NO_ERROR || id > gpa)
+        {
+            printf(M_ERR_ID_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = print_range(fd, id, gpa);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'n':
+        //    arv[0] arv[1]  arv[2]  arv[3]
+        // prog_name     -n    text  [dist]
+        //---------------------------------
+        // example:  prog_name -n jon 1
+        if (argc != 3 && argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = (argc == 4) ? atoi(argv[3]) : 0;     // reused for the distance
+        if (id < 0 || id > TRIE_MAX_DIST)
+        {
+            printf(M_ERR_NAME_DIST, TRIE_MAX_DIST);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_students_name(fd, argv[2], id);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'p':
-        //    arv[0] arv[1]
-        // prog_name     -p
-        //-----------------
-        // example:  prog_name -p
-        rc = print_db(fd);
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -p  [file]
+        // prog_name     -p  --sort-by  id|lname|gpa
+        //-------------------------
+        // example:  prog_name -p --sort-by gpa
+        if (argc > 4 || (argc == 4 && strcmp(argv[2], "--sort-by") != 0) ||
+            (argc == 3 && strcmp(argv[2], "--sort-by") == 0))
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (argc == 4 && strcmp(argv[2], "--sort-by") == 0)
+        {
+            int sort = print_sort_key(argv[3]);
+            if (sort < 0)
+            {
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = print_db_sorted(fd, sort);
+        }
+        else
+        {
+            rc = (argc == 3) ? print_packed(argv[2]) : print_db(fd);
+        }
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -797,20 +1835,127 @@ int main(int argc, char *argv[])
 
     case 'z':
         //    arv[0] arv[1]
-        // prog_name     -x
+        // prog_name     -z
         //-----------------
-        // example:  prog_name -x
-        // HINT:  close the db file, we already have fd
-        //       and reopen db indicating truncate=true
-        close(fd);
-        fd = open_db(DB_FILE, true);
-        if (fd < 0)
+        // example:  prog_name -z
+        if (zero_db(fd) != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+        exit_code = EXIT_OK;
+        break;
+
+    case 'i':
+        //    arv[0] arv[1]    arv[2]
+        // prog_name     -i  file.csv
+        //---------------------------
+        // example:  prog_name -i roster.csv
+        if (argc != 3)
         {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = import_csv(fd, argv[2]);
+        if (rc < 0)
             exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'b':
+        //    arv[0] arv[1]      arv[2]
+        // prog_name     -b  batch.txt
+        //-----------------------------
+        // example:  prog_name -b changes.txt
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
             break;
         }
-        printf(M_DB_ZERO_OK);
-        exit_code = EXIT_OK;
+        rc = batch_file(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'e':
+        //    arv[0] arv[1]      arv[2]
+        // prog_name     -e  [file.csv]
+        //-----------------------------
+        // example:  prog_name -e roster.csv
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = export_csv(fd, (argc == 3) ? argv[2] : NULL);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 's':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -s  [file]
+        //-------------------------
+        // example:  prog_name -s students.col
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = column_export(fd, (argc == 3) ? argv[2] : NULL);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'q':
+        //    arv[0] arv[1]     arv[2]   arv[3]
+        // prog_name     -q  aggregate    [arg]
+        //-------------------------------------
+        // example:  prog_name -q hist 25
+        if (argc == 3 && strcmp(argv[2], "gpa") == 0)
+        {
+            rc = aggregate_gpa(fd);
+        }
+        else if ((argc == 3 || argc == 4) && strcmp(argv[2], "hist") == 0)
+        {
+            gpa = (argc == 4) ? atoi(argv[3]) : COL_HIST_WIDTH;   // bucket width
+            if (gpa < 1 || gpa > MAX_STD_GPA)
+            {
+                printf(M_ERR_GPA_RNG);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = aggregate_hist(fd, gpa);
+        }
+        else if (argc == 4 && strcmp(argv[2], "prefix") == 0)
+        {
+            rc = aggregate_prefix(fd, argv[3]);
+        }
+        else
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'k':
+    case 'u':
+        //    arv[0] arv[1]     arv[2]
+        // prog_name  -k|-u  file.sdbk
+        //----------------------------
+        // example:  prog_name -k backup.sdbk
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = (opt == 'k') ? pack_db(fd, argv[2]) : unpack_db(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
         break;
     default:
         usage(argv[0]);
@@ -820,6 +1965,6 @@ int main(int argc, char *argv[])
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
     if (fd >= 0)
-        close(fd);
+        close_db(fd);
     exit(exit_code);
 }
@@ -1,17 +1,33 @@
 #ifndef __SDB_H__
+    #define __SDB_H__
+
+#include <stdbool.h>
 
 #include "db.h" //get student record type
 
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+void close_db(int fd);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
 int del_student(int fd, int id);
+int student_exists(int fd, int id);
+int apply_student(int fd, int id, const student_t *s);
+int put_student(int fd, int id, const student_t *s);
+int insert_student(int fd, const student_t *s);
+int remove_student(int fd, int id);
 int compress_db(int fd);
+int zero_db(int fd);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
 int count_db_records(int fd);
 int print_db(int fd);
+int print_db_sorted(int fd, int sort);
+int print_packed(const char *path);
+int find_students_lname(int fd, char *lname);
+int find_students_gpa(int fd, int lo, int hi);
+int find_students_name(int fd, const char *text, int maxdist);
+int print_range(int fd, int lo, int hi);
 void usage(char *);
 
 //error codes to be returned from individual functions
@@ -44,6 +60,9 @@ void usage(char *);
 #define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
 #define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
 #define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
+#define M_ERR_GPA_RNG     "Cant search, GPA out of allowable range!\n"
+#define M_ERR_ID_RNG      "Cant search, ID out of allowable range!\n"
+#define M_ERR_NAME_DIST   "Cant search, edit distance must be 0 to %d!\n"
 
 #define M_STD_ADDED       "Student %d added to database.\n"
 #define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
@@ -52,7 +71,39 @@ void usage(char *);
 #define M_DB_ZERO_OK      "All database records removed!\n"
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
+#define M_NO_MATCH        "No students matched the query.\n"
+#define M_ERR_SRV_SOCK    "Error creating server socket, exiting!\n"
+#define M_SRV_READY       "Serving student database on %s\n"
+#define M_ERR_WAL_RECOVER "Warning, could not replay the write-ahead log.\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_DB_IMPORTED     "Imported %d student record(s).\n"
+#define M_DB_EXPORTED     "Exported %d student record(s).\n"
+#define M_ERR_IMPORT_OPEN "Cant open csv file %s.\n"
+#define M_ERR_IMPORT_LINE "Import failed, bad record on line %d.\n"
+#define M_ERR_IMPORT_RNG  "Import failed, ID or GPA out of allowable range on line %d.\n"
+#define M_ERR_IMPORT_DUP  "Import failed, student with ID=%d on line %d already exists.\n"
+#define M_DB_SNAPSHOT     "Wrote columnar snapshot of %d student record(s).\n"
+#define M_AGG_GPA         "Students: %d, average gpa: %.2f, min: %.2f, max: %.2f\n"
+#define M_AGG_HIST        "%.2f - %.2f: %u\n"
+#define M_AGG_PREFIX      "%d student(s) with a last name starting with %s.\n"
+#define M_DB_PACKED       "Packed %d student record(s) into %s (%lld bytes).\n"
+#define M_ERR_PACK_FILE   "File %s is not a valid packed database.\n"
+#define M_ERR_UNPACK_DUP  "Import failed, student with ID=%d already exists.\n"
+#define M_BENCH_DONE      "Wrote benchmark results to %s.\n"
+#define M_ERR_BENCH_OUT   "Cant create benchmark results file %s.\n"
+#define M_ERR_BENCH       "Benchmark failed, could not load or run a database.\n"
+#define M_CRC_BAD         "Page %lld (ids %lld-%lld) fails its checksum.\n"
+#define M_CRC_VERIFIED    "Verified %lld page(s), %d bad.\n"
+#define M_CRC_REBUILT     "Checksums were missing or stale and have been rebuilt, nothing to verify.\n"
+#define M_ERR_CRC         "Cant verify, the checksum file is not available.\n"
+#define M_BATCH_DONE      "Batch of %d operation(s): %d done, %d failed.\n"
+#define M_ERR_BATCH_OPEN  "Cant open batch file %s.\n"
+#define M_ERR_BATCH_LINE  "Batch failed, bad operation on line %d.\n"
+#define M_SHARD_INIT      "Created %d shard(s) by %s, copied %d student record(s).\n"
+#define M_SHARD_MERGE     "Merged %d shard(s) into %s, copied %d student record(s).\n"
+#define M_ERR_SHARD_NONE  "No sharded database, create one with --sharded --init.\n"
+#define M_ERR_SHARDED     "Database is sharded (%s), run the command with --sharded.\n"
+#define M_ERR_SHARD_ARGS  "Shard count must be 1 to %d, split by range or hash.\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
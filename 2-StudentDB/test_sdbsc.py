@@ -6,6 +6,9 @@ Converted from BATS to pytest
 
 import subprocess
 import os
+import json
+import struct
+import socket
 import pytest
 
 
@@ -13,6 +16,9 @@ import pytest
 @pytest.fixture(scope="session", autouse=True)
 def setup_test_environment():
     """Delete student.db file if it exists before running tests"""
+    # a manifest left by an interrupted run would lock student.db
+    if os.path.exists("student.db.shards"):
+        subprocess.run(["./sdbsc", "--sharded", "--merge"], capture_output=True)
     if os.path.exists("student.db"):
         os.remove("student.db")
     yield
@@ -194,6 +200,819 @@ class TestDatabaseCompress:
         assert lines[0] == "Database successfully compressed!", f"Failed Output: {stdout}"
 
 
+class TestOccupancyBitmap:
+    """Test the occupancy bitmap sidecar file"""
+
+    def test_16_bitmap_rebuilt_when_missing(self):
+        """Counting still works after the bitmap sidecar is removed"""
+        os.remove("student.db.bitmap")
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Database contains 3 student record(s).", f"Failed Output: {stdout}"
+        assert os.path.exists("student.db.bitmap")
+
+    def test_17_duplicate_detected_by_bitmap(self):
+        """Duplicate check uses the rebuilt bitmap"""
+        returncode, stdout, stderr = run_sdbsc("-a", "3", "dup", "student", "300")
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert lines[0] == "Cant add student with ID=3, already exists in db.", f"Failed Output: {stdout}"
+
+
+class TestBulkImportExport:
+    """Test bulk csv import (-i) and export (-e)"""
+
+    def test_18_import_csv(self, tmp_path):
+        """Import three students from a csv file"""
+        csv = tmp_path / "roster.csv"
+        csv.write_text("id,fname,lname,gpa\n12,ann,lee,350\n10,bob,ray,275\n11,cy,fox,400\n")
+        returncode, stdout, stderr = run_sdbsc("-i", str(csv))
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        assert stdout.strip() == "Imported 3 student record(s).", f"Failed Output: {stdout}"
+
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s).", f"Failed Output: {stdout}"
+
+    def test_19_import_duplicate_fails(self, tmp_path):
+        """A duplicate id rejects the whole file"""
+        csv = tmp_path / "dups.csv"
+        csv.write_text("20,new,student,300\n3,dup,student,300\n")
+        returncode, stdout, stderr = run_sdbsc("-i", str(csv))
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+        assert stdout.strip() == "Import failed, student with ID=3 on line 2 already exists.", \
+            f"Failed Output: {stdout}"
+
+        returncode, stdout, stderr = run_sdbsc("-f", "20")
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+
+    def test_20_import_out_of_range_fails(self, tmp_path):
+        """validate_range rules apply to imported records"""
+        csv = tmp_path / "range.csv"
+        csv.write_text("21,bad,gpa,501\n")
+        returncode, stdout, stderr = run_sdbsc("-i", str(csv))
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+        assert stdout.strip() == "Import failed, ID or GPA out of allowable range on line 1."
+
+    def test_21_export_csv(self):
+        """Export writes every student in id order"""
+        returncode, stdout, stderr = run_sdbsc("-e")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        assert stdout.split('\n') == [
+            "id,fname,lname,gpa", "1,john,doe,345", "3,jane,doe,390",
+            "10,bob,ray,275", "11,cy,fox,400", "12,ann,lee,350",
+            "63,jim,doe,285", ""], f"Failed Output: {stdout}"
+
+
+class TestSecondaryIndexes:
+    """Test lname (-l) and gpa range (-g) queries"""
+
+    def test_22_find_by_last_name(self):
+        """Find all students with last name doe"""
+        returncode, stdout, stderr = run_sdbsc("-l", "doe")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        normalized_output = normalize_whitespace(stdout.strip())
+        expected_output = "ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 3 jane doe 3.90 63 jim doe 2.85"
+        assert normalized_output == expected_output, \
+            f"Failed Output: {normalized_output}\nExpected: {expected_output}"
+
+    def test_23_find_by_gpa_range(self):
+        """GPA range results come back in gpa order"""
+        returncode, stdout, stderr = run_sdbsc("-g", "340", "390")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        normalized_output = normalize_whitespace(stdout.strip())
+        expected_output = "ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 12 ann lee 3.50 3 jane doe 3.90"
+        assert normalized_output == expected_output, \
+            f"Failed Output: {normalized_output}\nExpected: {expected_output}"
+
+    def test_24_index_follows_delete(self):
+        """A deleted student disappears from the index"""
+        returncode, stdout, stderr = run_sdbsc("-d", "12")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        returncode, stdout, stderr = run_sdbsc("-l", "lee")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        assert stdout.strip() == "No students matched the query.", f"Failed Output: {stdout}"
+
+
+def crc32c(data):
+    """Bitwise CRC-32C, matches crc32c() in dbwal.c"""
+    crc = 0xffffffff
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x82f63b78 if crc & 1 else crc >> 1
+    return crc ^ 0xffffffff
+
+
+class TestWriteAheadLog:
+    """Test replay of student.db.wal after a simulated crash"""
+
+    def append_wal_record(self, sid, fname, lname, gpa):
+        """Log a write to the wal without applying it, as if we crashed"""
+        with open("student.db.wal", "rb") as f:
+            data = f.read()
+        start_lsn = struct.unpack_from("<Q", data, 16)[0]
+        lsn = start_lsn + (len(data) - 64) // 88
+        image = struct.pack("<i24s32si", sid, fname.encode(), lname.encode(), gpa)
+        body = struct.pack("<IQiI", 1, lsn, sid, 0) + image
+        with open("student.db.wal", "ab") as f:
+            f.write(struct.pack("<I", crc32c(body)) + body)
+
+    def test_25_replay_lost_write(self):
+        """A logged write missing from the database is redone on open"""
+        self.append_wal_record(70, "sam", "wal", 310)
+        returncode, stdout, stderr = run_sdbsc("-f", "70")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        normalized_output = normalize_whitespace(stdout.strip())
+        assert normalized_output == "ID FIRST_NAME LAST_NAME GPA 70 sam wal 3.10"
+        returncode, stdout, stderr = run_sdbsc("-l", "wal")
+        assert normalize_whitespace(stdout.strip()) == \
+            "ID FIRST_NAME LAST_NAME GPA 70 sam wal 3.10"
+        assert os.path.getsize("student.db.wal") == 64
+
+    def test_26_torn_tail_ignored(self):
+        """A partially written record at the end of the log is discarded"""
+        with open("student.db.wal", "ab") as f:
+            f.write(b"\x5a" * 88)
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestOnlineCompaction:
+    """Test hole punching of free pages and tail truncation"""
+
+    def test_27_delete_frees_empty_page(self, tmp_path):
+        """Deleting the last student of a 4K page gives the page back"""
+        csv = tmp_path / "page.csv"
+        csv.write_text("".join(f"{i},pg,page,300\n" for i in range(192, 256)) +
+                       "300,end,tail,300\n")
+        returncode, stdout, stderr = run_sdbsc("-i", str(csv))
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        before = os.stat("student.db").st_blocks
+        for i in range(192, 256):
+            returncode, stdout, stderr = run_sdbsc("-d", str(i))
+            assert returncode == 0, f"Expected return code 0, got {returncode}"
+        after = os.stat("student.db").st_blocks
+        assert after <= before - 8, f"Expected page to be freed, {before} -> {after} blocks"
+
+    def test_28_compress_truncates_tail(self):
+        """-x compacts in place and cuts empty records off the end"""
+        returncode, stdout, stderr = run_sdbsc("-d", "300")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        returncode, stdout, stderr = run_sdbsc("-x")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        assert stdout.strip() == "Database successfully compressed!"
+        assert os.path.getsize("student.db") == 71 * 64
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestServer:
+    """Test the --serve request protocol over the unix socket"""
+
+    def request(self, sock, op, sid=0, arg=0, payload=b""):
+        """Send one request, return (status, count, next, payload)"""
+        sock.sendall(struct.pack("<IiiI", op, sid, arg, len(payload)) + payload)
+        hdr = b""
+        while len(hdr) < 16:
+            hdr += sock.recv(16 - len(hdr))
+        status, count, nxt, length = struct.unpack("<iIiI", hdr)
+        body = b""
+        while len(body) < length:
+            body += sock.recv(length - len(body))
+        return status, count, nxt, body
+
+    def test_29_serve_requests(self):
+        """add/get/del/count/scan through a running server"""
+        server = subprocess.Popen(["./sdbsc", "--serve"], stdout=subprocess.PIPE, text=True)
+        try:
+            assert server.stdout.readline().strip() == \
+                "Serving student database on student.db.sock"
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect("student.db.sock")
+
+            image = struct.pack("<i24s32si", 80, b"srv", b"net", 333)
+            assert self.request(sock, 2, payload=image)[0] == 0
+            assert self.request(sock, 2, payload=image)[0] == -2
+            status, count, nxt, body = self.request(sock, 1, 80)
+            assert (status, count, body) == (0, 1, image)
+            assert self.request(sock, 1, 81)[0] == -3
+            assert self.request(sock, 4)[:2] == (0, 7)
+            status, count, nxt, body = self.request(sock, 5, 1, 3)
+            ids = [struct.unpack_from("<i", body, i * 64)[0] for i in range(count)]
+            assert (status, ids, nxt) == (0, [1, 3, 10], 11)
+            assert self.request(sock, 3, 80)[0] == 0
+            assert self.request(sock, 3, 80)[0] == -3
+            assert self.request(sock, 6)[0] == 0
+            sock.close()
+            assert server.wait(timeout=5) == 0
+        finally:
+            if server.poll() is None:
+                server.kill()
+        assert not os.path.exists("student.db.sock")
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestConcurrency:
+    """Test several sdbsc processes working on the database at once"""
+
+    def run_parallel(self, commands):
+        """Start every command at once, return the list of stdouts"""
+        procs = [subprocess.Popen(["./sdbsc"] + cmd, stdout=subprocess.PIPE, text=True)
+                 for cmd in commands]
+        return [p.communicate(timeout=30)[0] for p in procs]
+
+    def test_30_parallel_writers(self):
+        """racing adds of one id succeed once, distinct ids all land"""
+        outs = self.run_parallel([["-a", "90", "race", "same", "300"]] * 16)
+        assert sum("added to database" in out for out in outs) == 1
+        assert sum("already exists" in out for out in outs) == 15
+
+        ids = [str(500 + i * 64) for i in range(32)]
+        outs = self.run_parallel([["-a", sid, "par", "writer", "250"] for sid in ids])
+        assert all("added to database" in out for out in outs)
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 39 student record(s)."
+
+        outs = self.run_parallel([["-d", sid] for sid in ids + ["90"]])
+        assert all("was deleted from database" in out for out in outs)
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestColumnar:
+    """Test the columnar snapshot and the aggregate queries"""
+
+    def export_rows(self):
+        returncode, stdout, stderr = run_sdbsc("-e")
+        return [line.split(",") for line in stdout.strip().split("\n")[1:]]
+
+    def test_31_aggregates(self):
+        """aggregates agree with the exported rows and follow changes"""
+        rows = self.export_rows()
+        gpas = [int(r[3]) for r in rows]
+        returncode, stdout, stderr = run_sdbsc("-q", "gpa")
+        assert returncode == 0
+        assert stdout.strip() == "Students: %d, average gpa: %.2f, min: %.2f, max: %.2f" % (
+            len(gpas), sum(gpas) / 100.0 / len(gpas), min(gpas) / 100.0, max(gpas) / 100.0)
+        assert os.path.exists("student.db.col")
+
+        returncode, stdout, stderr = run_sdbsc("-q", "hist", "100")
+        counts = [int(line.split(":")[1]) for line in stdout.strip().split("\n")]
+        assert counts == [sum(1 for g in gpas if min(g // 100, 5) == b) for b in range(6)]
+
+        prefix = rows[0][2][:2]
+        returncode, stdout, stderr = run_sdbsc("-q", "prefix", prefix)
+        assert stdout.strip() == "%d student(s) with a last name starting with %s." % (
+            sum(1 for r in rows if r[2].startswith(prefix)), prefix)
+
+        # the snapshot is taken again once the database changed
+        run_sdbsc("-a", "95", "col", "Snapshot", "499")
+        returncode, stdout, stderr = run_sdbsc("-q", "prefix", "Snap")
+        assert stdout.strip() == "1 student(s) with a last name starting with Snap."
+        run_sdbsc("-d", "95")
+        returncode, stdout, stderr = run_sdbsc("-q", "prefix", "Snap")
+        assert stdout.strip() == "0 student(s) with a last name starting with Snap."
+
+        returncode, stdout, stderr = run_sdbsc("-s", "snapshot.col")
+        assert stdout.strip() == "Wrote columnar snapshot of %d student record(s)." % len(rows)
+        with open("snapshot.col", "rb") as f:
+            magic, version = struct.unpack("<II", f.read(8))
+        os.remove("snapshot.col")
+        assert magic == 0x4c4f4353
+
+
+class TestPackedFormat:
+    """Test converting to and from the packed slotted-page format"""
+
+    def test_32_pack_roundtrip(self):
+        """pack, zero, unpack gives back the same database"""
+        returncode, before, stderr = run_sdbsc("-e")
+        count = len(before.strip().split("\n")) - 1
+        returncode, stdout, stderr = run_sdbsc("-k", "backup.sdbk")
+        assert returncode == 0
+        assert stdout.startswith("Packed %d student record(s) into backup.sdbk" % count)
+        assert os.path.getsize("backup.sdbk") < os.path.getsize("student.db")
+
+        returncode, printed, stderr = run_sdbsc("-p")
+        assert run_sdbsc("-p", "backup.sdbk")[1] == printed
+
+        # loading it again clashes with every student
+        returncode, stdout, stderr = run_sdbsc("-u", "backup.sdbk")
+        assert returncode == 1
+        assert "already exists" in stdout
+
+        run_sdbsc("-z")
+        returncode, stdout, stderr = run_sdbsc("-u", "backup.sdbk")
+        assert stdout.strip() == "Imported %d student record(s)." % count
+        assert run_sdbsc("-e")[1] == before
+
+        with open("backup.sdbk", "r+b") as f:
+            f.seek(70)
+            f.write(b"\xff")
+        returncode, stdout, stderr = run_sdbsc("-p", "backup.sdbk")
+        os.remove("backup.sdbk")
+        assert returncode == 1
+        assert stdout.strip() == "File backup.sdbk is not a valid packed database."
+
+
+class TestNameSearch:
+    """Test prefix and fuzzy name search through the trie"""
+
+    def found_ids(self, *args):
+        returncode, stdout, stderr = run_sdbsc("-n", *args)
+        assert returncode == 0
+        return [int(line.split()[0]) for line in stdout.strip().split("\n")[1:]]
+
+    def test_33_prefix_and_fuzzy_search(self):
+        """prefix matches either name ignoring case, fuzzy allows typos"""
+        returncode, stdout, stderr = run_sdbsc("-e")
+        rows = [line.split(",") for line in stdout.strip().split("\n")[1:]]
+        lname = rows[0][2]
+
+        prefix = lname[:2].upper()
+        expected = [int(r[0]) for r in rows
+                    if r[1].lower().startswith(prefix.lower()) or
+                    r[2].lower().startswith(prefix.lower())]
+        assert self.found_ids(prefix) == expected
+
+        typo = lname[:-1] + ("q" if lname[-1] != "q" else "z")
+        assert int(rows[0][0]) in self.found_ids(typo, "1")
+        assert int(rows[0][0]) not in self.found_ids(typo + "qq", "1")
+
+        returncode, stdout, stderr = run_sdbsc("-n", "zzzzzz")
+        assert stdout.strip() == "No students matched the query."
+        returncode, stdout, stderr = run_sdbsc("-n", "a", "9")
+        assert returncode == 2
+
+
+class TestBufferPool:
+    """Test the server's page cache against writes from other processes"""
+
+    def test_34_cached_pages_stay_coherent(self):
+        """repeated lookups hit the pool, CLI writes are seen, server writes land"""
+        server = subprocess.Popen(["./sdbsc", "--serve"], stdout=subprocess.PIPE, text=True)
+        try:
+            server.stdout.readline()
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect("student.db.sock")
+            request = lambda *args, **kw: TestServer.request(None, sock, *args, **kw)
+
+            for _ in range(10):
+                assert request(1, 3)[0] == 0
+            body = request(8)[3]
+            hits, misses, evictions, writebacks = struct.unpack("<4Q", body)
+            assert hits >= 9 and misses >= 1
+
+            # written back before the add is acknowledged
+            image = struct.pack("<i24s32si", 12, b"pool", b"frame", 321)
+            assert request(2, payload=image)[0] == 0
+            returncode, stdout, stderr = run_sdbsc("-f", "12")
+            assert returncode == 0 and "pool" in stdout
+
+            # the cached page must notice the other process' delete
+            returncode, stdout, stderr = run_sdbsc("-d", "12")
+            assert returncode == 0
+            assert request(1, 12)[0] == -3
+            assert struct.unpack("<4Q", request(8)[3])[3] == writebacks + 1
+
+            assert request(6)[0] == 0
+            sock.close()
+            assert server.wait(timeout=5) == 0
+        finally:
+            if server.poll() is None:
+                server.kill()
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestHashedStore:
+    """Test the extendible hash database used by --hashed"""
+
+    def test_35_large_ids(self):
+        """nine digit ids stay small on disk and survive bucket splits"""
+        if os.path.exists("student.hdb"):
+            os.remove("student.hdb")
+        ids = [900000000 + i * 7919 for i in range(300)]
+        for sid in ids:
+            returncode, stdout, stderr = run_sdbsc("--hashed", "-a", str(sid), "big", "id", "300")
+            assert stdout.strip() == f"Student {sid} added to database."
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-a", str(ids[7]), "big", "id", "300")
+        assert returncode == 1
+
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-c")
+        assert stdout.strip() == "Database contains 300 student record(s)."
+        assert os.path.getsize("student.hdb") < 64 * 4096
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-f", str(ids[123]))
+        assert returncode == 0 and str(ids[123]) in stdout
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-p")
+        assert [int(line.split()[0]) for line in stdout.strip().split("\n")[1:]] == ids
+
+        for sid in ids:
+            assert run_sdbsc("--hashed", "-d", str(sid))[0] == 0
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-f", str(ids[0]))
+        assert returncode == 1
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-a", "2147483648", "a", "b", "1")
+        assert returncode == 2
+        os.remove("student.hdb")
+        os.remove("student.hdb.bloom")
+
+
+
+class TestSortedPrint:
+    """Test -p --sort-by against sorting the plain -p output"""
+
+    def rows(self, *args):
+        returncode, stdout, stderr = run_sdbsc("-p", *args)
+        assert returncode == 0
+        return [line.split() for line in stdout.strip().split("\n")[1:]]
+
+    def test_36_sort_by(self):
+        """lname and gpa orders break ties by id, unknown keys are rejected"""
+        rows = self.rows()
+        assert [int(r[0]) for r in rows] == sorted(int(r[0]) for r in rows)
+        assert self.rows("--sort-by", "lname") == \
+            sorted(rows, key=lambda r: (r[2], int(r[0])))
+        assert self.rows("--sort-by", "gpa") == \
+            sorted(rows, key=lambda r: (float(r[3]), int(r[0])))
+        assert self.rows("--sort-by", "id") == rows
+        returncode, stdout, stderr = run_sdbsc("-p", "--sort-by", "fname")
+        assert returncode == 2
+        returncode, stdout, stderr = run_sdbsc("-p", "--sort-by")
+        assert returncode == 2
+        assert not os.path.exists("--sort-by")
+
+
+class TestSnapshots:
+    """Test that long scans read a snapshot while writers carry on"""
+
+    def test_37_export_reads_snapshot(self, tmp_path):
+        """an export stalled mid-scan misses later writes and -z, versions are reclaimed"""
+        run_sdbsc("-k", "backup.sdbk")
+        # ~6.3 MB, the last ids are in the second scan block
+        bulk = tmp_path / "bulk.csv"
+        bulk.write_text("".join(f"{i},snap,shot{i},{200 + i % 300}\n" for i in range(200, 98000)))
+        more = tmp_path / "more.csv"
+        more.write_text("".join(f"{i},late,row,300\n" for i in range(98000, 99000)))
+        assert run_sdbsc("-i", str(bulk))[0] == 0
+        returncode, before, stderr = run_sdbsc("-e")
+
+        # once the first line is out the snapshot is taken and the reader
+        # blocks on the full pipe, well before it gets to the last ids
+        proc = subprocess.Popen(["./sdbsc", "-e"], stdout=subprocess.PIPE, text=True)
+        first = proc.stdout.readline()
+        assert run_sdbsc("-d", "97500")[0] == 0
+        assert run_sdbsc("-a", "97501", "new", "row", "300")[0] == 1
+        assert run_sdbsc("-i", str(more))[0] == 0
+        during = first + proc.stdout.read()
+        assert proc.wait(timeout=30) == 0
+        assert during == before
+        assert os.path.getsize("student.db.mvcc.idx") == 0
+        assert os.path.getsize("student.db.mvcc") == 0
+
+        returncode, after, stderr = run_sdbsc("-e")
+        assert len(after.strip().split("\n")) == len(before.strip().split("\n")) + 999
+
+        proc = subprocess.Popen(["./sdbsc", "-e"], stdout=subprocess.PIPE, text=True)
+        first = proc.stdout.readline()
+        returncode, stdout, stderr = run_sdbsc("-z")
+        assert stdout.strip() == "All database records removed!"
+        during = first + proc.stdout.read()
+        assert proc.wait(timeout=30) == 0
+        assert during == after
+        assert os.path.getsize("student.db") == 0
+
+        run_sdbsc("-u", "backup.sdbk")
+        os.remove("backup.sdbk")
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+    def test_47_snapshot_skips_empty_pages(self, tmp_path):
+        """only pages live at the snapshot are read, later changes to others stay out"""
+        run_sdbsc("-k", "backup.sdbk")
+        run_sdbsc("-z")
+        # every even page is full, odd pages are never written, the export
+        # is well over one write() buffer
+        ids = [p * 64 + k for p in range(2, 1562, 2) for k in range(64)]
+        bulk = tmp_path / "even.csv"
+        bulk.write_text("".join(f"{i},even,pagestudent{i},{200 + i % 300}\n" for i in ids))
+        assert run_sdbsc("-i", str(bulk))[0] == 0
+        returncode, before, stderr = run_sdbsc("-e")
+
+        returncode, stdout, stats = run_sdbsc("--stats", "--json", "-e")
+        assert returncode == 0
+        assert json.loads(stats)["read"]["bytes"] < os.path.getsize("student.db") * 0.6
+
+        proc = subprocess.Popen(["./sdbsc", "-e"], stdout=subprocess.PIPE, text=True)
+        first = proc.stdout.readline()
+        assert run_sdbsc("-a", str(1559 * 64 + 3), "odd", "page", "300")[0] == 0
+        for k in range(0, 64, 8):
+            assert run_sdbsc("-d", str(1560 * 64 + k))[0] == 0
+        during = first + proc.stdout.read()
+        assert proc.wait(timeout=30) == 0
+        assert during == before
+
+        run_sdbsc("-z")
+        run_sdbsc("-u", "backup.sdbk")
+        os.remove("backup.sdbk")
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestBench:
+    """Test the --bench workload generator"""
+
+    def test_38_bench_json(self, tmp_path):
+        """a small run reports every operation of both stores as JSON"""
+        out = tmp_path / "bench.json"
+        returncode, stdout, stderr = run_sdbsc("--bench", "--records", "500", "--ops", "400",
+                                               "--dist", "uniform", "--tag", "t\"1",
+                                               "--out", str(out))
+        assert returncode == 0
+        assert stdout.strip() == "Wrote benchmark results to %s." % out
+        doc = json.loads(out.read_text())
+        assert doc["tag"] == "t\"1" and doc["dist"] == "uniform"
+        ops = {(r["store"], r["op"]): r for r in doc["results"]}
+        assert set(ops) == {("flat", op) for op in
+                            ["load", "read", "insert", "delete", "scan", "count", "compress"]} | \
+                           {("hashed", op) for op in ["load", "read", "insert", "delete", "scan"]}
+        assert sum(ops[("flat", op)]["count"] for op in ["read", "insert", "delete", "scan"]) == 400
+        assert all(r["p50_us"] <= r["p99_us"] <= r["max_us"] for r in doc["results"] if "p50_us" in r)
+
+        assert run_sdbsc("--bench", "--mix", "50,50,50,0")[0] == 2
+        for f in os.listdir("."):
+            if f.startswith("bench."):
+                os.remove(f)
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestChecksums:
+    """Test the page checksums and --verify"""
+
+    def test_39_verify_finds_bad_page(self):
+        """a byte flipped behind sdbsc's back is reported with its page"""
+        returncode, stdout, stderr = run_sdbsc("--verify")
+        assert returncode == 0
+        assert stdout.strip() == "Verified 2 page(s), 0 bad."
+
+        # the empty slot of id 5 is in page 0, the log never rewrites it
+        with open("student.db", "r+b") as f:
+            f.seek(5 * 64 + 10)
+            f.write(b"\x01")
+        returncode, stdout, stderr = run_sdbsc("--verify")
+        assert returncode == 1
+        assert stdout == "Page 0 (ids 0-63) fails its checksum.\nVerified 2 page(s), 1 bad.\n"
+
+        with open("student.db", "r+b") as f:
+            f.seek(5 * 64 + 10)
+            f.write(b"\x00")
+        returncode, stdout, stderr = run_sdbsc("--verify")
+        assert returncode == 0
+
+class TestBatch:
+    """Test batched adds and deletes (-b)"""
+
+    def test_40_batch_file(self, tmp_path):
+        """every operation is reported in file order, later ones see earlier ones"""
+        batch = tmp_path / "changes.txt"
+        batch.write_text("a 20 ann lee 350\na 21 bob ray 275\n# comment\n\nd 20\n"
+                         "a 3 dup student 300\nd 22\na 20 cy fox 400\nd 20\nd 21\n")
+        returncode, stdout, stderr = run_sdbsc("-b", str(batch))
+        assert returncode == 1, f"Expected return code 1, got {returncode}"
+        assert stdout.split('\n') == [
+            "Student 20 added to database.", "Student 21 added to database.",
+            "Student 20 was deleted from database.",
+            "Cant add student with ID=3, already exists in db.",
+            "Student 22 was not found in database.",
+            "Student 20 added to database.", "Student 20 was deleted from database.",
+            "Student 21 was deleted from database.",
+            "Batch of 8 operation(s): 6 done, 2 failed.", ""], f"Failed Output: {stdout}"
+
+        # a bad line rejects the whole file
+        batch.write_text("a 20 ann lee 350\na 21 bob\n")
+        returncode, stdout, stderr = run_sdbsc("-b", str(batch))
+        assert returncode == 1
+        assert stdout.strip() == "Batch failed, bad operation on line 2."
+
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s).", f"Failed Output: {stdout}"
+        returncode, stdout, stderr = run_sdbsc("--verify")
+        assert returncode == 0
+
+class TestRange:
+    """Test printing an id range through a cursor (-r)"""
+
+    def test_41_print_range(self):
+        """only the students inside the range are printed, in id order"""
+        returncode, stdout, stderr = run_sdbsc("-r", "2", "63")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        lines = stdout.strip().split('\n')
+        assert [line.split()[0] for line in lines[1:]] == ["3", "10", "11", "63"], \
+            f"Failed Output: {stdout}"
+
+        returncode, stdout, stderr = run_sdbsc("-r", "64", "69")
+        assert returncode == 0
+        assert stdout.strip() == "No students matched the query."
+
+        returncode, stdout, stderr = run_sdbsc("-r", "10", "3")
+        assert returncode == 2
+        assert stdout.strip() == "Cant search, ID out of allowable range!"
+
+class TestSharded:
+    """Test the sharded database (--sharded)"""
+
+    def test_42_sharded(self):
+        """init copies student.db, which is then off limits to plain commands"""
+        returncode, flat, stderr = run_sdbsc("-p")
+        returncode, stdout, stderr = run_sdbsc("--sharded", "--init", "3", "hash")
+        assert returncode == 0, f"Expected return code 0, got {returncode}"
+        assert stdout.strip() == "Created 3 shard(s) by hash, copied 6 student record(s)."
+
+        returncode, stdout, stderr = run_sdbsc("--sharded", "-c")
+        assert stdout.strip() == "Database contains 6 student record(s).", f"Failed Output: {stdout}"
+        returncode, sharded, stderr = run_sdbsc("--sharded", "-p")
+        assert sharded == flat
+
+        returncode, stdout, stderr = run_sdbsc("--sharded", "-a", "500", "sam", "hill", "310")
+        assert returncode == 0
+        assert stdout.strip() == "Student 500 added to database."
+        returncode, stdout, stderr = run_sdbsc("--sharded", "-f", "500")
+        assert returncode == 0
+        assert "sam" in stdout
+        returncode, stdout, stderr = run_sdbsc("-a", "501", "ann", "hill", "310")
+        assert returncode == 1
+        assert stdout == "Database is sharded (student.db.shards), run the command with --sharded.\n"
+
+        returncode, stdout, stderr = run_sdbsc("--sharded", "-c")
+        assert stdout.strip() == "Database contains 7 student record(s)."
+        assert run_sdbsc("--sharded", "-d", "500")[0] == 0
+
+        # back to the unsharded student.db for the tests that follow
+        returncode, stdout, stderr = run_sdbsc("--sharded", "--merge")
+        assert returncode == 0
+        assert stdout.strip() == "Merged 3 shard(s) into student.db, copied 6 student record(s)."
+        assert not os.path.exists("student.db.shards")
+        returncode, stdout, stderr = run_sdbsc("-p")
+        assert stdout == flat
+        returncode, stdout, stderr = run_sdbsc("--sharded", "--merge")
+        assert returncode == 1
+        assert stdout == "No sharded database, create one with --sharded --init.\n"
+
+    def test_48_sharded_zero(self):
+        """-z empties every shard, a merge then empties student.db too"""
+        run_sdbsc("-k", "backup.sdbk")
+        assert run_sdbsc("--sharded", "--init", "2", "range")[0] == 0
+        returncode, stdout, stderr = run_sdbsc("--sharded", "-z")
+        assert returncode == 0
+        returncode, stdout, stderr = run_sdbsc("--sharded", "-c")
+        assert stdout.strip() == "Database contains no student records."
+
+        returncode, stdout, stderr = run_sdbsc("--sharded", "--merge")
+        assert stdout.strip() == "Merged 2 shard(s) into student.db, copied 0 student record(s)."
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains no student records."
+
+        run_sdbsc("-u", "backup.sdbk")
+        os.remove("backup.sdbk")
+        returncode, stdout, stderr = run_sdbsc("-c")
+        assert stdout.strip() == "Database contains 6 student record(s)."
+
+
+class TestWireFormats:
+    """Test --ndjson and --binary output and the --binary request stream"""
+
+    def test_43_ndjson_binary(self):
+        """records come out as json lines, raw student_t or protocol frames"""
+        returncode, stdout, stderr = run_sdbsc("--ndjson", "-p")
+        assert returncode == 0
+        rows = [json.loads(line) for line in stdout.splitlines()]
+        assert [r["id"] for r in rows] == [1, 3, 10, 11, 63, 70], f"Failed Output: {stdout}"
+        assert rows[0] == {"id": 1, "fname": "john", "lname": "doe", "gpa": 3.45}
+
+        returncode, stdout, stderr = run_sdbsc("--ndjson", "-r", "20", "30")
+        assert (returncode, stdout) == (0, "")
+
+        result = subprocess.run(["./sdbsc", "--binary", "-f", "3"], capture_output=True)
+        assert result.returncode == 0
+        assert len(result.stdout) == 64
+        sid, fname, lname, gpa = struct.unpack("<i24s32si", result.stdout)
+        assert (sid, fname.rstrip(b"\0"), gpa) == (3, b"jane", 390)
+
+        def req(op, sid=0, payload=b""):
+            return struct.pack("<IiiI", op, sid, 0, len(payload)) + payload
+        image = struct.pack("<i24s32si", 81, b"pipe", b"line", 300)
+        stream = req(2, payload=image) + req(1, 81) + req(3, 81) + req(4)
+        result = subprocess.run(["./sdbsc", "--binary"], input=stream, capture_output=True)
+        assert result.returncode == 0
+        out = result.stdout
+        statuses = []
+        pos = 0
+        while pos < len(out):
+            status, count, nxt, length = struct.unpack_from("<iIiI", out, pos)
+            statuses.append((status, count))
+            pos += 16 + length
+        assert statuses == [(0, 0), (0, 1), (0, 0), (0, 6)]
+
+class TestBloomFilter:
+    """Test the Bloom filter sidecar of the hashed database"""
+
+    def test_44_bloom_filter(self):
+        """the filter never hides a student and is rebuilt when stale"""
+        for path in ["student.hdb", "student.hdb.bloom"]:
+            if os.path.exists(path):
+                os.remove(path)
+        ids = [700000000 + i * 104729 for i in range(100)]
+        for sid in ids:
+            assert run_sdbsc("--hashed", "-a", str(sid), "bloom", "id", "250")[0] == 0
+        assert os.path.getsize("student.hdb.bloom") > 64
+
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-f", "123456789")
+        assert returncode == 1 and "not found" in stdout
+        assert run_sdbsc("--hashed", "-d", str(ids[5]))[0] == 0
+        returncode, stdout, stderr = run_sdbsc("--hashed", "-x")
+        assert stdout.strip() == "Database successfully compressed!"
+        assert run_sdbsc("--hashed", "-f", str(ids[5]))[0] == 1
+
+        # a damaged filter is rebuilt from the buckets on the next open
+        with open("student.hdb.bloom", "r+b") as f:
+            f.write(b"junk")
+        for sid in ids[6:]:
+            returncode, stdout, stderr = run_sdbsc("--hashed", "-f", str(sid))
+            assert returncode == 0 and str(sid) in stdout
+        os.remove("student.hdb")
+        os.remove("student.hdb.bloom")
+
+class TestIoStats:
+    """Test the --stats I/O counters and SRV_OP_IOSTATS"""
+
+    def test_45_io_stats(self):
+        """a command reports its calls on stderr, a server on request"""
+        returncode, stdout, stderr = run_sdbsc("--stats", "-f", "3")
+        assert returncode == 0 and "jane" in stdout
+        assert stderr.startswith("I/O statistics for -f:")
+
+        returncode, stdout, stderr = run_sdbsc("--stats", "--json", "-a", "90", "io", "stat", "300")
+        assert stdout.strip() == "Student 90 added to database."
+        stats = json.loads(stderr)
+        assert stats["command"] == "-a"
+        assert stats["write"]["calls"] >= 1 and stats["write"]["bytes"] >= 64
+        assert stats["sync"]["calls"] >= 1
+        assert sum(stats["read"]["hist_us_log2"]) == stats["read"]["calls"]
+        assert run_sdbsc("-d", "90")[0] == 0
+
+        returncode, stdout, stderr = run_sdbsc("--stats", "--hashed", "-c")
+        assert returncode == 0
+        assert stderr.startswith("I/O statistics for -c:")
+        for path in ["student.hdb", "student.hdb.bloom"]:
+            if os.path.exists(path):
+                os.remove(path)
+
+        server = subprocess.Popen(["./sdbsc", "--serve"], stdout=subprocess.PIPE, text=True)
+        try:
+            server.stdout.readline()
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect("student.db.sock")
+            request = lambda *args, **kw: TestServer.request(None, sock, *args, **kw)
+
+            assert request(1, 3)[0] == 0
+            status, count, nxt, body = request(9)
+            assert status == 0 and len(body) == 5 * 29 * 8
+            calls, errors, nbytes = struct.unpack_from("<3Q", body, 0)
+            assert calls >= 1 and nbytes >= 64
+            assert request(6)[0] == 0
+            sock.close()
+            assert server.wait(timeout=5) == 0
+        finally:
+            if server.poll() is None:
+                server.kill()
+
+
+class TestSidecarStamp:
+    """Test that sidecars notice a same size rewrite of the database"""
+
+    def test_46_rewrite_in_place(self):
+        """a slot written behind sdbsc's back shows up in -f and -l"""
+        rec = struct.pack("<i24s32si", 7, b"sam", b"stamp", 310)
+        with open("student.db", "r+b") as f:
+            f.seek(7 * 64)
+            f.write(rec)
+        returncode, stdout, stderr = run_sdbsc("-f", "7")
+        assert returncode == 0 and "sam" in stdout
+        returncode, stdout, stderr = run_sdbsc("-l", "stamp")
+        assert returncode == 0 and "sam" in stdout
+
+        with open("student.db", "r+b") as f:
+            f.seek(7 * 64)
+            f.write(bytes(64))
+        returncode, stdout, stderr = run_sdbsc("-f", "7")
+        assert returncode == 1
+        returncode, stdout, stderr = run_sdbsc("--verify")
+        assert returncode == 0
+
+
 if __name__ == "__main__":
     # Run pytest when script is executed directly
-    pytest.main([__file__, "-v"])
\ No newline at end of file
+    pytest.main([__file__, "-v"])
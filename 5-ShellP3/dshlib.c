@@ -122,14 +122,17 @@ int close_cmd_buff(cmd_buff_t *cmd_buff)
     return free_cmd_buff(cmd_buff);
 }
 
+/**
+ * free_cmd_list - Done with the current command line
+ *
+ * The stages own no memory, their argv[] strings point into the line
+ * given to build_cmd_list(), so the list is only reset for the next one.
+ */
 int free_cmd_list(command_list_t *cmd_lst)
 {
     if (cmd_lst == NULL) {
         return ERR_MEMORY;
     }
-    for (int i = 0; i < cmd_lst->num; i++) {
-        free_cmd_buff(&cmd_lst->commands[i]);
-    }
     cmd_lst->num = 0;
     return OK;
 }
@@ -139,294 +142,191 @@ int free_cmd_list(command_list_t *cmd_lst)
 // PARSING FUNCTIONS - YOU IMPLEMENT THESE
 //===================================================================
 
+//true for the characters that end an unquoted token
+static bool is_delim(char c)
+{
+    return c == '\0' || c == PIPE_CHAR || c == '<' || c == '>' || isspace((unsigned char)c);
+}
+
 /**
- * build_cmd_buff - Parse a single command string into cmd_buff_t
- * 
- * YOU NEED TO IMPLEMENT THIS FUNCTION!
- * 
- * This function takes a single command string (no pipes) and parses
- * it into argc/argv format.
- * 
- * Steps:
- *   1. Copy cmd_line into cmd_buff->_cmd_buffer
- *   2. Split the string by spaces into tokens
- *   3. Store each token pointer in cmd_buff->argv[]
- *   4. Set cmd_buff->argc to number of tokens
- *   5. Ensure cmd_buff->argv[argc] is NULL (required for execvp later)
- * 
- * Example:
- *   Input:  "ls -la /tmp"
- *   Output: argc=3, argv=["ls", "-la", "/tmp", NULL]
- * 
- * Hints:
- *   - Use strcpy() to copy cmd_line to _cmd_buffer
- *   - Use strtok() to split by spaces
- *   - Remember to trim leading/trailing whitespace
- *   - Handle multiple consecutive spaces
- * 
- * @param cmd_line: Command string to parse
- * @param cmd_buff: Allocated cmd_buff_t to populate
- * @return: OK on success, error code on failure
+ * add_token - Store a finished token in the command being built
+ *
+ * The token is the file name of a pending redirection (redir is '<', '>'
+ * or 'a' for ">>") or else the next argument.
+ *
+ * @return: OK or ERR_CMD_OR_ARGS_TOO_BIG when argv[] is full
  */
-int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff)
+static int add_token(cmd_buff_t *cmd, char *tok, char *redir)
 {
-    if (cmd_line == NULL || cmd_buff == NULL || cmd_buff->_cmd_buffer == NULL) {
-        return ERR_MEMORY;
-    }
-
-    clear_cmd_buff(cmd_buff);
-
-    // Copy into internal buffer
-    strncpy(cmd_buff->_cmd_buffer, cmd_line, SH_CMD_MAX - 1);
-    cmd_buff->_cmd_buffer[SH_CMD_MAX - 1] = '\0';
-
-    // Trim leading/trailing whitespace in place
-    char *start = cmd_buff->_cmd_buffer;
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
-    }
-    if (*start == '\0') {
-        return WARN_NO_CMDS;
-    }
-    char *end = start + strlen(start) - 1;
-    while (end > start && isspace((unsigned char)*end)) {
-        end--;
-    }
-    *(end + 1) = '\0';
-    if (start != cmd_buff->_cmd_buffer) {
-        memmove(cmd_buff->_cmd_buffer, start, strlen(start) + 1);
-        start = cmd_buff->_cmd_buffer;
+    if (*redir == '<') {
+        cmd->input_file = tok;
+    } else if (*redir != '\0') {
+        cmd->output_file = tok;
+        cmd->append_output = (*redir == 'a');
+    } else {
+        if (cmd->argc >= CMD_ARGV_MAX - 1) {
+            return ERR_CMD_OR_ARGS_TOO_BIG;
+        }
+        cmd->argv[cmd->argc++] = tok;
     }
+    *redir = '\0';
+    return OK;
+}
 
-    char expanded[SH_CMD_MAX * 2];
-    size_t exp_idx = 0;
-    char quote = '\0';
-    for (char *src = start;; src++) {
-        char c = *src;
-
-        if (quote) {
+/**
+ * lex_cmd_line - Tokenize a command line in place, in a single pass
+ *
+ * A small state machine walks the line once.  Token characters are moved
+ * down over the quotes and delimiters already consumed and each token is
+ * terminated where its delimiter was, so the write position never passes
+ * the read position and argv[], input_file and output_file all point
+ * into line itself.  Nothing is copied or allocated.
+ *
+ *   - quotes ('...' or "...") may start or end anywhere in a token and
+ *     make spaces, |, < and > ordinary characters
+ *   - | ends a pipeline stage, < > and >> take the next token as the file
+ *     name, with or without spaces around them
+ *
+ * @param line: command line, overwritten with the tokens
+ * @param cmds: stages of the pipeline, filled from cmds[0]
+ * @param max:  number of stages cmds has room for
+ * @param num:  receives the number of stages
+ * @return: OK, WARN_NO_CMDS for an empty line or an empty stage,
+ *          ERR_TOO_MANY_COMMANDS, ERR_CMD_OR_ARGS_TOO_BIG for too many
+ *          arguments, ERR_CMD_ARGS_BAD for a redirection without a file
+ */
+static int lex_cmd_line(char *line, cmd_buff_t *cmds, int max, int *num)
+{
+    char *src = line;
+    char *dst = line;
+    char *tok = NULL;       // start of the token being built
+    char quote = '\0';      // open quote character
+    char redir = '\0';      // redirection waiting for its file name
+    cmd_buff_t *cmd = &cmds[0];
+
+    *num = 0;
+    clear_cmd_buff(cmd);
+    for (;;) {
+        char c = *src++;
+
+        if (quote != '\0') {
             if (c == quote) {
                 quote = '\0';
+                continue;
             }
-            if (exp_idx >= sizeof(expanded) - 1) {
-                return ERR_CMD_OR_ARGS_TOO_BIG;
-            }
-            expanded[exp_idx++] = c;
-            if (c == '\0') {
-                break;
+            if (c != '\0') {
+                *dst++ = c;
+                continue;
             }
-            continue;
-        }
-
-        if (c == '"' || c == '\'') {
+            quote = '\0';  // an unterminated quote runs to the end of the line
+        } else if (c == '"' || c == '\'') {
             quote = c;
-            if (exp_idx >= sizeof(expanded) - 1) {
-                return ERR_CMD_OR_ARGS_TOO_BIG;
+            if (tok == NULL) {
+                tok = dst;
             }
-            expanded[exp_idx++] = c;
             continue;
-        }
-
-        if (c == '<' || c == '>') {
-            if (exp_idx >= sizeof(expanded) - 4) {
-                return ERR_CMD_OR_ARGS_TOO_BIG;
-            }
-            expanded[exp_idx++] = ' ';
-            expanded[exp_idx++] = c;
-            if (c == '>' && *(src + 1) == '>') {
-                expanded[exp_idx++] = '>';
-                src++;
+        } else if (!is_delim(c)) {
+            if (tok == NULL) {
+                tok = dst;
             }
-            expanded[exp_idx++] = ' ';
+            *dst++ = c;
             continue;
         }
 
-        if (exp_idx >= sizeof(expanded) - 1) {
-            return ERR_CMD_OR_ARGS_TOO_BIG;
-        }
-        expanded[exp_idx++] = c;
-        if (c == '\0') {
-            break;
-        }
-    }
-
-    int tokc = 0;
-    char *tokens[CMD_ARGV_MAX * 2];
-    char *dst = cmd_buff->_cmd_buffer;
-    char *token_start = NULL;
-    quote = '\0';
-
-    for (char *src = expanded;; src++) {
-        char c = *src;
-        if (quote) {
-            if (c == quote) {
-                quote = '\0';
-            } else if (c == '\0') {
-                *dst = '\0';
-                if (token_start) {
-                    if (tokc >= CMD_ARGV_MAX * 2) {
-                        return ERR_CMD_OR_ARGS_TOO_BIG;
-                    }
-                    tokens[tokc++] = token_start;
-                }
-                break;
-            } else {
-                *dst++ = c;
-            }
-        } else {
-            if (c == '"' || c == '\'') {
-                quote = c;
-                if (token_start == NULL) {
-                    token_start = dst;
-                }
-            } else if (c == '\0' || isspace((unsigned char)c)) {
-                if (token_start != NULL) {
-                    *dst = '\0';
-                    if (tokc >= CMD_ARGV_MAX * 2) {
-                        return ERR_CMD_OR_ARGS_TOO_BIG;
-                    }
-                    tokens[tokc++] = token_start;
-                    token_start = NULL;
-                    dst++;
-                }
-                if (c == '\0') {
-                    break;
-                }
-            } else {
-                if (token_start == NULL) {
-                    token_start = dst;
-                }
-                *dst++ = c;
+        // c ends the token being built, if there is one
+        if (tok != NULL) {
+            *dst++ = '\0';
+            int rc = add_token(cmd, tok, &redir);
+            if (rc != OK) {
+                return rc;
             }
+            tok = NULL;
         }
 
-        if ((size_t)(dst - cmd_buff->_cmd_buffer) >= SH_CMD_MAX - 1) {
-            return ERR_CMD_OR_ARGS_TOO_BIG;
-        }
-    }
-
-    int argc = 0;
-    for (int i = 0; i < tokc; i++) {
-        if (strcmp(tokens[i], "<") == 0) {
-            if (i + 1 >= tokc) {
+        if (c == '<' || c == '>') {
+            if (redir != '\0') {
                 return ERR_CMD_ARGS_BAD;
             }
-            i++;
-            if (strcmp(tokens[i], "<") == 0 || strcmp(tokens[i], ">") == 0 || strcmp(tokens[i], ">>") == 0) {
-                return ERR_CMD_ARGS_BAD;
+            redir = c;
+            if (c == '>' && *src == '>') {
+                redir = 'a';
+                src++;
             }
-            cmd_buff->input_file = tokens[i];
-            continue;
-        }
-
-        if (strcmp(tokens[i], ">") == 0 || strcmp(tokens[i], ">>") == 0) {
-            bool append = (strcmp(tokens[i], ">>") == 0);
-            if (i + 1 >= tokc) {
+        } else if (c == PIPE_CHAR || c == '\0') {
+            if (redir != '\0') {
                 return ERR_CMD_ARGS_BAD;
             }
-            i++;
-            if (strcmp(tokens[i], "<") == 0 || strcmp(tokens[i], ">") == 0 || strcmp(tokens[i], ">>") == 0) {
-                return ERR_CMD_ARGS_BAD;
+            if (cmd->argc == 0) {
+                return WARN_NO_CMDS;
             }
-            cmd_buff->output_file = tokens[i];
-            cmd_buff->append_output = append;
-            continue;
-        }
-
-        if (argc >= CMD_ARGV_MAX - 1) {
-            return ERR_CMD_OR_ARGS_TOO_BIG;
+            cmd->argv[cmd->argc] = NULL;
+            (*num)++;
+            if (c == '\0') {
+                return OK;
+            }
+            if (*num == max) {
+                return ERR_TOO_MANY_COMMANDS;
+            }
+            cmd = &cmds[*num];
+            clear_cmd_buff(cmd);
         }
-        cmd_buff->argv[argc++] = tokens[i];
     }
+}
 
-    if (argc == 0) {
-        return WARN_NO_CMDS;
-    }
+/**
+ * build_cmd_buff - Parse a single command string into cmd_buff_t
+ *
+ * The command is copied into cmd_buff->_cmd_buffer (see alloc_cmd_buff())
+ * and tokenized there by lex_cmd_line(), so cmd_line itself is left as it
+ * was.  A pipe is an error, use build_cmd_list() for pipelines.
+ *
+ * Example:
+ *   Input:  "ls -la /tmp"
+ *   Output: argc=3, argv=["ls", "-la", "/tmp", NULL]
+ *
+ * @param cmd_line: Command string to parse
+ * @param cmd_buff: Allocated cmd_buff_t to populate
+ * @return: OK on success, error code on failure
+ */
+int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff)
+{
+    int num;
 
-    cmd_buff->argc = argc;
-    cmd_buff->argv[argc] = NULL;
+    if (cmd_line == NULL || cmd_buff == NULL || cmd_buff->_cmd_buffer == NULL) {
+        return ERR_MEMORY;
+    }
 
-    return OK;
+    strncpy(cmd_buff->_cmd_buffer, cmd_line, SH_CMD_MAX - 1);
+    cmd_buff->_cmd_buffer[SH_CMD_MAX - 1] = '\0';
+    return lex_cmd_line(cmd_buff->_cmd_buffer, cmd_buff, 1, &num);
 }
 
+/**
+ * build_cmd_list - Parse a command line into its pipeline stages
+ *
+ * The line is tokenized in place by lex_cmd_line(): the argv[] strings
+ * of every stage point into cmd_line, which must therefore stay as it
+ * is until the list is no longer used.  No stage gets a _cmd_buffer of
+ * its own.
+ *
+ * @param cmd_line: Command line, overwritten with the tokens
+ * @param clist: Receives the stages, clist->num is 0 on error
+ * @return: OK on success, error code on failure
+ */
 int build_cmd_list(char *cmd_line, command_list_t *clist)
 {
     if (cmd_line == NULL || clist == NULL) {
         return ERR_MEMORY;
     }
 
-    clist->num = 0;
-
-    char line_copy[SH_CMD_MAX];
-    strncpy(line_copy, cmd_line, SH_CMD_MAX - 1);
-    line_copy[SH_CMD_MAX - 1] = '\0';
-
-    char *start = line_copy;
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
-    }
-    if (*start == '\0') {
-        return WARN_NO_CMDS;
-    }
-    char *end = start + strlen(start) - 1;
-    while (end > start && isspace((unsigned char)*end)) {
-        end--;
-    }
-    *(end + 1) = '\0';
-
-    if (start != line_copy) {
-        memmove(line_copy, start, strlen(start) + 1);
-    }
-
-    int pipe_count = 0;
-    for (char *p = line_copy; *p; p++) {
-        if (*p == PIPE_CHAR) {
-            pipe_count++;
-        }
-    }
-    if (pipe_count + 1 > CMD_MAX) {
-        return ERR_TOO_MANY_COMMANDS;
-    }
-
-    char *saveptr = NULL;
-    char *segment = strtok_r(line_copy, PIPE_STRING, &saveptr);
-    while (segment != NULL) {
-        char *seg_start = segment;
-        while (*seg_start && isspace((unsigned char)*seg_start)) {
-            seg_start++;
-        }
-        char *seg_end = seg_start + strlen(seg_start) - 1;
-        while (seg_end > seg_start && isspace((unsigned char)*seg_end)) {
-            seg_end--;
-        }
-        *(seg_end + 1) = '\0';
-
-        if (*seg_start == '\0') {
-            free_cmd_list(clist);
-            return WARN_NO_CMDS;
-        }
-
-        int rc = alloc_cmd_buff(&clist->commands[clist->num]);
-        if (rc != OK) {
-            free_cmd_list(clist);
-            return rc;
-        }
-
-        rc = build_cmd_buff(seg_start, &clist->commands[clist->num]);
-        if (rc != OK) {
-            free_cmd_list(clist);
-            return rc;
-        }
-
-        clist->num++;
-        segment = strtok_r(NULL, PIPE_STRING, &saveptr);
+    for (int i = 0; i < CMD_MAX; i++) {
+        clist->commands[i]._cmd_buffer = NULL;
     }
-
-    if (clist->num == 0) {
-        return WARN_NO_CMDS;
+    int rc = lex_cmd_line(cmd_line, clist->commands, CMD_MAX, &clist->num);
+    if (rc != OK) {
+        clist->num = 0;
     }
-
-    return OK;
+    return rc;
 }
 
 Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd)
@@ -37,6 +37,10 @@ typedef struct command{
 }command_t;
 */
 
+//The stages of a command line live in the list itself and their argv[]
+//strings in the line (see build_cmd_list()), so free_cmd_list() only
+//resets the list and a shell loop parses line after line without
+//touching the heap.
 typedef struct command_list{
     int num;
     cmd_buff_t commands[CMD_MAX];
@@ -359,6 +359,57 @@ class TestStress:
         assert output.count('test') >= 5
 
 
+class TestTokenizer:
+    """Tests for quoting and redirection in the command line lexer"""
+
+    def test_quoted_pipe_is_an_argument(self):
+        """Test: a | inside quotes does not split the pipeline"""
+        returncode, stdout, stderr = run_dsh(['echo "a|b" \'c > d\' | cat'])
+
+        assert returncode == 0
+        assert 'a|b c > d' in clean_output(stdout)
+
+    def test_redirection_without_spaces(self):
+        """Test: echo x>file, echo y>>file, cat<file|wc -l"""
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'out.txt')
+            returncode, stdout, stderr = run_dsh([
+                f'echo x>{path}',
+                f'echo y>>{path}',
+                f'cat<{path}|wc -l'
+            ])
+
+            assert returncode == 0
+            assert '2' in clean_output(stdout)
+
+    def test_empty_pipeline_stage(self):
+        """Test: a pipeline with an empty stage is rejected"""
+        returncode, stdout, stderr = run_dsh(['echo hello | | cat'])
+
+        assert returncode == 0
+        assert 'warning: no commands provided' in stdout
+
+    def test_list_reused_across_lines(self):
+        """Test: many pipelines in one session, each parsed into the same list"""
+        returncode, stdout, stderr = run_dsh([f'echo line{i} | cat' for i in range(50)])
+
+        assert returncode == 0
+        output = clean_output(stdout)
+        for i in range(50):
+            assert f'line{i}' in output
+
+    def test_too_many_stages_then_pipeline(self):
+        """Test: a line over the pipe limit leaves the next line intact"""
+        returncode, stdout, stderr = run_dsh([
+            'echo a' + ' | cat' * 8,
+            'echo b | tr b c'
+        ])
+
+        assert returncode == 0
+        assert 'error: piping limited to 8 commands' in stdout
+        assert 'c' in clean_output(stdout).split()
+
+
 if __name__ == "__main__":
     # Run pytest when script is executed directly
     pytest.main([__file__, "-v", "--tb=short"])
\ No newline at end of file
@@ -59,280 +59,148 @@ int close_cmd_buff(cmd_buff_t *cmd_buff)
     return free_cmd_buff(cmd_buff);
 }
 
+// the stages own no memory, the list is only reset for the next line
 int free_cmd_list(command_list_t *cmd_lst)
 {
     if (cmd_lst == NULL) {
         return ERR_MEMORY;
     }
-    for (int i = 0; i < cmd_lst->num; i++) {
-        free_cmd_buff(&cmd_lst->commands[i]);
-    }
     cmd_lst->num = 0;
     return OK;
 }
 
-int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff)
+static bool is_delim(char c)
 {
-    if (cmd_line == NULL || cmd_buff == NULL || cmd_buff->_cmd_buffer == NULL) {
-        return ERR_MEMORY;
-    }
-
-    clear_cmd_buff(cmd_buff);
-
-    strncpy(cmd_buff->_cmd_buffer, cmd_line, SH_CMD_MAX - 1);
-    cmd_buff->_cmd_buffer[SH_CMD_MAX - 1] = '\0';
-
-    char *start = cmd_buff->_cmd_buffer;
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
-    }
-    if (*start == '\0') {
-        return WARN_NO_CMDS;
-    }
-
-    char *end = start + strlen(start) - 1;
-    while (end > start && isspace((unsigned char)*end)) {
-        end--;
-    }
-    *(end + 1) = '\0';
+    return c == '\0' || c == PIPE_CHAR || c == '<' || c == '>' || isspace((unsigned char)c);
+}
 
-    if (start != cmd_buff->_cmd_buffer) {
-        memmove(cmd_buff->_cmd_buffer, start, strlen(start) + 1);
-        start = cmd_buff->_cmd_buffer;
+// a finished token is the file of a pending redirection or the next argument
+static int add_token(cmd_buff_t *cmd, char *tok, char *redir)
+{
+    if (*redir == '<') {
+        cmd->input_file = tok;
+    } else if (*redir != '\0') {
+        cmd->output_file = tok;
+        cmd->append_mode = (*redir == 'a');
+    } else {
+        if (cmd->argc >= CMD_ARGV_MAX - 1) {
+            return ERR_CMD_OR_ARGS_TOO_BIG;
+        }
+        cmd->argv[cmd->argc++] = tok;
     }
+    *redir = '\0';
+    return OK;
+}
 
-    char expanded[SH_CMD_MAX * 2];
-    size_t exp_idx = 0;
+// One pass over the line, tokens are written back into it: the write
+// position never passes the read position, so argv[] and the redirection
+// files point into line and nothing is copied.  Quotes may start or end
+// mid-token and make spaces, |, < and > ordinary characters.
+static int lex_cmd_line(char *line, cmd_buff_t *cmds, int max, int *num)
+{
+    char *src = line;
+    char *dst = line;
+    char *tok = NULL;
     char quote = '\0';
+    char redir = '\0';     // '<', '>' or 'a' for ">>" until its file is read
+    cmd_buff_t *cmd = &cmds[0];
 
-    for (char *src = start;; src++) {
-        char c = *src;
+    *num = 0;
+    clear_cmd_buff(cmd);
+    for (;;) {
+        char c = *src++;
 
-        if (quote) {
+        if (quote != '\0') {
             if (c == quote) {
                 quote = '\0';
+                continue;
             }
-            if (exp_idx >= sizeof(expanded) - 1) {
-                return ERR_CMD_OR_ARGS_TOO_BIG;
-            }
-            expanded[exp_idx++] = c;
-            if (c == '\0') {
-                break;
+            if (c != '\0') {
+                *dst++ = c;
+                continue;
             }
-            continue;
-        }
-
-        if (c == '"' || c == '\'') {
+            quote = '\0';
+        } else if (c == '"' || c == '\'') {
             quote = c;
-            if (exp_idx >= sizeof(expanded) - 1) {
-                return ERR_CMD_OR_ARGS_TOO_BIG;
+            if (tok == NULL) {
+                tok = dst;
             }
-            expanded[exp_idx++] = c;
             continue;
-        }
-
-        if (c == '<' || c == '>') {
-            if (exp_idx >= sizeof(expanded) - 4) {
-                return ERR_CMD_OR_ARGS_TOO_BIG;
+        } else if (!is_delim(c)) {
+            if (tok == NULL) {
+                tok = dst;
             }
-            expanded[exp_idx++] = ' ';
-            expanded[exp_idx++] = c;
-            if (c == '>' && *(src + 1) == '>') {
-                expanded[exp_idx++] = '>';
-                src++;
-            }
-            expanded[exp_idx++] = ' ';
+            *dst++ = c;
             continue;
         }
 
-        if (exp_idx >= sizeof(expanded) - 1) {
-            return ERR_CMD_OR_ARGS_TOO_BIG;
-        }
-        expanded[exp_idx++] = c;
-        if (c == '\0') {
-            break;
-        }
-    }
-
-    int tokc = 0;
-    char *tokens[CMD_ARGV_MAX * 2];
-    char *dst = cmd_buff->_cmd_buffer;
-    char *token_start = NULL;
-    quote = '\0';
-
-    for (char *src = expanded;; src++) {
-        char c = *src;
-
-        if (quote) {
-            if (c == quote) {
-                quote = '\0';
-            } else if (c == '\0') {
-                *dst = '\0';
-                if (token_start) {
-                    if (tokc >= CMD_ARGV_MAX * 2) {
-                        return ERR_CMD_OR_ARGS_TOO_BIG;
-                    }
-                    tokens[tokc++] = token_start;
-                }
-                break;
-            } else {
-                *dst++ = c;
-            }
-        } else {
-            if (c == '"' || c == '\'') {
-                quote = c;
-                if (token_start == NULL) {
-                    token_start = dst;
-                }
-            } else if (c == '\0' || isspace((unsigned char)c)) {
-                if (token_start != NULL) {
-                    *dst = '\0';
-                    if (tokc >= CMD_ARGV_MAX * 2) {
-                        return ERR_CMD_OR_ARGS_TOO_BIG;
-                    }
-                    tokens[tokc++] = token_start;
-                    token_start = NULL;
-                    dst++;
-                }
-                if (c == '\0') {
-                    break;
-                }
-            } else {
-                if (token_start == NULL) {
-                    token_start = dst;
-                }
-                *dst++ = c;
+        if (tok != NULL) {
+            *dst++ = '\0';
+            int rc = add_token(cmd, tok, &redir);
+            if (rc != OK) {
+                return rc;
             }
+            tok = NULL;
         }
 
-        if ((size_t)(dst - cmd_buff->_cmd_buffer) >= SH_CMD_MAX - 1) {
-            return ERR_CMD_OR_ARGS_TOO_BIG;
-        }
-    }
-
-    int argc = 0;
-    for (int i = 0; i < tokc; i++) {
-        if (strcmp(tokens[i], "<") == 0) {
-            if (i + 1 >= tokc) {
+        if (c == '<' || c == '>') {
+            if (redir != '\0') {
                 return ERR_CMD_ARGS_BAD;
             }
-            i++;
-            if (strcmp(tokens[i], "<") == 0 || strcmp(tokens[i], ">") == 0 || strcmp(tokens[i], ">>") == 0) {
-                return ERR_CMD_ARGS_BAD;
+            redir = c;
+            if (c == '>' && *src == '>') {
+                redir = 'a';
+                src++;
             }
-            cmd_buff->input_file = tokens[i];
-            continue;
-        }
-
-        if (strcmp(tokens[i], ">") == 0 || strcmp(tokens[i], ">>") == 0) {
-            bool append = (strcmp(tokens[i], ">>") == 0);
-            if (i + 1 >= tokc) {
+        } else if (c == PIPE_CHAR || c == '\0') {
+            if (redir != '\0') {
                 return ERR_CMD_ARGS_BAD;
             }
-            i++;
-            if (strcmp(tokens[i], "<") == 0 || strcmp(tokens[i], ">") == 0 || strcmp(tokens[i], ">>") == 0) {
-                return ERR_CMD_ARGS_BAD;
+            if (cmd->argc == 0) {
+                return WARN_NO_CMDS;
             }
-            cmd_buff->output_file = tokens[i];
-            cmd_buff->append_mode = append;
-            continue;
-        }
-
-        if (argc >= CMD_ARGV_MAX - 1) {
-            return ERR_CMD_OR_ARGS_TOO_BIG;
+            cmd->argv[cmd->argc] = NULL;
+            (*num)++;
+            if (c == '\0') {
+                return OK;
+            }
+            if (*num == max) {
+                return ERR_TOO_MANY_COMMANDS;
+            }
+            cmd = &cmds[*num];
+            clear_cmd_buff(cmd);
         }
-        cmd_buff->argv[argc++] = tokens[i];
     }
+}
 
-    if (argc == 0) {
-        return WARN_NO_CMDS;
+int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff)
+{
+    int num;
+
+    if (cmd_line == NULL || cmd_buff == NULL || cmd_buff->_cmd_buffer == NULL) {
+        return ERR_MEMORY;
     }
 
-    cmd_buff->argc = argc;
-    cmd_buff->argv[argc] = NULL;
-    return OK;
+    strncpy(cmd_buff->_cmd_buffer, cmd_line, SH_CMD_MAX - 1);
+    cmd_buff->_cmd_buffer[SH_CMD_MAX - 1] = '\0';
+    return lex_cmd_line(cmd_buff->_cmd_buffer, cmd_buff, 1, &num);
 }
 
+// tokenizes cmd_line in place, the stages point into it
 int build_cmd_list(char *cmd_line, command_list_t *clist)
 {
     if (cmd_line == NULL || clist == NULL) {
         return ERR_MEMORY;
     }
 
-    clist->num = 0;
-
-    char line_copy[SH_CMD_MAX];
-    strncpy(line_copy, cmd_line, SH_CMD_MAX - 1);
-    line_copy[SH_CMD_MAX - 1] = '\0';
-
-    char *start = line_copy;
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
-    }
-    if (*start == '\0') {
-        return WARN_NO_CMDS;
-    }
-
-    char *end = start + strlen(start) - 1;
-    while (end > start && isspace((unsigned char)*end)) {
-        end--;
+    for (int i = 0; i < CMD_MAX; i++) {
+        clist->commands[i]._cmd_buffer = NULL;
     }
-    *(end + 1) = '\0';
-
-    if (start != line_copy) {
-        memmove(line_copy, start, strlen(start) + 1);
-    }
-
-    int pipe_count = 0;
-    for (char *p = line_copy; *p; p++) {
-        if (*p == PIPE_CHAR) {
-            pipe_count++;
-        }
+    int rc = lex_cmd_line(cmd_line, clist->commands, CMD_MAX, &clist->num);
+    if (rc != OK) {
+        clist->num = 0;
     }
-    if (pipe_count + 1 > CMD_MAX) {
-        return ERR_TOO_MANY_COMMANDS;
-    }
-
-    char *saveptr = NULL;
-    char *segment = strtok_r(line_copy, PIPE_STRING, &saveptr);
-
-    while (segment != NULL) {
-        char *seg_start = segment;
-        while (*seg_start && isspace((unsigned char)*seg_start)) {
-            seg_start++;
-        }
-        if (*seg_start == '\0') {
-            free_cmd_list(clist);
-            return WARN_NO_CMDS;
-        }
-
-        char *seg_end = seg_start + strlen(seg_start) - 1;
-        while (seg_end > seg_start && isspace((unsigned char)*seg_end)) {
-            seg_end--;
-        }
-        *(seg_end + 1) = '\0';
-
-        int rc = alloc_cmd_buff(&clist->commands[clist->num]);
-        if (rc != OK) {
-            free_cmd_list(clist);
-            return rc;
-        }
-
-        rc = build_cmd_buff(seg_start, &clist->commands[clist->num]);
-        if (rc != OK) {
-            free_cmd_list(clist);
-            return rc;
-        }
-
-        clist->num++;
-        segment = strtok_r(NULL, PIPE_STRING, &saveptr);
-    }
-
-    if (clist->num == 0) {
-        return WARN_NO_CMDS;
-    }
-
-    return OK;
+    return rc;
 }
 
 Built_In_Cmds match_command(const char *input)
@@ -446,6 +446,29 @@ class TestStress:
         
         assert returncode == 0
 
+    def test_quoted_pipe(self, server):
+        """Test: quoted | and > are arguments, not operators"""
+        returncode, stdout, stderr = run_client_commands([
+            'echo "a|b" \'c > d\' | cat',
+            'exit'
+        ])
+
+        assert returncode == 0
+        assert 'a|b c > d' in stdout
+
+    def test_list_reused_across_requests(self, server):
+        """Test: a pipe limit error, then many pipelines on one connection"""
+        commands = ['echo a' + ' | cat' * 8]
+        commands += [f'echo req{i} | cat' for i in range(30)]
+        commands.append('exit')
+
+        returncode, stdout, stderr = run_client_commands(commands, timeout=15)
+
+        assert returncode == 0
+        assert 'error: piping limited to 8 commands' in stdout
+        for i in range(30):
+            assert f'req{i}' in stdout
+
 
 # Run tests with: pytest test_dsh4.py -v
 if __name__ == "__main__":